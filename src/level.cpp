@@ -1,5 +1,8 @@
 #include "level.h"
 
+#include <intrin.h>
+#include <math.h>
+
 string GetLevelFilePath(const_string levelName, LinearAllocator* allocator)
 {
     string path = AllocPrintf(allocator, "data/levels/%.*s.blockgrid", levelName.size, levelName.data);
@@ -7,214 +10,4216 @@ string GetLevelFilePath(const_string levelName, LinearAllocator* allocator)
     return path;
 }
 
-bool IsWalkable(const LevelData& levelData, Vec3Int blockIndex)
+// Full saves are written here first, so an interrupted save doesn't leave a partial level file
+string GetLevelTempPath(const_string levelName, LinearAllocator* allocator)
+{
+    string path = AllocPrintf(allocator, "data/levels/%.*s.savetmp", levelName.size, levelName.data);
+    DEBUG_ASSERT(path.data != nullptr);
+    return path;
+}
+
+string GetLevelDeltaPath(const_string levelName, LinearAllocator* allocator)
+{
+    string path = AllocPrintf(allocator, "data/levels/%.*s.blockdelta", levelName.size, levelName.data);
+    DEBUG_ASSERT(path.data != nullptr);
+    return path;
+}
+
+static_assert(sizeof(Block) == 1);
+
+internal Vec3Int BlockToChunkIndex(Vec3Int blockIndex)
+{
+    return Vec3Int { blockIndex.x / CHUNK_SIZE, blockIndex.y / CHUNK_SIZE, blockIndex.z / CHUNK_SIZE };
+}
+
+internal Vec3Int ChunkOrigin(Vec3Int chunkIndex)
+{
+    return Vec3Int { chunkIndex.x * CHUNK_SIZE, chunkIndex.y * CHUNK_SIZE, chunkIndex.z * CHUNK_SIZE };
+}
+
+internal uint32 ChunkSlotIndex(Vec3Int chunkIndex)
+{
+    return (chunkIndex.z * CHUNKS_SIZE.y + chunkIndex.y) * CHUNKS_SIZE.x + chunkIndex.x;
+}
+
+internal Vec3Int ChunkSlotToIndex(uint32 chunkSlot)
+{
+    return Vec3Int {
+        (int)(chunkSlot % CHUNKS_SIZE.x),
+        (int)(chunkSlot / CHUNKS_SIZE.x % CHUNKS_SIZE.y),
+        (int)(chunkSlot / (CHUNKS_SIZE.x * CHUNKS_SIZE.y))
+    };
+}
+
+// Index into BlockChunk::blocks of a position relative to the chunk origin
+internal uint32 ChunkBlockIndex(Vec3Int localIndex)
+{
+    return (localIndex.z * CHUNK_SIZE + localIndex.y) * CHUNK_SIZE + localIndex.x;
+}
+
+internal uint32 ChunkRowIndex(int y, int z)
+{
+    return z * CHUNK_SIZE + y;
+}
+
+internal uint32 SkyHeightIndex(Vec3Int blockIndex)
+{
+    return blockIndex.y * BLOCKS_SIZE.x + blockIndex.x;
+}
+
+// Bit of a chunk column in BlockGrid::unloadedColumns and pinnedColumns
+internal uint32 ColumnIndex(int chunkX, int chunkY)
+{
+    return chunkY * CHUNKS_SIZE.x + chunkX;
+}
+
+// Out of bounds columns count as loaded, there's nothing to load
+internal bool IsColumnLoaded(const BlockGrid& grid, int chunkX, int chunkY)
+{
+    if (chunkX < 0 || chunkX >= CHUNKS_SIZE.x || chunkY < 0 || chunkY >= CHUNKS_SIZE.y) {
+        return true;
+    }
+
+    const uint32 columnInd = ColumnIndex(chunkX, chunkY);
+    return ((grid.unloadedColumns[columnInd / 64] >> (columnInd % 64)) & 1) == 0;
+}
+
+internal BlockChunk* GetGridChunk(const BlockGrid& grid, uint32 chunkInd)
+{
+    BlockChunk* batch = grid.pool->batches[chunkInd / BlockChunkPool::CHUNKS_PER_BATCH];
+    return &batch[chunkInd % BlockChunkPool::CHUNKS_PER_BATCH];
+}
+
+bool IsInBlockGrid(Vec3Int blockIndex)
+{
+    return 0 <= blockIndex.x && blockIndex.x < BLOCKS_SIZE.x
+        && 0 <= blockIndex.y && blockIndex.y < BLOCKS_SIZE.y
+        && 0 <= blockIndex.z && blockIndex.z < BLOCKS_SIZE.z;
+}
+
+Block GetBlock(const BlockGrid& grid, Vec3Int blockIndex)
+{
+    if (!IsInBlockGrid(blockIndex)) {
+        return { .id = BlockId::NONE };
+    }
+
+    const Vec3Int chunkIndex = BlockToChunkIndex(blockIndex);
+    const uint16 slot = grid.chunkSlots[ChunkSlotIndex(chunkIndex)];
+    if (slot == 0) {
+        return { .id = BlockId::NONE };
+    }
+
+    return GetGridChunk(grid, slot - 1)->blocks[ChunkBlockIndex(blockIndex - ChunkOrigin(chunkIndex))];
+}
+
+internal bool SnapshotChunkTransition(BlockGridSnapshot* snapshot, uint32 chunkInd, SnapshotChunkState from,
+                                      SnapshotChunkState to)
+{
+    volatile LONG* state = (volatile LONG*)&snapshot->chunkStates[chunkInd];
+    return InterlockedCompareExchange(state, (LONG)to, (LONG)from) == (LONG)from;
+}
+
+// Called on the editing thread before a pool chunk's blocks are modified or the chunk is reused
+internal void PreserveSnapshotChunk(uint32 chunkInd, BlockGrid* grid)
+{
+    BlockGridSnapshot* snapshot = grid->snapshot;
+    if (snapshot == nullptr) {
+        return;
+    }
+
+    while (true) {
+        const SnapshotChunkState state = (SnapshotChunkState)snapshot->chunkStates[chunkInd];
+        if (state == SnapshotChunkState::PENDING && snapshot->numCopies < snapshot->maxCopies) {
+            if (SnapshotChunkTransition(snapshot, chunkInd, SnapshotChunkState::PENDING, SnapshotChunkState::COPYING)) {
+                const uint32 copyInd = snapshot->numCopies++;
+                MemCopy(snapshot->copies + copyInd * BLOCKS_PER_CHUNK, GetGridChunk(*grid, chunkInd)->blocks.data,
+                        BLOCKS_PER_CHUNK * sizeof(Block));
+                snapshot->chunkCopies[chunkInd] = (uint16)copyInd;
+                InterlockedExchange((volatile LONG*)&snapshot->chunkStates[chunkInd],
+                                    (LONG)SnapshotChunkState::COPIED);
+                return;
+            }
+        }
+        else if (state != SnapshotChunkState::PENDING && state != SnapshotChunkState::READING) {
+            return;
+        }
+
+        // Being read, or out of copies: the reader gets through a chunk in well under a millisecond
+        _mm_pause();
+    }
+}
+
+// Called on the reading thread, returns the chunk's blocks as they were when the snapshot was taken
+internal const Block* AcquireSnapshotChunk(BlockGridSnapshot* snapshot, const BlockGrid& grid, uint32 chunkInd)
+{
+    while (true) {
+        if (SnapshotChunkTransition(snapshot, chunkInd, SnapshotChunkState::PENDING, SnapshotChunkState::READING)) {
+            return GetGridChunk(grid, chunkInd)->blocks.data;
+        }
+        if ((SnapshotChunkState)snapshot->chunkStates[chunkInd] == SnapshotChunkState::COPIED) {
+            return snapshot->copies + snapshot->chunkCopies[chunkInd] * BLOCKS_PER_CHUNK;
+        }
+
+        _mm_pause();
+    }
+}
+
+internal void ReleaseSnapshotChunk(BlockGridSnapshot* snapshot, uint32 chunkInd)
+{
+    SnapshotChunkTransition(snapshot, chunkInd, SnapshotChunkState::READING, SnapshotChunkState::NONE);
+}
+
+// Hands out a pool chunk without touching its memory or adding it to the grid. -1 if the pool is exhausted.
+internal int AllocatePoolChunk(BlockGrid* grid)
+{
+    uint16 chunkInd;
+    if (grid->freeChunks.size > 0) {
+        chunkInd = grid->freeChunks[grid->freeChunks.size - 1];
+        grid->freeChunks.RemoveLast();
+    }
+    else if (grid->numChunksUsed < BlockGrid::MAX_CHUNKS) {
+        BlockChunkPool* pool = grid->pool;
+        if (grid->numChunksUsed == pool->numBatches * BlockChunkPool::CHUNKS_PER_BATCH) {
+            BlockChunk* batch = (BlockChunk*)defaultAllocator_.Allocate(BlockChunkPool::CHUNKS_PER_BATCH
+                                                                         * sizeof(BlockChunk));
+            if (batch == nullptr) {
+                LOG_ERROR("Failed to allocate %lu block chunks\n", BlockChunkPool::CHUNKS_PER_BATCH);
+                return -1;
+            }
+            pool->batches[pool->numBatches++] = batch;
+        }
+        chunkInd = (uint16)grid->numChunksUsed++;
+    }
+    else {
+        LOG_ERROR("Out of block chunks, max %lu\n", BlockGrid::MAX_CHUNKS);
+        return -1;
+    }
+
+    return chunkInd;
+}
+
+internal void InitChunk(Vec3Int chunkIndex, BlockChunk* chunk)
+{
+    chunk->chunkIndex = chunkIndex;
+    chunk->numSolid = 0;
+    MemSet(chunk->blocks.data, 0, sizeof(chunk->blocks));
+    MemSet(chunk->occupancy.data, 0, sizeof(chunk->occupancy));
+    MemSet(chunk->light.data, LIGHT_OPEN_SKY, sizeof(chunk->light));
+}
+
+// Allocates an empty chunk at an index that doesn't have one yet
+internal BlockChunk* AllocateChunk(Vec3Int chunkIndex, BlockGrid* grid)
+{
+    DEBUG_ASSERT(grid->chunkSlots[ChunkSlotIndex(chunkIndex)] == 0);
+    const int chunkInd = AllocatePoolChunk(grid);
+    if (chunkInd < 0) {
+        return nullptr;
+    }
+
+    grid->chunkSlots[ChunkSlotIndex(chunkIndex)] = (uint16)(chunkInd + 1);
+    PreserveSnapshotChunk(chunkInd, grid);
+    BlockChunk* chunk = GetGridChunk(*grid, chunkInd);
+    InitChunk(chunkIndex, chunk);
+    return chunk;
+}
+
+bool SetBlock(Vec3Int blockIndex, Block block, BlockGrid* grid)
 {
-    if (blockIndex.x < 0 || blockIndex.y < 0 || blockIndex.z < 0) {
+    if (!IsInBlockGrid(blockIndex) || !IsColumnLoaded(*grid, blockIndex.x / CHUNK_SIZE, blockIndex.y / CHUNK_SIZE)) {
         return false;
     }
 
-    const Block& block = levelData.grid[blockIndex.z][blockIndex.y][blockIndex.x];
-    return block.id == BlockId::NONE;
+    const Vec3Int chunkIndex = BlockToChunkIndex(blockIndex);
+    const uint32 slotIndex = ChunkSlotIndex(chunkIndex);
+    uint16 slot = grid->chunkSlots[slotIndex];
+    if (slot == 0) {
+        if (block.id == BlockId::NONE) {
+            return true;
+        }
+
+        if (AllocateChunk(chunkIndex, grid) == nullptr) {
+            return false;
+        }
+        slot = grid->chunkSlots[slotIndex];
+    }
+
+    PreserveSnapshotChunk(slot - 1, grid);
+    BlockChunk* chunk = GetGridChunk(*grid, slot - 1);
+    const Vec3Int localIndex = blockIndex - ChunkOrigin(chunkIndex);
+    Block* dst = &chunk->blocks[ChunkBlockIndex(localIndex)];
+    const bool wasSolid = dst->id != BlockId::NONE;
+    const bool isSolid = block.id != BlockId::NONE;
+    *dst = block;
+
+    uint32* row = &chunk->occupancy[ChunkRowIndex(localIndex.y, localIndex.z)];
+    if (isSolid && !wasSolid) {
+        chunk->numSolid++;
+        *row |= 1u << localIndex.x;
+    }
+    else if (!isSolid && wasSolid) {
+        chunk->numSolid--;
+        *row &= ~(1u << localIndex.x);
+        if (chunk->numSolid == 0) {
+            grid->chunkSlots[slotIndex] = 0;
+            grid->freeChunks.Append((uint16)(slot - 1));
+        }
+    }
+
+    // The column only needs a scan down when its top block is removed
+    uint8* skyHeight = &grid->skyHeights[SkyHeightIndex(blockIndex)];
+    if (isSolid && blockIndex.z >= *skyHeight) {
+        *skyHeight = (uint8)(blockIndex.z + 1);
+    }
+    else if (!isSolid && blockIndex.z + 1 == *skyHeight) {
+        int z = blockIndex.z;
+        while (z > 0 && GetBlock(*grid, Vec3Int { blockIndex.x, blockIndex.y, z - 1 }).id == BlockId::NONE) {
+            z--;
+        }
+        *skyHeight = (uint8)z;
+    }
+
+    return true;
 }
 
-void SubmitBlockUpdates(Array<BlockUpdate> updates, LevelData* levelData)
+void ClearBlockGrid(BlockGrid* grid)
 {
-    for (uint32 i = 0; i < updates.size; i++) {
-        const Vec3Int index = updates[i].index;
-        levelData->grid[index.z][index.y][index.x] = updates[i].block;
+    MemSet(grid->chunkSlots.data, 0, sizeof(grid->chunkSlots));
+    grid->numChunksUsed = 0;
+    grid->freeChunks.Clear();
+    MemSet(grid->skyHeights.data, 0, sizeof(grid->skyHeights));
+    MemSet(grid->unloadedColumns.data, 0, sizeof(grid->unloadedColumns));
+    MemSet(grid->pinnedColumns.data, 0, sizeof(grid->pinnedColumns));
+}
+
+// lowbias32, for the generator's randomness, which has to depend only on the seed and a position
+internal uint32 HashUInt32(uint32 x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+internal uint32 CityHash(uint32 seed, int a, int b, uint32 salt)
+{
+    return HashUInt32(seed ^ HashUInt32((uint32)a ^ HashUInt32((uint32)b ^ HashUInt32(salt))));
+}
+
+enum class CityStrip
+{
+    STREET,
+    SIDEWALK,
+    LOT
+};
+
+struct CityAxis
+{
+    int lot; // within the district
+    int pos; // within the lot's span, which starts with the street
+    CityStrip strip;
+};
+
+// Splits a district evenly into numLots spans along one axis, each a street, a sidewalk, the lot, and a sidewalk
+internal CityAxis GetCityAxis(const CityGenParams& params, int local, int numLots)
+{
+    const int districtSize = (int)params.districtSize;
+    const int streetSize = (int)params.streetSize;
+    const int sidewalkSize = (int)params.sidewalkSize;
+
+    CityAxis axis;
+    axis.lot = local * numLots / districtSize;
+    const int start = (axis.lot * districtSize + numLots - 1) / numLots;
+    const int end = ((axis.lot + 1) * districtSize + numLots - 1) / numLots;
+    axis.pos = local - start;
+    if (axis.pos < streetSize) {
+        axis.strip = CityStrip::STREET;
+    }
+    else if (axis.pos < streetSize + sidewalkSize || axis.pos >= end - start - sidewalkSize) {
+        axis.strip = CityStrip::SIDEWALK;
+    }
+    else {
+        axis.strip = CityStrip::LOT;
     }
+    return axis;
+}
+
+struct CityColumn
+{
+    BlockId ground;
+    int height; // of the building over the ground, 0 if none
+};
+
+internal CityColumn GetCityColumn(const CityGenParams& params, int x, int y)
+{
+    const int districtSize = (int)params.districtSize;
+    const int districtX = x / districtSize;
+    const int districtY = y / districtSize;
+    const uint32 kind = CityHash(params.seed, districtX, districtY, 0) % params.numDistricts;
+    const CityDistrict& district = params.districts[kind];
+
+    const uint32 lotSize = district.minLotSize
+        + CityHash(params.seed, districtX, districtY, 1) % (district.maxLotSize - district.minLotSize + 1);
+    const int lotSpan = (int)(params.streetSize + params.sidewalkSize * 2 + lotSize);
+    const int numLots = MaxInt(districtSize / lotSpan, 1);
+    const CityAxis axisX = GetCityAxis(params, x - districtX * districtSize, numLots);
+    const CityAxis axisY = GetCityAxis(params, y - districtY * districtSize, numLots);
 
-    UpdateGridRenderInfo(levelData->grid, levelData->blockSize, BLOCK_ORIGIN, &levelData->gridRenderInfo);
+    CityColumn column = { .ground = BlockId::BUILDING, .height = 0 };
+    if (axisX.strip == CityStrip::STREET || axisY.strip == CityStrip::STREET) {
+        column.ground = BlockId::STREET;
+    }
+    else if (axisX.strip == CityStrip::SIDEWALK || axisY.strip == CityStrip::SIDEWALK) {
+        const bool corner = axisX.pos == (int)params.streetSize && axisY.pos == (int)params.streetSize;
+        column.ground = corner ? BlockId::LAMP : BlockId::SIDEWALK;
+    }
+    else {
+        const uint32 lotHash = CityHash(params.seed, districtX * numLots + axisX.lot, districtY * numLots + axisY.lot,
+                                        2);
+        if ((float32)(lotHash & 0xffff) < params.plazaChance * 65536.0f) {
+            column.ground = BlockId::SIDEWALK;
+        }
+        else {
+            const uint32 heightRange = district.maxBuildingHeight - district.minBuildingHeight + 1;
+            column.height = (int)(district.minBuildingHeight + (lotHash >> 16) % heightRange);
+        }
+    }
+    return column;
 }
 
-bool LoadLevel(const_string levelName, LevelData* levelData, LinearAllocator* allocator)
+// Ground is the layer under BLOCK_ORIGIN, buildings stand on it
+const int CITY_GROUND_Z = BLOCK_ORIGIN.z - 1;
+static_assert(CITY_GROUND_Z >= 0);
+
+// Generates a chunk of the city into chunk, which doesn't have to be in a grid, without its light
+internal void GenerateCityChunk(const CityGenParams& params, Vec3Int chunkIndex, BlockChunk* chunk)
+{
+    InitChunk(chunkIndex, chunk);
+    const Vec3Int origin = ChunkOrigin(chunkIndex);
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            const CityColumn column = GetCityColumn(params, origin.x + x, origin.y + y);
+            const int minZ = MaxInt(CITY_GROUND_Z - origin.z, 0);
+            const int maxZ = MinInt(MinInt(CITY_GROUND_Z + 1 + column.height, BLOCKS_SIZE.z) - origin.z, CHUNK_SIZE);
+            for (int z = minZ; z < maxZ; z++) {
+                const BlockId id = origin.z + z == CITY_GROUND_Z ? column.ground : BlockId::BUILDING;
+                chunk->blocks[ChunkBlockIndex(Vec3Int { x, y, z })].id = id;
+                chunk->occupancy[ChunkRowIndex(y, z)] |= 1u << x;
+                chunk->numSolid++;
+            }
+        }
+    }
+}
+
+internal bool ValidateCityGenParams(const CityGenParams& params)
+{
+    if (params.districtSize == 0 || params.numDistricts == 0) {
+        LOG_ERROR("City needs a district size and at least one district\n");
+        return false;
+    }
+    for (uint32 i = 0; i < params.numDistricts; i++) {
+        const CityDistrict& district = params.districts[i];
+        if (district.minLotSize > district.maxLotSize || district.minBuildingHeight > district.maxBuildingHeight) {
+            LOG_ERROR("City district %lu has an empty size or height range\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Top chunk layer that the buildings of any district overlapping a chunk column can reach
+internal int GetCityTopChunkZ(const CityGenParams& params, int chunkX, int chunkY)
+{
+    const int districtSize = (int)params.districtSize;
+    const int minDistrictX = chunkX * CHUNK_SIZE / districtSize;
+    const int maxDistrictX = (chunkX * CHUNK_SIZE + CHUNK_SIZE - 1) / districtSize;
+    const int minDistrictY = chunkY * CHUNK_SIZE / districtSize;
+    const int maxDistrictY = (chunkY * CHUNK_SIZE + CHUNK_SIZE - 1) / districtSize;
+
+    uint32 maxHeight = 0;
+    for (int districtY = minDistrictY; districtY <= maxDistrictY; districtY++) {
+        for (int districtX = minDistrictX; districtX <= maxDistrictX; districtX++) {
+            const uint32 kind = CityHash(params.seed, districtX, districtY, 0) % params.numDistricts;
+            maxHeight = MaxUInt32(maxHeight, params.districts[kind].maxBuildingHeight);
+        }
+    }
+
+    return MinInt((CITY_GROUND_Z + (int)maxHeight) / CHUNK_SIZE, CHUNKS_SIZE.z - 1);
+}
+
+// (BlockId, run length - 1) byte pairs. Returns the encoded size, or 0 if it would be larger than maxSize.
+internal uint32 EncodeChunkRle(const Block* blocks, uint8* dst, uint32 maxSize)
+{
+    uint32 size = 0;
+    uint32 i = 0;
+    while (i < BLOCKS_PER_CHUNK) {
+        const BlockId id = blocks[i].id;
+        uint32 run = 1;
+        while (run < 256 && i + run < BLOCKS_PER_CHUNK && blocks[i + run].id == id) {
+            run++;
+        }
+
+        if (size + 2 > maxSize) {
+            return 0;
+        }
+        dst[size++] = (uint8)id;
+        dst[size++] = (uint8)(run - 1);
+        i += run;
+    }
+
+    return size;
+}
+
+internal bool DecodeChunkRle(const uint8* src, uint32 size, Block* blocks)
+{
+    if (size % 2 != 0) {
+        return false;
+    }
+
+    uint32 i = 0;
+    for (uint32 j = 0; j < size; j += 2) {
+        const uint32 run = (uint32)src[j + 1] + 1;
+        if (i + run > BLOCKS_PER_CHUNK) {
+            return false;
+        }
+        MemSet(blocks + i, src[j], run);
+        i += run;
+    }
+
+    return i == BLOCKS_PER_CHUNK;
+}
+
+// Validates the header and directory of a mapped file of version 2 or later
+internal bool ParseLevelFile(Array<uint8> data, LevelFile* levelFile)
 {
-    string path = GetLevelFilePath(levelName, allocator);
-    Array<uint8> data = LoadEntireFile(path, allocator);
-    if (data.data == nullptr) {
+    const LevelFileHeader* header = (const LevelFileHeader*)data.data;
+    if (data.size < sizeof(LevelFileHeader) || header->magic != LEVEL_FILE_MAGIC || header->version < 2
+        || header->version > LEVEL_FILE_VERSION) {
         return false;
     }
-    if (data.size != sizeof(Vec3Int) + sizeof(BlockGrid)) {
+    if (header->blocksSize != BLOCKS_SIZE) {
+        LOG_ERROR("Level file size %d x %d x %d doesn't match the grid\n",
+                  header->blocksSize.x, header->blocksSize.y, header->blocksSize.z);
         return false;
     }
 
-    const Vec3Int* fileBlockGridSize = (Vec3Int*)data.data;
-    if ((uint32)fileBlockGridSize->x != levelData->grid[0][0].SIZE
-        || (uint32)fileBlockGridSize->y != levelData->grid[0].SIZE
-        || (uint32)fileBlockGridSize->z != levelData->grid.SIZE) {
+    const uint64 directorySize = (uint64)header->numChunks * sizeof(LevelChunkEntry);
+    if (header->numChunks > BlockGrid::NUM_CHUNK_SLOTS || data.size < sizeof(LevelFileHeader) + directorySize) {
+        LOG_ERROR("Level file directory with %lu chunks doesn't fit\n", header->numChunks);
         return false;
     }
 
-    MemCopy(&levelData->grid, data.data + sizeof(Vec3Int), sizeof(BlockGrid));
+    // Chunk data is between the header and the directory, or after the directory in version 2
+    uint64 directoryStart = data.size - directorySize;
+    uint64 chunksStart = sizeof(LevelFileHeader);
+    uint64 chunksEnd = directoryStart;
+    if (header->version == 2) {
+        directoryStart = sizeof(LevelFileHeader);
+        chunksStart = directoryStart + directorySize;
+        chunksEnd = data.size;
+    }
+    else if (directoryStart % 4 != 0) {
+        LOG_ERROR("Level file directory isn't aligned\n");
+        return false;
+    }
 
-    UpdateGridRenderInfo(levelData->grid, levelData->blockSize, BLOCK_ORIGIN, &levelData->gridRenderInfo);
+    const LevelChunkEntry* directory = (const LevelChunkEntry*)(data.data + directoryStart);
+    for (uint32 i = 0; i < header->numChunks; i++) {
+        const LevelChunkEntry& entry = directory[i];
+        if (entry.offset < chunksStart || (uint64)entry.offset + entry.size > chunksEnd
+            || !IsInBlockGrid(ChunkOrigin(entry.chunkIndex))) {
+            LOG_ERROR("Level file chunk entry %lu is invalid\n", i);
+            return false;
+        }
+        if (i > 0 && ChunkSlotIndex(entry.chunkIndex) <= ChunkSlotIndex(directory[i - 1].chunkIndex)) {
+            LOG_ERROR("Level file chunk directory isn't sorted\n");
+            return false;
+        }
+    }
 
+    levelFile->numChunks = header->numChunks;
+    levelFile->directory = directory;
     return true;
 }
 
-bool SaveLevel(const_string levelName, const LevelData& levelData, LinearAllocator* allocator)
+bool OpenLevelFile(const_string levelName, LinearAllocator* allocator, LevelFile* levelFile)
 {
-    const Vec3Int blockGridSize = { (int)levelData.grid[0][0].SIZE, (int)levelData.grid[0].SIZE, (int)levelData.grid.SIZE };
+    ALLOCATOR_SCOPE_RESET(*allocator);
 
-    Array<uint8> data = allocator->NewArray<uint8>(sizeof(Vec3Int) + sizeof(BlockGrid));
-    MemCopy(data.data, &blockGridSize, sizeof(Vec3Int));
-    MemCopy(data.data + sizeof(Vec3Int), &levelData.grid, sizeof(BlockGrid));
+    const string path = GetLevelFilePath(levelName, allocator);
+    if (!MapFileReadOnly(path, allocator, &levelFile->mappedFile)) {
+        return false;
+    }
+    if (!ParseLevelFile(levelFile->mappedFile.data, levelFile)) {
+        UnmapFile(&levelFile->mappedFile);
+        return false;
+    }
 
-    string path = GetLevelFilePath(levelName, allocator);
-    return WriteFile(path, data, false);
+    return true;
 }
 
-Array<string> GetSavedLevels(LinearAllocator* allocator)
+void CloseLevelFile(LevelFile* levelFile)
 {
-    const Array<string> levelFiles = ListDir(ToString("data/levels"), allocator);
-    if (levelFiles.data == nullptr) {
-        return { .size = 0, .data = nullptr };
+    UnmapFile(&levelFile->mappedFile);
+    levelFile->numChunks = 0;
+    levelFile->directory = nullptr;
+}
+
+int FindLevelChunk(const LevelFile& levelFile, Vec3Int chunkIndex)
+{
+    const uint32 slotIndex = ChunkSlotIndex(chunkIndex);
+    uint32 min = 0;
+    uint32 max = levelFile.numChunks;
+    while (min < max) {
+        const uint32 mid = (min + max) / 2;
+        const uint32 midSlotIndex = ChunkSlotIndex(levelFile.directory[mid].chunkIndex);
+        if (midSlotIndex == slotIndex) {
+            return (int)mid;
+        }
+        else if (midSlotIndex < slotIndex) {
+            min = mid + 1;
+        }
+        else {
+            max = mid;
+        }
     }
 
-    DynamicArray<string, LinearAllocator> validLevelFiles(allocator);
-    for (uint32 i = 0; i < levelFiles.size; i++) {
-        const uint32 find = SubstringSearch(levelFiles[i], ToString(".blockgrid"));
-        if (find != levelFiles[i].size) {
-            validLevelFiles.Append(levelFiles[i].SliceTo(find));
+    return -1;
+}
+
+// Decodes a chunk's blocks into chunk, which doesn't have to be in a grid, only touching this chunk's bytes
+internal bool DecodeLevelChunk(const LevelFile& levelFile, uint32 entryIndex, BlockChunk* chunk)
+{
+    DEBUG_ASSERT(entryIndex < levelFile.numChunks);
+    const LevelChunkEntry& entry = levelFile.directory[entryIndex];
+    InitChunk(entry.chunkIndex, chunk);
+
+    const uint8* src = levelFile.mappedFile.data.data + entry.offset;
+    bool decoded = false;
+    switch (entry.encoding) {
+        case LevelChunkEncoding::RAW: {
+            decoded = entry.size == BLOCKS_PER_CHUNK;
+            if (decoded) {
+                MemCopy(chunk->blocks.data, src, BLOCKS_PER_CHUNK);
+            }
+        } break;
+        case LevelChunkEncoding::RLE: {
+            decoded = DecodeChunkRle(src, entry.size, chunk->blocks.data);
+        } break;
+    }
+
+    for (uint32 i = 0; decoded && i < BLOCKS_PER_CHUNK; i++) {
+        const BlockId id = chunk->blocks[i].id;
+        if ((uint8)id >= (uint8)BlockId::COUNT) {
+            decoded = false;
+        }
+        else if (id != BlockId::NONE) {
+            chunk->numSolid++;
+            chunk->occupancy[i / CHUNK_SIZE] |= 1u << (i % CHUNK_SIZE);
         }
     }
 
-    return validLevelFiles.ToArray();
+    if (!decoded) {
+        LOG_ERROR("Failed to decode chunk %d, %d, %d\n", entry.chunkIndex.x, entry.chunkIndex.y, entry.chunkIndex.z);
+    }
+    return decoded;
 }
 
-void UpdateGridRenderInfo(const BlockGrid& blockGrid, float32 blockSize, Vec3Int blockOrigin,
-                          FixedArray<BlockRenderInfo, LevelData::NUM_BLOCKS>* renderInfo)
-{
-    const Mat4 scale = Scale(blockSize);
-    DEFINE_BLOCK_ROTATION_MATRICES;
-
-    renderInfo->Clear();
+// Whether the level source has blocks in a chunk, which are otherwise all empty
+internal bool HasSourceChunk(const LevelSource& source, Vec3Int chunkIndex)
+{
+    switch (source.type) {
+        case LevelSourceType::NONE: {
+            return false;
+        } break;
+        case LevelSourceType::CITY: {
+            return CITY_GROUND_Z / CHUNK_SIZE <= chunkIndex.z
+                && chunkIndex.z <= GetCityTopChunkZ(source.city, chunkIndex.x, chunkIndex.y);
+        } break;
+        case LevelSourceType::FILE: {
+            return FindLevelChunk(source.file, chunkIndex) >= 0;
+        } break;
+    }
+    return false;
+}
 
-    const uint32 sizeZ = blockGrid.SIZE;
-    for (uint32 z = 0; z < sizeZ; z++) {
-        const uint32 sizeY = blockGrid[z].SIZE;
-        for (uint32 y = 0; y < sizeY; y++) {
-            const uint32 sizeX = blockGrid[z][y].SIZE;
-            for (uint32 x = 0; x < sizeX; x++) {
-                const Block block = blockGrid[z][y][x];
-
-                bool drawTop    = z != sizeZ - 1 && blockGrid[z + 1][y][x].id == BlockId::NONE;
-                bool drawLeft   = y != sizeY - 1 && blockGrid[z][y + 1][x].id == BlockId::NONE;
-                bool drawFront  = x != sizeX - 1 && blockGrid[z][y][x + 1].id == BlockId::NONE;
-                bool drawBottom = z != 0 && blockGrid[z - 1][y][x].id == BlockId::NONE;
-                bool drawRight  = y != 0 && blockGrid[z][y - 1][x].id == BlockId::NONE;
-                bool drawBack   = x != 0 && blockGrid[z][y][x - 1].id == BlockId::NONE;
-
-                Vec3 color = Vec3::zero;
-                switch (block.id) {
-                    case BlockId::NONE: {
-                        drawTop = false;
-                        drawLeft = false;
-                        drawFront = false;
-                        drawBottom = false;
-                        drawRight = false;
-                        drawBack = false;
-                    } break;
-                    case BlockId::SIDEWALK: {
-                        color = Vec3::one * 0.7f;
-                    } break;
-                    case BlockId::STREET: {
-                        color = Vec3::one * 0.5f;
-                    } break;
-                    case BlockId::BUILDING: {
-                        color = Vec3::one * 0.8f;
-                    } break;
-                }
-
-                const Vec3 pos = BlockIndexToWorldPos(Vec3Int { (int)x, (int)y, (int)z }, blockSize, blockOrigin);
-                const Mat4 posTransform = Translate(pos);
-                if (drawTop) {
-                    BlockRenderInfo* info = renderInfo->Append();
-                    info->meshId = MeshId::TILE;
-                    info->model = posTransform * scale * top;
-                    info->color = color;
-                }
-                if (drawBottom) {
-                    BlockRenderInfo* info = renderInfo->Append();
-                    info->meshId = MeshId::TILE;
-                    info->model = posTransform * scale * bottom;
-                    info->color = color;
-                }
-                if (drawLeft) {
-                    BlockRenderInfo* info = renderInfo->Append();
-                    info->meshId = MeshId::TILE;
-                    info->model = posTransform * scale * left;
-                    info->color = color;
-                }
-                if (drawRight) {
-                    BlockRenderInfo* info = renderInfo->Append();
-                    info->meshId = MeshId::TILE;
-                    info->model = posTransform * scale * right;
-                    info->color = color;
-                }
-                if (drawFront) {
-                    BlockRenderInfo* info = renderInfo->Append();
-                    info->meshId = MeshId::TILE;
-                    info->model = posTransform * scale * front;
-                    info->color = color;
-                }
-                if (drawBack) {
-                    BlockRenderInfo* info = renderInfo->Append();
-                    info->meshId = MeshId::TILE;
-                    info->model = posTransform * scale * back;
-                    info->color = color;
-                }
-            }
-        }
-    }
-}
-
-void GenerateCityBlocks(uint32 streetSize, uint32 sidewalkSize, uint32 buildingSize, uint32 buildingHeight,
-                        LinearAllocator* allocator, BlockGrid* blockGrid)
-{
-    MemSet(blockGrid, 0, sizeof(BlockGrid));
-
-    const uint32 cityBlockSize = streetSize + sidewalkSize * 2 + buildingSize;
-
-    Array<uint8> streetMask = allocator->NewArray<uint8>(cityBlockSize);
-    for (uint32 i = 0; i < cityBlockSize; i++) {
-        streetMask[i] = i < streetSize;
-    }
-    Array<uint8> sidewalkMask = allocator->NewArray<uint8>(cityBlockSize);
-    for (uint32 i = 0; i < cityBlockSize; i++) {
-        sidewalkMask[i] = (i >= streetSize && i < (streetSize + sidewalkSize))
-            || (i >= (streetSize + sidewalkSize + buildingSize) && i < (streetSize + 2 * sidewalkSize + buildingSize));
-    }
-    Array<uint8> buildingMask = allocator->NewArray<uint8>(cityBlockSize);
-    for (uint32 i = 0; i < cityBlockSize; i++) {
-        buildingMask[i] = i >= (streetSize + sidewalkSize) && i < (streetSize + sidewalkSize + buildingSize);
-    }
-
-    static_assert(BLOCK_ORIGIN.z > 0);
-    for (uint32 z = 0; z < blockGrid->SIZE; z++) {
-        for (uint32 y = 0; y < (*blockGrid)[z].SIZE; y++) {
-            for (uint32 x = 0; x < (*blockGrid)[z][y].SIZE; x++) {
-                const uint32 cityBlockX = x % cityBlockSize;
-                const uint32 cityBlockY = y % cityBlockSize;
-
-                const uint8 building = buildingMask[cityBlockX] * buildingMask[cityBlockY];
-                if ((int)z == BLOCK_ORIGIN.z - 1) {
-                    const uint8 street = streetMask[cityBlockX] + streetMask[cityBlockY];
-                    const uint8 sidewalk = sidewalkMask[cityBlockX] + sidewalkMask[cityBlockY];
-                    if (street) {
-                        (*blockGrid)[z][y][x].id = BlockId::STREET;
-                    }
-                    else if (sidewalk) {
-                        (*blockGrid)[z][y][x].id = BlockId::SIDEWALK;
-                    }
-                    else if (building) {
-                        (*blockGrid)[z][y][x].id = BlockId::BUILDING;
-                    }
-                }
-                else if (building && z - BLOCK_ORIGIN.z < buildingHeight) {
-                    (*blockGrid)[z][y][x].id = BlockId::BUILDING;
-                }
+// Reads a chunk's blocks from the level source into chunk, which doesn't have to be in a grid
+internal bool ReadSourceChunk(const LevelSource& source, Vec3Int chunkIndex, BlockChunk* chunk)
+{
+    switch (source.type) {
+        case LevelSourceType::NONE: {
+            InitChunk(chunkIndex, chunk);
+        } break;
+        case LevelSourceType::CITY: {
+            GenerateCityChunk(source.city, chunkIndex, chunk);
+        } break;
+        case LevelSourceType::FILE: {
+            const int entryIndex = FindLevelChunk(source.file, chunkIndex);
+            if (entryIndex < 0) {
+                InitChunk(chunkIndex, chunk);
             }
+            else {
+                return DecodeLevelChunk(source.file, (uint32)entryIndex, chunk);
+            }
+        } break;
+    }
+    return true;
+}
+
+// Unmaps the level source's file, for when the source is replaced
+internal void CloseLevelSource(LevelSource* source)
+{
+    if (source->type == LevelSourceType::FILE) {
+        CloseLevelFile(&source->file);
+    }
+    source->type = LevelSourceType::NONE;
+}
+
+bool IsWalkable(const LevelData& levelData, Vec3Int blockIndex)
+{
+    if (!IsInBlockGrid(blockIndex)
+        || !IsColumnLoaded(levelData.grid, blockIndex.x / CHUNK_SIZE, blockIndex.y / CHUNK_SIZE)) {
+        return false;
+    }
+
+    return GetBlock(levelData.grid, blockIndex).id == BlockId::NONE;
+}
+
+bool RaycastBlocks(const LevelData& levelData, Vec3 origin, Vec3 dir, float32 maxDistance, BlockRaycastHit* hit)
+{
+    // Entry face per axis, when stepping in the positive / negative direction
+    const BlockFace ENTRY_FACES[3][2] = {
+        { BlockFace::BACK,   BlockFace::FRONT },
+        { BlockFace::RIGHT,  BlockFace::LEFT },
+        { BlockFace::BOTTOM, BlockFace::TOP },
+    };
+
+    const float32 blockSize = levelData.blockSize;
+    Vec3Int blockIndex;
+    int step[3];
+    float32 tMax[3];   // distance to the next block boundary on each axis
+    float32 tDelta[3]; // distance between block boundaries on each axis
+    for (int e = 0; e < 3; e++) {
+        // Position within the block kept apart from the index, so it doesn't lose precision far from the origin
+        const float32 pos = origin.e[e] / blockSize;
+        const float32 posFloor = FloorFloat32(pos);
+        const float32 posFrac = pos - posFloor;
+        blockIndex.e[e] = (int)posFloor + BLOCK_ORIGIN.e[e];
+        if (dir.e[e] > 0.0f) {
+            step[e] = 1;
+            tDelta[e] = blockSize / dir.e[e];
+            tMax[e] = (1.0f - posFrac) * tDelta[e];
+        }
+        else if (dir.e[e] < 0.0f) {
+            step[e] = -1;
+            tDelta[e] = -blockSize / dir.e[e];
+            tMax[e] = posFrac * tDelta[e];
+        }
+        else {
+            step[e] = 0;
+            tDelta[e] = INFINITY;
+            tMax[e] = INFINITY;
+        }
+    }
+
+    while (true) {
+        int axis = 0;
+        if (tMax[1] < tMax[axis]) axis = 1;
+        if (tMax[2] < tMax[axis]) axis = 2;
+
+        const float32 t = tMax[axis];
+        if (t > maxDistance) {
+            return false;
+        }
+        blockIndex.e[axis] += step[axis];
+        tMax[axis] += tDelta[axis];
+
+        // Once outside the grid and moving away from it on that axis, nothing else can be hit
+        if ((blockIndex.e[axis] < 0 && step[axis] < 0)
+            || (blockIndex.e[axis] >= BLOCKS_SIZE.e[axis] && step[axis] > 0)) {
+            return false;
+        }
+
+        if (GetBlock(levelData.grid, blockIndex).id != BlockId::NONE) {
+            hit->blockIndex = blockIndex;
+            hit->face = ENTRY_FACES[axis][step[axis] > 0 ? 0 : 1];
+            hit->t = t;
+            return true;
         }
     }
 }
+
+// True if any block in [min, max] is solid, out of bounds blocks and unloaded chunk columns included
+internal bool IsBlockRegionSolid(const BlockGrid& grid, Vec3Int min, Vec3Int max)
+{
+    for (int e = 0; e < 3; e++) {
+        if (min.e[e] < 0 || max.e[e] >= BLOCKS_SIZE.e[e]) {
+            return true;
+        }
+    }
+
+    for (int z = min.z; z <= max.z; z++) {
+        for (int y = min.y; y <= max.y; y++) {
+            int x = min.x;
+            while (x <= max.x) {
+                const Vec3Int chunkIndex = BlockToChunkIndex(Vec3Int { x, y, z });
+                if (!IsColumnLoaded(grid, chunkIndex.x, chunkIndex.y)) {
+                    return true;
+                }
+
+                const int spanEnd = MinInt(max.x, (chunkIndex.x + 1) * CHUNK_SIZE - 1);
+                const uint16 slot = grid.chunkSlots[ChunkSlotIndex(chunkIndex)];
+                if (slot != 0) {
+                    const Vec3Int localIndex = Vec3Int { x, y, z } - ChunkOrigin(chunkIndex);
+                    const BlockChunk* chunk = GetGridChunk(grid, slot - 1);
+                    const uint32 row = chunk->occupancy[ChunkRowIndex(localIndex.y, localIndex.z)];
+                    const int width = spanEnd - x + 1;
+                    const uint32 mask = (width == CHUNK_SIZE ? 0xffffffff : (1u << width) - 1) << localIndex.x;
+                    if ((row & mask) != 0) {
+                        return true;
+                    }
+                }
+                x = spanEnd + 1;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Distance in blocks that a box, relative to BLOCK_ORIGIN for precision, can move along an axis before a solid block
+internal float32 SweepBoxAxis(const BlockGrid& grid, const float32 boxMin[3], const float32 boxMax[3], int axis,
+                              float32 delta)
+{
+    // Boxes stop this far short of blocks, so a box resting against one isn't counted as overlapping it next time
+    const float32 SKIN = 1e-3f;
+    const float32 EPSILON = 1e-4f;
+
+    // Blocks the box overlaps on the other two axes
+    Vec3Int regionMin, regionMax;
+    for (int e = 0; e < 3; e++) {
+        regionMin.e[e] = (int)FloorFloat32(boxMin[e] + EPSILON) + BLOCK_ORIGIN.e[e];
+        regionMax.e[e] = (int)FloorFloat32(boxMax[e] - EPSILON) + BLOCK_ORIGIN.e[e];
+    }
+
+    // Blocks on the far side of the leading face, in the order they're reached
+    if (delta > 0.0f) {
+        const float32 leading = boxMax[axis];
+        for (int b = (int)FloorFloat32(leading - EPSILON) + 1; (float32)b < leading + delta; b++) {
+            regionMin.e[axis] = b + BLOCK_ORIGIN.e[axis];
+            regionMax.e[axis] = b + BLOCK_ORIGIN.e[axis];
+            if (IsBlockRegionSolid(grid, regionMin, regionMax)) {
+                return MaxFloat32((float32)b - leading - SKIN, 0.0f);
+            }
+        }
+    }
+    else {
+        const float32 leading = boxMin[axis];
+        for (int b = (int)FloorFloat32(leading + EPSILON) - 1; (float32)(b + 1) > leading + delta; b--) {
+            regionMin.e[axis] = b + BLOCK_ORIGIN.e[axis];
+            regionMax.e[axis] = b + BLOCK_ORIGIN.e[axis];
+            if (IsBlockRegionSolid(grid, regionMin, regionMax)) {
+                return MinFloat32((float32)(b + 1) - leading + SKIN, 0.0f);
+            }
+        }
+    }
+
+    return delta;
+}
+
+Vec3 MoveBoxThroughBlocks(const LevelData& levelData, Box box, Vec3 delta)
+{
+    const float32 blockSize = levelData.blockSize;
+    float32 boxMin[3], boxMax[3];
+    for (int e = 0; e < 3; e++) {
+        boxMin[e] = box.min.e[e] / blockSize;
+        boxMax[e] = box.max.e[e] / blockSize;
+    }
+
+    // Vertical first, so standing on the ground doesn't catch on block edges when walking
+    const int AXIS_ORDER[3] = { 2, 0, 1 };
+    Vec3 moved = Vec3::zero;
+    for (int i = 0; i < 3; i++) {
+        const int axis = AXIS_ORDER[i];
+        if (delta.e[axis] == 0.0f) continue;
+
+        const float32 d = SweepBoxAxis(levelData.grid, boxMin, boxMax, axis, delta.e[axis] / blockSize);
+        boxMin[axis] += d;
+        boxMax[axis] += d;
+        moved.e[axis] = d * blockSize;
+    }
+
+    return moved;
+}
+
+bool IsMobAlive(const MobList& mobs, uint32 mobIndex)
+{
+    return mobIndex < mobs.size && (mobs.aliveMask[mobIndex / 64] & (1ull << (mobIndex % 64))) != 0;
+}
+
+Vec3 GetMobPos(const MobList& mobs, uint32 mobIndex)
+{
+    return Vec3 { mobs.posX[mobIndex], mobs.posY[mobIndex], mobs.posZ[mobIndex] };
+}
+
+bool AddMob(Vec3 pos, float32 yaw, MobList* mobs)
+{
+    if (mobs->size == MAX_MOBS) {
+        return false;
+    }
+
+    const uint32 mobIndex = mobs->size++;
+    mobs->posX[mobIndex] = pos.x;
+    mobs->posY[mobIndex] = pos.y;
+    mobs->posZ[mobIndex] = pos.z;
+    mobs->yaw[mobIndex] = yaw;
+    mobs->prevPosX[mobIndex] = pos.x;
+    mobs->prevPosY[mobIndex] = pos.y;
+    mobs->prevPosZ[mobIndex] = pos.z;
+    mobs->prevYaw[mobIndex] = yaw;
+    mobs->fallSpeed[mobIndex] = 0.0f;
+    mobs->collapseT[mobIndex] = 0.0f;
+    mobs->hitboxMinX[mobIndex] = pos.x - MOB_HITBOX_RADIUS.x;
+    mobs->hitboxMinY[mobIndex] = pos.y - MOB_HITBOX_RADIUS.y;
+    mobs->hitboxMinZ[mobIndex] = pos.z - MOB_HITBOX_RADIUS.z;
+    mobs->hitboxMaxX[mobIndex] = pos.x + MOB_HITBOX_RADIUS.x;
+    mobs->hitboxMaxY[mobIndex] = pos.y + MOB_HITBOX_RADIUS.y;
+    mobs->hitboxMaxZ[mobIndex] = pos.z + MOB_HITBOX_RADIUS.z;
+    mobs->aliveMask[mobIndex / 64] |= 1ull << (mobIndex % 64);
+    return true;
+}
+
+void ClearMobs(MobList* mobs)
+{
+    mobs->size = 0;
+    MemSet(mobs->aliveMask.data, 0, sizeof(mobs->aliveMask));
+}
+
+internal void MoveMob(MobList* mobs, uint32 src, uint32 dst)
+{
+    mobs->posX[dst] = mobs->posX[src];
+    mobs->posY[dst] = mobs->posY[src];
+    mobs->posZ[dst] = mobs->posZ[src];
+    mobs->yaw[dst] = mobs->yaw[src];
+    mobs->prevPosX[dst] = mobs->prevPosX[src];
+    mobs->prevPosY[dst] = mobs->prevPosY[src];
+    mobs->prevPosZ[dst] = mobs->prevPosZ[src];
+    mobs->prevYaw[dst] = mobs->prevYaw[src];
+    mobs->fallSpeed[dst] = mobs->fallSpeed[src];
+    mobs->collapseT[dst] = mobs->collapseT[src];
+    mobs->hitboxMinX[dst] = mobs->hitboxMinX[src];
+    mobs->hitboxMinY[dst] = mobs->hitboxMinY[src];
+    mobs->hitboxMinZ[dst] = mobs->hitboxMinZ[src];
+    mobs->hitboxMaxX[dst] = mobs->hitboxMaxX[src];
+    mobs->hitboxMaxY[dst] = mobs->hitboxMaxY[src];
+    mobs->hitboxMaxZ[dst] = mobs->hitboxMaxZ[src];
+}
+
+void CompactMobs(LevelData* levelData)
+{
+    MobList* mobs = &levelData->mobs;
+
+    uint32 numAlive = 0;
+    for (uint32 w = 0; w < MOB_MASK_WORDS; w++) {
+        numAlive += (uint32)_mm_popcnt_u64(mobs->aliveMask[w]);
+    }
+    if (numAlive == mobs->size) {
+        return;
+    }
+
+    uint32 collapsingMobIndex = numAlive;
+    uint32 dst = 0;
+    for (uint32 w = 0; w < MOB_MASK_WORDS; w++) {
+        uint64 alive = mobs->aliveMask[w];
+        while (alive != 0) {
+            const uint32 src = w * 64 + (uint32)_tzcnt_u64(alive);
+            alive &= alive - 1;
+
+            if (src == levelData->collapsingMobIndex) {
+                collapsingMobIndex = dst;
+            }
+            if (src != dst) {
+                MoveMob(mobs, src, dst);
+            }
+            dst++;
+        }
+    }
+
+    MemSet(mobs->aliveMask.data, 0, sizeof(mobs->aliveMask));
+    for (uint32 w = 0; w < numAlive / 64; w++) {
+        mobs->aliveMask[w] = 0xffffffffffffffff;
+    }
+    if (numAlive % 64 != 0) {
+        mobs->aliveMask[numAlive / 64] = (1ull << (numAlive % 64)) - 1;
+    }
+    mobs->size = numAlive;
+    levelData->collapsingMobIndex = collapsingMobIndex;
+}
+
+// The kernels below run 8 mobs at a time up to size rounded up to 8, the lanes past size are ignored
+static_assert(MAX_MOBS % 8 == 0);
+
+void UpdateMobCollapse(float32 collapseStep, float32 uncollapseStep, LevelData* levelData)
+{
+    MobList* mobs = &levelData->mobs;
+
+    const __m256i collapsingMobIndex8 = _mm256_set1_epi32((int)levelData->collapsingMobIndex);
+    const __m256i lanes8 = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 collapseStep8 = _mm256_set1_ps(collapseStep);
+    const __m256 uncollapseStep8 = _mm256_set1_ps(-uncollapseStep);
+    const __m256 zero8 = _mm256_setzero_ps();
+    const __m256 one8 = _mm256_set1_ps(1.0f);
+
+    for (uint32 i = 0; i < mobs->size; i += 8) {
+        const uint32 alive = (uint32)(mobs->aliveMask[i / 64] >> (i % 64)) & 0xff;
+        if (alive == 0) continue;
+
+        const __m256i mobIndex8 = _mm256_add_epi32(_mm256_set1_epi32((int)i), lanes8);
+        const __m256 collapsing8 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(mobIndex8, collapsingMobIndex8));
+        const __m256 step8 = _mm256_blendv_ps(uncollapseStep8, collapseStep8, collapsing8);
+        const __m256 collapseT8 = _mm256_max_ps(_mm256_add_ps(_mm256_loadu_ps(mobs->collapseT.data + i), step8), zero8);
+        _mm256_storeu_ps(mobs->collapseT.data + i, collapseT8);
+
+        const uint32 collapsed = (uint32)_mm256_movemask_ps(_mm256_cmp_ps(collapseT8, one8, _CMP_GE_OQ)) & alive;
+        if (collapsed != 0) {
+            mobs->aliveMask[i / 64] &= ~((uint64)collapsed << (i % 64));
+            levelData->collapsingMobIndex = mobs->size;
+        }
+    }
+}
+
+internal void UpdateMobHitboxes(MobList* mobs)
+{
+    const __m256 radiusX8 = _mm256_set1_ps(MOB_HITBOX_RADIUS.x);
+    const __m256 radiusY8 = _mm256_set1_ps(MOB_HITBOX_RADIUS.y);
+    const __m256 radiusZ8 = _mm256_set1_ps(MOB_HITBOX_RADIUS.z);
+
+    for (uint32 i = 0; i < mobs->size; i += 8) {
+        const __m256 posX8 = _mm256_loadu_ps(mobs->posX.data + i);
+        const __m256 posY8 = _mm256_loadu_ps(mobs->posY.data + i);
+        const __m256 posZ8 = _mm256_loadu_ps(mobs->posZ.data + i);
+        _mm256_storeu_ps(mobs->hitboxMinX.data + i, _mm256_sub_ps(posX8, radiusX8));
+        _mm256_storeu_ps(mobs->hitboxMinY.data + i, _mm256_sub_ps(posY8, radiusY8));
+        _mm256_storeu_ps(mobs->hitboxMinZ.data + i, _mm256_sub_ps(posZ8, radiusZ8));
+        _mm256_storeu_ps(mobs->hitboxMaxX.data + i, _mm256_add_ps(posX8, radiusX8));
+        _mm256_storeu_ps(mobs->hitboxMaxY.data + i, _mm256_add_ps(posY8, radiusY8));
+        _mm256_storeu_ps(mobs->hitboxMaxZ.data + i, _mm256_add_ps(posZ8, radiusZ8));
+    }
+}
+
+internal int MobHashCell(float32 x)
+{
+    return (int)FloorFloat32(x / MobSpatialHash::CELL_SIZE);
+}
+
+internal uint32 MobHashBucket(int cellX, int cellY)
+{
+    const uint32 h = ((uint32)cellX * 0x9e3779b1) ^ ((uint32)cellY * 0x85ebca77);
+    return (h ^ (h >> 16)) & (MobSpatialHash::NUM_BUCKETS - 1);
+}
+
+void UpdateMobSpatialHash(LevelData* levelData)
+{
+    MobSpatialHash* hash = &levelData->mobHash;
+    MemSet(hash->bucketStarts.data, 0, sizeof(hash->bucketStarts));
+    hash->bounds = { .min = Vec3::one * INFINITY, .max = -Vec3::one * INFINITY };
+
+    DEBUG_ASSERT(2.0f * MOB_HITBOX_RADIUS.x <= MobSpatialHash::CELL_SIZE);
+    DEBUG_ASSERT(2.0f * MOB_HITBOX_RADIUS.y <= MobSpatialHash::CELL_SIZE);
+
+    // Count the entries in each bucket, then turn the counts into bucket ends
+    const MobList& mobs = levelData->mobs;
+    for (uint32 w = 0; w < MOB_MASK_WORDS; w++) {
+        uint64 alive = mobs.aliveMask[w];
+        while (alive != 0) {
+            const uint32 i = w * 64 + (uint32)_tzcnt_u64(alive);
+            alive &= alive - 1;
+
+            for (int y = MobHashCell(mobs.hitboxMinY[i]); y <= MobHashCell(mobs.hitboxMaxY[i]); y++) {
+                for (int x = MobHashCell(mobs.hitboxMinX[i]); x <= MobHashCell(mobs.hitboxMaxX[i]); x++) {
+                    hash->bucketStarts[MobHashBucket(x, y)]++;
+                }
+            }
+            hash->bounds.min.x = MinFloat32(hash->bounds.min.x, mobs.hitboxMinX[i]);
+            hash->bounds.min.y = MinFloat32(hash->bounds.min.y, mobs.hitboxMinY[i]);
+            hash->bounds.min.z = MinFloat32(hash->bounds.min.z, mobs.hitboxMinZ[i]);
+            hash->bounds.max.x = MaxFloat32(hash->bounds.max.x, mobs.hitboxMaxX[i]);
+            hash->bounds.max.y = MaxFloat32(hash->bounds.max.y, mobs.hitboxMaxY[i]);
+            hash->bounds.max.z = MaxFloat32(hash->bounds.max.z, mobs.hitboxMaxZ[i]);
+        }
+    }
+    for (uint32 b = 1; b < MobSpatialHash::NUM_BUCKETS; b++) {
+        hash->bucketStarts[b] += hash->bucketStarts[b - 1];
+    }
+    hash->numEntries = hash->bucketStarts[MobSpatialHash::NUM_BUCKETS - 1];
+    hash->bucketStarts[MobSpatialHash::NUM_BUCKETS] = hash->numEntries;
+    DEBUG_ASSERT(hash->numEntries <= MobSpatialHash::MAX_ENTRIES);
+
+    // Filling each bucket back to front leaves bucketStarts at the bucket starts
+    for (uint32 w = 0; w < MOB_MASK_WORDS; w++) {
+        uint64 alive = mobs.aliveMask[w];
+        while (alive != 0) {
+            const uint32 i = w * 64 + (uint32)_tzcnt_u64(alive);
+            alive &= alive - 1;
+
+            for (int y = MobHashCell(mobs.hitboxMinY[i]); y <= MobHashCell(mobs.hitboxMaxY[i]); y++) {
+                for (int x = MobHashCell(mobs.hitboxMinX[i]); x <= MobHashCell(mobs.hitboxMaxX[i]); x++) {
+                    const uint32 entry = --hash->bucketStarts[MobHashBucket(x, y)];
+                    hash->minX[entry] = mobs.hitboxMinX[i];
+                    hash->minY[entry] = mobs.hitboxMinY[i];
+                    hash->minZ[entry] = mobs.hitboxMinZ[i];
+                    hash->maxX[entry] = mobs.hitboxMaxX[i];
+                    hash->maxY[entry] = mobs.hitboxMaxY[i];
+                    hash->maxZ[entry] = mobs.hitboxMaxZ[i];
+                    hash->mobIndices[entry] = (uint16)i;
+                }
+            }
+        }
+    }
+}
+
+bool RaycastMobs(const LevelData& levelData, Vec3 origin, Vec3 dir, float32 maxDistance, MobRaycastHit* hit)
+{
+    const MobSpatialHash& hash = levelData.mobHash;
+    if (hash.numEntries == 0) {
+        return false;
+    }
+
+    // Clip the ray to the bounds of all the hitboxes, so the walk only visits cells that can have any
+    float32 tStart = 0.0f;
+    float32 tEnd = maxDistance;
+    for (int e = 0; e < 3; e++) {
+        if (dir.e[e] == 0.0f) {
+            if (origin.e[e] < hash.bounds.min.e[e] || origin.e[e] > hash.bounds.max.e[e]) {
+                return false;
+            }
+            continue;
+        }
+        const float32 t1 = (hash.bounds.min.e[e] - origin.e[e]) / dir.e[e];
+        const float32 t2 = (hash.bounds.max.e[e] - origin.e[e]) / dir.e[e];
+        tStart = MaxFloat32(tStart, MinFloat32(t1, t2));
+        tEnd = MinFloat32(tEnd, MaxFloat32(t1, t2));
+    }
+    if (tStart > tEnd) {
+        return false;
+    }
+
+    const int cellMin[2] = { MobHashCell(hash.bounds.min.x), MobHashCell(hash.bounds.min.y) };
+    const int cellMax[2] = { MobHashCell(hash.bounds.max.x), MobHashCell(hash.bounds.max.y) };
+    int cell[2];
+    int step[2];
+    float32 tNext[2];  // distance to the next cell boundary on each axis
+    float32 tDelta[2]; // distance between cell boundaries on each axis
+    for (int e = 0; e < 2; e++) {
+        const float32 pos = (origin.e[e] + dir.e[e] * tStart) / MobSpatialHash::CELL_SIZE;
+        const float32 posFloor = FloorFloat32(pos);
+        const float32 posFrac = pos - posFloor;
+        cell[e] = MinInt(MaxInt((int)posFloor, cellMin[e]), cellMax[e]);
+        if (dir.e[e] > 0.0f) {
+            step[e] = 1;
+            tDelta[e] = MobSpatialHash::CELL_SIZE / dir.e[e];
+            tNext[e] = tStart + (1.0f - posFrac) * tDelta[e];
+        }
+        else if (dir.e[e] < 0.0f) {
+            step[e] = -1;
+            tDelta[e] = -MobSpatialHash::CELL_SIZE / dir.e[e];
+            tNext[e] = tStart + posFrac * tDelta[e];
+        }
+        else {
+            step[e] = 0;
+            tDelta[e] = INFINITY;
+            tNext[e] = INFINITY;
+        }
+    }
+
+    const Vec3 inverseDir = Reciprocal(dir);
+    const __m256 originX8 = _mm256_set1_ps(origin.x);
+    const __m256 originY8 = _mm256_set1_ps(origin.y);
+    const __m256 originZ8 = _mm256_set1_ps(origin.z);
+    const __m256 inverseDirX8 = _mm256_set1_ps(inverseDir.x);
+    const __m256 inverseDirY8 = _mm256_set1_ps(inverseDir.y);
+    const __m256 inverseDirZ8 = _mm256_set1_ps(inverseDir.z);
+    const __m256 zero8 = _mm256_setzero_ps();
+    const __m256 lanes8 = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    bool found = false;
+    float32 bestT = tEnd;
+    while (true) {
+        const uint32 bucket = MobHashBucket(cell[0], cell[1]);
+        const uint32 bucketEnd = hash.bucketStarts[bucket + 1];
+        for (uint32 i = hash.bucketStarts[bucket]; i < bucketEnd; i += 8) {
+            // Slab test, where tMax starts at the closest hit so far so that only closer hitboxes pass
+            __m256 tMin8 = zero8;
+            __m256 tMax8 = _mm256_set1_ps(bestT);
+
+            const __m256 tX1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&hash.minX[i]), originX8), inverseDirX8);
+            const __m256 tX2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&hash.maxX[i]), originX8), inverseDirX8);
+            tMin8 = _mm256_max_ps(tMin8, _mm256_min_ps(tX1, tX2));
+            tMax8 = _mm256_min_ps(tMax8, _mm256_max_ps(tX1, tX2));
+
+            const __m256 tY1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&hash.minY[i]), originY8), inverseDirY8);
+            const __m256 tY2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&hash.maxY[i]), originY8), inverseDirY8);
+            tMin8 = _mm256_max_ps(tMin8, _mm256_min_ps(tY1, tY2));
+            tMax8 = _mm256_min_ps(tMax8, _mm256_max_ps(tY1, tY2));
+
+            const __m256 tZ1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&hash.minZ[i]), originZ8), inverseDirZ8);
+            const __m256 tZ2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&hash.maxZ[i]), originZ8), inverseDirZ8);
+            tMin8 = _mm256_max_ps(tMin8, _mm256_min_ps(tZ1, tZ2));
+            tMax8 = _mm256_min_ps(tMax8, _mm256_max_ps(tZ1, tZ2));
+
+            // Lanes past the end of the bucket hold other buckets' entries, or garbage
+            const __m256 inBucket8 = _mm256_cmp_ps(lanes8, _mm256_set1_ps((float32)(bucketEnd - i)), _CMP_LT_OQ);
+            const __m256 hit8 = _mm256_and_ps(_mm256_cmp_ps(tMax8, tMin8, _CMP_GE_OQ), inBucket8);
+            uint32 hitMask = (uint32)_mm256_movemask_ps(hit8);
+            if (hitMask == 0) continue;
+
+            float32 tMin[8];
+            _mm256_storeu_ps(tMin, tMin8);
+            while (hitMask != 0) {
+                const uint32 lane = _tzcnt_u32(hitMask);
+                hitMask &= hitMask - 1;
+                if (!found || tMin[lane] < bestT) {
+                    found = true;
+                    bestT = tMin[lane];
+                    hit->mobIndex = hash.mobIndices[i + lane];
+                    hit->t = tMin[lane];
+                }
+            }
+        }
+
+        // Cells further along can only have hitboxes that start further than the best hit
+        const int axis = tNext[0] < tNext[1] ? 0 : 1;
+        if (tNext[axis] > bestT) {
+            break;
+        }
+        cell[axis] += step[axis];
+        tNext[axis] += tDelta[axis];
+        if (cell[axis] < cellMin[axis] || cell[axis] > cellMax[axis]) {
+            break;
+        }
+    }
+
+    return found;
+}
+
+internal uint32 FlowCellIndex(const FlowField& field, int x, int y)
+{
+    return (uint32)((y - field.origin.y) * FlowField::SIZE + (x - field.origin.x));
+}
+
+internal bool IsInFlowField(const FlowField& field, int x, int y)
+{
+    return field.origin.x <= x && x < field.origin.x + FlowField::SIZE
+        && field.origin.y <= y && y < field.origin.y + FlowField::SIZE;
+}
+
+internal bool IsFlowCellWalkable(const LevelData& levelData, int x, int y)
+{
+    const FlowField& field = levelData.flowField;
+    for (int z = field.origin.z; z < field.origin.z + field.clearance; z++) {
+        if (!IsWalkable(levelData, Vec3Int { x, y, z })) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Solid bits of the row of blocks at (y, z) in chunk column chunkX, all set out of bounds and in unloaded columns
+internal uint32 GetSolidRow(const BlockGrid& grid, int chunkX, int y, int z)
+{
+    if (chunkX < 0 || chunkX >= CHUNKS_SIZE.x || y < 0 || y >= BLOCKS_SIZE.y || z < 0 || z >= BLOCKS_SIZE.z
+        || !IsColumnLoaded(grid, chunkX, y / CHUNK_SIZE)) {
+        return 0xffffffff;
+    }
+
+    const uint16 slot = grid.chunkSlots[ChunkSlotIndex(Vec3Int { chunkX, y / CHUNK_SIZE, z / CHUNK_SIZE })];
+    if (slot == 0) {
+        return 0;
+    }
+    return GetGridChunk(grid, slot - 1)->occupancy[ChunkRowIndex(y % CHUNK_SIZE, z % CHUNK_SIZE)];
+}
+
+internal void PushFlowHeap(FlowField* field, uint32 distance, uint32 cell)
+{
+    DEBUG_ASSERT(field->heapSize < FlowField::MAX_HEAP);
+
+    uint32 i = field->heapSize++;
+    const uint32 key = distance << 16 | cell;
+    while (i > 0 && field->heap[(i - 1) / 2] > key) {
+        field->heap[i] = field->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    field->heap[i] = key;
+}
+
+internal uint32 PopFlowHeap(FlowField* field)
+{
+    const uint32 top = field->heap[0];
+    const uint32 last = field->heap[--field->heapSize];
+    uint32 i = 0;
+    while (true) {
+        uint32 child = i * 2 + 1;
+        if (child >= field->heapSize) break;
+        if (child + 1 < field->heapSize && field->heap[child + 1] < field->heap[child]) {
+            child++;
+        }
+        if (field->heap[child] >= last) break;
+        field->heap[i] = field->heap[child];
+        i = child;
+    }
+    if (field->heapSize > 0) {
+        field->heap[i] = last;
+    }
+    return top;
+}
+
+// Dijkstra from the cells on the heap. Entries whose cell has been lowered since they were pushed are skipped.
+internal void PropagateFlowField(FlowField* field)
+{
+    const int OFFSETS[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+    while (field->heapSize > 0) {
+        const uint32 key = PopFlowHeap(field);
+        const uint32 distance = key >> 16;
+        const uint32 cell = key & 0xffff;
+        if (field->distances[cell] != distance || distance + 1 >= FlowField::UNREACHABLE) continue;
+
+        const int x = (int)(cell % FlowField::SIZE);
+        const int y = (int)(cell / FlowField::SIZE);
+        for (int n = 0; n < 4; n++) {
+            const int nx = x + OFFSETS[n][0];
+            const int ny = y + OFFSETS[n][1];
+            if (nx < 0 || nx >= FlowField::SIZE || ny < 0 || ny >= FlowField::SIZE) continue;
+
+            const uint32 neighbor = (uint32)(ny * FlowField::SIZE + nx);
+            const uint16 neighborDistance = field->distances[neighbor];
+            if (neighborDistance != FlowField::BLOCKED && neighborDistance > distance + 1) {
+                field->distances[neighbor] = (uint16)(distance + 1);
+                PushFlowHeap(field, distance + 1, neighbor);
+            }
+        }
+    }
+}
+
+// Shortest distance from a walkable cell's neighbours, plus one, or UNREACHABLE
+internal uint16 GetFlowCellSeed(const FlowField& field, uint32 cell)
+{
+    const int x = (int)(cell % FlowField::SIZE);
+    const int y = (int)(cell / FlowField::SIZE);
+    uint32 seed = FlowField::UNREACHABLE;
+    if (x > 0) seed = MinUInt32(seed, field.distances[cell - 1]);
+    if (x < FlowField::SIZE - 1) seed = MinUInt32(seed, field.distances[cell + 1]);
+    if (y > 0) seed = MinUInt32(seed, field.distances[cell - FlowField::SIZE]);
+    if (y < FlowField::SIZE - 1) seed = MinUInt32(seed, field.distances[cell + FlowField::SIZE]);
+    return seed >= FlowField::UNREACHABLE - 1 ? FlowField::UNREACHABLE : (uint16)(seed + 1);
+}
+
+internal void RebuildFlowField(Vec3Int target, LevelData* levelData)
+{
+    FlowField* field = &levelData->flowField;
+    field->valid = true;
+    field->target = target;
+    field->clearance = (int)CeilFloat32(MOB_HITBOX_RADIUS.z * 2.0f / levelData->blockSize);
+    // Chunk-aligned on x, so each cell row is read from the occupancy bits a chunk at a time
+    field->origin = Vec3Int {
+        (target.x - FlowField::SIZE / 2) & ~(CHUNK_SIZE - 1),
+        target.y - FlowField::SIZE / 2,
+        target.z
+    };
+
+    for (int y = 0; y < FlowField::SIZE; y++) {
+        for (int chunkX = 0; chunkX < FlowField::SIZE / CHUNK_SIZE; chunkX++) {
+            uint32 solid = 0;
+            for (int z = field->origin.z; z < field->origin.z + field->clearance; z++) {
+                solid |= GetSolidRow(levelData->grid, field->origin.x / CHUNK_SIZE + chunkX, field->origin.y + y, z);
+            }
+
+            uint16* distances = field->distances.data + y * FlowField::SIZE + chunkX * CHUNK_SIZE;
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                distances[x] = (solid & (1u << x)) != 0 ? FlowField::BLOCKED : FlowField::UNREACHABLE;
+            }
+        }
+    }
+
+    // From the target alone, so a breadth-first search reaches cells in distance order without the heap
+    const int OFFSETS[4] = { -1, 1, -FlowField::SIZE, FlowField::SIZE };
+    const uint32 targetCell = FlowCellIndex(*field, target.x, target.y);
+    field->distances[targetCell] = 0;
+    uint32 head = 0;
+    uint32 tail = 0;
+    field->cells[tail++] = targetCell;
+    while (head < tail) {
+        const uint32 cell = field->cells[head++];
+        const uint16 next = (uint16)(field->distances[cell] + 1);
+        const int x = (int)(cell % FlowField::SIZE);
+        const int y = (int)(cell / FlowField::SIZE);
+        const bool inside[4] = { x > 0, x < FlowField::SIZE - 1, y > 0, y < FlowField::SIZE - 1 };
+        for (int n = 0; n < 4; n++) {
+            if (!inside[n]) continue;
+
+            const uint32 neighbor = cell + OFFSETS[n];
+            if (field->distances[neighbor] == FlowField::UNREACHABLE) {
+                field->distances[neighbor] = next;
+                field->cells[tail++] = neighbor;
+            }
+        }
+    }
+}
+
+// Patches the field after a block change, reseeding the cells whose distance could have come through the block
+internal void UpdateFlowFieldBlock(Vec3Int blockIndex, LevelData* levelData)
+{
+    FlowField* field = &levelData->flowField;
+    if (!field->valid || !IsInFlowField(*field, blockIndex.x, blockIndex.y)
+        || blockIndex.z < field->origin.z || blockIndex.z >= field->origin.z + field->clearance) {
+        return;
+    }
+
+    const int x = blockIndex.x;
+    const int y = blockIndex.y;
+    const uint32 cell = FlowCellIndex(*field, x, y);
+    const uint16 oldDistance = field->distances[cell];
+    const bool walkable = IsFlowCellWalkable(*levelData, x, y);
+    if (walkable == (oldDistance != FlowField::BLOCKED) || oldDistance == 0) {
+        return;
+    }
+
+    field->heapSize = 0;
+    if (walkable) {
+        const uint16 seed = GetFlowCellSeed(*field, cell);
+        field->distances[cell] = seed;
+        if (seed != FlowField::UNREACHABLE) {
+            PushFlowHeap(field, seed, cell);
+        }
+        PropagateFlowField(field);
+        return;
+    }
+
+    field->distances[cell] = FlowField::BLOCKED;
+    if (oldDistance == FlowField::UNREACHABLE) {
+        return;
+    }
+
+    // Cut off cells one step further than a cut off neighbour, keeping their old distance to find the next ones
+    uint32 numCut = 0;
+    field->cells[numCut++] = (uint32)oldDistance << 16 | cell;
+    for (uint32 i = 0; i < numCut; i++) {
+        const uint32 cutDistance = field->cells[i] >> 16;
+        const uint32 cutCell = field->cells[i] & 0xffff;
+        const int cx = (int)(cutCell % FlowField::SIZE);
+        const int cy = (int)(cutCell / FlowField::SIZE);
+        const uint32 neighbors[4] = {
+            cx > 0 ? cutCell - 1 : cutCell,
+            cx < FlowField::SIZE - 1 ? cutCell + 1 : cutCell,
+            cy > 0 ? cutCell - FlowField::SIZE : cutCell,
+            cy < FlowField::SIZE - 1 ? cutCell + FlowField::SIZE : cutCell,
+        };
+        for (int n = 0; n < 4; n++) {
+            const uint16 neighborDistance = field->distances[neighbors[n]];
+            if (neighborDistance < FlowField::UNREACHABLE && neighborDistance == cutDistance + 1) {
+                field->distances[neighbors[n]] = FlowField::UNREACHABLE;
+                field->cells[numCut++] = (uint32)neighborDistance << 16 | neighbors[n];
+            }
+        }
+    }
+
+    for (uint32 i = 1; i < numCut; i++) {
+        const uint32 cutCell = field->cells[i] & 0xffff;
+        const uint16 seed = GetFlowCellSeed(*field, cutCell);
+        if (seed != FlowField::UNREACHABLE) {
+            field->distances[cutCell] = seed;
+            PushFlowHeap(field, seed, cutCell);
+        }
+    }
+    PropagateFlowField(field);
+}
+
+void UpdateFlowFieldTarget(Vec3 target, LevelData* levelData)
+{
+    const Vec3Int targetIndex = WorldPosToBlockIndex(target, levelData->blockSize, BLOCKS_SIZE, BLOCK_ORIGIN);
+    if (!IsInBlockGrid(targetIndex)) {
+        levelData->flowField.valid = false;
+        return;
+    }
+
+    const FlowField& field = levelData->flowField;
+    const int clearance = (int)CeilFloat32(MOB_HITBOX_RADIUS.z * 2.0f / levelData->blockSize);
+    if (!field.valid || field.clearance != clearance || field.target.x != targetIndex.x
+        || field.target.y != targetIndex.y || field.target.z != targetIndex.z) {
+        RebuildFlowField(targetIndex, levelData);
+    }
+}
+
+// The field is rebuilt from scratch when a chunk column under it is loaded or unloaded
+internal void InvalidateFlowFieldColumn(Vec2Int column, LevelData* levelData)
+{
+    FlowField* field = &levelData->flowField;
+    const int x = column.x * CHUNK_SIZE;
+    const int y = column.y * CHUNK_SIZE;
+    if (x < field->origin.x + FlowField::SIZE && field->origin.x < x + CHUNK_SIZE
+        && y < field->origin.y + FlowField::SIZE && field->origin.y < y + CHUNK_SIZE) {
+        field->valid = false;
+    }
+}
+
+bool SampleFlowField(const FlowField& flowField, Vec3Int blockIndex, Vec2* dir, uint32* distance)
+{
+    if (!flowField.valid || !IsInFlowField(flowField, blockIndex.x, blockIndex.y)) {
+        return false;
+    }
+
+    const uint32 cell = FlowCellIndex(flowField, blockIndex.x, blockIndex.y);
+    const uint16 d = flowField.distances[cell];
+    if (d >= FlowField::UNREACHABLE) {
+        return false;
+    }
+
+    // Central differences, with walls and the field edges treated as one step uphill so mobs are pushed off them
+    const int x = blockIndex.x - flowField.origin.x;
+    const int y = blockIndex.y - flowField.origin.y;
+    const uint32 uphill = d + 1;
+    const uint32 left = x > 0 ? MinUInt32(flowField.distances[cell - 1], uphill) : uphill;
+    const uint32 right = x < FlowField::SIZE - 1 ? MinUInt32(flowField.distances[cell + 1], uphill) : uphill;
+    const uint32 down = y > 0 ? MinUInt32(flowField.distances[cell - FlowField::SIZE], uphill) : uphill;
+    const uint32 up = y < FlowField::SIZE - 1 ? MinUInt32(flowField.distances[cell + FlowField::SIZE], uphill) : uphill;
+
+    *dir = Vec2 { (float32)left - (float32)right, (float32)down - (float32)up };
+    const float32 length = SqrtFloat32(dir->x * dir->x + dir->y * dir->y);
+    if (length > 0.0f) {
+        dir->x /= length;
+        dir->y /= length;
+    }
+    *distance = d;
+    return true;
+}
+
+// Into [-PI, PI)
+internal float32 WrapAngle(float32 angle)
+{
+    return angle - 2.0f * PI_F * FloorFloat32((angle + PI_F) / (2.0f * PI_F));
+}
+
+internal void TickMob(uint32 mobIndex, Vec3 target, LevelData* levelData)
+{
+    MobList* mobs = &levelData->mobs;
+    const Vec3 pos = GetMobPos(*mobs, mobIndex);
+    float32 yaw = mobs->yaw[mobIndex];
+
+    // Collapsing mobs stand still
+    Vec3 walk = Vec3::zero;
+    if (mobs->collapseT[mobIndex] == 0.0f) {
+        // Down the flow field while the target is close enough to walk to, then straight at it from the last cell
+        const Vec3Int blockIndex = WorldPosToBlockIndex(pos, levelData->blockSize, BLOCKS_SIZE, BLOCK_ORIGIN);
+        Vec2 flowDir;
+        uint32 flowDistance;
+        if (SampleFlowField(levelData->flowField, blockIndex, &flowDir, &flowDistance)
+            && (float32)flowDistance * levelData->blockSize < MOB_CHASE_DISTANCE) {
+            if (flowDir.x == 0.0f && flowDir.y == 0.0f) {
+                flowDir = Vec2 { target.x - pos.x, target.y - pos.y };
+            }
+            if (flowDir.x * flowDir.x + flowDir.y * flowDir.y > MOB_HITBOX_RADIUS.x * MOB_HITBOX_RADIUS.x) {
+                const float32 maxTurn = MOB_TURN_SPEED * MOB_TICK_TIME;
+                yaw += ClampFloat32(WrapAngle(atan2f(flowDir.y, flowDir.x) - yaw), -maxTurn, maxTurn);
+            }
+        }
+        walk = Vec3 { cosf(yaw), sinf(yaw), 0.0f } * (MOB_WALK_SPEED * MOB_TICK_TIME);
+    }
+
+    mobs->fallSpeed[mobIndex] = MinFloat32(mobs->fallSpeed[mobIndex] + GRAVITY * MOB_TICK_TIME, MAX_FALL_SPEED);
+    const Vec3 delta = walk - Vec3::unitZ * (mobs->fallSpeed[mobIndex] * MOB_TICK_TIME);
+    const Box hitbox = { .min = pos - MOB_HITBOX_RADIUS, .max = pos + MOB_HITBOX_RADIUS };
+    const Vec3 moved = MoveBoxThroughBlocks(*levelData, hitbox, delta);
+    if (moved.z > delta.z) {
+        mobs->fallSpeed[mobIndex] = 0.0f;
+    }
+
+    // Turn away from whatever stopped the mob, to a side picked from its position so it doesn't depend on mob order
+    const float32 blockedX = walk.x - moved.x;
+    const float32 blockedY = walk.y - moved.y;
+    const float32 walkLengthSq = walk.x * walk.x + walk.y * walk.y;
+    if (blockedX * blockedX + blockedY * blockedY > 0.25f * walkLengthSq && walkLengthSq > 0.0f) {
+        const int side = ((int)FloorFloat32(pos.x) + (int)FloorFloat32(pos.y)) & 1;
+        yaw += side == 0 ? PI_F / 2.0f : -PI_F / 2.0f;
+    }
+
+    mobs->posX[mobIndex] += moved.x;
+    mobs->posY[mobIndex] += moved.y;
+    mobs->posZ[mobIndex] += moved.z;
+    mobs->yaw[mobIndex] = WrapAngle(yaw);
+}
+
+// Returns false once all of the current tick's jobs are claimed
+internal bool RunMobTickJob(MobSimulation* simulation)
+{
+    uint32 claimed;
+    do {
+        claimed = simulation->jobsClaimed;
+        if (claimed >= simulation->numJobs) {
+            return false;
+        }
+    } while (InterlockedCompareExchange((volatile LONG*)&simulation->jobsClaimed, (LONG)(claimed + 1),
+                                        (LONG)claimed) != (LONG)claimed);
+
+    const MobTickJob& job = simulation->jobs[claimed];
+    for (uint32 i = 0; i < job.numMobs; i++) {
+        TickMob(job.mobIndices[i], job.target, job.levelData);
+    }
+    InterlockedIncrement((volatile LONG*)&simulation->jobsDone);
+    return true;
+}
+
+internal void ThreadMobTick(AppWorkQueue* queue, void* data)
+{
+    UNREFERENCED_PARAMETER(queue);
+
+    RunMobTickJob((MobSimulation*)data);
+}
+
+// Sorts the live mobs by hash bucket, so each job's mobs touch the same few chunks. Returns the number of live mobs.
+internal uint32 SortMobsByCell(LevelData* levelData)
+{
+    MobSimulation* simulation = &levelData->mobSimulation;
+    const MobList& mobs = levelData->mobs;
+    MemSet(simulation->bucketStarts.data, 0, sizeof(simulation->bucketStarts));
+
+    for (uint32 w = 0; w < MOB_MASK_WORDS; w++) {
+        uint64 alive = mobs.aliveMask[w];
+        while (alive != 0) {
+            const uint32 i = w * 64 + (uint32)_tzcnt_u64(alive);
+            alive &= alive - 1;
+            simulation->bucketStarts[MobHashBucket(MobHashCell(mobs.posX[i]), MobHashCell(mobs.posY[i]))]++;
+        }
+    }
+    for (uint32 b = 1; b < MobSpatialHash::NUM_BUCKETS; b++) {
+        simulation->bucketStarts[b] += simulation->bucketStarts[b - 1];
+    }
+    const uint32 numMobs = simulation->bucketStarts[MobSpatialHash::NUM_BUCKETS - 1];
+    simulation->bucketStarts[MobSpatialHash::NUM_BUCKETS] = numMobs;
+
+    for (uint32 w = 0; w < MOB_MASK_WORDS; w++) {
+        uint64 alive = mobs.aliveMask[w];
+        while (alive != 0) {
+            const uint32 i = w * 64 + (uint32)_tzcnt_u64(alive);
+            alive &= alive - 1;
+            const uint32 bucket = MobHashBucket(MobHashCell(mobs.posX[i]), MobHashCell(mobs.posY[i]));
+            simulation->order[--simulation->bucketStarts[bucket]] = (uint16)i;
+        }
+    }
+
+    return numMobs;
+}
+
+void UpdateMobSimulation(float32 deltaTime, Vec3 target, AppWorkQueue* queue, LevelData* levelData)
+{
+    MobSimulation* simulation = &levelData->mobSimulation;
+    MobList* mobs = &levelData->mobs;
+
+    simulation->tickTime += deltaTime;
+    uint32 numTicks = 0;
+    while (simulation->tickTime >= MOB_TICK_TIME) {
+        simulation->tickTime -= MOB_TICK_TIME;
+        numTicks++;
+    }
+    numTicks = MinUInt32(numTicks, MOB_MAX_TICKS_PER_FRAME);
+
+    if (numTicks > 0) {
+        UpdateFlowFieldTarget(target, levelData);
+    }
+    for (uint32 t = 0; t < numTicks; t++) {
+        MemCopy(mobs->prevPosX.data, mobs->posX.data, mobs->size * sizeof(float32));
+        MemCopy(mobs->prevPosY.data, mobs->posY.data, mobs->size * sizeof(float32));
+        MemCopy(mobs->prevPosZ.data, mobs->posZ.data, mobs->size * sizeof(float32));
+        MemCopy(mobs->prevYaw.data, mobs->yaw.data, mobs->size * sizeof(float32));
+
+        // Each job writes only its own mobs, and reads only the grid besides, so they can run in any order
+        const uint32 numMobs = SortMobsByCell(levelData);
+        const uint32 minJobMobs = MobSimulation::MIN_MOBS_PER_JOB;
+        const uint32 numJobs = MinUInt32((numMobs + minJobMobs - 1) / minJobMobs, MobSimulation::MAX_JOBS);
+        for (uint32 j = 0; j < numJobs; j++) {
+            const uint32 start = numMobs * j / numJobs;
+            const uint32 end = numMobs * (j + 1) / numJobs;
+            MobTickJob* job = &simulation->jobs[j];
+            job->levelData = levelData;
+            job->mobIndices = simulation->order.data + start;
+            job->numMobs = end - start;
+            job->target = target;
+        }
+        simulation->jobsClaimed = 0;
+        simulation->jobsDone = 0;
+        InterlockedExchange((volatile LONG*)&simulation->numJobs, (LONG)numJobs);
+
+        // The shared queue may be busy, so this thread takes whatever jobs are still unclaimed
+        for (uint32 j = 1; j < numJobs; j++) {
+            if (queue == nullptr || !TryAddWork(queue, ThreadMobTick, simulation)) break;
+        }
+        while (RunMobTickJob(simulation)) {}
+        while (simulation->jobsDone != numJobs) {
+            _mm_pause();
+        }
+        InterlockedExchange((volatile LONG*)&simulation->numJobs, 0);
+
+        UpdateMobHitboxes(mobs);
+    }
+}
+
+Vec3 GetMobRenderPos(const LevelData& levelData, uint32 mobIndex)
+{
+    const MobList& mobs = levelData.mobs;
+    const float32 t = levelData.mobSimulation.tickTime / MOB_TICK_TIME;
+    const Vec3 prevPos = { mobs.prevPosX[mobIndex], mobs.prevPosY[mobIndex], mobs.prevPosZ[mobIndex] };
+    return prevPos + (GetMobPos(mobs, mobIndex) - prevPos) * t;
+}
+
+float32 GetMobRenderYaw(const LevelData& levelData, uint32 mobIndex)
+{
+    const MobList& mobs = levelData.mobs;
+    const float32 t = levelData.mobSimulation.tickTime / MOB_TICK_TIME;
+    return mobs.prevYaw[mobIndex] + WrapAngle(mobs.yaw[mobIndex] - mobs.prevYaw[mobIndex]) * t;
+}
+
+// A block's own chunk needs new faces, and so do the chunks of its neighbours, diagonal ones included for AO
+internal void MarkBlockDirty(Vec3Int blockIndex, GridRenderInfo* renderInfo)
+{
+    if (!IsInBlockGrid(blockIndex)) {
+        return;
+    }
+
+    // Only blocks on a chunk's border reach into other chunks
+    const Vec3Int chunkIndex = BlockToChunkIndex(blockIndex);
+    const Vec3Int localIndex = blockIndex - ChunkOrigin(chunkIndex);
+    const Vec3Int minChunk = {
+        MaxInt(chunkIndex.x - (localIndex.x == 0), 0),
+        MaxInt(chunkIndex.y - (localIndex.y == 0), 0),
+        MaxInt(chunkIndex.z - (localIndex.z == 0), 0)
+    };
+    const Vec3Int maxChunk = {
+        MinInt(chunkIndex.x + (localIndex.x == CHUNK_SIZE - 1), CHUNKS_SIZE.x - 1),
+        MinInt(chunkIndex.y + (localIndex.y == CHUNK_SIZE - 1), CHUNKS_SIZE.y - 1),
+        MinInt(chunkIndex.z + (localIndex.z == CHUNK_SIZE - 1), CHUNKS_SIZE.z - 1)
+    };
+    for (int z = minChunk.z; z <= maxChunk.z; z++) {
+        for (int y = minChunk.y; y <= maxChunk.y; y++) {
+            for (int x = minChunk.x; x <= maxChunk.x; x++) {
+                const uint32 chunkSlot = ChunkSlotIndex(Vec3Int { x, y, z });
+                renderInfo->dirtyChunks[chunkSlot / 64] |= (uint64)1 << (chunkSlot % 64);
+            }
+        }
+    }
+}
+
+// Horizontally, within the chunk columns [minColumn, maxColumn]
+internal bool IsChunkInColumns(Vec3Int chunkIndex, Vec2Int minColumn, Vec2Int maxColumn)
+{
+    return minColumn.x <= chunkIndex.x && chunkIndex.x <= maxColumn.x
+        && minColumn.y <= chunkIndex.y && chunkIndex.y <= maxColumn.y;
+}
+
+// Light BFS entries are a pool chunk index << LIGHT_ENTRY_CHUNK_SHIFT | block index within the chunk, plus flags
+const uint32 LIGHT_ENTRY_CHUNK_SHIFT = 15;
+const uint32 LIGHT_ENTRY_BLOCK_MASK = (1u << 31) - 1;
+const uint32 LIGHT_ENTRY_PULL = 1u << 31;
+const uint32 LIGHT_ENTRY_LEVEL_SHIFT = 32;
+static_assert(BLOCKS_PER_CHUNK == 1 << LIGHT_ENTRY_CHUNK_SHIFT);
+static_assert(BlockGrid::MAX_CHUNKS <= 1u << (31 - LIGHT_ENTRY_CHUNK_SHIFT));
+
+// Light reaches MAX_LIGHT blocks at most, so queues only hold what a chunk's worth of sources or an edit can reach
+const uint32 LIGHT_QUEUE_SIZE = 1 << 20;
+
+// Opposite directions differ in the lowest bit, and directions 2 * axis and 2 * axis + 1 run along it
+const int LIGHT_UP = 4;
+const int LIGHT_DOWN = 5;
+const Vec3Int LIGHT_DIRECTIONS[6] = {
+    { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+};
+
+struct LightQueue
+{
+    Array<uint64> entries; // ring buffer
+    uint32 start;
+    uint32 size;
+};
+
+internal bool PushLightQueue(LightQueue* queue, uint64 entry)
+{
+    if (queue->size == queue->entries.size) {
+        LOG_ERROR("Light queue full, max %lu\n", queue->entries.size);
+        return false;
+    }
+
+    queue->entries[(queue->start + queue->size) % queue->entries.size] = entry;
+    queue->size++;
+    return true;
+}
+
+internal uint64 PopLightQueue(LightQueue* queue)
+{
+    const uint64 entry = queue->entries[queue->start];
+    queue->start = (queue->start + 1) % queue->entries.size;
+    queue->size--;
+    return entry;
+}
+
+internal uint8 GetBlockEmission(BlockId id)
+{
+    return id == BlockId::LAMP ? 14 : 0;
+}
+
+internal uint32 GetLightLevel(uint8 light, int shift)
+{
+    return (light >> shift) & MAX_LIGHT;
+}
+
+internal void SetLightLevel(uint8* light, int shift, uint32 level)
+{
+    *light = (uint8)((*light & ~(MAX_LIGHT << shift)) | (level << shift));
+}
+
+// Light a block gets from a neighbour at level, in direction from the block. Full sky light goes straight down.
+internal uint32 GetLightFrom(uint32 level, int shift, int direction)
+{
+    if (shift == LIGHT_SKY_SHIFT && direction == LIGHT_UP && level == MAX_LIGHT) {
+        return MAX_LIGHT;
+    }
+    return level > 0 ? level - 1 : 0;
+}
+
+internal Vec3Int LightEntryLocalIndex(uint32 entry)
+{
+    const int blockInd = (int)(entry & (BLOCKS_PER_CHUNK - 1));
+    return Vec3Int { blockInd % CHUNK_SIZE, blockInd / CHUNK_SIZE % CHUNK_SIZE, blockInd / (CHUNK_SIZE * CHUNK_SIZE) };
+}
+
+internal Vec3Int LightEntryBlockIndex(const BlockGrid& grid, uint32 entry)
+{
+    const BlockChunk& chunk = *GetGridChunk(grid, (entry & LIGHT_ENTRY_BLOCK_MASK) >> LIGHT_ENTRY_CHUNK_SHIFT);
+    return ChunkOrigin(chunk.chunkIndex) + LightEntryLocalIndex(entry);
+}
+
+internal uint8* GetLightEntryLight(BlockGrid* grid, uint32 entry)
+{
+    BlockChunk* chunk = GetGridChunk(*grid, (entry & LIGHT_ENTRY_BLOCK_MASK) >> LIGHT_ENTRY_CHUNK_SHIFT);
+    return &chunk->light[entry & (BLOCKS_PER_CHUNK - 1)];
+}
+
+internal bool IsLightEntrySolid(const BlockGrid& grid, uint32 entry)
+{
+    const BlockChunk& chunk = *GetGridChunk(grid, (entry & LIGHT_ENTRY_BLOCK_MASK) >> LIGHT_ENTRY_CHUNK_SHIFT);
+    const uint32 blockInd = entry & (BLOCKS_PER_CHUNK - 1);
+    return (chunk.occupancy[blockInd / CHUNK_SIZE] >> (blockInd % CHUNK_SIZE)) & 1;
+}
+
+// Entry of the block next to an entry's. False if its light is fixed, see GetFixedNeighborLight.
+internal bool GetLightNeighbor(const BlockGrid& grid, uint32 entry, int direction, uint32* neighbor)
+{
+    // Within the chunk, the neighbour is a fixed stride away in the block index
+    const int axisShift = direction / 2 * 5;
+    static_assert(CHUNK_SIZE == 1 << 5);
+    const uint32 blockEntry = entry & LIGHT_ENTRY_BLOCK_MASK;
+    const uint32 coord = (blockEntry >> axisShift) & (CHUNK_SIZE - 1);
+    if ((direction & 1) == 0 && coord < CHUNK_SIZE - 1) {
+        *neighbor = blockEntry + (1u << axisShift);
+        return true;
+    }
+    if ((direction & 1) != 0 && coord > 0) {
+        *neighbor = blockEntry - (1u << axisShift);
+        return true;
+    }
+
+    const Vec3Int blockIndex = LightEntryBlockIndex(grid, entry) + LIGHT_DIRECTIONS[direction];
+    if (!IsInBlockGrid(blockIndex)) {
+        return false;
+    }
+    const Vec3Int chunkIndex = BlockToChunkIndex(blockIndex);
+    const uint16 slot = grid.chunkSlots[ChunkSlotIndex(chunkIndex)];
+    if (slot == 0) {
+        return false;
+    }
+
+    *neighbor = (uint32)(slot - 1) << LIGHT_ENTRY_CHUNK_SHIFT | ChunkBlockIndex(blockIndex - ChunkOrigin(chunkIndex));
+    return true;
+}
+
+// Light of a block out of bounds or in an unallocated chunk, see GetBlockLight
+internal uint8 GetFixedLight(const BlockGrid& grid, Vec3Int blockIndex)
+{
+    if (!IsInBlockGrid(blockIndex)) {
+        return blockIndex.z < 0 ? 0 : LIGHT_OPEN_SKY;
+    }
+    return blockIndex.z >= grid.skyHeights[SkyHeightIndex(blockIndex)] ? LIGHT_OPEN_SKY : 0;
+}
+
+// Light next to an entry where GetLightNeighbor has no entry
+internal uint8 GetFixedNeighborLight(const BlockGrid& grid, uint32 entry, int direction)
+{
+    return GetFixedLight(grid, LightEntryBlockIndex(grid, entry) + LIGHT_DIRECTIONS[direction]);
+}
+
+// Brightest light a block gets from its neighbours, fixed ones included
+internal uint32 PullLight(const BlockGrid& grid, uint32 entry, int shift)
+{
+    uint32 level = 0;
+    for (int d = 0; d < 6; d++) {
+        uint32 neighbor;
+        const uint8 neighborLight = GetLightNeighbor(grid, entry, d, &neighbor)
+            ? GetGridChunk(grid, neighbor >> LIGHT_ENTRY_CHUNK_SHIFT)->light[neighbor & (BLOCKS_PER_CHUNK - 1)]
+            : GetFixedNeighborLight(grid, entry, d);
+        level = MaxUInt32(level, GetLightFrom(GetLightLevel(neighborLight, shift), shift, d));
+    }
+    return level;
+}
+
+// Spreads light from the queued blocks breadth first, marking changed blocks dirty in renderInfo if it's not null
+internal bool SpreadLight(BlockGrid* grid, int shift, LightQueue* queue, GridRenderInfo* renderInfo)
+{
+    while (queue->size > 0) {
+        const uint64 popped = PopLightQueue(queue);
+        const uint32 entry = (uint32)popped & LIGHT_ENTRY_BLOCK_MASK;
+        const uint8* light = GetLightEntryLight(grid, entry);
+        uint32 level = GetLightLevel(*light, shift);
+        if (popped & LIGHT_ENTRY_PULL) {
+            const uint32 pulled = PullLight(*grid, entry, shift);
+            if (pulled > level) {
+                level = pulled;
+                SetLightLevel(GetLightEntryLight(grid, entry), shift, level);
+                if (renderInfo != nullptr) {
+                    MarkBlockDirty(LightEntryBlockIndex(*grid, entry), renderInfo);
+                }
+            }
+        }
+        if (level <= 1) continue;
+
+        for (int d = 0; d < 6; d++) {
+            uint32 neighbor;
+            if (!GetLightNeighbor(*grid, entry, d, &neighbor) || IsLightEntrySolid(*grid, neighbor)) continue;
+
+            uint8* neighborLight = GetLightEntryLight(grid, neighbor);
+            const uint32 neighborLevel = GetLightFrom(level, shift, d ^ 1);
+            if (GetLightLevel(*neighborLight, shift) >= neighborLevel) continue;
+
+            SetLightLevel(neighborLight, shift, neighborLevel);
+            if (renderInfo != nullptr) {
+                MarkBlockDirty(LightEntryBlockIndex(*grid, neighbor), renderInfo);
+            }
+            if (!PushLightQueue(queue, neighbor)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Darkens an empty block whose light could have come from a darkened one, and queues it to pull light back in
+internal bool DarkenLight(BlockGrid* grid, int shift, uint32 maxLevel, uint32 entry, LightQueue* removeQueue,
+                          LightQueue* spreadQueue, GridRenderInfo* renderInfo)
+{
+    if (IsLightEntrySolid(*grid, entry)) {
+        return true;
+    }
+
+    uint8* light = GetLightEntryLight(grid, entry);
+    const uint32 level = GetLightLevel(*light, shift);
+    if (level == 0 || level > maxLevel) {
+        return true;
+    }
+
+    SetLightLevel(light, shift, 0);
+    MarkBlockDirty(LightEntryBlockIndex(*grid, entry), renderInfo);
+    return PushLightQueue(removeQueue, (uint64)level << LIGHT_ENTRY_LEVEL_SHIFT | entry)
+        && PushLightQueue(spreadQueue, entry | LIGHT_ENTRY_PULL);
+}
+
+internal bool UnspreadLight(BlockGrid* grid, int shift, LightQueue* removeQueue, LightQueue* spreadQueue,
+                            GridRenderInfo* renderInfo)
+{
+    while (removeQueue->size > 0) {
+        const uint64 removed = PopLightQueue(removeQueue);
+        const uint32 level = (uint32)(removed >> LIGHT_ENTRY_LEVEL_SHIFT);
+        for (int d = 0; d < 6; d++) {
+            uint32 neighbor;
+            if (!GetLightNeighbor(*grid, (uint32)removed & LIGHT_ENTRY_BLOCK_MASK, d, &neighbor)) continue;
+
+            if (!DarkenLight(grid, shift, GetLightFrom(level, shift, d ^ 1), neighbor, removeQueue, spreadQueue,
+                             renderInfo)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+uint8 GetBlockLight(const BlockGrid& grid, Vec3Int blockIndex)
+{
+    if (!IsInBlockGrid(blockIndex)) {
+        return GetFixedLight(grid, blockIndex);
+    }
+
+    const Vec3Int chunkIndex = BlockToChunkIndex(blockIndex);
+    const uint16 slot = grid.chunkSlots[ChunkSlotIndex(chunkIndex)];
+    if (slot == 0) {
+        return GetFixedLight(grid, blockIndex);
+    }
+    return GetGridChunk(grid, slot - 1)->light[ChunkBlockIndex(blockIndex - ChunkOrigin(chunkIndex))];
+}
+
+// Lights the loaded chunk columns in [minColumn, maxColumn] from scratch, then exchanges light with the ones around
+internal bool ComputeColumnLight(BlockGrid* grid, Vec2Int minColumn, Vec2Int maxColumn, GridRenderInfo* renderInfo,
+                                 LinearAllocator* allocator)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+    const uint32 rowsPerChunk = CHUNK_SIZE * CHUNK_SIZE;
+    LightQueue queue = { .entries = allocator->NewArray<uint64>(LIGHT_QUEUE_SIZE), .start = 0, .size = 0 };
+    Array<uint32> openRows = allocator->NewArray<uint32>(grid->numChunksUsed * rowsPerChunk);
+    if (queue.entries.data == nullptr || (grid->numChunksUsed > 0 && openRows.data == nullptr)) {
+        LOG_ERROR("Failed to allocate light queue\n");
+        return false;
+    }
+
+    // Sky light down each column of chunks from the top, and emissive blocks' own light
+    StaticArray<uint64, BlockGrid::MAX_CHUNKS / 64> emissiveChunks;
+    MemSet(emissiveChunks.data, 0, sizeof(emissiveChunks));
+    for (int chunkY = minColumn.y; chunkY <= maxColumn.y; chunkY++) {
+        for (int chunkX = minColumn.x; chunkX <= maxColumn.x; chunkX++) {
+            if (!IsColumnLoaded(*grid, chunkX, chunkY)) continue;
+
+            uint32 open[CHUNK_SIZE];
+            MemSet(open, 0xff, sizeof(open));
+            uint8* skyHeights = &grid->skyHeights[SkyHeightIndex(ChunkOrigin(Vec3Int { chunkX, chunkY, 0 }))];
+            for (int y = 0; y < CHUNK_SIZE; y++) {
+                MemSet(&skyHeights[y * BLOCKS_SIZE.x], 0, CHUNK_SIZE);
+            }
+
+            for (int chunkZ = CHUNKS_SIZE.z - 1; chunkZ >= 0; chunkZ--) {
+                const uint16 slot = grid->chunkSlots[ChunkSlotIndex(Vec3Int { chunkX, chunkY, chunkZ })];
+                if (slot == 0) continue;
+
+                BlockChunk* chunk = GetGridChunk(*grid, slot - 1);
+                for (int z = CHUNK_SIZE - 1; z >= 0; z--) {
+                    for (int y = 0; y < CHUNK_SIZE; y++) {
+                        const uint32 row = ChunkRowIndex(y, z);
+                        const uint32 occupancy = chunk->occupancy[row];
+                        uint32 closed = open[y] & occupancy;
+                        while (closed != 0) {
+                            const int x = (int)_tzcnt_u32(closed);
+                            closed &= closed - 1;
+                            skyHeights[y * BLOCKS_SIZE.x + x] = (uint8)(chunk->chunkIndex.z * CHUNK_SIZE + z + 1);
+                        }
+                        open[y] &= ~occupancy;
+                        openRows[(slot - 1) * rowsPerChunk + row] = open[y];
+
+                        // Most rows are either all open or all closed
+                        uint8* light = &chunk->light[row * CHUNK_SIZE];
+                        if (open[y] == 0 || open[y] == 0xffffffff) {
+                            MemSet(light, open[y] == 0 ? 0 : LIGHT_OPEN_SKY, CHUNK_SIZE);
+                        }
+                        else {
+                            for (int x = 0; x < CHUNK_SIZE; x++) {
+                                light[x] = (open[y] >> x) & 1 ? LIGHT_OPEN_SKY : 0;
+                            }
+                        }
+
+                        uint32 solid = occupancy;
+                        while (solid != 0) {
+                            const int x = (int)_tzcnt_u32(solid);
+                            solid &= solid - 1;
+
+                            const uint8 emission = GetBlockEmission(chunk->blocks[row * CHUNK_SIZE + x].id);
+                            if (emission == 0) continue;
+                            light[x] = emission;
+                            emissiveChunks[(slot - 1) / 64] |= (uint64)1 << ((slot - 1) % 64);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Light spreads from one chunk's sources at a time, to keep the queue short
+    for (uint32 i = 0; i < BlockGrid::NUM_CHUNK_SLOTS; i++) {
+        const uint16 slot = grid->chunkSlots[i];
+        if (slot == 0 || ((emissiveChunks[(slot - 1) / 64] >> ((slot - 1) % 64)) & 1) == 0) continue;
+
+        BlockChunk* chunk = GetGridChunk(*grid, slot - 1);
+        for (uint32 row = 0; row < CHUNK_SIZE * CHUNK_SIZE; row++) {
+            uint32 solid = chunk->occupancy[row];
+            while (solid != 0) {
+                const uint32 blockInd = row * CHUNK_SIZE + _tzcnt_u32(solid);
+                solid &= solid - 1;
+                if (GetBlockEmission(chunk->blocks[blockInd].id) == 0) continue;
+
+                if (!PushLightQueue(&queue, (uint32)(slot - 1) << LIGHT_ENTRY_CHUNK_SHIFT | blockInd)) {
+                    return false;
+                }
+            }
+        }
+        if (!SpreadLight(grid, 0, &queue, renderInfo)) {
+            return false;
+        }
+    }
+
+    // Empty blocks out of the sky take what they can from their neighbours, which spreads from there
+    for (uint32 i = 0; i < BlockGrid::NUM_CHUNK_SLOTS; i++) {
+        const uint16 slot = grid->chunkSlots[i];
+        if (slot == 0 || !IsChunkInColumns(ChunkSlotToIndex(i), minColumn, maxColumn)) continue;
+
+        BlockChunk* chunk = GetGridChunk(*grid, slot - 1);
+        const uint32* open = &openRows[(slot - 1) * rowsPerChunk];
+        const uint32 bottomFace = chunk->chunkIndex.z > 0 ? 0xffffffff : 0;
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            for (int y = 0; y < CHUNK_SIZE; y++) {
+                const uint32 row = ChunkRowIndex(y, z);
+                const uint32 nextToOpen = (open[row] << 1) | (open[row] >> 1) | 0x80000001
+                    | (y > 0 ? open[row - 1] : 0xffffffff) | (y < CHUNK_SIZE - 1 ? open[row + 1] : 0xffffffff)
+                    | (z > 0 ? open[row - CHUNK_SIZE] : bottomFace)
+                    | (z < CHUNK_SIZE - 1 ? open[row + CHUNK_SIZE] : 0xffffffff);
+                uint32 candidates = ~chunk->occupancy[row] & ~open[row] & nextToOpen;
+                while (candidates != 0) {
+                    const uint32 blockInd = row * CHUNK_SIZE + _tzcnt_u32(candidates);
+                    candidates &= candidates - 1;
+                    if (GetLightLevel(chunk->light[blockInd], LIGHT_SKY_SHIFT) == MAX_LIGHT) continue;
+
+                    const uint32 entry = (uint32)(slot - 1) << LIGHT_ENTRY_CHUNK_SHIFT | blockInd;
+                    const uint32 level = PullLight(*grid, entry, LIGHT_SKY_SHIFT);
+                    if (level == 0) continue;
+                    SetLightLevel(&chunk->light[blockInd], LIGHT_SKY_SHIFT, level);
+                    if (!PushLightQueue(&queue, entry)) {
+                        return false;
+                    }
+                }
+            }
+        }
+        if (!SpreadLight(grid, LIGHT_SKY_SHIFT, &queue, renderInfo)) {
+            return false;
+        }
+    }
+
+    // Blocks on the faces of the loaded columns around the region pull in the region's light, and spread their own
+    for (int d = 0; d < 4; d++) {
+        const Vec3Int dir = LIGHT_DIRECTIONS[d];
+        const Vec2Int min = {
+            dir.x > 0 ? maxColumn.x + 1 : dir.x < 0 ? minColumn.x - 1 : minColumn.x,
+            dir.y > 0 ? maxColumn.y + 1 : dir.y < 0 ? minColumn.y - 1 : minColumn.y
+        };
+        const Vec2Int max = { dir.x == 0 ? maxColumn.x : min.x, dir.y == 0 ? maxColumn.y : min.y };
+        const int face = (d & 1) == 0 ? 0 : CHUNK_SIZE - 1;
+        for (int chunkY = MaxInt(min.y, 0); chunkY <= MinInt(max.y, CHUNKS_SIZE.y - 1); chunkY++) {
+            for (int chunkX = MaxInt(min.x, 0); chunkX <= MinInt(max.x, CHUNKS_SIZE.x - 1); chunkX++) {
+                if (!IsColumnLoaded(*grid, chunkX, chunkY)) continue;
+
+                for (int chunkZ = 0; chunkZ < CHUNKS_SIZE.z; chunkZ++) {
+                    const uint16 slot = grid->chunkSlots[ChunkSlotIndex(Vec3Int { chunkX, chunkY, chunkZ })];
+                    if (slot == 0) continue;
+
+                    for (int shift = 0; shift <= LIGHT_SKY_SHIFT; shift += LIGHT_SKY_SHIFT) {
+                        for (int z = 0; z < CHUNK_SIZE; z++) {
+                            for (int a = 0; a < CHUNK_SIZE; a++) {
+                                const Vec3Int local = d < 2 ? Vec3Int { face, a, z } : Vec3Int { a, face, z };
+                                const uint32 entry = (uint32)(slot - 1) << LIGHT_ENTRY_CHUNK_SHIFT
+                                    | ChunkBlockIndex(local);
+                                // Solid blocks only spread their own light, which emissive ones have
+                                const bool solid = IsLightEntrySolid(*grid, entry);
+                                if (solid && GetLightLevel(*GetLightEntryLight(grid, entry), shift) == 0) continue;
+                                if (!PushLightQueue(&queue, solid ? entry : entry | LIGHT_ENTRY_PULL)) {
+                                    return false;
+                                }
+                            }
+                        }
+                        if (!SpreadLight(grid, shift, &queue, renderInfo)) {
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool ComputeGridLight(BlockGrid* grid, LinearAllocator* allocator)
+{
+    return ComputeColumnLight(grid, Vec2Int { 0, 0 }, Vec2Int { CHUNKS_SIZE.x - 1, CHUNKS_SIZE.y - 1 }, nullptr,
+                              allocator);
+}
+
+// Links a chunk column's pool chunks into the grid, or returns the empty ones to the pool, and marks it loaded
+internal void LinkGridColumn(Vec2Int column, Array<uint16> chunkInds, BlockGrid* grid)
+{
+    for (uint32 i = 0; i < chunkInds.size; i++) {
+        const BlockChunk* chunk = GetGridChunk(*grid, chunkInds[i]);
+        if (chunk->numSolid == 0) {
+            grid->freeChunks.Append(chunkInds[i]);
+        }
+        else {
+            grid->chunkSlots[ChunkSlotIndex(chunk->chunkIndex)] = (uint16)(chunkInds[i] + 1);
+        }
+    }
+
+    const uint32 columnInd = ColumnIndex(column.x, column.y);
+    grid->unloadedColumns[columnInd / 64] &= ~((uint64)1 << (columnInd % 64));
+}
+
+// Adds the chunks read into a column from the level source, which must all have been read, and lights it
+internal bool AddGridColumn(Vec2Int column, Array<uint16> chunkInds, LevelData* levelData, LinearAllocator* allocator)
+{
+    LinkGridColumn(column, chunkInds, &levelData->grid);
+    InvalidateFlowFieldColumn(column, levelData);
+    return ComputeColumnLight(&levelData->grid, column, column, &levelData->gridRenderInfo, allocator);
+}
+
+// Reads an unloaded chunk column from the level source on this thread, and links it into the grid without its light
+internal bool ReadGridColumn(const LevelSource& source, Vec2Int column, BlockGrid* grid)
+{
+    StaticArray<uint16, CHUNKS_SIZE.z> chunkIndsData;
+    Array<uint16> chunkInds = { .size = 0, .data = chunkIndsData.data };
+    bool read = true;
+    for (int chunkZ = 0; chunkZ < CHUNKS_SIZE.z; chunkZ++) {
+        const Vec3Int chunkIndex = { column.x, column.y, chunkZ };
+        if (!HasSourceChunk(source, chunkIndex)) continue;
+
+        const int chunkInd = AllocatePoolChunk(grid);
+        if (chunkInd < 0) {
+            read = false;
+            break;
+        }
+        chunkInds.Append((uint16)chunkInd);
+        PreserveSnapshotChunk(chunkInd, grid);
+        read = ReadSourceChunk(source, chunkIndex, GetGridChunk(*grid, chunkInd));
+        if (!read) break;
+    }
+
+    if (!read) {
+        LOG_ERROR("Failed to load chunk column %d, %d\n", column.x, column.y);
+        for (uint32 i = 0; i < chunkInds.size; i++) {
+            grid->freeChunks.Append(chunkInds[i]);
+        }
+        return false;
+    }
+
+    LinkGridColumn(column, chunkInds, grid);
+    return true;
+}
+
+// Reads an unloaded chunk column from the level source on this thread, and adds it to the grid
+internal bool LoadGridColumn(Vec2Int column, LevelData* levelData, LinearAllocator* allocator)
+{
+    if (!ReadGridColumn(levelData->blockStreaming.source, column, &levelData->grid)) {
+        return false;
+    }
+
+    InvalidateFlowFieldColumn(column, levelData);
+    return ComputeColumnLight(&levelData->grid, column, column, &levelData->gridRenderInfo, allocator);
+}
+
+// Drops an unedited chunk column's blocks, which can be read from the level source again
+internal void UnloadGridColumn(Vec2Int column, LevelData* levelData)
+{
+    BlockGrid* grid = &levelData->grid;
+    for (int chunkZ = 0; chunkZ < CHUNKS_SIZE.z; chunkZ++) {
+        const uint32 slotIndex = ChunkSlotIndex(Vec3Int { column.x, column.y, chunkZ });
+        if (grid->chunkSlots[slotIndex] != 0) {
+            grid->freeChunks.Append((uint16)(grid->chunkSlots[slotIndex] - 1));
+            grid->chunkSlots[slotIndex] = 0;
+        }
+    }
+
+    // Dark and solid to the loaded columns around it, which keep the light they got from it
+    uint8* skyHeights = &grid->skyHeights[SkyHeightIndex(ChunkOrigin(Vec3Int { column.x, column.y, 0 }))];
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        MemSet(&skyHeights[y * BLOCKS_SIZE.x], BLOCKS_SIZE.z, CHUNK_SIZE);
+    }
+    const uint32 columnInd = ColumnIndex(column.x, column.y);
+    grid->unloadedColumns[columnInd / 64] |= (uint64)1 << (columnInd % 64);
+    InvalidateFlowFieldColumn(column, levelData);
+}
+
+internal bool RunChunkLoadJob(LevelData* levelData)
+{
+    BlockStreaming* streaming = &levelData->blockStreaming;
+    uint32 claimed;
+    do {
+        claimed = streaming->jobsClaimed;
+        if (claimed >= streaming->numJobs) {
+            return false;
+        }
+    } while (InterlockedCompareExchange((volatile LONG*)&streaming->jobsClaimed, (LONG)(claimed + 1),
+                                        (LONG)claimed) != (LONG)claimed);
+
+    ChunkLoadJob* job = &streaming->jobs[claimed];
+    job->loaded = ReadSourceChunk(streaming->source, job->chunkIndex, GetGridChunk(levelData->grid, job->chunkInd));
+    InterlockedIncrement((volatile LONG*)&streaming->jobsDone);
+    return true;
+}
+
+internal void ThreadChunkLoad(AppWorkQueue* queue, void* data)
+{
+    UNREFERENCED_PARAMETER(queue);
+
+    RunChunkLoadJob((LevelData*)data);
+}
+
+// Jobs that no queue entry has picked up yet are run on this thread
+internal void WaitChunkLoadJobs(LevelData* levelData)
+{
+    BlockStreaming* streaming = &levelData->blockStreaming;
+    const uint32 numJobs = streaming->numJobs;
+    while (RunChunkLoadJob(levelData)) {}
+    while (streaming->jobsDone != numJobs) {
+        _mm_pause();
+    }
+}
+
+// Waits for the chunk columns being loaded and adds them to the grid. Nothing can be meshing from the grid.
+internal bool FinishBlockStreaming(LevelData* levelData, LinearAllocator* allocator)
+{
+    BlockStreaming* streaming = &levelData->blockStreaming;
+    if (streaming->columns.size == 0) {
+        return true;
+    }
+
+    WaitChunkLoadJobs(levelData);
+    bool succeeded = true;
+    uint32 jobStart = 0;
+    for (uint32 c = 0; c < streaming->columns.size; c++) {
+        const Vec2Int column = streaming->columns[c];
+        StaticArray<uint16, CHUNKS_SIZE.z> chunkIndsData;
+        Array<uint16> chunkInds = { .size = 0, .data = chunkIndsData.data };
+        bool loaded = true;
+        uint32 jobEnd = jobStart;
+        while (jobEnd < streaming->numJobs && streaming->jobs[jobEnd].chunkIndex.x == column.x
+               && streaming->jobs[jobEnd].chunkIndex.y == column.y) {
+            chunkInds.Append(streaming->jobs[jobEnd].chunkInd);
+            loaded = loaded && streaming->jobs[jobEnd].loaded;
+            jobEnd++;
+        }
+        jobStart = jobEnd;
+
+        if (!loaded) {
+            LOG_ERROR("Failed to load chunk column %d, %d\n", column.x, column.y);
+            for (uint32 i = 0; i < chunkInds.size; i++) {
+                levelData->grid.freeChunks.Append(chunkInds[i]);
+            }
+            succeeded = false;
+        }
+        else if (!AddGridColumn(column, chunkInds, levelData, allocator)) {
+            succeeded = false;
+        }
+    }
+
+    streaming->columns.Clear();
+    InterlockedExchange((volatile LONG*)&streaming->numJobs, 0);
+    return succeeded;
+}
+
+// Waits for the chunk columns being loaded and drops them, for when the level is replaced
+internal void CancelBlockStreaming(LevelData* levelData)
+{
+    BlockStreaming* streaming = &levelData->blockStreaming;
+    WaitChunkLoadJobs(levelData);
+    for (uint32 i = 0; i < streaming->numJobs; i++) {
+        levelData->grid.freeChunks.Append(streaming->jobs[i].chunkInd);
+    }
+
+    streaming->columns.Clear();
+    InterlockedExchange((volatile LONG*)&streaming->numJobs, 0);
+}
+
+// Queues the light changes from allocating or freeing the chunk of chunkInd
+internal bool QueueChunkLightChanges(uint32 chunkInd, bool allocated, int shift, LevelData* levelData,
+                                     LightQueue* removeQueue, LightQueue* spreadQueue)
+{
+    BlockGrid* grid = &levelData->grid;
+    BlockChunk* chunk = GetGridChunk(*grid, chunkInd);
+    if (allocated && shift == LIGHT_SKY_SHIFT) {
+        // Empty blocks under the first solid block of each column lose the sky
+        const Vec3Int chunkOrigin = ChunkOrigin(chunk->chunkIndex);
+        for (int y = 0; y < CHUNK_SIZE; y++) {
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                const Vec3Int aboveIndex = chunkOrigin + Vec3Int { x, y, CHUNK_SIZE };
+                bool open = GetLightLevel(GetBlockLight(*grid, aboveIndex), LIGHT_SKY_SHIFT) == MAX_LIGHT;
+                for (int z = CHUNK_SIZE - 1; z >= 0; z--) {
+                    const uint32 blockInd = ChunkBlockIndex(Vec3Int { x, y, z });
+                    open = open && chunk->blocks[blockInd].id == BlockId::NONE;
+                    if (open) continue;
+
+                    if (!DarkenLight(grid, shift, MAX_LIGHT, chunkInd << LIGHT_ENTRY_CHUNK_SHIFT | blockInd,
+                                     removeQueue, spreadQueue, &levelData->gridRenderInfo)) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // Otherwise only the blocks on either side of the chunk's faces are affected
+    for (int d = 0; d < 6; d++) {
+        const Vec3Int dir = LIGHT_DIRECTIONS[d];
+        const int side = dir.x + dir.y + dir.z > 0 ? CHUNK_SIZE - 1 : 0;
+        for (int i = 0; i < CHUNK_SIZE; i++) {
+            for (int j = 0; j < CHUNK_SIZE; j++) {
+                const Vec3Int localIndex = {
+                    dir.x != 0 ? side : i,
+                    dir.y != 0 ? side : (dir.x != 0 ? i : j),
+                    dir.z != 0 ? side : j
+                };
+                const uint32 entry = chunkInd << LIGHT_ENTRY_CHUNK_SHIFT | ChunkBlockIndex(localIndex);
+                if (allocated) {
+                    if (!IsLightEntrySolid(*grid, entry) && !PushLightQueue(spreadQueue, entry | LIGHT_ENTRY_PULL)) {
+                        return false;
+                    }
+                    continue;
+                }
+
+                uint32 neighbor;
+                if (!GetLightNeighbor(*grid, entry, d, &neighbor)) continue;
+                if (shift == LIGHT_SKY_SHIFT) {
+                    if (!IsLightEntrySolid(*grid, neighbor)
+                        && !PushLightQueue(spreadQueue, neighbor | LIGHT_ENTRY_PULL)) {
+                        return false;
+                    }
+                }
+                else {
+                    const uint32 level = GetLightLevel(chunk->light[entry & (BLOCKS_PER_CHUNK - 1)], shift);
+                    if (level > 0 && !DarkenLight(grid, shift, GetLightFrom(level, shift, d ^ 1), neighbor,
+                                                  removeQueue, spreadQueue, &levelData->gridRenderInfo)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Queues the sky light changes from a column's sky height moving
+internal bool QueueSkyHeightLightChanges(Vec3Int blockIndex, uint8 oldSkyHeight, LevelData* levelData,
+                                         LightQueue* removeQueue, LightQueue* spreadQueue)
+{
+    BlockGrid* grid = &levelData->grid;
+    const uint8 skyHeight = grid->skyHeights[SkyHeightIndex(blockIndex)];
+    const bool darkened = skyHeight > oldSkyHeight;
+    const int minZ = MinInt(skyHeight, oldSkyHeight);
+    const int maxZ = MaxInt(skyHeight, oldSkyHeight);
+    for (int z = minZ; z < maxZ; z++) {
+        const Vec3Int fixedIndex = { blockIndex.x, blockIndex.y, z };
+        if (grid->chunkSlots[ChunkSlotIndex(BlockToChunkIndex(fixedIndex))] != 0) continue;
+
+        MarkBlockDirty(fixedIndex, &levelData->gridRenderInfo);
+        for (int d = 0; d < 6; d++) {
+            const Vec3Int neighborIndex = fixedIndex + LIGHT_DIRECTIONS[d];
+            if (!IsInBlockGrid(neighborIndex)) continue;
+            const Vec3Int chunkIndex = BlockToChunkIndex(neighborIndex);
+            const uint16 slot = grid->chunkSlots[ChunkSlotIndex(chunkIndex)];
+            if (slot == 0) continue;
+
+            const uint32 entry = (uint32)(slot - 1) << LIGHT_ENTRY_CHUNK_SHIFT
+                | ChunkBlockIndex(neighborIndex - ChunkOrigin(chunkIndex));
+            if (darkened) {
+                if (!DarkenLight(grid, LIGHT_SKY_SHIFT, GetLightFrom(MAX_LIGHT, LIGHT_SKY_SHIFT, d ^ 1), entry,
+                                 removeQueue, spreadQueue, &levelData->gridRenderInfo)) {
+                    return false;
+                }
+            }
+            else if (!IsLightEntrySolid(*grid, entry) && !PushLightQueue(spreadQueue, entry | LIGHT_ENTRY_PULL)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Relights around a block that was just set, given its chunk's slot and its column's sky height from before
+internal bool UpdateBlockLight(Vec3Int blockIndex, uint16 oldSlot, uint8 oldSkyHeight, LevelData* levelData,
+                               LightQueue* removeQueue, LightQueue* spreadQueue)
+{
+    BlockGrid* grid = &levelData->grid;
+    GridRenderInfo* renderInfo = &levelData->gridRenderInfo;
+    const Vec3Int chunkIndex = BlockToChunkIndex(blockIndex);
+    const uint16 slot = grid->chunkSlots[ChunkSlotIndex(chunkIndex)];
+    if (oldSlot == 0 && slot == 0) {
+        return true;
+    }
+    const bool skyHeightChanged = grid->skyHeights[SkyHeightIndex(blockIndex)] != oldSkyHeight;
+
+    const uint32 chunkInd = slot != 0 ? slot - 1 : oldSlot - 1;
+    const uint32 entry = chunkInd << LIGHT_ENTRY_CHUNK_SHIFT | ChunkBlockIndex(blockIndex - ChunkOrigin(chunkIndex));
+    const int shifts[2] = { LIGHT_SKY_SHIFT, 0 };
+    for (int i = 0; i < 2; i++) {
+        const int shift = shifts[i];
+        removeQueue->start = removeQueue->size = 0;
+        spreadQueue->start = spreadQueue->size = 0;
+
+        if ((oldSlot == 0) != (slot == 0)) {
+            if (!QueueChunkLightChanges(chunkInd, slot != 0, shift, levelData, removeQueue, spreadQueue)) {
+                return false;
+            }
+        }
+        if (shift == LIGHT_SKY_SHIFT && skyHeightChanged) {
+            if (!QueueSkyHeightLightChanges(blockIndex, oldSkyHeight, levelData, removeQueue, spreadQueue)) {
+                return false;
+            }
+        }
+
+        uint8 emission = 0;
+        if (slot != 0) {
+            uint8* light = GetLightEntryLight(grid, entry);
+            const uint32 level = GetLightLevel(*light, shift);
+            SetLightLevel(light, shift, 0);
+            if (level > 0 && !PushLightQueue(removeQueue, (uint64)level << LIGHT_ENTRY_LEVEL_SHIFT | entry)) {
+                return false;
+            }
+            if (shift == 0) {
+                const BlockChunk* chunk = GetGridChunk(*grid, chunkInd);
+                emission = GetBlockEmission(chunk->blocks[entry & (BLOCKS_PER_CHUNK - 1)].id);
+            }
+        }
+
+        if (!UnspreadLight(grid, shift, removeQueue, spreadQueue, renderInfo)) {
+            return false;
+        }
+
+        if (slot != 0) {
+            if (emission > 0) {
+                SetLightLevel(GetLightEntryLight(grid, entry), shift, emission);
+                if (!PushLightQueue(spreadQueue, entry)) {
+                    return false;
+                }
+            }
+            else if (!IsLightEntrySolid(*grid, entry) && !PushLightQueue(spreadQueue, entry | LIGHT_ENTRY_PULL)) {
+                return false;
+            }
+        }
+
+        if (!SpreadLight(grid, shift, spreadQueue, renderInfo)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Forgets the undo history and unsaved blocks, for a grid that isn't the result of edits to the saved level
+internal void ResetBlockJournal(BlockJournal* journal)
+{
+    journal->firstBatch = journal->batchEnd;
+    journal->appliedEnd = journal->batchEnd;
+    journal->numUnsaved = 0;
+    journal->unsavedComplete = true;
+    journal->savedLevelName = { .size = 0, .data = journal->savedLevelNameBuffer.data };
+    journal->savedDelta = {};
+}
+
+internal void SetJournalSavedLevel(const_string levelName, const LevelDeltaState& delta, BlockJournal* journal)
+{
+    if (levelName.size > MAX_LEVEL_NAME_LENGTH) {
+        return;
+    }
+
+    MemCopy(journal->savedLevelNameBuffer.data, levelName.data, levelName.size);
+    journal->savedLevelName = { .size = levelName.size, .data = journal->savedLevelNameBuffer.data };
+    journal->savedDelta = delta;
+}
+
+internal void RecordUnsavedBlock(Vec3Int index, Block block, BlockJournal* journal)
+{
+    if (journal->numUnsaved == LEVEL_DELTA_MAX_RECORDS) {
+        journal->unsavedComplete = false;
+        return;
+    }
+
+    journal->unsaved[journal->numUnsaved++] = { .index = index, .block = block };
+}
+
+// Drops the batches that could be redone, then the oldest ones until numEdits more fit, or all of them
+internal bool BeginJournalBatch(uint32 numEdits, BlockJournal* journal)
+{
+    journal->batchEnd = journal->appliedEnd;
+    if (journal->batchEnd != journal->firstBatch) {
+        journal->editEnd = journal->batches[(journal->batchEnd - 1) % BlockJournal::MAX_BATCHES].end;
+    }
+
+    if (numEdits > BlockJournal::MAX_EDITS) {
+        journal->firstBatch = journal->batchEnd;
+        journal->appliedEnd = journal->batchEnd;
+        return false;
+    }
+
+    while (journal->firstBatch != journal->batchEnd) {
+        const uint32 firstEdit = journal->batches[journal->firstBatch % BlockJournal::MAX_BATCHES].start;
+        if (journal->editEnd - firstEdit + numEdits <= BlockJournal::MAX_EDITS
+            && journal->batchEnd - journal->firstBatch < BlockJournal::MAX_BATCHES) {
+            break;
+        }
+        journal->firstBatch++;
+    }
+
+    BlockEditBatch* batch = &journal->batches[journal->batchEnd % BlockJournal::MAX_BATCHES];
+    batch->start = journal->editEnd;
+    batch->end = journal->editEnd;
+    return true;
+}
+
+internal void AddJournalEdit(const BlockEdit& edit, BlockJournal* journal)
+{
+    journal->edits[journal->editEnd % BlockJournal::MAX_EDITS] = edit;
+    journal->editEnd++;
+    journal->batches[journal->batchEnd % BlockJournal::MAX_BATCHES].end = journal->editEnd;
+}
+
+internal void EndJournalBatch(BlockJournal* journal)
+{
+    const BlockEditBatch& batch = journal->batches[journal->batchEnd % BlockJournal::MAX_BATCHES];
+    if (batch.end != batch.start) {
+        journal->batchEnd++;
+        journal->appliedEnd = journal->batchEnd;
+    }
+}
+
+// Every block that changes is recorded for the next save, and in the open journal batch if record is set
+internal void ApplyBlockUpdates(Array<BlockUpdate> updates, bool record, LevelData* levelData, AppWorkQueue* queue,
+                                LinearAllocator* allocator)
+{
+    BlockJournal* journal = &levelData->journal;
+    // Streaming jobs read the grid
+    FinishChunkMeshJobs(&levelData->gridRenderInfo);
+    if (!FinishBlockStreaming(levelData, allocator)) {
+        LOG_ERROR("Failed to load streamed chunk columns\n");
+    }
+
+    // Edited columns are loaded first, and stay loaded since the level source doesn't have the edits
+    BlockGrid* grid = &levelData->grid;
+    for (uint32 i = 0; i < updates.size; i++) {
+        const Vec3Int index = updates[i].index;
+        if (!IsInBlockGrid(index)) continue;
+
+        const Vec2Int column = { index.x / CHUNK_SIZE, index.y / CHUNK_SIZE };
+        if (!IsColumnLoaded(*grid, column.x, column.y) && !LoadGridColumn(column, levelData, allocator)) continue;
+        const uint32 columnInd = ColumnIndex(column.x, column.y);
+        grid->pinnedColumns[columnInd / 64] |= (uint64)1 << (columnInd % 64);
+    }
+
+    {
+        ALLOCATOR_SCOPE_RESET(*allocator);
+        LightQueue removeQueue = {
+            .entries = allocator->NewArray<uint64>(LIGHT_QUEUE_SIZE), .start = 0, .size = 0
+        };
+        LightQueue spreadQueue = {
+            .entries = allocator->NewArray<uint64>(LIGHT_QUEUE_SIZE), .start = 0, .size = 0
+        };
+        const bool updateLight = removeQueue.entries.data != nullptr && spreadQueue.entries.data != nullptr;
+        if (!updateLight) {
+            LOG_ERROR("Failed to allocate light queues, light won't be updated\n");
+        }
+
+        for (uint32 i = 0; i < updates.size; i++) {
+            const Vec3Int index = updates[i].index;
+            const Block block = updates[i].block;
+            const Block oldBlock = GetBlock(levelData->grid, index);
+            const uint16 oldSlot = IsInBlockGrid(index)
+                ? levelData->grid.chunkSlots[ChunkSlotIndex(BlockToChunkIndex(index))] : 0;
+            const uint8 oldSkyHeight = IsInBlockGrid(index) ? levelData->grid.skyHeights[SkyHeightIndex(index)] : 0;
+            if (!SetBlock(index, block, &levelData->grid)) {
+                LOG_ERROR("Failed to set block %d, %d, %d\n", index.x, index.y, index.z);
+                continue;
+            }
+            if (oldBlock.id != block.id) {
+                RecordUnsavedBlock(index, block, journal);
+                if (record) {
+                    AddJournalEdit({ .index = index, .oldBlock = oldBlock, .newBlock = block }, journal);
+                }
+            }
+            MarkBlockDirty(index, &levelData->gridRenderInfo);
+            if (updateLight && !UpdateBlockLight(index, oldSlot, oldSkyHeight, levelData, &removeQueue, &spreadQueue)) {
+                LOG_ERROR("Failed to update light around block %d, %d, %d\n", index.x, index.y, index.z);
+            }
+            UpdateFlowFieldBlock(index, levelData);
+        }
+    }
+
+    if (!UpdateDirtyGridRenderInfo(levelData->grid, queue, allocator, &levelData->gridRenderInfo)) {
+        LOG_ERROR("Failed to update block faces\n");
+    }
+}
+
+void SubmitBlockUpdates(Array<BlockUpdate> updates, LevelData* levelData, AppWorkQueue* queue,
+                        LinearAllocator* allocator)
+{
+    BlockJournal* journal = &levelData->journal;
+    const bool record = BeginJournalBatch(updates.size, journal);
+    if (!record) {
+        LOG_ERROR("%lu block updates don't fit in the journal, undo history dropped\n", updates.size);
+    }
+
+    ApplyBlockUpdates(updates, record, levelData, queue, allocator);
+    if (record) {
+        EndJournalBatch(journal);
+    }
+}
+
+// Sets a batch's edits back in reverse order, or applies them again in order
+internal bool ApplyJournalBatch(uint32 batchNumber, bool undo, LevelData* levelData, AppWorkQueue* queue,
+                                LinearAllocator* allocator)
+{
+    const BlockJournal& journal = levelData->journal;
+    const BlockEditBatch batch = journal.batches[batchNumber % BlockJournal::MAX_BATCHES];
+
+    ALLOCATOR_SCOPE_RESET(*allocator);
+    Array<BlockUpdate> updates = allocator->NewArray<BlockUpdate>(batch.end - batch.start);
+    if (updates.data == nullptr) {
+        LOG_ERROR("Failed to allocate %lu block updates\n", batch.end - batch.start);
+        return false;
+    }
+
+    for (uint32 i = 0; i < updates.size; i++) {
+        const uint32 edit = undo ? batch.end - 1 - i : batch.start + i;
+        const BlockEdit& blockEdit = journal.edits[edit % BlockJournal::MAX_EDITS];
+        updates[i] = { .index = blockEdit.index, .block = undo ? blockEdit.oldBlock : blockEdit.newBlock };
+    }
+
+    ApplyBlockUpdates(updates, false, levelData, queue, allocator);
+    return true;
+}
+
+bool UndoBlockUpdates(LevelData* levelData, AppWorkQueue* queue, LinearAllocator* allocator)
+{
+    BlockJournal* journal = &levelData->journal;
+    if (journal->appliedEnd == journal->firstBatch
+        || !ApplyJournalBatch(journal->appliedEnd - 1, true, levelData, queue, allocator)) {
+        return false;
+    }
+
+    journal->appliedEnd--;
+    return true;
+}
+
+bool RedoBlockUpdates(LevelData* levelData, AppWorkQueue* queue, LinearAllocator* allocator)
+{
+    BlockJournal* journal = &levelData->journal;
+    if (journal->appliedEnd == journal->batchEnd
+        || !ApplyJournalBatch(journal->appliedEnd, false, levelData, queue, allocator)) {
+        return false;
+    }
+
+    journal->appliedEnd++;
+    return true;
+}
+
+// Dense files from before chunking: Vec3Int size, then a 4-byte BlockId per block, recentered on BLOCK_ORIGIN
+internal bool LoadLegacyLevel(Array<uint8> data, BlockGrid* grid)
+{
+    if (data.size < sizeof(Vec3Int)) {
+        return false;
+    }
+    const Vec3Int size = *(const Vec3Int*)data.data;
+    for (int e = 0; e < 3; e++) {
+        if (size.e[e] <= 0 || size.e[e] > BLOCKS_SIZE.e[e]) {
+            return false;
+        }
+    }
+    if (data.size != sizeof(Vec3Int) + (uint64)size.x * size.y * size.z * sizeof(uint32)) {
+        return false;
+    }
+
+    const Vec3Int legacyOrigin = { size.x / 2, size.y / 2, BLOCK_ORIGIN.z };
+    const Vec3Int offset = BLOCK_ORIGIN - legacyOrigin;
+    const uint32* ids = (const uint32*)(data.data + sizeof(Vec3Int));
+
+    for (int z = 0; z < size.z; z++) {
+        for (int y = 0; y < size.y; y++) {
+            for (int x = 0; x < size.x; x++) {
+                const uint32 id = ids[(z * size.y + y) * size.x + x];
+                if (id == (uint32)BlockId::NONE) continue;
+                if (id >= (uint32)BlockId::COUNT) {
+                    return false;
+                }
+
+                const Vec3Int index = Vec3Int { x, y, z } + offset;
+                if (!SetBlock(index, { .id = (BlockId)id }, grid)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Version 1 files have no directory, just numChunks of: Vec3Int chunkIndex, then BLOCKS_PER_CHUNK raw BlockIds
+internal bool LoadLevelV1(Array<uint8> data, BlockGrid* grid)
+{
+    const LevelFileHeader* header = (const LevelFileHeader*)data.data;
+    const uint32 chunkDataSize = sizeof(Vec3Int) + BLOCKS_PER_CHUNK;
+    if (header->numChunks > BlockGrid::NUM_CHUNK_SLOTS
+        || data.size != sizeof(LevelFileHeader) + (uint64)header->numChunks * chunkDataSize) {
+        LOG_ERROR("Level file has %lu chunks and doesn't match its size\n", header->numChunks);
+        return false;
+    }
+
+    const uint8* chunkData = data.data + sizeof(LevelFileHeader);
+    for (uint32 i = 0; i < header->numChunks; i++) {
+        const Vec3Int chunkIndex = *(const Vec3Int*)chunkData;
+        const Block* blocks = (const Block*)(chunkData + sizeof(Vec3Int));
+        chunkData += chunkDataSize;
+
+        const Vec3Int chunkOrigin = ChunkOrigin(chunkIndex);
+        if (!IsInBlockGrid(chunkOrigin)) {
+            LOG_ERROR("Level file chunk %d, %d, %d out of bounds\n", chunkIndex.x, chunkIndex.y, chunkIndex.z);
+            return false;
+        }
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            for (int y = 0; y < CHUNK_SIZE; y++) {
+                for (int x = 0; x < CHUNK_SIZE; x++) {
+                    const Vec3Int localIndex = { x, y, z };
+                    const Block block = blocks[ChunkBlockIndex(localIndex)];
+                    if (block.id == BlockId::NONE) continue;
+                    if ((uint8)block.id >= (uint8)BlockId::COUNT) {
+                        return false;
+                    }
+                    if (!SetBlock(chunkOrigin + localIndex, block, grid)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+const uint32 LEVEL_FILE_HASH_BASIS = 2166136261;
+
+// FNV-1a, to tell which level file a delta log was started for. Pass the hash of the previous bytes to continue it.
+internal uint32 HashLevelFile(Array<uint8> data, uint32 hash = LEVEL_FILE_HASH_BASIS)
+{
+    for (uint32 i = 0; i < data.size; i++) {
+        hash = (hash ^ data[i]) * 16777619;
+    }
+    return hash;
+}
+
+internal void WriteLevelDeltaRecord(const BlockUpdate& update, uint8* record)
+{
+    const uint16 index[3] = { (uint16)update.index.x, (uint16)update.index.y, (uint16)update.index.z };
+    for (int i = 0; i < 3; i++) {
+        record[i * 2] = (uint8)(index[i] & 0xff);
+        record[i * 2 + 1] = (uint8)(index[i] >> 8);
+    }
+    record[6] = (uint8)update.block.id;
+}
+
+internal BlockUpdate ReadLevelDeltaRecord(const uint8* record)
+{
+    BlockUpdate update;
+    update.index.x = record[0] | (record[1] << 8);
+    update.index.y = record[2] | (record[3] << 8);
+    update.index.z = record[4] | (record[5] << 8);
+    update.block.id = (BlockId)record[6];
+    return update;
+}
+
+// Replays a level's delta log over its level file, loading and pinning the chunk columns it edits
+internal bool LoadLevelDelta(const_string levelName, const LevelSource& source, BlockGrid* grid,
+                             LinearAllocator* allocator, LevelDeltaState* delta)
+{
+    delta->numRecords = 0;
+    delta->appendable = true;
+
+    MappedFile mappedFile;
+    {
+        ALLOCATOR_SCOPE_RESET(*allocator);
+        const string path = GetLevelDeltaPath(levelName, allocator);
+        if (!FileExists(path)) {
+            return true;
+        }
+        if (!MapFileReadOnly(path, allocator, &mappedFile)) {
+            return false;
+        }
+    }
+    defer(UnmapFile(&mappedFile));
+
+    const Array<uint8> data = mappedFile.data;
+    const LevelDeltaHeader* header = (const LevelDeltaHeader*)data.data;
+    if (data.size < sizeof(LevelDeltaHeader) || header->magic != LEVEL_DELTA_MAGIC
+        || (header->version != 1 && header->version != LEVEL_DELTA_VERSION)) {
+        LOG_ERROR("Level delta log %.*s is invalid\n", levelName.size, levelName.data);
+        return false;
+    }
+    if (header->baseHash != delta->header.baseHash || header->baseSize != delta->header.baseSize) {
+        LOG_INFO("Ignoring level delta log %.*s, it's for an older level file\n", levelName.size, levelName.data);
+        return true;
+    }
+
+    const uint32 recordSize = header->version == 1 ? sizeof(BlockUpdate) : LEVEL_DELTA_RECORD_SIZE;
+    const uint32 recordsSize = data.size - sizeof(LevelDeltaHeader);
+    const uint8* records = data.data + sizeof(LevelDeltaHeader);
+    delta->numRecords = recordsSize / recordSize;
+    for (uint32 i = 0; i < delta->numRecords; i++) {
+        const BlockUpdate record = header->version == 1 ? ((const BlockUpdate*)records)[i]
+            : ReadLevelDeltaRecord(records + i * recordSize);
+        if ((uint8)record.block.id >= (uint8)BlockId::COUNT) {
+            LOG_ERROR("Level delta log %.*s record %lu is invalid\n", levelName.size, levelName.data, i);
+            return false;
+        }
+        if (IsInBlockGrid(record.index)) {
+            const Vec2Int column = { record.index.x / CHUNK_SIZE, record.index.y / CHUNK_SIZE };
+            if (!IsColumnLoaded(*grid, column.x, column.y) && !ReadGridColumn(source, column, grid)) {
+                return false;
+            }
+            const uint32 columnInd = ColumnIndex(column.x, column.y);
+            grid->pinnedColumns[columnInd / 64] |= (uint64)1 << (columnInd % 64);
+        }
+        if (!SetBlock(record.index, record.block, grid)) {
+            LOG_ERROR("Failed to apply level delta log %.*s record %lu\n", levelName.size, levelName.data, i);
+            return false;
+        }
+    }
+
+    // A partial record from an interrupted save mustn't be appended after, and version 1 logs are only replayed
+    delta->appendable = recordsSize % recordSize == 0 && header->version == LEVEL_DELTA_VERSION;
+    return true;
+}
+
+// Loads a level file older than version 2 whole, and hashes it for its delta log
+internal bool LoadOldLevelFile(const_string levelName, BlockGrid* grid, LinearAllocator* allocator, uint32* hash,
+                               uint32* size)
+{
+    MappedFile mappedFile;
+    {
+        ALLOCATOR_SCOPE_RESET(*allocator);
+        const string path = GetLevelFilePath(levelName, allocator);
+        if (!MapFileReadOnly(path, allocator, &mappedFile)) {
+            return false;
+        }
+    }
+    defer(UnmapFile(&mappedFile));
+
+    const Array<uint8> data = mappedFile.data;
+    const LevelFileHeader* header = (const LevelFileHeader*)data.data;
+    if (data.size >= sizeof(LevelFileHeader) && header->magic == LEVEL_FILE_MAGIC) {
+        // Newer versions are opened with OpenLevelFile, so they've failed to parse
+        if (header->version != 1 || !LoadLevelV1(data, grid)) {
+            return false;
+        }
+    }
+    else if (!LoadLegacyLevel(data, grid)) {
+        return false;
+    }
+
+    *hash = HashLevelFile(data);
+    *size = data.size;
+    return true;
+}
+
+// Loads a level and its delta log, opening files of version 2 or later as the source. Close it even on failure.
+internal bool LoadLevelBlocks(const_string levelName, BlockGrid* grid, LinearAllocator* allocator,
+                              LevelSource* source, LevelDeltaState* delta)
+{
+    source->type = LevelSourceType::NONE;
+    if (levelName.size > MAX_LEVEL_NAME_LENGTH) {
+        LOG_ERROR("Level name %.*s is too long\n", levelName.size, levelName.data);
+        return false;
+    }
+
+    uint32 hash, size;
+    if (OpenLevelFile(levelName, allocator, &source->file)) {
+        source->type = LevelSourceType::FILE;
+        MemCopy(source->fileNameBuffer.data, levelName.data, levelName.size);
+        source->fileName = { .size = levelName.size, .data = source->fileNameBuffer.data };
+
+        // Every chunk column is read as it's streamed in
+        MemSet(grid->unloadedColumns.data, 0xff, sizeof(grid->unloadedColumns));
+        MemSet(grid->skyHeights.data, BLOCKS_SIZE.z, sizeof(grid->skyHeights));
+        hash = HashLevelFile(source->file.mappedFile.data);
+        size = source->file.mappedFile.data.size;
+    }
+    else if (!LoadOldLevelFile(levelName, grid, allocator, &hash, &size)) {
+        return false;
+    }
+
+    delta->header = {
+        .magic = LEVEL_DELTA_MAGIC,
+        .version = LEVEL_DELTA_VERSION,
+        .baseHash = hash,
+        .baseSize = size
+    };
+    return LoadLevelDelta(levelName, *source, grid, allocator, delta);
+}
+
+bool LoadLevel(const_string levelName, LevelData* levelData, LinearAllocator* allocator)
+{
+    CancelBlockStreaming(levelData);
+    LevelSource* source = &levelData->blockStreaming.source;
+    CloseLevelSource(source);
+    ResetGridRenderInfo(&levelData->gridRenderInfo);
+    levelData->flowField.valid = false;
+    ResetBlockJournal(&levelData->journal);
+    ClearBlockGrid(&levelData->grid);
+    LevelDeltaState delta;
+    if (!LoadLevelBlocks(levelName, &levelData->grid, allocator, source, &delta)
+        || !ComputeGridLight(&levelData->grid, allocator)) {
+        CloseLevelSource(source);
+        ClearBlockGrid(&levelData->grid);
+        return false;
+    }
+
+    SetJournalSavedLevel(levelName, delta, &levelData->journal);
+    return true;
+}
+
+// Whether a chunk's column is unloaded, so the chunk is in the level source instead of the grid
+internal bool IsSourceChunk(const StaticArray<uint64, BlockGrid::COLUMN_WORDS>& unloadedColumns, Vec3Int chunkIndex)
+{
+    const uint32 columnInd = ColumnIndex(chunkIndex.x, chunkIndex.y);
+    return ((unloadedColumns[columnInd / 64] >> (columnInd % 64)) & 1) != 0;
+}
+
+// Writes the chunks in chunkSlots (through snapshot if not null) and unloadedColumns' to the level's temporary file
+internal bool WriteLevelFile(const_string levelName, const StaticArray<uint16, BlockGrid::NUM_CHUNK_SLOTS>& chunkSlots,
+                             const StaticArray<uint64, BlockGrid::COLUMN_WORDS>& unloadedColumns,
+                             const LevelSource& source, const BlockGrid& grid, BlockGridSnapshot* snapshot,
+                             LinearAllocator* allocator, LevelDeltaState* delta)
+{
+    uint32 numChunks = 0;
+    for (uint32 i = 0; i < BlockGrid::NUM_CHUNK_SLOTS; i++) {
+        const Vec3Int chunkIndex = ChunkSlotToIndex(i);
+        if (IsSourceChunk(unloadedColumns, chunkIndex) ? HasSourceChunk(source, chunkIndex) : chunkSlots[i] != 0) {
+            numChunks++;
+        }
+    }
+
+    Array<LevelChunkEntry> directory = allocator->NewArray<LevelChunkEntry>(numChunks);
+    Array<uint8> page = allocator->NewArray<uint8>(LEVEL_FILE_PAGE_SIZE + 2); // room for the padding
+    BlockChunk* sourceChunk = allocator->New<BlockChunk>();
+    if ((numChunks > 0 && directory.data == nullptr) || page.data == nullptr || sourceChunk == nullptr) {
+        LOG_ERROR("Failed to allocate level file directory for %lu chunks\n", numChunks);
+        return false;
+    }
+
+    LevelFileHeader header = {
+        .magic = LEVEL_FILE_MAGIC,
+        .version = LEVEL_FILE_VERSION,
+        .blocksSize = BLOCKS_SIZE,
+        .numChunks = numChunks
+    };
+    const Array<uint8> headerData = { .size = sizeof(LevelFileHeader), .data = (uint8*)&header };
+    const string path = GetLevelTempPath(levelName, allocator);
+    if (!WriteFile(path, headerData, false)) {
+        return false;
+    }
+    uint32 hash = HashLevelFile(headerData);
+    uint32 offset = sizeof(LevelFileHeader);
+
+    // Slot order, which is what FindLevelChunk expects. Chunks never straddle pages.
+    page.size = 0;
+    uint32 entryInd = 0;
+    for (uint32 i = 0; i < BlockGrid::NUM_CHUNK_SLOTS; i++) {
+        const Vec3Int chunkIndex = ChunkSlotToIndex(i);
+        const bool inSource = IsSourceChunk(unloadedColumns, chunkIndex);
+        const uint16 slot = chunkSlots[i];
+        if (inSource ? !HasSourceChunk(source, chunkIndex) : slot == 0) continue;
+
+        if (page.size + BLOCKS_PER_CHUNK > LEVEL_FILE_PAGE_SIZE) {
+            if (!WriteFile(path, page, true)) {
+                return false;
+            }
+            hash = HashLevelFile(page, hash);
+            page.size = 0;
+        }
+
+        const Block* blocks;
+        if (inSource) {
+            if (!ReadSourceChunk(source, chunkIndex, sourceChunk)) {
+                LOG_ERROR("Failed to read chunk %d, %d, %d\n", chunkIndex.x, chunkIndex.y, chunkIndex.z);
+                return false;
+            }
+            blocks = sourceChunk->blocks.data;
+        }
+        else {
+            blocks = snapshot == nullptr ? GetGridChunk(grid, slot - 1)->blocks.data
+                                         : AcquireSnapshotChunk(snapshot, grid, slot - 1);
+        }
+        LevelChunkEntry* entry = &directory[entryInd++];
+        entry->chunkIndex = chunkIndex;
+        entry->offset = offset;
+
+        uint8* dst = page.data + page.size;
+        const uint32 rleSize = EncodeChunkRle(blocks, dst, BLOCKS_PER_CHUNK);
+        if (rleSize != 0) {
+            entry->encoding = LevelChunkEncoding::RLE;
+            entry->size = rleSize;
+        }
+        else {
+            entry->encoding = LevelChunkEncoding::RAW;
+            entry->size = BLOCKS_PER_CHUNK;
+            MemCopy(dst, blocks, BLOCKS_PER_CHUNK);
+        }
+        page.size += entry->size;
+        offset += entry->size;
+
+        if (snapshot != nullptr && !inSource) {
+            ReleaseSnapshotChunk(snapshot, slot - 1);
+        }
+    }
+
+    // Chunk sizes are even, so this pads by 0 or 2 bytes
+    while (offset % 4 != 0) {
+        page.data[page.size++] = 0;
+        offset++;
+    }
+    const Array<uint8> directoryData = {
+        .size = numChunks * (uint32)sizeof(LevelChunkEntry),
+        .data = (uint8*)directory.data
+    };
+    if (!WriteFile(path, page, true) || (numChunks > 0 && !WriteFile(path, directoryData, true))) {
+        return false;
+    }
+    hash = HashLevelFile(directoryData, HashLevelFile(page, hash));
+
+    delta->header = {
+        .magic = LEVEL_DELTA_MAGIC,
+        .version = LEVEL_DELTA_VERSION,
+        .baseHash = hash,
+        .baseSize = offset + directoryData.size
+    };
+    return true;
+}
+
+// Moves the file written by WriteLevelFile into place and starts its delta log, reopening a source mapping it
+internal bool ReplaceLevelFile(const_string levelName, LevelData* levelData, LinearAllocator* allocator,
+                               LevelDeltaState* delta)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+    LevelSource* source = &levelData->blockStreaming.source;
+    const bool replacesSource = source->type == LevelSourceType::FILE && StringEquals(source->fileName, levelName);
+    if (replacesSource) {
+        CancelBlockStreaming(levelData);
+        CloseLevelFile(&source->file);
+    }
+
+    const char* tempPath = ToCString(GetLevelTempPath(levelName, allocator), allocator);
+    const char* path = ToCString(GetLevelFilePath(levelName, allocator), allocator);
+    const bool moved = MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING) != 0;
+    if (!moved) {
+        LOG_ERROR("Failed to replace level file %.*s\n", levelName.size, levelName.data);
+    }
+    if (replacesSource && !OpenLevelFile(levelName, allocator, &source->file)) {
+        LOG_ERROR("Failed to reopen level file %.*s, its unloaded chunk columns are lost\n",
+                  levelName.size, levelName.data);
+        source->type = LevelSourceType::NONE;
+        return false;
+    }
+    if (!moved) {
+        return false;
+    }
+
+    delta->numRecords = 0;
+    const Array<uint8> deltaData = { .size = sizeof(LevelDeltaHeader), .data = (uint8*)&delta->header };
+    delta->appendable = WriteFile(GetLevelDeltaPath(levelName, allocator), deltaData, false);
+    return delta->appendable;
+}
+
+bool SaveLevel(const_string levelName, LevelData* levelData, LinearAllocator* allocator)
+{
+    BlockJournal* journal = &levelData->journal;
+    LevelDeltaState delta;
+    const BlockGrid& grid = levelData->grid;
+    if (!WriteLevelFile(levelName, grid.chunkSlots, grid.unloadedColumns, levelData->blockStreaming.source, grid,
+                        nullptr, allocator, &delta)
+        || !ReplaceLevelFile(levelName, levelData, allocator, &delta)) {
+        journal->savedDelta.appendable = false;
+        return false;
+    }
+
+    journal->numUnsaved = 0;
+    journal->unsavedComplete = true;
+    SetJournalSavedLevel(levelName, delta, journal);
+    return true;
+}
+
+// Whether appending the unsaved blocks to the level's delta log brings it up to date
+internal bool CanAppendLevelDelta(const BlockJournal& journal, const_string levelName)
+{
+    return journal.savedDelta.appendable && journal.unsavedComplete && StringEquals(journal.savedLevelName, levelName)
+        && journal.savedDelta.numRecords + journal.numUnsaved <= LEVEL_DELTA_MAX_RECORDS;
+}
+
+internal bool AppendLevelDelta(const_string levelName, BlockJournal* journal, LinearAllocator* allocator)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+    const string path = GetLevelDeltaPath(levelName, allocator);
+    LevelDeltaState* delta = &journal->savedDelta;
+    if (delta->numRecords == 0) {
+        // Replaces a missing or stale log
+        const Array<uint8> headerData = { .size = sizeof(LevelDeltaHeader), .data = (uint8*)&delta->header };
+        if (!WriteFile(path, headerData, false)) {
+            return false;
+        }
+    }
+
+    if (journal->numUnsaved > 0) {
+        const Array<uint8> records = allocator->NewArray<uint8>(journal->numUnsaved * LEVEL_DELTA_RECORD_SIZE);
+        if (records.data == nullptr) {
+            LOG_ERROR("Failed to allocate %lu level delta records\n", journal->numUnsaved);
+            return false;
+        }
+        for (uint32 i = 0; i < journal->numUnsaved; i++) {
+            WriteLevelDeltaRecord(journal->unsaved[i], records.data + i * LEVEL_DELTA_RECORD_SIZE);
+        }
+        if (!WriteFile(path, records, true)) {
+            return false;
+        }
+    }
+
+    delta->numRecords += journal->numUnsaved;
+    journal->numUnsaved = 0;
+    return true;
+}
+
+Array<string> GetSavedLevels(LinearAllocator* allocator)
+{
+    const Array<string> levelFiles = ListDir(ToString("data/levels"), allocator);
+    if (levelFiles.data == nullptr) {
+        return { .size = 0, .data = nullptr };
+    }
+
+    DynamicArray<string, LinearAllocator> validLevelFiles(allocator);
+    for (uint32 i = 0; i < levelFiles.size; i++) {
+        const uint32 find = SubstringSearch(levelFiles[i], ToString(".blockgrid"));
+        if (find != levelFiles[i].size) {
+            validLevelFiles.Append(levelFiles[i].SliceTo(find));
+        }
+    }
+
+    return validLevelFiles.ToArray();
+}
+
+internal Vec3 GetBlockColor(BlockId id)
+{
+    switch (id) {
+        case BlockId::SIDEWALK: {
+            return Vec3::one * 0.7f;
+        } break;
+        case BlockId::STREET: {
+            return Vec3::one * 0.5f;
+        } break;
+        case BlockId::BUILDING: {
+            return Vec3::one * 0.8f;
+        } break;
+        case BlockId::LAMP: {
+            return Vec3 { 1.0f, 0.9f, 0.6f };
+        } break;
+        default: {
+            return Vec3::zero;
+        } break;
+    }
+}
+
+const float32 AO_BRIGHTNESS[BLOCK_AO_NONE + 1] = { 0.5f, 0.65f, 0.8f, 1.0f };
+
+// Of the brighter of sky and block light, 0.8 per level below MAX_LIGHT, over a little ambient light
+internal float32 GetLightBrightness(uint8 light)
+{
+    const uint32 level = MaxUInt32(GetLightLevel(light, LIGHT_SKY_SHIFT), GetLightLevel(light, 0));
+    return 0.1f + 0.9f * powf(0.8f, (float32)(MAX_LIGHT - level));
+}
+
+const StaticArray<uint32, CHUNK_SIZE * CHUNK_SIZE> OCCUPANCY_EMPTY = {};
+
+// Occupancy rows of the chunk next to chunkIndex, solid outside the grid and empty in unallocated chunks
+internal const uint32* GetNeighborOccupancy(const BlockGrid& grid, Vec3Int chunkIndex, Vec3Int offset,
+                                            const uint32* solid)
+{
+    const Vec3Int neighborIndex = chunkIndex + offset;
+    if (neighborIndex.x < 0 || neighborIndex.x >= CHUNKS_SIZE.x || neighborIndex.y < 0
+        || neighborIndex.y >= CHUNKS_SIZE.y || neighborIndex.z < 0 || neighborIndex.z >= CHUNKS_SIZE.z) {
+        return solid;
+    }
+
+    const uint16 slot = grid.chunkSlots[ChunkSlotIndex(neighborIndex)];
+    if (slot == 0) {
+        return OCCUPANCY_EMPTY.data;
+    }
+    return GetGridChunk(grid, slot - 1)->occupancy.data;
+}
+
+// Per BlockFace, rows of visible faces in the same layout as BlockChunk::occupancy
+internal void GetVisibleFaces(const BlockGrid& grid, const BlockChunk& chunk,
+                              StaticArray<StaticArray<uint32, CHUNK_SIZE * CHUNK_SIZE>,
+                                          (uint32)BlockFace::COUNT>* visible)
+{
+    StaticArray<uint32, CHUNK_SIZE * CHUNK_SIZE> solid;
+    MemSet(solid.data, 0xff, sizeof(solid));
+
+    const uint32* occ = chunk.occupancy.data;
+    const uint32* occPosZ = GetNeighborOccupancy(grid, chunk.chunkIndex, Vec3Int {  0,  0,  1 }, solid.data);
+    const uint32* occNegZ = GetNeighborOccupancy(grid, chunk.chunkIndex, Vec3Int {  0,  0, -1 }, solid.data);
+    const uint32* occPosY = GetNeighborOccupancy(grid, chunk.chunkIndex, Vec3Int {  0,  1,  0 }, solid.data);
+    const uint32* occNegY = GetNeighborOccupancy(grid, chunk.chunkIndex, Vec3Int {  0, -1,  0 }, solid.data);
+    const uint32* occPosX = GetNeighborOccupancy(grid, chunk.chunkIndex, Vec3Int {  1,  0,  0 }, solid.data);
+    const uint32* occNegX = GetNeighborOccupancy(grid, chunk.chunkIndex, Vec3Int { -1,  0,  0 }, solid.data);
+
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        for (int y = 0; y < CHUNK_SIZE; y++) {
+            const uint32 r = ChunkRowIndex(y, z);
+            const uint32 row = occ[r];
+
+            const uint32 above = z < CHUNK_SIZE - 1 ? occ[r + CHUNK_SIZE] : occPosZ[ChunkRowIndex(y, 0)];
+            const uint32 below = z > 0 ? occ[r - CHUNK_SIZE] : occNegZ[ChunkRowIndex(y, CHUNK_SIZE - 1)];
+            const uint32 left = y < CHUNK_SIZE - 1 ? occ[r + 1] : occPosY[ChunkRowIndex(0, z)];
+            const uint32 right = y > 0 ? occ[r - 1] : occNegY[ChunkRowIndex(CHUNK_SIZE - 1, z)];
+            const uint32 front = (row >> 1) | (occPosX[r] << (CHUNK_SIZE - 1));
+            const uint32 back = (row << 1) | (occNegX[r] >> (CHUNK_SIZE - 1));
+
+            (*visible)[(uint32)BlockFace::TOP][r] = row & ~above;
+            (*visible)[(uint32)BlockFace::BOTTOM][r] = row & ~below;
+            (*visible)[(uint32)BlockFace::LEFT][r] = row & ~left;
+            (*visible)[(uint32)BlockFace::RIGHT][r] = row & ~right;
+            (*visible)[(uint32)BlockFace::FRONT][r] = row & ~front;
+            (*visible)[(uint32)BlockFace::BACK][r] = row & ~back;
+        }
+    }
+}
+
+internal void FreeChunkQuads(uint32 chunkSlot, GridRenderInfo* renderInfo)
+{
+    uint16 page = renderInfo->chunkPages[chunkSlot];
+    while (page != 0) {
+        const uint16 next = renderInfo->pages[page - 1].next;
+        renderInfo->numQuads -= renderInfo->pages[page - 1].quads.size;
+        renderInfo->freePages.Append((uint16)(page - 1));
+        page = next;
+    }
+    renderInfo->chunkPages[chunkSlot] = 0;
+}
+
+// Appends a page to the end of a chunk's page list, lastPage is null if the list is empty
+internal BlockQuadPage* AppendQuadPage(uint32 chunkSlot, BlockQuadPage* lastPage, GridRenderInfo* renderInfo)
+{
+    uint16 pageInd;
+    if (renderInfo->freePages.size > 0) {
+        pageInd = renderInfo->freePages[renderInfo->freePages.size - 1];
+        renderInfo->freePages.RemoveLast();
+    }
+    else if (renderInfo->numPagesUsed < GridRenderInfo::MAX_PAGES) {
+        pageInd = (uint16)renderInfo->numPagesUsed++;
+    }
+    else {
+        return nullptr;
+    }
+
+    BlockQuadPage* page = &renderInfo->pages[pageInd];
+    page->next = 0;
+    page->quads.Clear();
+    if (lastPage == nullptr) {
+        renderInfo->chunkPages[chunkSlot] = pageInd + 1;
+    }
+    else {
+        lastPage->next = pageInd + 1;
+    }
+    return page;
+}
+
+// Position in a chunk of (u, v) on slice n along a face's normal
+internal Vec3Int FaceSliceToLocal(const BlockFaceAxes& axes, int n, int u, int v)
+{
+    return Vec3Int {
+        axes.normal.x * axes.normal.x * n + axes.u.x * u + axes.v.x * v,
+        axes.normal.y * axes.normal.y * n + axes.u.y * u + axes.v.y * v,
+        axes.normal.z * axes.normal.z * n + axes.u.z * u + axes.v.z * v
+    };
+}
+
+// Coordinate of p along a unit axis
+internal int AxisComponent(Vec3Int axis, Vec3Int p)
+{
+    return axis.x * p.x + axis.y * p.y + axis.z * p.z;
+}
+
+internal Vec3 BlockAxisToVec3(Vec3Int v)
+{
+    return Vec3 { (float32)v.x, (float32)v.y, (float32)v.z };
+}
+
+internal bool IsInChunk(Vec3Int localIndex)
+{
+    return localIndex.x >= 0 && localIndex.x < CHUNK_SIZE && localIndex.y >= 0 && localIndex.y < CHUNK_SIZE
+        && localIndex.z >= 0 && localIndex.z < CHUNK_SIZE;
+}
+
+// For a position relative to the chunk's origin, which can be outside it
+internal bool IsChunkBlockSolid(const BlockGrid& grid, const BlockChunk& chunk, Vec3Int localIndex)
+{
+    if (IsInChunk(localIndex)) {
+        return (chunk.occupancy[ChunkRowIndex(localIndex.y, localIndex.z)] >> localIndex.x) & 1;
+    }
+    return GetBlock(grid, ChunkOrigin(chunk.chunkIndex) + localIndex).id != BlockId::NONE;
+}
+
+// Classic voxel AO, packed as in BlockQuad::ao
+internal uint8 GetFaceAo(const BlockGrid& grid, const BlockChunk& chunk, const BlockFaceAxes& axes, Vec3Int frontIndex)
+{
+    uint8 ao = 0;
+    for (int cornerV = 0; cornerV < 2; cornerV++) {
+        for (int cornerU = 0; cornerU < 2; cornerU++) {
+            const int su = cornerU * 2 - 1;
+            const int sv = cornerV * 2 - 1;
+            const Vec3Int du = { axes.u.x * su, axes.u.y * su, axes.u.z * su };
+            const Vec3Int dv = { axes.v.x * sv, axes.v.y * sv, axes.v.z * sv };
+            const int side1 = IsChunkBlockSolid(grid, chunk, frontIndex + du) ? 1 : 0;
+            const int side2 = IsChunkBlockSolid(grid, chunk, frontIndex + dv) ? 1 : 0;
+            const int corner = IsChunkBlockSolid(grid, chunk, frontIndex + du + dv) ? 1 : 0;
+            const int level = side1 + side2 == 2 ? 0 : BLOCK_AO_NONE - side1 - side2 - corner;
+            ao |= (uint8)(level << ((cornerU + 2 * cornerV) * 2));
+        }
+    }
+    return ao;
+}
+
+// Greedy meshing of the visible faces of each slice, merging faces that look the same. quads has MAX_CHUNK_QUADS room.
+internal void MeshChunkQuads(const BlockGrid& blockGrid, const BlockChunk& chunk, Array<BlockQuad>* quads)
+{
+    quads->size = 0;
+
+    StaticArray<StaticArray<uint32, CHUNK_SIZE * CHUNK_SIZE>, (uint32)BlockFace::COUNT> visible;
+    GetVisibleFaces(blockGrid, chunk, &visible);
+
+    // Per slice along the normal, CHUNK_SIZE^2 keys indexed by v, u, cleared again by merging
+    StaticArray<uint32, BLOCKS_PER_CHUNK> masks;
+    MemSet(masks.data, 0, sizeof(masks));
+    for (uint32 f = 0; f < (uint32)BlockFace::COUNT; f++) {
+        const BlockFaceAxes& axes = BLOCK_FACE_AXES[f];
+        const Vec3Int normalAxis = {
+            axes.normal.x * axes.normal.x, axes.normal.y * axes.normal.y, axes.normal.z * axes.normal.z
+        };
+
+        // Scatter visible faces into their slices' masks, only touching set bits
+        uint32 nonEmptySlices = 0;
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            for (int y = 0; y < CHUNK_SIZE; y++) {
+                uint32 bits = visible[f][ChunkRowIndex(y, z)];
+                while (bits != 0) {
+                    const int x = (int)_tzcnt_u32(bits);
+                    bits &= bits - 1;
+
+                    const Vec3Int localIndex = { x, y, z };
+                    const int n = AxisComponent(normalAxis, localIndex);
+                    const int u = AxisComponent(axes.u, localIndex);
+                    const int v = AxisComponent(axes.v, localIndex);
+                    const Vec3Int frontIndex = localIndex + axes.normal;
+                    const uint8 light = IsInChunk(frontIndex)
+                        ? chunk.light[ChunkBlockIndex(frontIndex)]
+                        : GetBlockLight(blockGrid, ChunkOrigin(chunk.chunkIndex) + frontIndex);
+                    const uint8 ao = GetFaceAo(blockGrid, chunk, axes, frontIndex);
+                    const BlockId id = chunk.blocks[ChunkBlockIndex(localIndex)].id;
+                    masks[(n * CHUNK_SIZE + v) * CHUNK_SIZE + u] = (uint32)ao << 16 | (uint32)light << 8 | (uint8)id;
+                    nonEmptySlices |= 1u << n;
+                }
+            }
+        }
+
+        while (nonEmptySlices != 0) {
+            const int n = (int)_tzcnt_u32(nonEmptySlices);
+            nonEmptySlices &= nonEmptySlices - 1;
+            uint32* mask = &masks[n * CHUNK_SIZE * CHUNK_SIZE];
+
+            for (int v = 0; v < CHUNK_SIZE; v++) {
+                for (int u = 0; u < CHUNK_SIZE; ) {
+                    const uint32 key = mask[v * CHUNK_SIZE + u];
+                    if (key == 0) {
+                        u++;
+                        continue;
+                    }
+
+                    int width = 1;
+                    while (u + width < CHUNK_SIZE && mask[v * CHUNK_SIZE + u + width] == key) {
+                        width++;
+                    }
+
+                    int height = 1;
+                    while (v + height < CHUNK_SIZE) {
+                        const uint32* row = &mask[(v + height) * CHUNK_SIZE + u];
+                        bool rowMatches = true;
+                        for (int i = 0; i < width; i++) {
+                            if (row[i] != key) {
+                                rowMatches = false;
+                                break;
+                            }
+                        }
+                        if (!rowMatches) break;
+                        height++;
+                    }
+
+                    for (int j = 0; j < height; j++) {
+                        MemSet(&mask[(v + j) * CHUNK_SIZE + u], 0, width * sizeof(uint32));
+                    }
+
+                    const Vec3Int minIndex = FaceSliceToLocal(axes, n, u, v);
+                    BlockQuad* quad = quads->Append();
+                    quad->x = (uint8)minIndex.x;
+                    quad->y = (uint8)minIndex.y;
+                    quad->z = (uint8)minIndex.z;
+                    quad->face = (uint8)f;
+                    quad->width = (uint8)width;
+                    quad->height = (uint8)height;
+                    quad->id = (BlockId)(key & 0xff);
+                    quad->light = (uint8)(key >> 8);
+                    quad->ao = (uint8)(key >> 16);
+                    quad->unused = 0;
+
+                    u += width;
+                }
+            }
+        }
+    }
+}
+
+// Replaces a chunk's quads in the page pool
+internal void StoreChunkQuads(uint32 chunkSlot, Array<BlockQuad> quads, GridRenderInfo* renderInfo)
+{
+    FreeChunkQuads(chunkSlot, renderInfo);
+    renderInfo->uploadChunks[chunkSlot / 64] |= (uint64)1 << (chunkSlot % 64);
+
+    BlockQuadPage* page = nullptr;
+    uint32 stored = 0;
+    while (stored < quads.size) {
+        page = AppendQuadPage(chunkSlot, page, renderInfo);
+        if (page == nullptr) {
+            LOG_ERROR("Out of block quad pages, chunk %lu will be partially drawn\n", chunkSlot);
+            return;
+        }
+
+        const uint32 n = MinUInt32(quads.size - stored, BlockQuadPage::MAX_QUADS);
+        MemCopy(page->quads.data, quads.data + stored, n * sizeof(BlockQuad));
+        page->quads.size = n;
+        stored += n;
+        renderInfo->numQuads += n;
+    }
+}
+
+internal bool IsChunkBitSet(const StaticArray<uint64, GridRenderInfo::DIRTY_WORDS>& bits, uint32 chunkSlot)
+{
+    return (bits[chunkSlot / 64] & ((uint64)1 << (chunkSlot % 64))) != 0;
+}
+
+internal bool RunChunkMeshJob(GridRenderInfo* renderInfo)
+{
+    uint32 claimed;
+    do {
+        claimed = renderInfo->meshJobsClaimed;
+        if (claimed >= renderInfo->numMeshJobs) {
+            return false;
+        }
+    } while (InterlockedCompareExchange((volatile LONG*)&renderInfo->meshJobsClaimed, (LONG)(claimed + 1),
+                                        (LONG)claimed) != (LONG)claimed);
+
+    ChunkMeshJob* job = &renderInfo->meshJobs[claimed];
+    Array<BlockQuad> quads = { .size = 0, .data = renderInfo->meshQuads.data + claimed * MAX_CHUNK_QUADS };
+    const uint16 slot = job->grid->chunkSlots[job->chunkSlot];
+    if (slot != 0) {
+        MeshChunkQuads(*job->grid, *GetGridChunk(*job->grid, slot - 1), &quads);
+    }
+    job->numQuads = quads.size;
+    InterlockedIncrement((volatile LONG*)&renderInfo->meshJobsDone);
+    return true;
+}
+
+internal void ThreadChunkMesh(AppWorkQueue* queue, void* data)
+{
+    UNREFERENCED_PARAMETER(queue);
+
+    RunChunkMeshJob((GridRenderInfo*)data);
+}
+
+// Meshes up to STREAMING_CHUNKS_PER_FRAME chunks on queue, or on this thread, for FinishChunkMeshJobs to store
+internal void StartChunkMeshJobs(const BlockGrid& blockGrid, Array<uint32> chunkSlots, AppWorkQueue* queue,
+                                 GridRenderInfo* renderInfo)
+{
+    DEBUG_ASSERT(renderInfo->numMeshJobs == 0 && chunkSlots.size <= STREAMING_CHUNKS_PER_FRAME);
+    for (uint32 i = 0; i < chunkSlots.size; i++) {
+        renderInfo->meshJobs[i] = { .grid = &blockGrid, .chunkSlot = chunkSlots[i], .numQuads = 0 };
+    }
+    renderInfo->meshJobsClaimed = 0;
+    renderInfo->meshJobsDone = 0;
+    InterlockedExchange((volatile LONG*)&renderInfo->numMeshJobs, (LONG)chunkSlots.size);
+
+    for (uint32 i = 0; i < chunkSlots.size; i++) {
+        if (queue == nullptr || !TryAddWork(queue, ThreadChunkMesh, renderInfo)) {
+            RunChunkMeshJob(renderInfo);
+        }
+    }
+}
+
+// Unclaimed jobs are meshed on this thread, and quads are copied into the page pool here since it isn't thread-safe
+void FinishChunkMeshJobs(GridRenderInfo* renderInfo)
+{
+    const uint32 numJobs = renderInfo->numMeshJobs;
+    if (numJobs == 0) {
+        return;
+    }
+
+    while (RunChunkMeshJob(renderInfo)) {}
+    while (renderInfo->meshJobsDone != numJobs) {
+        _mm_pause();
+    }
+
+    for (uint32 i = 0; i < numJobs; i++) {
+        const ChunkMeshJob& job = renderInfo->meshJobs[i];
+        if (!IsChunkBitSet(renderInfo->residentChunks, job.chunkSlot)) continue;
+
+        BlockQuad* quads = renderInfo->meshQuads.data + i * MAX_CHUNK_QUADS;
+        StoreChunkQuads(job.chunkSlot, { .size = job.numQuads, .data = quads }, renderInfo);
+    }
+    InterlockedExchange((volatile LONG*)&renderInfo->numMeshJobs, 0);
+}
+
+// Meshes chunks a batch of jobs at a time, and waits for them
+internal void RebuildChunks(const BlockGrid& blockGrid, Array<uint32> chunkSlots, AppWorkQueue* queue,
+                            GridRenderInfo* renderInfo)
+{
+    FinishChunkMeshJobs(renderInfo);
+    for (uint32 start = 0; start < chunkSlots.size; start += STREAMING_CHUNKS_PER_FRAME) {
+        const uint32 n = MinUInt32(chunkSlots.size - start, STREAMING_CHUNKS_PER_FRAME);
+        StartChunkMeshJobs(blockGrid, { .size = n, .data = chunkSlots.data + start }, queue, renderInfo);
+        FinishChunkMeshJobs(renderInfo);
+    }
+}
+
+const int STREAMING_NO_LIMIT = INT32_MAX;
+
+void ResetGridRenderInfo(GridRenderInfo* renderInfo)
+{
+    FinishChunkMeshJobs(renderInfo);
+    MemSet(renderInfo->chunkPages.data, 0, sizeof(renderInfo->chunkPages));
+    MemSet(renderInfo->residentChunks.data, 0, sizeof(renderInfo->residentChunks));
+    MemSet(renderInfo->dirtyChunks.data, 0, sizeof(renderInfo->dirtyChunks));
+    MemSet(renderInfo->uploadChunks.data, 0xff, sizeof(renderInfo->uploadChunks));
+    renderInfo->numQuads = 0;
+    renderInfo->streamingLimit = STREAMING_NO_LIMIT;
+    renderInfo->numPagesUsed = 0;
+    renderInfo->freePages.Clear();
+}
+
+internal void EvictChunk(uint32 chunkSlot, GridRenderInfo* renderInfo)
+{
+    FreeChunkQuads(chunkSlot, renderInfo);
+    renderInfo->residentChunks[chunkSlot / 64] &= ~((uint64)1 << (chunkSlot % 64));
+    renderInfo->uploadChunks[chunkSlot / 64] |= (uint64)1 << (chunkSlot % 64);
+}
+
+// Horizontally, within a square of chunks centered on the camera's
+internal bool IsChunkInRadius(Vec3Int chunkIndex, Vec3Int cameraChunk, int radius)
+{
+    const int dx = chunkIndex.x - cameraChunk.x;
+    const int dy = chunkIndex.y - cameraChunk.y;
+    return -radius <= dx && dx <= radius && -radius <= dy && dy <= radius;
+}
+
+// Squared horizontal distance in chunks
+internal int ChunkDistanceSquared(Vec3Int chunkIndex, Vec3Int cameraChunk)
+{
+    const int dx = chunkIndex.x - cameraChunk.x;
+    const int dy = chunkIndex.y - cameraChunk.y;
+    return dx * dx + dy * dy;
+}
+
+// Whether a chunk column and the 8 around it are loaded, so its chunks can be meshed
+internal bool IsColumnAreaLoaded(const BlockGrid& grid, int chunkX, int chunkY)
+{
+    for (int y = chunkY - 1; y <= chunkY + 1; y++) {
+        for (int x = chunkX - 1; x <= chunkX + 1; x++) {
+            if (!IsColumnLoaded(grid, x, y)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Whether any chunk in a chunk column or the 8 around it is resident, so it's meshed from the column's blocks
+internal bool IsColumnAreaResident(const GridRenderInfo& renderInfo, int chunkX, int chunkY)
+{
+    for (int y = MaxInt(chunkY - 1, 0); y <= MinInt(chunkY + 1, CHUNKS_SIZE.y - 1); y++) {
+        for (int x = MaxInt(chunkX - 1, 0); x <= MinInt(chunkX + 1, CHUNKS_SIZE.x - 1); x++) {
+            for (int z = 0; z < CHUNKS_SIZE.z; z++) {
+                if (IsChunkBitSet(renderInfo.residentChunks, ChunkSlotIndex(Vec3Int { x, y, z }))) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+struct StreamingCandidate
+{
+    uint32 chunkSlot;
+    int distanceSquared;
+};
+
+bool UpdateGridStreaming(const BlockGrid& blockGrid, Vec3Int cameraBlockIndex, AppWorkQueue* queue,
+                         LinearAllocator* allocator, GridRenderInfo* renderInfo)
+{
+    Vec3Int cameraChunk;
+    for (int e = 0; e < 3; e++) {
+        cameraChunk.e[e] = MinInt(MaxInt(cameraBlockIndex.e[e], 0), BLOCKS_SIZE.e[e] - 1) / CHUNK_SIZE;
+    }
+    if (cameraChunk.x != renderInfo->streamingCenter.x || cameraChunk.y != renderInfo->streamingCenter.y) {
+        renderInfo->streamingCenter = cameraChunk;
+        renderInfo->streamingLimit = STREAMING_NO_LIMIT;
+    }
+
+    // The last update's jobs are only picked up once they're all done, the frame never waits on them
+    if (renderInfo->numMeshJobs > 0 && renderInfo->meshJobsDone == renderInfo->numMeshJobs) {
+        FinishChunkMeshJobs(renderInfo);
+    }
+
+    for (uint32 i = 0; i < GridRenderInfo::DIRTY_WORDS; i++) {
+        uint64 resident = renderInfo->residentChunks[i];
+        while (resident != 0) {
+            const uint32 chunkSlot = i * 64 + (uint32)_tzcnt_u64(resident);
+            resident &= resident - 1;
+
+            if (!IsChunkInRadius(ChunkSlotToIndex(chunkSlot), cameraChunk, STREAMING_EVICT_RADIUS)) {
+                EvictChunk(chunkSlot, renderInfo);
+            }
+        }
+    }
+
+    // A batch can overshoot the budget, since a chunk's quads aren't known until it's meshed
+    while (renderInfo->numQuads > STREAMING_MAX_QUADS) {
+        uint32 furthestSlot = 0;
+        int furthestDistance = -1;
+        for (uint32 i = 0; i < GridRenderInfo::DIRTY_WORDS; i++) {
+            uint64 resident = renderInfo->residentChunks[i];
+            while (resident != 0) {
+                const uint32 chunkSlot = i * 64 + (uint32)_tzcnt_u64(resident);
+                resident &= resident - 1;
+
+                const int distance = ChunkDistanceSquared(ChunkSlotToIndex(chunkSlot), cameraChunk);
+                if (renderInfo->chunkPages[chunkSlot] != 0 && distance > furthestDistance) {
+                    furthestSlot = chunkSlot;
+                    furthestDistance = distance;
+                }
+            }
+        }
+
+        DEBUG_ASSERT(furthestDistance >= 0);
+        EvictChunk(furthestSlot, renderInfo);
+        renderInfo->streamingLimit = MinInt(renderInfo->streamingLimit, furthestDistance);
+    }
+
+    // One batch is meshed at a time
+    if (renderInfo->numMeshJobs > 0) {
+        return true;
+    }
+
+    ALLOCATOR_SCOPE_RESET(*allocator);
+    const uint32 maxCandidates = (2 * STREAMING_RADIUS + 1) * (2 * STREAMING_RADIUS + 1) * CHUNKS_SIZE.z;
+    Array<StreamingCandidate> candidates = allocator->NewArray<StreamingCandidate>(maxCandidates);
+    if (candidates.data == nullptr) {
+        return false;
+    }
+    candidates.size = 0;
+
+    const int minX = MaxInt(cameraChunk.x - STREAMING_RADIUS, 0);
+    const int maxX = MinInt(cameraChunk.x + STREAMING_RADIUS, CHUNKS_SIZE.x - 1);
+    const int minY = MaxInt(cameraChunk.y - STREAMING_RADIUS, 0);
+    const int maxY = MinInt(cameraChunk.y + STREAMING_RADIUS, CHUNKS_SIZE.y - 1);
+    for (int z = 0; z < CHUNKS_SIZE.z; z++) {
+        for (int y = minY; y <= maxY; y++) {
+            for (int x = minX; x <= maxX; x++) {
+                const Vec3Int chunkIndex = { x, y, z };
+                const uint32 chunkSlot = ChunkSlotIndex(chunkIndex);
+                if (IsChunkBitSet(renderInfo->residentChunks, chunkSlot) || !IsColumnAreaLoaded(blockGrid, x, y)) {
+                    continue;
+                }
+
+                // Empty chunks have no quads to build, they're only tracked so edits to them get meshed
+                if (blockGrid.chunkSlots[chunkSlot] == 0) {
+                    renderInfo->residentChunks[chunkSlot / 64] |= (uint64)1 << (chunkSlot % 64);
+                    continue;
+                }
+
+                const int distanceSquared = ChunkDistanceSquared(chunkIndex, cameraChunk);
+                if (distanceSquared < renderInfo->streamingLimit) {
+                    candidates.Append({ .chunkSlot = chunkSlot, .distanceSquared = distanceSquared });
+                }
+            }
+        }
+    }
+
+    // Partial selection sort, only the nearest few are needed
+    Array<uint32> chunkSlots = allocator->NewArray<uint32>(STREAMING_CHUNKS_PER_FRAME);
+    if (chunkSlots.data == nullptr) {
+        return false;
+    }
+    chunkSlots.size = 0;
+    if (renderInfo->numQuads < STREAMING_MAX_QUADS) {
+        const uint32 n = MinUInt32(candidates.size, STREAMING_CHUNKS_PER_FRAME);
+        for (uint32 i = 0; i < n; i++) {
+            uint32 nearest = i;
+            for (uint32 j = i + 1; j < candidates.size; j++) {
+                if (candidates[j].distanceSquared < candidates[nearest].distanceSquared) {
+                    nearest = j;
+                }
+            }
+
+            const StreamingCandidate candidate = candidates[nearest];
+            candidates[nearest] = candidates[i];
+            candidates[i] = candidate;
+            chunkSlots.Append(candidate.chunkSlot);
+            renderInfo->residentChunks[candidate.chunkSlot / 64] |= (uint64)1 << (candidate.chunkSlot % 64);
+        }
+    }
+
+    if (chunkSlots.size > 0) {
+        StartChunkMeshJobs(blockGrid, chunkSlots, queue, renderInfo);
+    }
+    return true;
+}
+
+bool UpdateDirtyGridRenderInfo(const BlockGrid& blockGrid, AppWorkQueue* queue, LinearAllocator* allocator,
+                               GridRenderInfo* renderInfo)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+    Array<uint32> chunkSlots = allocator->NewArray<uint32>(BlockGrid::NUM_CHUNK_SLOTS);
+    if (chunkSlots.data == nullptr) {
+        return false;
+    }
+    chunkSlots.size = 0;
+    for (uint32 i = 0; i < GridRenderInfo::DIRTY_WORDS; i++) {
+        // Chunks that aren't resident are meshed from scratch when they're streamed in
+        uint64 dirty = renderInfo->dirtyChunks[i] & renderInfo->residentChunks[i];
+        while (dirty != 0) {
+            chunkSlots.Append(i * 64 + (uint32)_tzcnt_u64(dirty));
+            dirty &= dirty - 1;
+        }
+        renderInfo->dirtyChunks[i] = 0;
+    }
+
+    RebuildChunks(blockGrid, chunkSlots, queue, renderInfo);
+    return true;
+}
+
+bool UpdateBlockStreaming(Vec3Int cameraBlockIndex, AppWorkQueue* queue, LinearAllocator* allocator,
+                          LevelData* levelData)
+{
+    BlockGrid* grid = &levelData->grid;
+    GridRenderInfo* renderInfo = &levelData->gridRenderInfo;
+    BlockStreaming* streaming = &levelData->blockStreaming;
+    Vec3Int cameraChunk;
+    for (int e = 0; e < 3; e++) {
+        cameraChunk.e[e] = MinInt(MaxInt(cameraBlockIndex.e[e], 0), BLOCKS_SIZE.e[e] - 1) / CHUNK_SIZE;
+    }
+
+    // The grid only changes once the loading jobs and any meshing jobs are done, the frame never waits on them
+    if (streaming->jobsDone != streaming->numJobs
+        || (renderInfo->numMeshJobs > 0 && renderInfo->meshJobsDone != renderInfo->numMeshJobs)) {
+        return true;
+    }
+    FinishChunkMeshJobs(renderInfo);
+
+    bool succeeded = true;
+    if (streaming->columns.size > 0) {
+        succeeded = FinishBlockStreaming(levelData, allocator);
+        // Light from the new columns can reach resident chunks
+        if (!UpdateDirtyGridRenderInfo(*grid, queue, allocator, renderInfo)) {
+            succeeded = false;
+        }
+    }
+    if (streaming->source.type == LevelSourceType::NONE) {
+        return succeeded;
+    }
+
+    for (int y = 0; y < CHUNKS_SIZE.y; y++) {
+        for (int x = 0; x < CHUNKS_SIZE.x; x++) {
+            const uint32 columnInd = ColumnIndex(x, y);
+            const uint64 columnBit = (uint64)1 << (columnInd % 64);
+            if ((grid->unloadedColumns[columnInd / 64] & columnBit) != 0
+                || (grid->pinnedColumns[columnInd / 64] & columnBit) != 0
+                || IsChunkInRadius(Vec3Int { x, y, 0 }, cameraChunk, STREAMING_BLOCK_EVICT_RADIUS)
+                || IsColumnAreaResident(*renderInfo, x, y)) continue;
+
+            UnloadGridColumn(Vec2Int { x, y }, levelData);
+        }
+    }
+
+    // Nearest first, kept sorted by insertion since only a few are picked
+    StaticArray<int, STREAMING_COLUMNS_PER_FRAME> distances;
+    const int minX = MaxInt(cameraChunk.x - STREAMING_BLOCK_RADIUS, 0);
+    const int maxX = MinInt(cameraChunk.x + STREAMING_BLOCK_RADIUS, CHUNKS_SIZE.x - 1);
+    const int minY = MaxInt(cameraChunk.y - STREAMING_BLOCK_RADIUS, 0);
+    const int maxY = MinInt(cameraChunk.y + STREAMING_BLOCK_RADIUS, CHUNKS_SIZE.y - 1);
+    for (int y = minY; y <= maxY; y++) {
+        for (int x = minX; x <= maxX; x++) {
+            if (IsColumnLoaded(*grid, x, y)) continue;
+
+            const int distance = ChunkDistanceSquared(Vec3Int { x, y, 0 }, cameraChunk);
+            uint32 i = streaming->columns.size;
+            if (i == STREAMING_COLUMNS_PER_FRAME) {
+                if (distance >= distances[i - 1]) continue;
+                i--;
+            }
+            else {
+                streaming->columns.size++;
+            }
+            for (; i > 0 && distances[i - 1] > distance; i--) {
+                streaming->columns[i] = streaming->columns[i - 1];
+                distances[i] = distances[i - 1];
+            }
+            streaming->columns[i] = Vec2Int { x, y };
+            distances[i] = distance;
+        }
+    }
+
+    // A job per chunk the source has, grouped by column for FinishBlockStreaming
+    uint32 numJobs = 0;
+    for (uint32 c = 0; c < streaming->columns.size; c++) {
+        const Vec2Int column = streaming->columns[c];
+        const uint32 columnJobs = numJobs;
+        for (int chunkZ = 0; chunkZ < CHUNKS_SIZE.z; chunkZ++) {
+            const Vec3Int chunkIndex = { column.x, column.y, chunkZ };
+            if (!HasSourceChunk(streaming->source, chunkIndex)) continue;
+
+            const int chunkInd = AllocatePoolChunk(grid);
+            if (chunkInd < 0) {
+                for (uint32 i = columnJobs; i < numJobs; i++) {
+                    grid->freeChunks.Append(streaming->jobs[i].chunkInd);
+                }
+                numJobs = columnJobs;
+                streaming->columns.size = c;
+                succeeded = false;
+                break;
+            }
+
+            PreserveSnapshotChunk(chunkInd, grid);
+            streaming->jobs[numJobs++] = { .chunkIndex = chunkIndex, .chunkInd = (uint16)chunkInd, .loaded = false };
+        }
+    }
+
+    streaming->jobsClaimed = 0;
+    streaming->jobsDone = 0;
+    InterlockedExchange((volatile LONG*)&streaming->numJobs, (LONG)numJobs);
+    for (uint32 i = 0; i < numJobs; i++) {
+        if (queue == nullptr || !TryAddWork(queue, ThreadChunkLoad, levelData)) {
+            RunChunkLoadJob(levelData);
+        }
+    }
+    return succeeded;
+}
+
+internal bool SetLevelJobName(const_string levelName, LevelJob* job)
+{
+    if (levelName.size > LevelJob::MAX_NAME_LENGTH) {
+        LOG_ERROR("Level name %.*s is too long\n", levelName.size, levelName.data);
+        return false;
+    }
+
+    MemCopy(job->levelNameBuffer.data, levelName.data, levelName.size);
+    job->levelName = { .size = levelName.size, .data = job->levelNameBuffer.data };
+    return true;
+}
+
+internal bool SaveLevelJob(LevelJob* job)
+{
+    const BlockGridSnapshot& snapshot = job->snapshot;
+    const uint64 copiesSize = (uint64)snapshot.maxCopies * BLOCKS_PER_CHUNK * sizeof(Block);
+    const LargeArray<uint8> memory = { .size = job->memory.size - copiesSize, .data = job->memory.data + copiesSize };
+    LinearAllocator allocator(memory);
+
+    const LevelData& levelData = *job->levelData;
+    const bool written = WriteLevelFile(job->levelName, snapshot.chunkSlots, snapshot.unloadedColumns,
+                                        levelData.blockStreaming.source, levelData.grid, &job->snapshot, &allocator,
+                                        &job->delta);
+
+    // If writing failed partway, edits mustn't keep waiting on chunks that will never be read
+    for (uint32 i = 0; i < BlockGrid::MAX_CHUNKS; i++) {
+        SnapshotChunkTransition(&job->snapshot, i, SnapshotChunkState::PENDING, SnapshotChunkState::NONE);
+    }
+
+    return written;
+}
+
+internal bool LoadLevelJob(LevelJob* job)
+{
+    LinearAllocator allocator(job->memory);
+    return LoadLevelBlocks(job->levelName, &job->loadGrid, &allocator, &job->loadSource, &job->delta)
+        && ComputeGridLight(&job->loadGrid, &allocator);
+}
+
+internal void ThreadLevelJob(AppWorkQueue* queue, void* data)
+{
+    UNREFERENCED_PARAMETER(queue);
+
+    LevelJob* job = (LevelJob*)data;
+    DEBUG_ASSERT(job->state == LevelJobState::RUNNING);
+
+    bool succeeded = false;
+    switch (job->type) {
+        case LevelJobType::SAVE: {
+            succeeded = SaveLevelJob(job);
+        } break;
+        case LevelJobType::LOAD: {
+            succeeded = LoadLevelJob(job);
+        } break;
+    }
+
+    const LevelJobState result = succeeded ? LevelJobState::DONE : LevelJobState::FAILED;
+    InterlockedExchange((volatile LONG*)&job->state, (LONG)result);
+}
+
+internal bool StartLevelJob(AppWorkQueue* queue, LevelJob* job)
+{
+    job->state = LevelJobState::RUNNING;
+    if (!TryAddWork(queue, ThreadLevelJob, job)) {
+        LOG_ERROR("Work queue full, level job not started\n");
+        job->state = LevelJobState::IDLE;
+        return false;
+    }
+
+    return true;
+}
+
+bool StartSaveLevel(const_string levelName, LevelData* levelData, AppWorkQueue* queue, LevelJob* job)
+{
+    if (job->state != LevelJobState::IDLE || !SetLevelJobName(levelName, job)) {
+        return false;
+    }
+
+    BlockJournal* journal = &levelData->journal;
+    bool appended = false;
+    if (CanAppendLevelDelta(*journal, levelName)) {
+        const uint32 numRecords = journal->numUnsaved;
+        LinearAllocator allocator(job->memory);
+        if (!AppendLevelDelta(levelName, journal, &allocator)) {
+            journal->savedDelta.appendable = false;
+            return false;
+        }
+
+        LOG_INFO("Saved %lu blocks to level %.*s\n", numRecords, levelName.size, levelName.data);
+        if (journal->savedDelta.numRecords < LEVEL_DELTA_COMPACT_RECORDS) {
+            return true;
+        }
+        appended = true;
+    }
+
+    job->type = LevelJobType::SAVE;
+    job->levelData = levelData;
+
+    BlockGrid* grid = &levelData->grid;
+    BlockGridSnapshot* snapshot = &job->snapshot;
+    MemCopy(snapshot->chunkSlots.data, grid->chunkSlots.data, sizeof(grid->chunkSlots));
+    MemCopy(snapshot->unloadedColumns.data, grid->unloadedColumns.data, sizeof(grid->unloadedColumns));
+    for (uint32 i = 0; i < BlockGrid::MAX_CHUNKS; i++) {
+        snapshot->chunkStates[i] = (uint32)SnapshotChunkState::NONE;
+    }
+    uint32 numChunks = 0;
+    for (uint32 i = 0; i < BlockGrid::NUM_CHUNK_SLOTS; i++) {
+        const uint16 slot = grid->chunkSlots[i];
+        if (slot != 0) {
+            snapshot->chunkStates[slot - 1] = (uint32)SnapshotChunkState::PENDING;
+            numChunks++;
+        }
+    }
+
+    // Copies take whatever the file can't need
+    DEBUG_ASSERT(job->memory.size > LEVEL_SAVE_MAX_MEMORY);
+    const uint32 maxCopies = (uint32)((job->memory.size - LEVEL_SAVE_MAX_MEMORY) / (BLOCKS_PER_CHUNK * sizeof(Block)));
+    snapshot->numCopies = 0;
+    snapshot->maxCopies = MinUInt32(numChunks, maxCopies);
+    snapshot->copies = (Block*)job->memory.data;
+
+    grid->snapshot = snapshot;
+    if (!StartLevelJob(queue, job)) {
+        grid->snapshot = nullptr;
+        // The log is up to date, it's compacted by a later save
+        return appended;
+    }
+
+    // The snapshot has every block set so far, blocks set from here on go in the log once the job is done
+    journal->numUnsaved = 0;
+    journal->unsavedComplete = true;
+    journal->savedDelta.appendable = false;
+    return true;
+}
+
+bool StartLoadLevel(const_string levelName, LevelData* levelData, AppWorkQueue* queue, LevelJob* job)
+{
+    if (job->state != LevelJobState::IDLE || !SetLevelJobName(levelName, job)) {
+        return false;
+    }
+
+    job->type = LevelJobType::LOAD;
+    job->levelData = levelData;
+
+    // Pool chunks the current level doesn't use, which stay untouched as long as the current level isn't edited
+    const BlockGrid& grid = levelData->grid;
+    BlockGrid* loadGrid = &job->loadGrid;
+    MemSet(loadGrid->chunkSlots.data, 0, sizeof(loadGrid->chunkSlots));
+    MemSet(loadGrid->skyHeights.data, 0, sizeof(loadGrid->skyHeights));
+    MemSet(loadGrid->unloadedColumns.data, 0, sizeof(loadGrid->unloadedColumns));
+    MemSet(loadGrid->pinnedColumns.data, 0, sizeof(loadGrid->pinnedColumns));
+    job->loadSource.type = LevelSourceType::NONE;
+    loadGrid->numChunksUsed = grid.numChunksUsed;
+    loadGrid->freeChunks = grid.freeChunks;
+    loadGrid->pool = grid.pool;
+    loadGrid->snapshot = nullptr;
+
+    return StartLevelJob(queue, job);
+}
+
+void FinishLevelJob(LevelJob* job)
+{
+    const LevelJobState state = job->state;
+    if (state != LevelJobState::DONE && state != LevelJobState::FAILED) {
+        return;
+    }
+
+    LevelData* levelData = job->levelData;
+    const_string levelName = job->levelName;
+    switch (job->type) {
+        case LevelJobType::SAVE: {
+            levelData->grid.snapshot = nullptr;
+            // Here instead of in the job, since the level source may be reading the file that's replaced
+            LinearAllocator allocator(job->memory);
+            if (state == LevelJobState::DONE && ReplaceLevelFile(levelName, levelData, &allocator, &job->delta)) {
+                SetJournalSavedLevel(levelName, job->delta, &levelData->journal);
+                LOG_INFO("Saved level %.*s\n", levelName.size, levelName.data);
+            }
+            else {
+                LOG_ERROR("Failed to save level %.*s\n", levelName.size, levelName.data);
+            }
+        } break;
+        case LevelJobType::LOAD: {
+            if (state == LevelJobState::DONE) {
+                // Chunks around the camera are streamed back in over the next few frames
+                ResetGridRenderInfo(&levelData->gridRenderInfo);
+
+                // The old level's chunks go back to the pool, along with the ones the load didn't use
+                BlockGrid* grid = &levelData->grid;
+                const BlockGrid& loadGrid = job->loadGrid;
+                grid->freeChunks = loadGrid.freeChunks;
+                for (uint32 i = 0; i < BlockGrid::NUM_CHUNK_SLOTS; i++) {
+                    if (grid->chunkSlots[i] != 0) {
+                        grid->freeChunks.Append((uint16)(grid->chunkSlots[i] - 1));
+                    }
+                }
+                MemCopy(grid->chunkSlots.data, loadGrid.chunkSlots.data, sizeof(grid->chunkSlots));
+                MemCopy(grid->skyHeights.data, loadGrid.skyHeights.data, sizeof(grid->skyHeights));
+                MemCopy(grid->unloadedColumns.data, loadGrid.unloadedColumns.data, sizeof(grid->unloadedColumns));
+                MemCopy(grid->pinnedColumns.data, loadGrid.pinnedColumns.data, sizeof(grid->pinnedColumns));
+                grid->numChunksUsed = loadGrid.numChunksUsed;
+                CancelBlockStreaming(levelData);
+                LevelSource* source = &levelData->blockStreaming.source;
+                CloseLevelSource(source);
+                *source = job->loadSource;
+                source->fileName.data = source->fileNameBuffer.data;
+
+                levelData->flowField.valid = false;
+                ResetBlockJournal(&levelData->journal);
+                SetJournalSavedLevel(levelName, job->delta, &levelData->journal);
+                LOG_INFO("Loaded level %.*s\n", levelName.size, levelName.data);
+            }
+            else {
+                CloseLevelSource(&job->loadSource);
+                LOG_ERROR("Failed to load level %.*s\n", levelName.size, levelName.data);
+            }
+        } break;
+    }
+
+    job->state = LevelJobState::IDLE;
+}
+
+Array<VulkanMeshVertex> GetChunkMeshVertices(const GridRenderInfo& renderInfo, uint32 chunkSlot, float32 blockSize,
+                                             Vec3Int blockOrigin, LinearAllocator* allocator)
+{
+    uint32 numQuads = 0;
+    for (uint16 page = renderInfo.chunkPages[chunkSlot]; page != 0; page = renderInfo.pages[page - 1].next) {
+        numQuads += renderInfo.pages[page - 1].quads.size;
+    }
+    if (numQuads == 0) {
+        return { .size = 0, .data = nullptr };
+    }
+
+    Array<VulkanMeshVertex> vertices = allocator->NewArray<VulkanMeshVertex>(numQuads * 6);
+    if (vertices.data == nullptr) {
+        return vertices;
+    }
+
+    const Vec3Int chunkOrigin = ChunkOrigin(ChunkSlotToIndex(chunkSlot));
+    // Same corner order as the mesh pipeline's tile, and the same winding split along the other diagonal
+    const Vec2Int corners[6] = { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 1, 1 }, { 1, 0 }, { 0, 0 } };
+    const Vec2Int flippedCorners[6] = { { 0, 1 }, { 1, 1 }, { 1, 0 }, { 1, 0 }, { 0, 0 }, { 0, 1 } };
+
+    uint32 vertexInd = 0;
+    for (uint16 page = renderInfo.chunkPages[chunkSlot]; page != 0; page = renderInfo.pages[page - 1].next) {
+        const BlockQuadPage& quadPage = renderInfo.pages[page - 1];
+        for (uint32 i = 0; i < quadPage.quads.size; i++) {
+            const BlockQuad& quad = quadPage.quads[i];
+            const BlockFaceAxes& axes = BLOCK_FACE_AXES[quad.face];
+            const Vec3Int minIndex = chunkOrigin + Vec3Int { (int)quad.x, (int)quad.y, (int)quad.z };
+
+            // Faces on the positive side of a block sit one block further along the normal
+            const Vec3Int normalOffset = {
+                axes.normal.x > 0 ? 1 : 0, axes.normal.y > 0 ? 1 : 0, axes.normal.z > 0 ? 1 : 0
+            };
+            const Vec3 origin = BlockIndexToWorldPos(minIndex + normalOffset, blockSize, blockOrigin);
+            const Vec3 u = BlockAxisToVec3(axes.u) * (blockSize * quad.width);
+            const Vec3 v = BlockAxisToVec3(axes.v) * (blockSize * quad.height);
+            const Vec3 normal = BlockAxisToVec3(axes.normal);
+            const Vec3 color = GetBlockColor(quad.id) * GetLightBrightness(quad.light);
+
+            // Split along the brighter diagonal, so a single occluded corner doesn't smear into a stripe
+            const uint32 ao00 = quad.ao & 3;
+            const uint32 ao10 = (quad.ao >> 2) & 3;
+            const uint32 ao01 = (quad.ao >> 4) & 3;
+            const uint32 ao11 = (quad.ao >> 6) & 3;
+            const Vec2Int* quadCorners = ao00 + ao11 >= ao10 + ao01 ? corners : flippedCorners;
+
+            for (int j = 0; j < 6; j++) {
+                const Vec2Int corner = quadCorners[j];
+                const uint32 ao = (quad.ao >> ((corner.x + 2 * corner.y) * 2)) & 3;
+                VulkanMeshVertex* vertex = &vertices[vertexInd++];
+                vertex->pos = origin + u * (float32)corner.x + v * (float32)corner.y;
+                vertex->normal = normal;
+                vertex->color = color * AO_BRIGHTNESS[ao];
+            }
+        }
+    }
+
+    return vertices;
+}
+
+bool GenerateCity(const CityGenParams& params, LevelData* levelData)
+{
+    if (!ValidateCityGenParams(params)) {
+        return false;
+    }
+    if (params.numDistricts > MAX_CITY_DISTRICTS) {
+        LOG_ERROR("City has %lu districts, max %lu\n", params.numDistricts, MAX_CITY_DISTRICTS);
+        return false;
+    }
+
+    CancelBlockStreaming(levelData);
+    ResetGridRenderInfo(&levelData->gridRenderInfo);
+    levelData->flowField.valid = false;
+    ResetBlockJournal(&levelData->journal);
+    BlockGrid* grid = &levelData->grid;
+    ClearBlockGrid(grid);
+
+    // Every chunk column is generated as it's streamed in
+    MemSet(grid->unloadedColumns.data, 0xff, sizeof(grid->unloadedColumns));
+    MemSet(grid->skyHeights.data, BLOCKS_SIZE.z, sizeof(grid->skyHeights));
+    LevelSource* source = &levelData->blockStreaming.source;
+    CloseLevelSource(source);
+    source->type = LevelSourceType::CITY;
+    source->city = params;
+    MemCopy(source->cityDistricts.data, params.districts, params.numDistricts * sizeof(CityDistrict));
+    source->city.districts = source->cityDistricts.data;
+    return true;
+}
@@ -1,24 +1,33 @@
 #pragma once
 
 #include <km_common/km_array.h>
+#include <km_common/app/km_app.h>
 
 #include "mesh.h"
 
-constexpr Vec3Int BLOCKS_SIZE = { 128, 128, 32 };
+constexpr Vec3Int BLOCKS_SIZE = { 2048, 2048, 64 };
 constexpr Vec3Int BLOCK_ORIGIN = { BLOCKS_SIZE.x / 2, BLOCKS_SIZE.y / 2, 4 };
 
+const int CHUNK_SIZE = 32;
+const uint32 BLOCKS_PER_CHUNK = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+constexpr Vec3Int CHUNKS_SIZE = {
+    BLOCKS_SIZE.x / CHUNK_SIZE, BLOCKS_SIZE.y / CHUNK_SIZE, BLOCKS_SIZE.z / CHUNK_SIZE
+};
+static_assert(BLOCKS_SIZE.x % CHUNK_SIZE == 0 && BLOCKS_SIZE.y % CHUNK_SIZE == 0 && BLOCKS_SIZE.z % CHUNK_SIZE == 0);
+
 enum class GridTemplateId
 {
     FLATGRASS,
     TUNNELS
 };
 
-enum class BlockId
+enum class BlockId : uint8
 {
     NONE = 0,
     SIDEWALK,
     STREET,
     BUILDING,
+    LAMP,
 
     COUNT
 };
@@ -28,51 +37,611 @@ struct Block
     BlockId id;
 };
 
-using BlockGrid = StaticArray<StaticArray<StaticArray<Block, BLOCKS_SIZE.x>, BLOCKS_SIZE.y>, BLOCKS_SIZE.z>;
+static_assert(CHUNK_SIZE == 32); // occupancy rows are uint32
+
+// CHUNK_SIZE^3 blocks, x fastest, then y, then z
+struct BlockChunk
+{
+    Vec3Int chunkIndex;
+    uint32 numSolid; // chunks are freed when this reaches 0
+    StaticArray<Block, BLOCKS_PER_CHUNK> blocks;
+    // Per row of blocks along x, at y + z * CHUNK_SIZE, bit x is set if the block is solid
+    StaticArray<uint32, CHUNK_SIZE * CHUNK_SIZE> occupancy;
+    // Per block, sky light << LIGHT_SKY_SHIFT | block light, each 0 to MAX_LIGHT. Solid blocks have no sky light and
+    // only their own block light, if they emit any.
+    StaticArray<uint8, BLOCKS_PER_CHUNK> light;
+};
+
+const uint8 MAX_LIGHT = 15;
+const uint8 LIGHT_SKY_SHIFT = 4;
+// Light of blocks in unallocated chunks and outside the grid, open sky besides under the grid
+const uint8 LIGHT_OPEN_SKY = MAX_LIGHT << LIGHT_SKY_SHIFT;
+
+struct BlockGridSnapshot;
+struct BlockChunkPool;
+
+// Sparse grid of BLOCKS_SIZE blocks, with pool chunks for the non-empty chunks of loaded chunk columns
+struct BlockGrid
+{
+    static const uint32 NUM_CHUNK_SLOTS = CHUNKS_SIZE.x * CHUNKS_SIZE.y * CHUNKS_SIZE.z;
+    static const uint32 NUM_COLUMNS = CHUNKS_SIZE.x * CHUNKS_SIZE.y;
+    static const uint32 COLUMN_WORDS = NUM_COLUMNS / 64;
+    // Shared by the level and any level loading in the background, which fails if they don't fit together
+    static const uint32 MAX_CHUNKS = NUM_CHUNK_SLOTS;
+
+    // Per chunk index, 1 + index into the pool, or 0 if the chunk is empty and not allocated
+    StaticArray<uint16, NUM_CHUNK_SLOTS> chunkSlots;
+    uint32 numChunksUsed; // high water mark in pool chunks, slots below it are reused through freeChunks
+    FixedArray<uint16, MAX_CHUNKS> freeChunks;
+    // Per block column, 1 + z of its top solid block, or BLOCKS_SIZE.z in unloaded chunk columns
+    StaticArray<uint8, BLOCKS_SIZE.x * BLOCKS_SIZE.y> skyHeights;
+    StaticArray<uint64, COLUMN_WORDS> unloadedColumns; // bit per chunk column, its blocks are only in the level source
+    StaticArray<uint64, COLUMN_WORDS> pinnedColumns; // bit per chunk column, it has edits the source doesn't
+    BlockChunkPool* pool;
+    BlockGridSnapshot* snapshot; // if set, chunks are preserved for it before they're modified
+};
+static_assert(BlockGrid::MAX_CHUNKS < UINT16_MAX);
+static_assert(BLOCKS_SIZE.z <= UINT8_MAX);
+static_assert(BlockGrid::NUM_COLUMNS % 64 == 0);
+
+// Chunk memory, allocated in batches and shared by grids that never hand out the same chunks
+struct BlockChunkPool
+{
+    static const uint32 CHUNKS_PER_BATCH = 64;
+    static const uint32 MAX_BATCHES = BlockGrid::MAX_CHUNKS / CHUNKS_PER_BATCH;
+
+    StaticArray<BlockChunk*, MAX_BATCHES> batches;
+    uint32 numBatches;
+};
+static_assert(BlockGrid::MAX_CHUNKS % BlockChunkPool::CHUNKS_PER_BATCH == 0);
+
+// Coplanar faces of the same block type, merged into a rectangle by the greedy mesher. Chunk-local, in blocks.
+struct BlockQuad
+{
+    uint32 x : 5, y : 5, z : 5; // block at the rectangle's min corner
+    uint32 face : 3;            // BlockFace
+    uint32 width : 6;           // along the face's u axis, see BLOCK_FACE_AXES
+    uint32 height : 6;          // along the face's v axis
+    BlockId id;
+    uint8 light; // of the block in front of the faces
+    uint8 ao;    // per corner (u, v), 2 bits at (u + 2 * v) * 2, from 0 (fully occluded) to BLOCK_AO_NONE
+    uint8 unused;
+};
+static_assert(sizeof(BlockQuad) == 8);
+
+const uint8 BLOCK_AO_NONE = 3;
+
+enum class BlockFace : uint8
+{
+    TOP,    // +z
+    BOTTOM, // -z
+    LEFT,   // +y
+    RIGHT,  // -y
+    FRONT,  // +x
+    BACK,   // -x
+
+    COUNT
+};
+
+// Normal and in-plane axes of each BlockFace, with u x v = normal, so quads keep the tile's winding
+struct BlockFaceAxes
+{
+    Vec3Int normal;
+    Vec3Int u;
+    Vec3Int v;
+};
+
+constexpr BlockFaceAxes BLOCK_FACE_AXES[(uint32)BlockFace::COUNT] = {
+    { .normal = {  0,  0,  1 }, .u = { 1, 0, 0 }, .v = { 0, 1, 0 } },
+    { .normal = {  0,  0, -1 }, .u = { 0, 1, 0 }, .v = { 1, 0, 0 } },
+    { .normal = {  0,  1,  0 }, .u = { 0, 0, 1 }, .v = { 1, 0, 0 } },
+    { .normal = {  0, -1,  0 }, .u = { 1, 0, 0 }, .v = { 0, 0, 1 } },
+    { .normal = {  1,  0,  0 }, .u = { 0, 1, 0 }, .v = { 0, 0, 1 } },
+    { .normal = { -1,  0,  0 }, .u = { 0, 0, 1 }, .v = { 0, 1, 0 } },
+};
+
+struct BlockQuadPage
+{
+    static const uint32 MAX_QUADS = 1024;
+
+    uint16 next; // 1 + index of the next page of the same chunk, or 0
+    FixedArray<BlockQuad, MAX_QUADS> quads;
+};
+
+// Every face of every other block, in a 3D checkerboard
+const uint32 MAX_CHUNK_QUADS = BLOCKS_PER_CHUNK / 2 * 6;
+
+struct ChunkMeshJob
+{
+    const BlockGrid* grid;
+    uint32 chunkSlot;
+    uint32 numQuads; // written to the job's part of GridRenderInfo::meshQuads
+};
+
+// Render data and block data are only kept for chunks near the camera
+const int STREAMING_RADIUS = 8; // in chunks, horizontally, all of them are meshed unless the budget runs out
+const int STREAMING_EVICT_RADIUS = 10; // further out than the radius, so chunks at the edge don't thrash
+const uint32 STREAMING_CHUNKS_PER_FRAME = 16; // meshed per update, nearest first
+// Block data reaches a column further, since chunks are only meshed once their neighbours are loaded
+const int STREAMING_BLOCK_RADIUS = STREAMING_RADIUS + 1;
+const int STREAMING_BLOCK_EVICT_RADIUS = STREAMING_EVICT_RADIUS + 1;
+const uint32 STREAMING_COLUMNS_PER_FRAME = 4; // loaded per update, nearest first
+const uint64 STREAMING_GPU_BUDGET = MEGABYTES(64); // for chunk vertex buffers
+const uint32 STREAMING_MAX_QUADS = (uint32)(STREAMING_GPU_BUDGET / (6 * sizeof(VulkanMeshVertex)));
 
-struct BlockRenderInfo
+// Greedy-meshed block quads per chunk, in linked lists of pages from a shared pool. Only dirty chunks are remeshed.
+struct GridRenderInfo
 {
-    MeshId meshId;
-    Mat4 model;
-    Vec3 color;
+    static const uint32 MAX_PAGES = 1536;
+    static const uint32 DIRTY_WORDS = (BlockGrid::NUM_CHUNK_SLOTS + 63) / 64;
+
+    // Per chunk index, 1 + index of the chunk's first page, or 0 if it has no visible faces
+    StaticArray<uint16, BlockGrid::NUM_CHUNK_SLOTS> chunkPages;
+    StaticArray<uint64, DIRTY_WORDS> residentChunks; // bit per chunk index, quads are built and kept up to date
+    StaticArray<uint64, DIRTY_WORDS> dirtyChunks; // bit per chunk index, quads need rebuilding
+    StaticArray<uint64, DIRTY_WORDS> uploadChunks; // bit per chunk index, quads changed since the last GPU upload
+    uint32 numQuads; // over all resident chunks
+    // Once the quad budget has been hit, chunks this far from the center (squared, in chunks) aren't streamed in, so
+    // the ones evicted to get back under the budget don't come straight back. Lifted when the camera changes chunks.
+    Vec3Int streamingCenter;
+    int streamingLimit;
+    uint32 numPagesUsed;
+    FixedArray<uint16, MAX_PAGES> freePages;
+    StaticArray<BlockQuadPage, MAX_PAGES> pages;
+
+    // Chunks being meshed, claimed by queue entries or whichever thread waits on them. Stored once they're all done.
+    StaticArray<ChunkMeshJob, STREAMING_CHUNKS_PER_FRAME> meshJobs;
+    volatile uint32 numMeshJobs, meshJobsClaimed, meshJobsDone;
+    StaticArray<BlockQuad, STREAMING_CHUNKS_PER_FRAME * MAX_CHUNK_QUADS> meshQuads;
+};
+// Every chunk within the eviction radius can hold a partly filled page, on top of the pages the budget's quads fill
+static_assert((2 * STREAMING_EVICT_RADIUS + 1) * (2 * STREAMING_EVICT_RADIUS + 1) * CHUNKS_SIZE.z
+              + STREAMING_MAX_QUADS / BlockQuadPage::MAX_QUADS <= GridRenderInfo::MAX_PAGES);
+
+// Level files, data/levels/NAME.blockgrid:
+//   LevelFileHeader
+//   chunk data at each entry's offset: BLOCKS_PER_CHUNK 1-byte BlockIds, x fastest, in the entry's encoding
+//   zero padding to a multiple of 4 bytes
+//   LevelChunkEntry directory[numChunks], one per non-empty chunk, in chunk slot order (x fastest, then y, then z)
+// Version 2 files have the directory after the header. Version 1 and headerless files still load.
+const uint32 LEVEL_FILE_MAGIC = 0x4b4c4247; // "GBLK"
+const uint32 LEVEL_FILE_VERSION = 3;
+const uint32 MAX_LEVEL_NAME_LENGTH = 64;
+
+struct LevelFileHeader
+{
+    uint32 magic;
+    uint32 version;
+    Vec3Int blocksSize;
+    uint32 numChunks;
+};
+
+enum class LevelChunkEncoding : uint32
+{
+    RAW = 0,
+    RLE = 1 // (BlockId, run length - 1) byte pairs
+};
+
+struct LevelChunkEntry
+{
+    Vec3Int chunkIndex;
+    uint32 offset; // from the start of the file
+    uint32 size;
+    LevelChunkEncoding encoding;
+};
+
+// Saves write chunks out a page at a time, with the directory last. A page is written once a raw chunk doesn't fit.
+const uint32 LEVEL_FILE_PAGE_SIZE = 32 * BLOCKS_PER_CHUNK;
+// Unloaded chunks are read from the level source into the BlockChunk. File paths fit in the extra KILOBYTES(4).
+const uint64 LEVEL_SAVE_MAX_MEMORY = LEVEL_FILE_PAGE_SIZE + BlockGrid::NUM_CHUNK_SLOTS * sizeof(LevelChunkEntry)
+    + sizeof(BlockChunk) + KILOBYTES(4);
+
+// A mapped level file with a chunk directory, for loading chunks one at a time
+struct LevelFile
+{
+    MappedFile mappedFile;
+    uint32 numChunks;
+    const LevelChunkEntry* directory;
+};
+
+// Saved edits on top of a level file, data/levels/NAME.blockdelta:
+//   LevelDeltaHeader
+//   LEVEL_DELTA_RECORD_SIZE byte records, in the order the blocks were set
+// Loads replay it over the level file, and ignore it if it was started for a different one
+const uint32 LEVEL_DELTA_MAGIC = 0x4c444247; // "GBDL"
+const uint32 LEVEL_DELTA_VERSION = 2;
+const uint32 LEVEL_DELTA_MAX_RECORDS = 1 << 16; // past this, saves compact the log instead of appending
+const uint32 LEVEL_DELTA_COMPACT_RECORDS = LEVEL_DELTA_MAX_RECORDS / 4; // past this, saves append and then compact
+// Little-endian uint16 x, y, z block index, then the uint8 BlockId. Version 1 records were raw BlockUpdate structs.
+const uint32 LEVEL_DELTA_RECORD_SIZE = 7;
+static_assert(BLOCKS_SIZE.x <= 0x10000 && BLOCKS_SIZE.y <= 0x10000 && BLOCKS_SIZE.z <= 0x10000);
+
+struct LevelDeltaHeader
+{
+    uint32 magic;
+    uint32 version;
+    uint32 baseHash; // of the level file's contents
+    uint32 baseSize;
 };
 
-struct Mob
+// A level's delta log, as of the last load or full save
+struct LevelDeltaState
 {
-    Vec3 pos;
-    float32 yaw;
-    Box hitbox;
-    float32 collapseT;
-    bool collapsed;
+    LevelDeltaHeader header;
+    uint32 numRecords;
+    bool appendable; // false if only a full save can bring the files up to date
 };
 
+enum class SnapshotChunkState : uint32
+{
+    NONE,    // not in the snapshot, or the reader is done with it: edits go ahead
+    PENDING, // not read or copied yet
+    READING, // the reader is using the pool chunk, edits wait
+    COPYING, // an edit is copying it, the reader waits
+    COPIED   // the reader uses the copy
+};
+
+// Copy-on-write view of a grid, for reading on another thread while the grid keeps being edited
+struct BlockGridSnapshot
+{
+    StaticArray<uint16, BlockGrid::NUM_CHUNK_SLOTS> chunkSlots;
+    StaticArray<uint64, BlockGrid::COLUMN_WORDS> unloadedColumns; // read from the level source instead
+    // Per pool chunk, a SnapshotChunkState, changed with interlocked operations by both threads
+    StaticArray<volatile uint32, BlockGrid::MAX_CHUNKS> chunkStates;
+    StaticArray<uint16, BlockGrid::MAX_CHUNKS> chunkCopies; // per COPIED pool chunk, index into copies
+    uint32 numCopies;
+    uint32 maxCopies; // once these run out, edits wait for the reader instead
+    Block* copies; // maxCopies * BLOCKS_PER_CHUNK
+};
+
+const uint32 MAX_MOBS = 16384;
+const uint32 MOB_MASK_WORDS = MAX_MOBS / 64;
+const Vec3 MOB_HITBOX_RADIUS = { 0.5f, 0.5f, 1.2f }; // around the mob's position
+const float32 MOB_TICK_TIME = 1.0f / 30.0f;
+const uint32 MOB_MAX_TICKS_PER_FRAME = 4; // after a long frame, the simulation falls behind instead of catching up
+const float32 MOB_WALK_SPEED = 1.5f;
+const float32 MOB_TURN_SPEED = PI_F; // radians per second, when steering towards the target
+const float32 MOB_CHASE_DISTANCE = 64.0f; // along the flow field
+
+const float32 GRAVITY = 9.8f;
+const float32 MAX_FALL_SPEED = 50.0f;
+
+// Mobs stored SoA, updated 8 at a time. Collapsed mobs keep their index until CompactMobs.
+struct MobList
+{
+    uint32 size;
+    StaticArray<uint64, MOB_MASK_WORDS> aliveMask; // bits past size are always clear, clear bits before it collapsed
+
+    StaticArray<float32, MAX_MOBS> posX, posY, posZ;
+    StaticArray<float32, MAX_MOBS> yaw;
+    StaticArray<float32, MAX_MOBS> prevPosX, prevPosY, prevPosZ; // as of the previous tick, for interpolation
+    StaticArray<float32, MAX_MOBS> prevYaw;
+    StaticArray<float32, MAX_MOBS> fallSpeed;
+    StaticArray<float32, MAX_MOBS> collapseT;
+    StaticArray<float32, MAX_MOBS> hitboxMinX, hitboxMinY, hitboxMinZ;
+    StaticArray<float32, MAX_MOBS> hitboxMaxX, hitboxMaxY, hitboxMaxZ;
+};
+
+static_assert(MAX_MOBS % 64 == 0);
+
+// Uniform grid of mob hitboxes over xy, hashed into buckets with a counting sort, each bucket's hitboxes SoA
+struct MobSpatialHash
+{
+    static constexpr float32 CELL_SIZE = 4.0f; // world units, hitboxes must be no wider so they cover at most 4 cells
+    static const uint32 NUM_BUCKETS = 4096;
+    static const uint32 MAX_ENTRIES = MAX_MOBS * 4;
+    static const uint32 ENTRY_CAPACITY = MAX_ENTRIES + 7; // the last 8-wide load can run past the end
+
+    StaticArray<uint32, NUM_BUCKETS + 1> bucketStarts; // entries of bucket b are [bucketStarts[b], bucketStarts[b + 1])
+    uint32 numEntries;
+    Box bounds; // of all the hitboxes in the hash
+
+    StaticArray<float32, ENTRY_CAPACITY> minX, minY, minZ;
+    StaticArray<float32, ENTRY_CAPACITY> maxX, maxY, maxZ;
+    StaticArray<uint16, ENTRY_CAPACITY> mobIndices;
+};
+
+static_assert((MobSpatialHash::NUM_BUCKETS & (MobSpatialHash::NUM_BUCKETS - 1)) == 0);
+static_assert(MAX_MOBS <= UINT16_MAX);
+
+struct LevelData;
+
+struct MobTickJob
+{
+    LevelData* levelData;
+    const uint16* mobIndices;
+    uint32 numMobs;
+    Vec3 target;
+};
+
+// Mobs are simulated in fixed ticks, each split into jobs over runs of mobs sorted by the spatial cell they're in
+struct MobSimulation
+{
+    static const uint32 MAX_JOBS = 16;
+    static const uint32 MIN_MOBS_PER_JOB = 256;
+
+    float32 tickTime; // time since the last tick, always less than MOB_TICK_TIME
+    StaticArray<uint32, MobSpatialHash::NUM_BUCKETS + 1> bucketStarts;
+    StaticArray<uint16, MAX_MOBS> order; // live mobs sorted by the hash bucket of their position
+    StaticArray<MobTickJob, MAX_JOBS> jobs;
+    // Jobs of the current tick, claimed by queue entries or the frame thread, whichever gets to them first
+    volatile uint32 numJobs;
+    volatile uint32 jobsClaimed;
+    volatile uint32 jobsDone;
+};
+
+// Walking distances to a target over a horizontal slice of the grid around it, which mobs follow downhill
+struct FlowField
+{
+    static const int SIZE = 256; // cells per side
+    static const uint16 UNREACHABLE = 0xfffe;
+    static const uint16 BLOCKED = 0xffff;
+    static const uint32 MAX_HEAP = SIZE * SIZE * 2; // a cell is pushed at most as a seed and once when relaxed
+
+    bool valid;
+    Vec3Int origin; // block index of the first cell, the slice is at origin.z
+    Vec3Int target;
+    int clearance; // number of blocks from the slice up that must be walkable
+    StaticArray<uint16, SIZE * SIZE> distances;
+
+    // Scratch for updates: a min-heap of distance << 16 | cell, and the cells cut off by a new block or the queue of a
+    // rebuild's breadth-first search
+    uint32 heapSize;
+    StaticArray<uint32, MAX_HEAP> heap;
+    StaticArray<uint32, SIZE * SIZE> cells;
+};
+
+static_assert(FlowField::SIZE * FlowField::SIZE <= UINT16_MAX + 1); // cell indices pack into 16 bits
+
 struct BlockUpdate
 {
     Vec3Int index;
     Block block;
 };
 
-struct LevelData
+struct BlockEdit
 {
-    static const uint32 NUM_BLOCKS = BLOCKS_SIZE.x * BLOCKS_SIZE.y * BLOCKS_SIZE.z;
-    static const uint32 MAX_MOBS = 1024;
+    Vec3Int index;
+    Block oldBlock;
+    Block newBlock;
+};
+
+struct BlockEditBatch
+{
+    uint32 start, end; // edit numbers
+};
+
+// Undo history of block edits in ring buffers, a batch per SubmitBlockUpdates, and the blocks set since the last save
+struct BlockJournal
+{
+    static const uint32 MAX_EDITS = 1 << 16;
+    static const uint32 MAX_BATCHES = 1 << 12;
+
+    StaticArray<BlockEdit, MAX_EDITS> edits;
+    StaticArray<BlockEditBatch, MAX_BATCHES> batches;
+    uint32 editEnd;
+    uint32 firstBatch; // [firstBatch, appliedEnd) can be undone
+    uint32 appliedEnd;
+    uint32 batchEnd; // [appliedEnd, batchEnd) can be redone
+
+    // Blocks set since the last save, for the next delta save. Once it's full, the next save is a full one.
+    StaticArray<BlockUpdate, LEVEL_DELTA_MAX_RECORDS> unsaved;
+    uint32 numUnsaved;
+    bool unsavedComplete;
+
+    StaticArray<char, MAX_LEVEL_NAME_LENGTH> savedLevelNameBuffer;
+    string savedLevelName; // points into savedLevelNameBuffer, the level the grid was loaded from or saved to
+    LevelDeltaState savedDelta;
+};
+
+// Lot sizes (inside the sidewalks) and building heights of a kind of district, in blocks
+struct CityDistrict
+{
+    uint32 minLotSize, maxLotSize;
+    uint32 minBuildingHeight, maxBuildingHeight;
+};
+
+// Procedural city of districts cut by streets into lots, each with a building or a plaza, and lamps at the corners
+struct CityGenParams
+{
+    uint32 seed;
+    uint32 districtSize;
+    uint32 streetSize;
+    uint32 sidewalkSize;
+    float32 plazaChance;
+    const CityDistrict* districts;
+    uint32 numDistricts;
+};
+
+enum class LevelSourceType
+{
+    NONE, // every chunk column is loaded
+    CITY,
+    FILE // a level file of version 2 or later
+};
+
+const uint32 MAX_CITY_DISTRICTS = 16;
+
+// Where the blocks of unloaded chunk columns come from. Edited columns are never unloaded.
+struct LevelSource
+{
+    LevelSourceType type;
+    CityGenParams city; // districts points into cityDistricts
+    StaticArray<CityDistrict, MAX_CITY_DISTRICTS> cityDistricts; // city.numDistricts of them
+    LevelFile file;
+    StaticArray<char, MAX_LEVEL_NAME_LENGTH> fileNameBuffer;
+    string fileName; // points into fileNameBuffer, the level the file was opened for
+};
 
+struct ChunkLoadJob
+{
+    Vec3Int chunkIndex;
+    uint16 chunkInd; // pool chunk, only added to the grid once every job is done
+    bool loaded;
+};
+
+// Chunk columns being loaded from the level source, a job per chunk, added to the grid once all jobs are done
+struct BlockStreaming
+{
+    static const uint32 MAX_JOBS = STREAMING_COLUMNS_PER_FRAME * CHUNKS_SIZE.z;
+
+    LevelSource source;
+    FixedArray<Vec2Int, STREAMING_COLUMNS_PER_FRAME> columns; // chunk columns
+    StaticArray<ChunkLoadJob, MAX_JOBS> jobs;
+    volatile uint32 numJobs, jobsClaimed, jobsDone;
+};
+
+struct LevelData
+{
     GridTemplateId gridTemplateId;
     float32 blockSize;
     BlockGrid grid;
-    FixedArray<BlockRenderInfo, NUM_BLOCKS> gridRenderInfo;
+    GridRenderInfo gridRenderInfo;
+    BlockChunkPool chunkPool; // grid.pool
+    BlockStreaming blockStreaming;
 
-    FixedArray<Mob, MAX_MOBS> mobs;
-    uint32 collapsingMobIndex;
+    MobList mobs;
+    uint32 collapsingMobIndex; // mobs.size if none
+    MobSpatialHash mobHash;
+    MobSimulation mobSimulation;
+    FlowField flowField;
+    BlockJournal journal;
 };
 
+bool IsInBlockGrid(Vec3Int blockIndex);
+// Out of bounds blocks and blocks in unloaded chunk columns read as BlockId::NONE
+Block GetBlock(const BlockGrid& grid, Vec3Int blockIndex);
+// Fails if blockIndex is out of bounds or in an unloaded chunk column, or if the chunk pool is exhausted
+bool SetBlock(Vec3Int blockIndex, Block block, BlockGrid* grid);
+void ClearBlockGrid(BlockGrid* grid);
+// Unallocated and out of bounds blocks are open sky above their column's top solid block, dark below it
+uint8 GetBlockLight(const BlockGrid& grid, Vec3Int blockIndex);
+// Recomputes the light of every loaded chunk, from the sky and from emissive blocks
+bool ComputeGridLight(BlockGrid* grid, LinearAllocator* allocator);
+
+// Out of bounds blocks and unloaded chunk columns aren't
 bool IsWalkable(const LevelData& levelData, Vec3Int blockIndex);
 
-void SubmitBlockUpdates(Array<BlockUpdate> updates, LevelData* levelData);
+struct BlockRaycastHit
+{
+    Vec3Int blockIndex;
+    BlockFace face; // the face of the hit block that the ray entered through
+    float32 t;      // distance along the ray, in world units
+};
+
+// Moves a box by delta one axis at a time, z first, up to the first solid block. Returns the delta moved.
+Vec3 MoveBoxThroughBlocks(const LevelData& levelData, Box box, Vec3 delta);
+
+// Walks the blocks along a ray (Amanatides-Woo), skipping origin's. dir must be normalized. False if nothing is hit.
+bool RaycastBlocks(const LevelData& levelData, Vec3 origin, Vec3 dir, float32 maxDistance, BlockRaycastHit* hit);
+
+bool IsMobAlive(const MobList& mobs, uint32 mobIndex);
+Vec3 GetMobPos(const MobList& mobs, uint32 mobIndex);
+// Fails if the list is full
+bool AddMob(Vec3 pos, float32 yaw, MobList* mobs);
+void ClearMobs(MobList* mobs);
+// Moves the live mobs down over the collapsed ones, keeping their order. Changes mob indices.
+void CompactMobs(LevelData* levelData);
+// Collapses the collapsing mob further and uncollapses the others, clearing it once it's fully collapsed
+void UpdateMobCollapse(float32 collapseStep, float32 uncollapseStep, LevelData* levelData);
+// Rebuilds the flow field if target is in a different block than at the last rebuild
+void UpdateFlowFieldTarget(Vec3 target, LevelData* levelData);
+// Direction down the flow field from blockIndex's cell, and its distance to the target. False if it can't reach it.
+bool SampleFlowField(const FlowField& flowField, Vec3Int blockIndex, Vec2* dir, uint32* distance);
+
+// Runs as many fixed mob ticks as deltaTime adds up to, so the result doesn't depend on the frame rate
+void UpdateMobSimulation(float32 deltaTime, Vec3 target, AppWorkQueue* queue, LevelData* levelData);
+// Position and yaw interpolated between the last two ticks, for drawing
+Vec3 GetMobRenderPos(const LevelData& levelData, uint32 mobIndex);
+float32 GetMobRenderYaw(const LevelData& levelData, uint32 mobIndex);
+
+struct MobRaycastHit
+{
+    uint32 mobIndex;
+    float32 t; // distance along the ray, in world units, 0 if origin is inside the hitbox
+};
+
+// Rebuilds the mob hash from the hitboxes of all mobs that haven't collapsed
+void UpdateMobSpatialHash(LevelData* levelData);
+
+// Walks the mob hash cells along a ray, as of the last UpdateMobSpatialHash. dir must be normalized.
+bool RaycastMobs(const LevelData& levelData, Vec3 origin, Vec3 dir, float32 maxDistance, MobRaycastHit* hit);
+
+// Sets blocks and their light, remeshing on queue if it's not null, and records them as one batch for undo
+void SubmitBlockUpdates(Array<BlockUpdate> updates, LevelData* levelData, AppWorkQueue* queue,
+                        LinearAllocator* allocator);
+// Sets the blocks of the last applied batch back, or applies the last undone one again. False if there's none.
+bool UndoBlockUpdates(LevelData* levelData, AppWorkQueue* queue, LinearAllocator* allocator);
+bool RedoBlockUpdates(LevelData* levelData, AppWorkQueue* queue, LinearAllocator* allocator);
 
+// Level files of version 2 or later are streamed in as the level source, older ones are loaded whole
 bool LoadLevel(const_string levelName, LevelData* levelData, LinearAllocator* allocator);
-bool SaveLevel(const_string levelName, const LevelData& levelData, LinearAllocator* allocator);
+
+// Replaces the level with a city, generated a chunk column at a time as it's streamed in
+bool GenerateCity(const CityGenParams& params, LevelData* levelData);
+// Fails for files in older versions, which can only be loaded whole with LoadLevel
+bool OpenLevelFile(const_string levelName, LinearAllocator* allocator, LevelFile* levelFile);
+void CloseLevelFile(LevelFile* levelFile);
+// Index of the chunk's directory entry, or -1 if the chunk is empty in the file
+int FindLevelChunk(const LevelFile& levelFile, Vec3Int chunkIndex);
+// Writes the whole level file to a temporary file and moves it into place, then a delta log with no records
+bool SaveLevel(const_string levelName, LevelData* levelData, LinearAllocator* allocator);
 Array<string> GetSavedLevels(LinearAllocator* allocator);
 
-void UpdateGridRenderInfo(const BlockGrid& blockGrid, float32 blockSize, Vec3Int blockOrigin,
-                          FixedArray<BlockRenderInfo, LevelData::NUM_BLOCKS>* renderInfo);
+enum class LevelJobType
+{
+    SAVE,
+    LOAD
+};
+
+enum class LevelJobState : uint32
+{
+    IDLE,
+    RUNNING,
+    DONE,
+    FAILED
+};
+
+// Level save or load off the frame loop. Don't edit the grid during a load until FinishLevelJob swaps it in.
+struct LevelJob
+{
+    static const uint32 MAX_NAME_LENGTH = MAX_LEVEL_NAME_LENGTH;
+
+    volatile LevelJobState state; // RUNNING is set by the frame loop, DONE/FAILED by the job's thread
+    LevelJobType type;
+    StaticArray<char, MAX_NAME_LENGTH> levelNameBuffer;
+    string levelName; // points into levelNameBuffer
+    LevelData* levelData;
+
+    BlockGridSnapshot snapshot; // SAVE
+    BlockGrid loadGrid; // LOAD
+    LevelSource loadSource; // LOAD, the source of loadGrid's unloaded chunk columns
+    LevelDeltaState delta; // the level's log once the job is done
+
+    LargeArray<uint8> memory;
+};
+
+// Fail if the job isn't IDLE. Appends to the level's delta log when it can, the job writes the whole file otherwise.
+bool StartSaveLevel(const_string levelName, LevelData* levelData, AppWorkQueue* queue, LevelJob* job);
+bool StartLoadLevel(const_string levelName, LevelData* levelData, AppWorkQueue* queue, LevelJob* job);
+// Call once per frame, outside of grid edits. Swaps in a loaded level or ends a save, and returns the job to IDLE.
+void FinishLevelJob(LevelJob* job);
+
+// Loads the chunk columns near the camera from the level source and unloads far unedited ones, outside grid edits
+bool UpdateBlockStreaming(Vec3Int cameraBlockIndex, AppWorkQueue* queue, LinearAllocator* allocator,
+                          LevelData* levelData);
+
+// Drops every chunk's quads and GPU meshes, they're meshed again as they're streamed back in
+void ResetGridRenderInfo(GridRenderInfo* renderInfo);
+// Meshes the nearest chunks within STREAMING_RADIUS on queue, and evicts far ones or the furthest over the quad budget
+bool UpdateGridStreaming(const BlockGrid& blockGrid, Vec3Int cameraBlockIndex, AppWorkQueue* queue,
+                         LinearAllocator* allocator, GridRenderInfo* renderInfo);
+// Waits for the chunks being meshed and stores the quads of the ones still resident. Call before modifying the grid.
+void FinishChunkMeshJobs(GridRenderInfo* renderInfo);
+// Rebuilds quads only for resident chunks marked dirty since the last update
+bool UpdateDirtyGridRenderInfo(const BlockGrid& blockGrid, AppWorkQueue* queue, LinearAllocator* allocator,
+                               GridRenderInfo* renderInfo);
+
+// Expands a chunk's quads into mesh pipeline triangles in world space. Empty if the chunk has no quads.
+Array<VulkanMeshVertex> GetChunkMeshVertices(const GridRenderInfo& renderInfo, uint32 chunkSlot, float32 blockSize,
+                                             Vec3Int blockOrigin, LinearAllocator* allocator);
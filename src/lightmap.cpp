@@ -2,6 +2,8 @@
 
 #include <intrin.h>
 #include <stb_image_write.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 // SIMD helpers ------------------------------------------------------------------------
@@ -313,70 +315,186 @@ struct RaycastTriangle
     Vec2 uvs[3];
 };
 
+// Triangle data shared by every instance of the same model
 struct RaycastMesh
 {
     Vec3 min, max;
-    Lightmap lightmap;
     Array<RaycastTriangle> triangles;
 };
 
+// One placement of a RaycastMesh in the scene. There is one instance per obj model, in the same order, so instance
+// indices are what the rest of the baker calls mesh indices.
+struct RaycastInstance
+{
+    uint32 meshInd;
+    // NOTE obj models are baked in world space, so duplicates can only be recognized up to a translation
+    Vec3 offset; // mesh space to world space
+    Vec3 min, max;
+    bool occluder;
+    Lightmap lightmap;
+};
+
 struct RaycastGeometry
 {
     Array<RaycastMesh> meshes;
+    Array<RaycastInstance> instances;
 };
 
-RaycastGeometry CreateRaycastGeometry(const LoadObjResult& obj, LinearAllocator* allocator)
+internal Vec3 ObjModelFirstPos(const ObjModel& model)
 {
-    RaycastGeometry geometry;
-    geometry.meshes = allocator->NewArray<RaycastMesh>(obj.models.size);
-    if (geometry.meshes.data == nullptr) {
-        return geometry;
+    if (model.triangles.size > 0) {
+        return model.triangles[0].v[0].pos;
+    }
+    else if (model.quads.size > 0) {
+        return model.quads[0].v[0].pos;
+    }
+    return Vec3::zero;
+}
+
+internal bool ObjVerticesMatch(const ObjVertex& v1, const ObjVertex& v2, Vec3 offset)
+{
+    const float32 EPSILON = 1e-5f;
+    const Vec3 posDiff = v2.pos - v1.pos - offset;
+    const Vec2 uvDiff = v2.uv - v1.uv;
+    return fabsf(posDiff.x) < EPSILON && fabsf(posDiff.y) < EPSILON && fabsf(posDiff.z) < EPSILON
+        && fabsf(uvDiff.x) < EPSILON && fabsf(uvDiff.y) < EPSILON;
+}
+
+// Checks whether model2 is a copy of model1 moved by some offset, which is returned in offset
+internal bool ObjModelsMatchUpToTranslation(const ObjModel& model1, const ObjModel& model2, Vec3* offset)
+{
+    if (model1.triangles.size != model2.triangles.size || model1.quads.size != model2.quads.size) {
+        return false;
+    }
+
+    *offset = ObjModelFirstPos(model2) - ObjModelFirstPos(model1);
+    for (uint32 i = 0; i < model1.triangles.size; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (!ObjVerticesMatch(model1.triangles[i].v[j], model2.triangles[i].v[j], *offset)) {
+                return false;
+            }
+        }
+    }
+    for (uint32 i = 0; i < model1.quads.size; i++) {
+        for (int j = 0; j < 4; j++) {
+            if (!ObjVerticesMatch(model1.quads[i].v[j], model2.quads[i].v[j], *offset)) {
+                return false;
+            }
+        }
     }
 
+    return true;
+}
+
+internal bool CreateRaycastMesh(const ObjModel& model, LinearAllocator* allocator, RaycastMesh* mesh)
+{
     const Vec3 vertexColor = Vec3::zero;
 
-    for (uint32 i = 0; i < obj.models.size; i++) {
-        RaycastMesh& mesh = geometry.meshes[i];
-        const uint32 numTriangles = obj.models[i].triangles.size + obj.models[i].quads.size * 2;
-        mesh.triangles = allocator->NewArray<RaycastTriangle>(numTriangles);
-        if (mesh.triangles.data == nullptr) {
-            LOG_ERROR("Failed to allocate triangles for raycast mesh %lu\n", i);
-            geometry.meshes.data = nullptr;
-            return geometry;
+    const uint32 numTriangles = model.triangles.size + model.quads.size * 2;
+    mesh->triangles = allocator->NewArray<RaycastTriangle>(numTriangles);
+    if (mesh->triangles.data == nullptr) {
+        return false;
+    }
+
+    // Fill in triangle geometry data
+    for (uint32 j = 0; j < model.triangles.size; j++) {
+        const ObjTriangle& t = model.triangles[j];
+        const Vec3 normal = CalculateTriangleUnitNormal(t.v[0].pos, t.v[1].pos, t.v[2].pos);
+
+        for (int k = 0; k < 3; k++) {
+            mesh->triangles[j].pos[k] = t.v[k].pos;
+            mesh->triangles[j].uvs[k] = t.v[k].uv;
+            mesh->triangles[j].color[k] = vertexColor;
         }
+        mesh->triangles[j].normal = normal;
+    }
+    for (uint32 j = 0; j < model.quads.size; j++) {
+        const uint32 ind = model.triangles.size + j * 2;
+        const ObjQuad& q = model.quads[j];
+        const Vec3 normal = CalculateTriangleUnitNormal(q.v[0].pos, q.v[1].pos, q.v[2].pos);
+
+        for (int k = 0; k < 3; k++) {
+            mesh->triangles[ind].pos[k] = q.v[k].pos;
+            mesh->triangles[ind].uvs[k] = q.v[k].uv;
+            mesh->triangles[ind].color[k] = vertexColor;
+        }
+        mesh->triangles[ind].normal = normal;
 
-        // Fill in triangle geometry data
-        for (uint32 j = 0; j < obj.models[i].triangles.size; j++) {
-            const ObjTriangle& t = obj.models[i].triangles[j];
-            const Vec3 normal = CalculateTriangleUnitNormal(t.v[0].pos, t.v[1].pos, t.v[2].pos);
+        for (int k = 0; k < 3; k++) {
+            const uint32 quadInd = (k + 2) % 4;
+            mesh->triangles[ind + 1].pos[k] = q.v[quadInd].pos;
+            mesh->triangles[ind + 1].uvs[k] = q.v[quadInd].uv;
+            mesh->triangles[ind + 1].color[k] = vertexColor;
+        }
+        mesh->triangles[ind + 1].normal = normal;
+    }
 
-            for (int k = 0; k < 3; k++) {
-                mesh.triangles[j].pos[k] = t.v[k].pos;
-                mesh.triangles[j].uvs[k] = t.v[k].uv;
-                mesh.triangles[j].color[k] = vertexColor;
+    // Calculate AABB
+    mesh->min = Vec3::one * 1e8;
+    mesh->max = -Vec3::one * 1e8;
+    for (uint32 j = 0; j < mesh->triangles.size; j++) {
+        for (int k = 0; k < 3; k++) {
+            const Vec3 v = mesh->triangles[j].pos[k];
+            for (int e = 0; e < 3; e++) {
+                mesh->min.e[e] = MinFloat32(mesh->min.e[e], v.e[e]);
+                mesh->max.e[e] = MaxFloat32(mesh->max.e[e], v.e[e]);
             }
-            mesh.triangles[j].normal = normal;
         }
-        for (uint32 j = 0; j < obj.models[i].quads.size; j++) {
-            const uint32 ind = obj.models[i].triangles.size + j * 2;
-            const ObjQuad& q = obj.models[i].quads[j];
-            const Vec3 normal = CalculateTriangleUnitNormal(q.v[0].pos, q.v[1].pos, q.v[2].pos);
+    }
 
-            for (int k = 0; k < 3; k++) {
-                mesh.triangles[ind].pos[k] = q.v[k].pos;
-                mesh.triangles[ind].uvs[k] = q.v[k].uv;
-                mesh.triangles[ind].color[k] = vertexColor;
-            }
-            mesh.triangles[ind].normal = normal;
+    return true;
+}
 
-            for (int k = 0; k < 3; k++) {
-                const uint32 quadInd = (k + 2) % 4;
-                mesh.triangles[ind + 1].pos[k] = q.v[quadInd].pos;
-                mesh.triangles[ind + 1].uvs[k] = q.v[quadInd].uv;
-                mesh.triangles[ind + 1].color[k] = vertexColor;
+RaycastGeometry CreateRaycastGeometry(const LoadObjResult& obj, LinearAllocator* allocator)
+{
+    RaycastGeometry geometry;
+    geometry.meshes.data = nullptr;
+    geometry.instances = allocator->NewArray<RaycastInstance>(obj.models.size);
+    if (geometry.instances.data == nullptr) {
+        return geometry;
+    }
+
+    // Find unique models. meshModelInds[m] is the obj model that mesh m's triangles are taken from.
+    Array<uint32> meshModelInds = allocator->NewArray<uint32>(obj.models.size);
+    if (meshModelInds.data == nullptr) {
+        return geometry;
+    }
+    meshModelInds.size = 0;
+    for (uint32 i = 0; i < obj.models.size; i++) {
+        RaycastInstance& instance = geometry.instances[i];
+        instance.meshInd = meshModelInds.size;
+        instance.offset = Vec3::zero;
+        for (uint32 m = 0; m < meshModelInds.size; m++) {
+            if (ObjModelsMatchUpToTranslation(obj.models[meshModelInds[m]], obj.models[i], &instance.offset)) {
+                instance.meshInd = m;
+                break;
             }
-            mesh.triangles[ind + 1].normal = normal;
         }
+        if (instance.meshInd == meshModelInds.size) {
+            instance.offset = Vec3::zero;
+            meshModelInds.data[meshModelInds.size++] = i;
+        }
+    }
+
+    Array<RaycastMesh> meshes = allocator->NewArray<RaycastMesh>(meshModelInds.size);
+    if (meshes.data == nullptr) {
+        return geometry;
+    }
+    for (uint32 m = 0; m < meshes.size; m++) {
+        if (!CreateRaycastMesh(obj.models[meshModelInds[m]], allocator, &meshes[m])) {
+            LOG_ERROR("Failed to allocate triangles for raycast mesh %lu\n", m);
+            return geometry;
+        }
+    }
+
+    LOG_INFO("Raycast geometry: %lu instances of %lu unique meshes\n", geometry.instances.size, meshes.size);
+
+    for (uint32 i = 0; i < geometry.instances.size; i++) {
+        RaycastInstance& instance = geometry.instances[i];
+        const RaycastMesh& mesh = meshes[instance.meshInd];
+        instance.min = mesh.min + instance.offset;
+        instance.max = mesh.max + instance.offset;
+        instance.occluder = true;
 
         float32 surfaceArea = 0.0f;
         for (uint32 j = 0; j < mesh.triangles.size; j++) {
@@ -384,33 +502,20 @@ RaycastGeometry CreateRaycastGeometry(const LoadObjResult& obj, LinearAllocator*
             surfaceArea += TriangleArea(t.pos[0], t.pos[1], t.pos[2]);
         }
 
-        // Calculate AABB
-        mesh.min = Vec3::one * 1e8;
-        mesh.max = -Vec3::one * 1e8;
-        for (uint32 j = 0; j < mesh.triangles.size; j++) {
-            for (int k = 0; k < 3; k++) {
-                const Vec3 v = mesh.triangles[j].pos[k];
-                for (int e = 0; e < 3; e++) {
-                    mesh.min.e[e] = MinFloat32(mesh.min.e[e], v.e[e]);
-                    mesh.max.e[e] = MaxFloat32(mesh.max.e[e], v.e[e]);
-                }
-            }
-        }
-
-        // Allocate lightmap
+        // Allocate lightmap, each instance receives its own lighting
         const uint32 size = (uint32)(sqrt(surfaceArea) * RESOLUTION_PER_WORLD_UNIT);
         const uint32 squareSize = RoundUpToPowerOfTwo(MinInt(size, 1024));
-        mesh.lightmap.squareSize = squareSize;
-        mesh.lightmap.pixels = allocator->New<uint32>(squareSize * squareSize);
-        if (mesh.lightmap.pixels == nullptr) {
+        instance.lightmap.squareSize = squareSize;
+        instance.lightmap.pixels = allocator->New<uint32>(squareSize * squareSize);
+        if (instance.lightmap.pixels == nullptr) {
             LOG_ERROR("Failed to allocate %dx%d pixels for lightmap %lu\n", squareSize, squareSize, i);
-            geometry.meshes.data = nullptr;
             return geometry;
         }
 
-        MemSet(mesh.lightmap.pixels, 0, squareSize * squareSize * sizeof(uint32));
+        MemSet(instance.lightmap.pixels, 0, squareSize * squareSize * sizeof(uint32));
     }
 
+    geometry.meshes = meshes;
     return geometry;
 }
 
@@ -450,10 +555,14 @@ internal float32 HemisphereGroupCloseness(const Array<Vec3>& samples, int groupI
     return closeness;
 }
 
-internal bool GenerateHemisphereSampleGroups(Array<SampleGroup> sampleGroups, LinearAllocator* allocator)
+internal bool GenerateHemisphereSampleGroups(Array<SampleGroup> sampleGroups, unsigned int seed,
+                                             LinearAllocator* allocator)
 {
     ALLOCATOR_SCOPE_RESET(*allocator);
 
+    // NOTE both the sample directions and the grouping shuffle draw from rand()
+    srand(seed);
+
     Array<Vec3> samples = {
         .size = sampleGroups.size * SAMPLES_PER_GROUP,
         .data = &sampleGroups[0].group[0]
@@ -471,9 +580,6 @@ internal bool GenerateHemisphereSampleGroups(Array<SampleGroup> sampleGroups, Li
         indices[i] = i;
     }
 
-    const unsigned int seed = (unsigned int)time(NULL);
-    srand(seed);
-
     const uint32 ITERATIONS = 10000;
     Array<int> minIndices = allocator->NewArray<int>(samples.size);
     if (minIndices.data == nullptr) {
@@ -514,188 +620,204 @@ internal bool GenerateHemisphereSampleGroups(Array<SampleGroup> sampleGroups, Li
     return true;
 }
 
-internal Vec3 RaycastColor(Array<SampleGroup> sampleGroups, Vec3 pos, Vec3 normal, const RaycastGeometry& geometry)
+// For reference: left wall is at  Y =  1.498721
+//                right wall is at Y = -1.544835
+const LightRect LIGHT_RECTS[] = {
+    {
+        .origin = { 4.0f, 1.498721f - 0.005f, 2.24f },
+        .width = { -2.0f, 0.0f, 0.0f },
+        .height = { 0.0f, 0.0f, -2.2f },
+        .color = { 1.0f, 0.0f, 0.0f },
+        .intensity = 2.0f
+    },
+    {
+        .origin = { 2.0f, -1.544835f + 0.005f, 2.24f },
+        .width = { 2.0f, 0.0f, 0.0f },
+        .height = { 0.0f, 0.0f, -2.2f },
+        .color = { 0.0f, 0.0f, 1.0f },
+        .intensity = 2.0f
+    },
+};
+
+const float32 MATERIAL_REFLECTANCE = 0.3f;
+
+// Traces a packet of 8 rays from pos, starting each one offset along its direction to avoid self-intersection,
+// and returns the light arriving back along each ray: light rect emission or the previous bounce's lightmap.
+internal void TraceRadiance_8(const StaticArray<Vec3, 8>& dirs, Vec3 pos, float32 offset,
+                              const RaycastGeometry& geometry, StaticArray<Vec3, 8>* radiance)
 {
-    // For reference: left wall is at  Y =  1.498721
-    //                right wall is at Y = -1.544835
-    const LightRect LIGHT_RECTS[] = {
-        {
-            .origin = { 4.0f, 1.498721f - 0.005f, 2.24f },
-            .width = { -2.0f, 0.0f, 0.0f },
-            .height = { 0.0f, 0.0f, -2.2f },
-            .color = Vec3 { 1.0f, 0.0f, 0.0f },
-            .intensity = 2.0f
-        },
-        {
-            .origin = { 2.0f, -1.544835f + 0.005f, 2.24f },
-            .width = { 2.0f, 0.0f, 0.0f },
-            .height = { 0.0f, 0.0f, -2.2f },
-            .color = Vec3 { 0.0f, 0.0f, 1.0f },
-            .intensity = 2.0f
-        },
-    };
+    const float32 largeFloat = 1e8;
+    const __m256 largeFloat8 = _mm256_set1_ps(largeFloat);
+    const __m256 zero8 = _mm256_setzero_ps();
+    const Vec3_8 pos8 = Set1Vec3_8(pos);
+    const __m256 offset8 = _mm256_set1_ps(offset);
+
+    const Vec3_8 sampleNormal8 = SetVec3_8(dirs);
+    const Vec3_8 sampleNormalInv8 = Inverse_8(sampleNormal8);
+    const Vec3_8 originOffset8 = Add_8(pos8, Multiply_8(sampleNormal8, offset8));
+
+    __m256i closestInstanceInd8 = _mm256_set1_epi32(geometry.instances.size);
+    __m256i closestTriangleInd8 = _mm256_undefined_si256();
+    __m256 closestTriangleDist8 = largeFloat8;
+    for (uint32 i = 0; i < geometry.instances.size; i++) {
+        const RaycastInstance& instance = geometry.instances[i];
+        if (!instance.occluder) continue;
+
+        const __m256i instanceInd8 = _mm256_set1_epi32(i);
+        // TODO also return min distance, and compare with closestTriangleDist8 ?
+        const __m256 intersect8 = RayAxisAlignedBoxIntersection_8(originOffset8, sampleNormalInv8,
+                                                                  instance.min, instance.max);
+        const int allZero = _mm256_testc_ps(zero8, intersect8);
+        if (allZero) {
+            continue;
+        }
+
+        // Trace against the shared mesh in its own space, translation doesn't change ray direction or distance
+        const RaycastMesh& mesh = geometry.meshes[instance.meshInd];
+        const Vec3_8 meshOrigin8 = Subtract_8(originOffset8, Set1Vec3_8(instance.offset));
+        for (uint32 j = 0; j < mesh.triangles.size; j++) {
+            const RaycastTriangle& triangle = mesh.triangles[j];
+            const __m256i triangleInd8 = _mm256_set1_epi32(j);
+            __m256 t8;
+            const __m256 tIntersect8 = RayTriangleIntersection_8(meshOrigin8, sampleNormal8,
+                                                                 triangle.pos[0], triangle.pos[1], triangle.pos[2],
+                                                                 &t8);
+
+            const __m256 closerMask8 = _mm256_and_ps(_mm256_cmp_ps(t8, closestTriangleDist8, _CMP_LT_OQ), tIntersect8);
+            closestTriangleDist8 = _mm256_blendv_ps(closestTriangleDist8, t8, closerMask8);
+
+            const __m256i closerMask8i = _mm256_castps_si256(closerMask8);
+            closestInstanceInd8 = _mm256_blendv_epi8(closestInstanceInd8, instanceInd8, closerMask8i);
+            closestTriangleInd8 = _mm256_blendv_epi8(closestTriangleInd8, triangleInd8, closerMask8i);
+        }
+    }
+
+    __m256i closestLightInd8 = _mm256_set1_epi32(C_ARRAY_LENGTH(LIGHT_RECTS));
+    __m256 closestLightDist8 = largeFloat8;
+    for (int l = 0; l < C_ARRAY_LENGTH(LIGHT_RECTS); l++) {
+        const __m256i lightInd = _mm256_set1_epi32(l);
+        const Vec3_8 lightRectOrigin8 = Set1Vec3_8(LIGHT_RECTS[l].origin);
+        const Vec3_8 lightRectNormal8 = Set1Vec3_8(Normalize(Cross(LIGHT_RECTS[l].width, LIGHT_RECTS[l].height)));
+
+        const Vec3_8 lightWidth8 = Set1Vec3_8(LIGHT_RECTS[l].width);
+        const Vec3_8 lightHeight8 = Set1Vec3_8(LIGHT_RECTS[l].height);
+        const __m256 lightRectWidth8 = Mag_8(lightWidth8);
+        const Vec3_8 lightRectUnitWidth8 = Divide_8(lightWidth8, lightRectWidth8);
+        const __m256 lightRectHeight8 = Mag_8(lightHeight8);
+        const Vec3_8 lightRectUnitHeight8 = Divide_8(lightHeight8, lightRectHeight8);
+
+        __m256 t8;
+        const __m256 pIntersect8 = RayPlaneIntersection_8(pos8, sampleNormal8,
+                                                          lightRectOrigin8, lightRectNormal8, &t8);
+
+        // Pixels are lit only when 0.0f <= t < closestTriangleDist
+        __m256 lit8 = _mm256_and_ps(pIntersect8, _mm256_cmp_ps(zero8, t8, _CMP_LE_OQ));
+        lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(t8, closestTriangleDist8, _CMP_LT_OQ));
+
+        const Vec3_8 intersect8 = Add_8(pos8, Multiply_8(sampleNormal8, t8));
+        const Vec3_8 rectOriginToIntersect8 = Subtract_8(intersect8, lightRectOrigin8);
+
+        const __m256 projWidth8 = Dot_8(rectOriginToIntersect8, lightRectUnitWidth8);
+        lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(zero8, projWidth8, _CMP_LE_OQ));
+        lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(projWidth8, lightRectWidth8, _CMP_LE_OQ));
+
+        const __m256 projHeight8 = Dot_8(rectOriginToIntersect8, lightRectUnitHeight8);
+        lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(zero8, projHeight8, _CMP_LE_OQ));
+        lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(projHeight8, lightRectHeight8, _CMP_LE_OQ));
+
+        closestLightDist8 = _mm256_blendv_ps(closestLightDist8, t8, lit8);
+        const __m256i lit8i = _mm256_castps_si256(lit8);
+        closestLightInd8 = _mm256_blendv_epi8(closestLightInd8, lightInd, lit8i);
+    }
 
-    const float32 MATERIAL_REFLECTANCE = 0.3f;
+    // TODO wow... there's definitely a better way to do this... right?
+    const int32 lightInds[8] = {
+        _mm256_extract_epi32(closestLightInd8, 0),
+        _mm256_extract_epi32(closestLightInd8, 1),
+        _mm256_extract_epi32(closestLightInd8, 2),
+        _mm256_extract_epi32(closestLightInd8, 3),
+        _mm256_extract_epi32(closestLightInd8, 4),
+        _mm256_extract_epi32(closestLightInd8, 5),
+        _mm256_extract_epi32(closestLightInd8, 6),
+        _mm256_extract_epi32(closestLightInd8, 7),
+    };
+    const int32 instanceInds[8] = {
+        _mm256_extract_epi32(closestInstanceInd8, 0),
+        _mm256_extract_epi32(closestInstanceInd8, 1),
+        _mm256_extract_epi32(closestInstanceInd8, 2),
+        _mm256_extract_epi32(closestInstanceInd8, 3),
+        _mm256_extract_epi32(closestInstanceInd8, 4),
+        _mm256_extract_epi32(closestInstanceInd8, 5),
+        _mm256_extract_epi32(closestInstanceInd8, 6),
+        _mm256_extract_epi32(closestInstanceInd8, 7),
+    };
+    const int32 triangleInds[8] = {
+        _mm256_extract_epi32(closestTriangleInd8, 0),
+        _mm256_extract_epi32(closestTriangleInd8, 1),
+        _mm256_extract_epi32(closestTriangleInd8, 2),
+        _mm256_extract_epi32(closestTriangleInd8, 3),
+        _mm256_extract_epi32(closestTriangleInd8, 4),
+        _mm256_extract_epi32(closestTriangleInd8, 5),
+        _mm256_extract_epi32(closestTriangleInd8, 6),
+        _mm256_extract_epi32(closestTriangleInd8, 7),
+    };
+    for (int i = 0; i < 8; i++) {
+        (*radiance)[i] = Vec3::zero;
+        if (lightInds[i] != C_ARRAY_LENGTH(LIGHT_RECTS)) {
+            (*radiance)[i] = LIGHT_RECTS[lightInds[i]].intensity * LIGHT_RECTS[lightInds[i]].color;
+        }
+        else if ((uint32)instanceInds[i] != geometry.instances.size) {
+            const RaycastInstance& instance = geometry.instances[instanceInds[i]];
+            const Lightmap& lightmap = instance.lightmap;
+            const int squareSize = lightmap.squareSize;
+            const RaycastTriangle& triangle = geometry.meshes[instance.meshInd].triangles[triangleInds[i]];
+            const Vec3 originOffset = pos + dirs[i] * offset - instance.offset;
+
+            Vec3 b;
+            const bool result = BarycentricCoordinates(originOffset, dirs[i],
+                                                       triangle.pos[0], triangle.pos[1], triangle.pos[2], &b);
+            const Vec2 uv = triangle.uvs[0] * b.x + triangle.uvs[1] * b.y + triangle.uvs[2] * b.z;
+            const Vec2Int pixel = { (int)(uv.x * squareSize), (int)(uv.y * squareSize) };
+            if (0 <= pixel.x && pixel.x < squareSize && 0 <= pixel.y && pixel.y < squareSize) {
+                const uint32 pixelValue = lightmap.pixels[pixel.y * squareSize + pixel.x];
+                uint32 pixelR = pixelValue & 0xff;
+                uint32 pixelG = (pixelValue >> 8) & 0xff;
+                uint32 pixelB = (pixelValue >> 16) & 0xff;
+                const Vec3 pixelColor = {
+                    (float32)pixelR / 255.0f,
+                    (float32)pixelG / 255.0f,
+                    (float32)pixelB / 255.0f
+                };
+                // TODO adjust color based on material properties, e.g. material should absorb some light
+                (*radiance)[i] = MATERIAL_REFLECTANCE * pixelColor;
+            }
+        }
+    }
+}
 
+internal Vec3 RaycastColor(Array<SampleGroup> sampleGroups, Vec3 pos, Vec3 normal, const RaycastGeometry& geometry)
+{
     const uint32 numSamples = sampleGroups.size * SAMPLES_PER_GROUP;
 
     // NOTE this will do unknown-ish things with "up" direction
     const Quat xToNormalRot = QuatRotBetweenVectors(Vec3::unitX, normal);
 
-    const float32 largeFloat = 1e8;
-    const __m256 largeFloat8 = _mm256_set1_ps(largeFloat);
-    const __m256 zero8 = _mm256_setzero_ps();
-    const Vec3_8 pos8 = Set1Vec3_8(pos);
-    const Quat_8 xToNormalRot8 = Set1Quat_8(xToNormalRot);
     const float32 offset = 0.001f;
-    const __m256 offset8 = _mm256_set1_ps(offset);
     const float32 sampleContribution = 1.0f / (float32)numSamples;
 
     static_assert(SAMPLES_PER_GROUP == 8);
 
     Vec3 outputColor = Vec3::zero;
     for (uint32 m = 0; m < sampleGroups.size; m++) {
-        const Vec3_8 sample8 = SetVec3_8(sampleGroups[m].group);
-        const Vec3_8 sampleNormal8 = Multiply_8(xToNormalRot8, sample8);
-        const Vec3_8 sampleNormalInv8 = Inverse_8(sampleNormal8);
-        const Vec3_8 originOffset8 = Add_8(pos8, Multiply_8(sampleNormal8, offset8));
-
-        __m256i closestMeshInd8 = _mm256_set1_epi32(geometry.meshes.size);
-        __m256i closestTriangleInd8 = _mm256_undefined_si256();
-        __m256 closestTriangleDist8 = largeFloat8;
-        for (uint32 i = 0; i < geometry.meshes.size; i++) {
-#if RESTRICT_LIGHTING && RESTRICT_OCCLUSION
-            if (i != MODEL_TO_OCCLUDE) continue;
-#endif
-            const RaycastMesh& mesh = geometry.meshes[i];
-            const __m256i meshInd8 = _mm256_set1_epi32(i);
-            // TODO also return min distance, and compare with closestTriangleDist8 ?
-            const __m256 intersect8 = RayAxisAlignedBoxIntersection_8(originOffset8, sampleNormalInv8,
-                                                                      mesh.min, mesh.max);
-            const int allZero = _mm256_testc_ps(zero8, intersect8);
-            if (allZero) {
-                continue;
-            }
-
-            for (uint32 j = 0; j < mesh.triangles.size; j++) {
-                const RaycastTriangle& triangle = mesh.triangles[j];
-                const __m256i triangleInd8 = _mm256_set1_epi32(j);
-                __m256 t8;
-                const __m256 tIntersect8 = RayTriangleIntersection_8(originOffset8, sampleNormal8,
-                                                                     triangle.pos[0], triangle.pos[1], triangle.pos[2],
-                                                                     &t8);
-
-                const __m256 closerMask8 = _mm256_and_ps(_mm256_cmp_ps(t8, closestTriangleDist8, _CMP_LT_OQ), tIntersect8);
-                closestTriangleDist8 = _mm256_blendv_ps(closestTriangleDist8, t8, closerMask8);
-
-                const __m256i closerMask8i = _mm256_castps_si256(closerMask8);
-                closestMeshInd8 = _mm256_blendv_epi8(closestMeshInd8, meshInd8, closerMask8i);
-                closestTriangleInd8 = _mm256_blendv_epi8(closestTriangleInd8, triangleInd8, closerMask8i);
-            }
-        }
-
-        __m256i closestLightInd8 = _mm256_set1_epi32(C_ARRAY_LENGTH(LIGHT_RECTS));
-        __m256 closestLightDist8 = largeFloat8;
-        for (int l = 0; l < C_ARRAY_LENGTH(LIGHT_RECTS); l++) {
-            const __m256i lightInd = _mm256_set1_epi32(l);
-            const Vec3_8 lightRectOrigin8 = Set1Vec3_8(LIGHT_RECTS[l].origin);
-            const Vec3_8 lightRectNormal8 = Set1Vec3_8(Normalize(Cross(LIGHT_RECTS[l].width, LIGHT_RECTS[l].height)));
-
-            const Vec3_8 lightWidth8 = Set1Vec3_8(LIGHT_RECTS[l].width);
-            const Vec3_8 lightHeight8 = Set1Vec3_8(LIGHT_RECTS[l].height);
-            const __m256 lightRectWidth8 = Mag_8(lightWidth8);
-            const Vec3_8 lightRectUnitWidth8 = Divide_8(lightWidth8, lightRectWidth8);
-            const __m256 lightRectHeight8 = Mag_8(lightHeight8);
-            const Vec3_8 lightRectUnitHeight8 = Divide_8(lightHeight8, lightRectHeight8);
+        StaticArray<Vec3, 8> dirs;
+        for (int i = 0; i < 8; i++) {
+            dirs[i] = xToNormalRot * sampleGroups[m].group[i];
+        }
 
-            __m256 t8;
-            const __m256 pIntersect8 = RayPlaneIntersection_8(pos8, sampleNormal8,
-                                                              lightRectOrigin8, lightRectNormal8, &t8);
-
-            // Pixels are lit only when 0.0f <= t < closestTriangleDist
-            __m256 lit8 = _mm256_and_ps(pIntersect8, _mm256_cmp_ps(zero8, t8, _CMP_LE_OQ));
-            lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(t8, closestTriangleDist8, _CMP_LT_OQ));
-
-            const Vec3_8 intersect8 = Add_8(pos8, Multiply_8(sampleNormal8, t8));
-            const Vec3_8 rectOriginToIntersect8 = Subtract_8(intersect8, lightRectOrigin8);
-
-            const __m256 projWidth8 = Dot_8(rectOriginToIntersect8, lightRectUnitWidth8);
-            lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(zero8, projWidth8, _CMP_LE_OQ));
-            lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(projWidth8, lightRectWidth8, _CMP_LE_OQ));
-
-            const __m256 projHeight8 = Dot_8(rectOriginToIntersect8, lightRectUnitHeight8);
-            lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(zero8, projHeight8, _CMP_LE_OQ));
-            lit8 = _mm256_and_ps(lit8, _mm256_cmp_ps(projHeight8, lightRectHeight8, _CMP_LE_OQ));
-
-            closestLightDist8 = _mm256_blendv_ps(closestLightDist8, t8, lit8);
-            const __m256i lit8i = _mm256_castps_si256(lit8);
-            closestLightInd8 = _mm256_blendv_epi8(closestLightInd8, lightInd, lit8i);
-        }
-
-        // TODO wow... there's definitely a better way to do this... right?
-        const int32 lightInds[8] = {
-            _mm256_extract_epi32(closestLightInd8, 0),
-            _mm256_extract_epi32(closestLightInd8, 1),
-            _mm256_extract_epi32(closestLightInd8, 2),
-            _mm256_extract_epi32(closestLightInd8, 3),
-            _mm256_extract_epi32(closestLightInd8, 4),
-            _mm256_extract_epi32(closestLightInd8, 5),
-            _mm256_extract_epi32(closestLightInd8, 6),
-            _mm256_extract_epi32(closestLightInd8, 7),
-        };
-        const int32 meshInds[8] = {
-            _mm256_extract_epi32(closestMeshInd8, 0),
-            _mm256_extract_epi32(closestMeshInd8, 1),
-            _mm256_extract_epi32(closestMeshInd8, 2),
-            _mm256_extract_epi32(closestMeshInd8, 3),
-            _mm256_extract_epi32(closestMeshInd8, 4),
-            _mm256_extract_epi32(closestMeshInd8, 5),
-            _mm256_extract_epi32(closestMeshInd8, 6),
-            _mm256_extract_epi32(closestMeshInd8, 7),
-        };
-        const int32 triangleInds[8] = {
-            _mm256_extract_epi32(closestTriangleInd8, 0),
-            _mm256_extract_epi32(closestTriangleInd8, 1),
-            _mm256_extract_epi32(closestTriangleInd8, 2),
-            _mm256_extract_epi32(closestTriangleInd8, 3),
-            _mm256_extract_epi32(closestTriangleInd8, 4),
-            _mm256_extract_epi32(closestTriangleInd8, 5),
-            _mm256_extract_epi32(closestTriangleInd8, 6),
-            _mm256_extract_epi32(closestTriangleInd8, 7),
-        };
+        StaticArray<Vec3, 8> radiance;
+        TraceRadiance_8(dirs, pos, offset, geometry, &radiance);
         for (int i = 0; i < 8; i++) {
-            if (lightInds[i] != C_ARRAY_LENGTH(LIGHT_RECTS)) {
-                const float32 lightIntensity = LIGHT_RECTS[lightInds[i]].intensity;
-                outputColor += lightIntensity * sampleContribution * LIGHT_RECTS[lightInds[i]].color;
-            }
-            else if ((uint32)meshInds[i] != geometry.meshes.size) {
-                const RaycastMesh& mesh = geometry.meshes[meshInds[i]];
-                const Lightmap& lightmap = mesh.lightmap;
-                const int squareSize = lightmap.squareSize;
-                const RaycastTriangle& triangle = mesh.triangles[triangleInds[i]];
-                const Vec3 sampleNormal = xToNormalRot * sampleGroups[m].group[i];
-                const Vec3 originOffset = pos + sampleNormal * offset;
-
-                Vec3 b;
-                const bool result = BarycentricCoordinates(originOffset, sampleNormal,
-                                                           triangle.pos[0], triangle.pos[1], triangle.pos[2], &b);
-                const Vec2 uv = triangle.uvs[0] * b.x + triangle.uvs[1] * b.y + triangle.uvs[2] * b.z;
-                const Vec2Int pixel = { (int)(uv.x * squareSize), (int)(uv.y * squareSize) };
-                if (0 <= pixel.x && pixel.x < squareSize && 0 <= pixel.y && pixel.y < squareSize) {
-                    const uint32 pixelValue = lightmap.pixels[pixel.y * squareSize + pixel.x];
-                    uint32 pixelR = pixelValue & 0xff;
-                    uint32 pixelG = (pixelValue >> 8) & 0xff;
-                    uint32 pixelB = (pixelValue >> 16) & 0xff;
-                    const Vec3 pixelColor = {
-                        (float32)pixelR / 255.0f,
-                        (float32)pixelG / 255.0f,
-                        (float32)pixelB / 255.0f
-                    };
-                    // TODO adjust color based on material properties, e.g. material should absorb some light
-                    float32 weight = MATERIAL_REFLECTANCE;
-                    outputColor += weight * sampleContribution * pixelColor;
-                }
-            }
+            outputColor += sampleContribution * radiance[i];
         }
     }
 
@@ -705,6 +827,87 @@ internal Vec3 RaycastColor(Array<SampleGroup> sampleGroups, Vec3 pos, Vec3 norma
     return outputColor;
 }
 
+// Any-hit test for a packet of 8 rays, set for each ray blocked closer than maxDist. Instances out of reach of pos
+// are skipped before any packet math, and tracing stops as soon as every ray is blocked, so short rays are cheap.
+internal __m256 TraceOcclusion_8(const StaticArray<Vec3, 8>& dirs, Vec3 pos, float32 offset, float32 maxDist,
+                                 const RaycastGeometry& geometry)
+{
+    const __m256 zero8 = _mm256_setzero_ps();
+    const __m256 maxDist8 = _mm256_set1_ps(maxDist);
+
+    const Vec3_8 dir8 = SetVec3_8(dirs);
+    const Vec3_8 dirInv8 = Inverse_8(dir8);
+    const Vec3_8 originOffset8 = Add_8(Set1Vec3_8(pos), Multiply_8(dir8, _mm256_set1_ps(offset)));
+
+    __m256 occluded8 = zero8;
+    for (uint32 i = 0; i < geometry.instances.size; i++) {
+        const RaycastInstance& instance = geometry.instances[i];
+        if (!instance.occluder) continue;
+
+        float32 boxDistSq = 0.0f;
+        for (int e = 0; e < 3; e++) {
+            const float32 d = MaxFloat32(MaxFloat32(instance.min.e[e] - pos.e[e], pos.e[e] - instance.max.e[e]), 0.0f);
+            boxDistSq += d * d;
+        }
+        if (boxDistSq > maxDist * maxDist) continue;
+
+        const __m256 intersect8 = RayAxisAlignedBoxIntersection_8(originOffset8, dirInv8, instance.min, instance.max);
+        if (_mm256_testc_ps(zero8, intersect8)) continue;
+
+        const RaycastMesh& mesh = geometry.meshes[instance.meshInd];
+        const Vec3_8 meshOrigin8 = Subtract_8(originOffset8, Set1Vec3_8(instance.offset));
+        for (uint32 j = 0; j < mesh.triangles.size; j++) {
+            const RaycastTriangle& triangle = mesh.triangles[j];
+            __m256 t8;
+            const __m256 tIntersect8 = RayTriangleIntersection_8(meshOrigin8, dir8,
+                                                                 triangle.pos[0], triangle.pos[1], triangle.pos[2],
+                                                                 &t8);
+            const __m256 hit8 = _mm256_and_ps(tIntersect8, _mm256_cmp_ps(t8, maxDist8, _CMP_LT_OQ));
+            occluded8 = _mm256_or_ps(occluded8, hit8);
+            if (_mm256_movemask_ps(occluded8) == 0xff) {
+                return occluded8;
+            }
+        }
+    }
+
+    return occluded8;
+}
+
+// Cosine-weighted fraction of the hemisphere around normal that is unoccluded within maxDist. bentNormal is set to
+// the average unoccluded direction, or to normal if every sample is blocked.
+internal float32 RaycastAmbientOcclusion(Array<SampleGroup> sampleGroups, Vec3 pos, Vec3 normal, float32 maxDist,
+                                         const RaycastGeometry& geometry, Vec3* bentNormal)
+{
+    const Quat xToNormalRot = QuatRotBetweenVectors(Vec3::unitX, normal);
+    const float32 offset = 0.001f;
+
+    static_assert(SAMPLES_PER_GROUP == 8);
+
+    float32 visibleWeight = 0.0f;
+    float32 totalWeight = 0.0f;
+    Vec3 visibleDirSum = Vec3::zero;
+    for (uint32 m = 0; m < sampleGroups.size; m++) {
+        StaticArray<Vec3, 8> dirs;
+        for (int i = 0; i < 8; i++) {
+            dirs[i] = xToNormalRot * sampleGroups[m].group[i];
+        }
+
+        const int occludedMask = _mm256_movemask_ps(TraceOcclusion_8(dirs, pos, offset, maxDist, geometry));
+        for (int i = 0; i < 8; i++) {
+            // Samples are uniform over the +X hemisphere, so x is the cosine to the normal
+            const float32 cosTheta = sampleGroups[m].group[i].x;
+            totalWeight += cosTheta;
+            if ((occludedMask & (1 << i)) == 0) {
+                visibleWeight += cosTheta;
+                visibleDirSum += dirs[i];
+            }
+        }
+    }
+
+    *bentNormal = MagSq(visibleDirSum) > 0.0f ? Normalize(visibleDirSum) : normal;
+    return totalWeight > 0.0f ? visibleWeight / totalWeight : 1.0f;
+}
+
 struct WorkLightmapRasterizeRowCommon
 {
     Array<SampleGroup> hemisphereSampleGroups;
@@ -724,14 +927,15 @@ void LightmapRasterizeRow(const RaycastGeometry& geometry, uint32 meshInd, uint3
                           int minPixelX, int maxPixelX, int pixelY, Array<SampleGroup> hemisphereSampleGroups,
                           Lightmap* lightmap)
 {
-    const RaycastTriangle& triangle = geometry.meshes[meshInd].triangles[triangleInd];
+    const RaycastInstance& instance = geometry.instances[meshInd];
+    const RaycastTriangle& triangle = geometry.meshes[instance.meshInd].triangles[triangleInd];
     const uint32 squareSize = lightmap->squareSize;
     const float32 uvY = (float32)pixelY / squareSize;
 
     for (int x = minPixelX; x < maxPixelX; x++) {
         const float32 uvX = (float32)x / squareSize;
         const Vec3 bC = BarycentricCoordinates(Vec2 { uvX, uvY }, triangle.uvs[0], triangle.uvs[1], triangle.uvs[2]);
-        const Vec3 p = triangle.pos[0] * bC.x + triangle.pos[1] * bC.y + triangle.pos[2] * bC.z;
+        const Vec3 p = triangle.pos[0] * bC.x + triangle.pos[1] * bC.y + triangle.pos[2] * bC.z + instance.offset;
 
         const Vec3 raycastColor = RaycastColor(hemisphereSampleGroups, p, triangle.normal, geometry);
         uint8 r = (uint8)(raycastColor.r * 255.0f);
@@ -742,6 +946,28 @@ void LightmapRasterizeRow(const RaycastGeometry& geometry, uint32 meshInd, uint3
     }
 }
 
+// Checks a triangle against the request's triangle range and region. Shards are handled separately.
+internal bool IsTriangleSelected(const RaycastGeometry& geometry, uint32 meshInd, uint32 triangleInd,
+                                 const LightmapBakeRequest& request)
+{
+    if (triangleInd < request.triangleStart || triangleInd >= request.triangleEnd) {
+        return false;
+    }
+
+    if (request.restrictRegion) {
+        const RaycastInstance& instance = geometry.instances[meshInd];
+        const RaycastTriangle& t = geometry.meshes[instance.meshInd].triangles[triangleInd];
+        const Vec3 centroid = (t.pos[0] + t.pos[1] + t.pos[2]) / 3.0f + instance.offset;
+        for (int e = 0; e < 3; e++) {
+            if (centroid.e[e] < request.regionMin.e[e] || centroid.e[e] > request.regionMax.e[e]) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 uint32 bounce_ = 0;
 
 void ThreadLightmapRasterizeRow(AppWorkQueue* queue, void* data)
@@ -753,7 +979,8 @@ void ThreadLightmapRasterizeRow(AppWorkQueue* queue, void* data)
         const RaycastGeometry& geometry = *workData->common->geometry;
         const int32 meshInd = workData->common->meshInd;
         LOG_INFO("%d rows in queue | bounce %lu, mesh %lu, triangle %lu/%lu, row %d (%d pixels)\n",
-                 remaining, bounce_, meshInd, workData->triangleInd, geometry.meshes[meshInd].triangles.size,
+                 remaining, bounce_, meshInd, workData->triangleInd,
+                 geometry.meshes[geometry.instances[meshInd].meshInd].triangles.size,
                  workData->pixelY, workData->maxPixelX - workData->minPixelX);
     }
 
@@ -763,7 +990,8 @@ void ThreadLightmapRasterizeRow(AppWorkQueue* queue, void* data)
 }
 
 #if 0
-internal bool CalculateLightmapForMesh(const RaycastGeometry& geometry, uint32 meshInd, AppWorkQueue* queue,
+internal bool CalculateLightmapForMesh(const RaycastGeometry& geometry, uint32 meshInd,
+                                       const LightmapBakeRequest& request, AppWorkQueue* queue,
                                        LinearAllocator* allocator, Lightmap* lightmap)
 {
     const int LIGHTMAP_PIXEL_MARGIN = 1;
@@ -773,7 +1001,7 @@ internal bool CalculateLightmapForMesh(const RaycastGeometry& geometry, uint32 m
         LOG_ERROR("Failed to allocate hemisphere sample groups\n");
         return false;
     }
-    if (!GenerateHemisphereSampleGroups(hemisphereSampleGroups, allocator)) {
+    if (!GenerateHemisphereSampleGroups(hemisphereSampleGroups, LIGHTMAP_SAMPLE_SEED + meshInd, allocator)) {
         LOG_ERROR("Failed to generate hemisphere sample groups\n");
         return false;
     }
@@ -786,13 +1014,11 @@ internal bool CalculateLightmapForMesh(const RaycastGeometry& geometry, uint32 m
     };
     auto allocatorState = allocator->SaveState();
 
-    const RaycastMesh& mesh = geometry.meshes[meshInd];
-    const uint32 squareSize = mesh.lightmap.squareSize;
+    const RaycastMesh& mesh = geometry.meshes[geometry.instances[meshInd].meshInd];
+    const uint32 squareSize = geometry.instances[meshInd].lightmap.squareSize;
 
     for (uint32 i = 0; i < mesh.triangles.size; i++) {
-#if RESTRICT_LIGHTING && RESTRICT_WALL
-        if (i / 2 != PLANE_TO_LIGHT) continue;
-#endif
+        if (!IsTriangleSelected(geometry, meshInd, i, request)) continue;
         const RaycastTriangle& triangle = mesh.triangles[i];
         const Vec2 minUv = {
             MinFloat32(triangle.uvs[0].x, MinFloat32(triangle.uvs[1].x, triangle.uvs[2].x)),
@@ -871,72 +1097,567 @@ internal bool CalculateLightmapForMesh(const RaycastGeometry& geometry, uint32 m
 }
 #endif
 
-bool LightMeshVertices(const RaycastGeometry& geometry, uint32 meshInd, LinearAllocator* allocator,
-                       Array<Vec3> vertexColors)
+internal uint64 HashFnv1a(uint64 hash, const void* data, uint32 size)
+{
+    const uint8* bytes = (const uint8*)data;
+    for (uint32 i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+uint64 HashObjModel(const ObjModel& model)
+{
+    uint64 hash = 0xcbf29ce484222325;
+    hash = HashFnv1a(hash, &model.triangles.size, sizeof(model.triangles.size));
+    for (uint32 i = 0; i < model.triangles.size; i++) {
+        for (int j = 0; j < 3; j++) {
+            hash = HashFnv1a(hash, &model.triangles[i].v[j].pos, sizeof(Vec3));
+        }
+    }
+    hash = HashFnv1a(hash, &model.quads.size, sizeof(model.quads.size));
+    for (uint32 i = 0; i < model.quads.size; i++) {
+        for (int j = 0; j < 4; j++) {
+            hash = HashFnv1a(hash, &model.quads[i].v[j].pos, sizeof(Vec3));
+        }
+    }
+
+    return hash;
+}
+
+uint32 EncodeRGB9E5(Vec3 color)
+{
+    // Same packing as VK_FORMAT_E5B9G9R9_UFLOAT_PACK32: r in bits 0-8, g 9-17, b 18-26, exponent 27-31
+    const int MANTISSA_BITS = 9;
+    const int EXP_BIAS = 15;
+    const int MAX_EXP = 31;
+    const float32 MAX_VALUE = (float32)((1 << MANTISSA_BITS) - 1) / (1 << MANTISSA_BITS) * (float32)(1 << (MAX_EXP - EXP_BIAS));
+
+    const float32 r = ClampFloat32(color.r, 0.0f, MAX_VALUE);
+    const float32 g = ClampFloat32(color.g, 0.0f, MAX_VALUE);
+    const float32 b = ClampFloat32(color.b, 0.0f, MAX_VALUE);
+    const float32 maxComponent = MaxFloat32(r, MaxFloat32(g, b));
+    if (!(maxComponent > 0.0f)) {
+        // Black, or NaN. log2f would give -inf, which doesn't convert to int.
+        return 0;
+    }
+
+    int exp = MaxInt((int)floorf(log2f(maxComponent)), -EXP_BIAS - 1) + 1 + EXP_BIAS;
+    float32 scale = exp2f((float32)(exp - EXP_BIAS - MANTISSA_BITS));
+    if ((int)floorf(maxComponent / scale + 0.5f) == (1 << MANTISSA_BITS)) {
+        exp++;
+        scale *= 2.0f;
+    }
+
+    const uint32 rm = (uint32)floorf(r / scale + 0.5f);
+    const uint32 gm = (uint32)floorf(g / scale + 0.5f);
+    const uint32 bm = (uint32)floorf(b / scale + 0.5f);
+    return rm | (gm << 9) | (bm << 18) | ((uint32)exp << 27);
+}
+
+bool MapFileReadOnly(const_string filePath, LinearAllocator* allocator, MappedFile* mappedFile)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+
+    const char* filePathC = ToCString(filePath, allocator);
+    HANDLE fileHandle = CreateFileA(filePathC, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                    FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0 || fileSize.QuadPart > UINT32_MAX) {
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle == NULL) {
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    void* data = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    mappedFile->fileHandle = fileHandle;
+    mappedFile->mappingHandle = mappingHandle;
+    mappedFile->data.size = (uint32)fileSize.QuadPart;
+    mappedFile->data.data = (uint8*)data;
+    return true;
+}
+
+void UnmapFile(MappedFile* mappedFile)
+{
+    UnmapViewOfFile(mappedFile->data.data);
+    CloseHandle((HANDLE)mappedFile->mappingHandle);
+    CloseHandle((HANDLE)mappedFile->fileHandle);
+    mappedFile->data.size = 0;
+    mappedFile->data.data = nullptr;
+}
+
+// Marks the vertices of triangles outside a request. Every shard marks the same ones, and colors are never negative,
+// so they stay negative when shards are summed. Their baked colors are kept when the vertex file is written.
+const Vec3 LIGHTMAP_VERTEX_UNSELECTED = { -1.0f, -1.0f, -1.0f };
+
+// Sample directions of a mesh's vertices, the same every time it's baked. Empty if they couldn't be allocated.
+internal Array<SampleGroup> GetMeshSampleGroups(uint32 meshInd, LinearAllocator* allocator)
 {
     Array<SampleGroup> hemisphereSampleGroups = allocator->NewArray<SampleGroup>(NUM_HEMISPHERE_SAMPLE_GROUPS);
     if (hemisphereSampleGroups.data == nullptr) {
         LOG_ERROR("Failed to allocate hemisphere sample groups\n");
-        return false;
+        return hemisphereSampleGroups;
     }
-    if (!GenerateHemisphereSampleGroups(hemisphereSampleGroups, allocator)) {
+    if (!GenerateHemisphereSampleGroups(hemisphereSampleGroups, LIGHTMAP_SAMPLE_SEED + meshInd, allocator)) {
         LOG_ERROR("Failed to generate hemisphere sample groups\n");
-        return false;
+        hemisphereSampleGroups.data = nullptr;
     }
 
+    return hemisphereSampleGroups;
+}
+
+// Lights the vertices of triangles [triangleStart, triangleEnd) of a mesh that are selected by the request and owned
+// by its shard. Triangles owned by other shards are left black, so that the partial results of all shards can be
+// summed together, and unselected ones are marked with LIGHTMAP_VERTEX_UNSELECTED.
+// Only writes those triangles' vertices, so ranges of a mesh can be lit in parallel.
+void LightMeshVertices(const RaycastGeometry& geometry, uint32 meshInd, uint32 triangleOffset,
+                       const LightmapBakeRequest& request, Array<SampleGroup> hemisphereSampleGroups,
+                       uint32 triangleStart, uint32 triangleEnd, Array<Vec3> vertexColors,
+                       LightmapBakeProgress* progress)
+{
+    const RaycastInstance& instance = geometry.instances[meshInd];
+    const RaycastMesh& mesh = geometry.meshes[instance.meshInd];
+    for (uint32 i = triangleStart; i < triangleEnd; i++) {
+        if (!IsTriangleSelected(geometry, meshInd, i, request)) {
+            for (int j = 0; j < 3; j++) {
+                vertexColors[i * 3 + j] = LIGHTMAP_VERTEX_UNSELECTED;
+            }
+            continue;
+        }
+        const bool ownedByShard = (triangleOffset + i) % request.shard.count == request.shard.index;
+        if (!ownedByShard) {
+            for (int j = 0; j < 3; j++) {
+                vertexColors[i * 3 + j] = Vec3::zero;
+            }
+            continue;
+        }
 
-    for (uint32 i = 0; i < geometry.meshes[meshInd].triangles.size; i++) {
-        const RaycastTriangle& t = geometry.meshes[meshInd].triangles[i];
+        const RaycastTriangle& t = mesh.triangles[i];
         for (int j = 0; j < 3; j++) {
             const Vec3 dir = t.normal;
-            const Vec3 raycastColor = RaycastColor(hemisphereSampleGroups, t.pos[j], dir, geometry);
+            const Vec3 raycastColor = RaycastColor(hemisphereSampleGroups, t.pos[j] + instance.offset, dir, geometry);
             vertexColors[i * 3 + j] = raycastColor;
         }
+        if (progress != nullptr) {
+            InterlockedIncrement((volatile LONG*)&progress->trianglesDone);
+        }
     }
+}
 
-    return true;
+internal uint32 EncodeAoVertex(float32 visibility, Vec3 bentNormal)
+{
+    const uint32 r = (uint32)(ClampFloat32(bentNormal.x * 0.5f + 0.5f, 0.0f, 1.0f) * 255.0f + 0.5f);
+    const uint32 g = (uint32)(ClampFloat32(bentNormal.y * 0.5f + 0.5f, 0.0f, 1.0f) * 255.0f + 0.5f);
+    const uint32 b = (uint32)(ClampFloat32(bentNormal.z * 0.5f + 0.5f, 0.0f, 1.0f) * 255.0f + 0.5f);
+    const uint32 a = (uint32)(ClampFloat32(visibility, 0.0f, 1.0f) * 255.0f + 0.5f);
+    return r | (g << 8) | (b << 16) | (a << 24);
 }
 
-bool GenerateLightmaps(const LoadObjResult& obj, uint32 bounces, AppWorkQueue* queue, LinearAllocator* allocator,
-                       const_string lightmapDirPath)
+// AO counterpart of LightMeshVertices. Triangles outside the request keep the values already in vertexAo.
+void LightMeshVerticesAo(const RaycastGeometry& geometry, uint32 meshInd, const LightmapBakeRequest& request,
+                         Array<SampleGroup> hemisphereSampleGroups, uint32 triangleStart, uint32 triangleEnd,
+                         Array<uint32> vertexAo, LightmapBakeProgress* progress)
 {
-    RaycastGeometry geometry = CreateRaycastGeometry(obj, allocator);
-    if (geometry.meshes.data == nullptr) {
-        LOG_ERROR("Failed to construct raycast geometry from obj\n");
-        return false;
-    }
+    const RaycastInstance& instance = geometry.instances[meshInd];
+    const RaycastMesh& mesh = geometry.meshes[instance.meshInd];
+    for (uint32 i = triangleStart; i < triangleEnd; i++) {
+        if (!IsTriangleSelected(geometry, meshInd, i, request)) continue;
 
-    uint32 totalTriangles = 0;
-    for (uint32 i = 0; i < geometry.meshes.size; i++) {
-        totalTriangles += geometry.meshes[i].triangles.size;
+        const RaycastTriangle& t = mesh.triangles[i];
+        for (int j = 0; j < 3; j++) {
+            Vec3 bentNormal;
+            const float32 visibility = RaycastAmbientOcclusion(hemisphereSampleGroups, t.pos[j] + instance.offset,
+                                                               t.normal, request.aoMaxDistance, geometry,
+                                                               &bentNormal);
+            vertexAo[i * 3 + j] = EncodeAoVertex(visibility, bentNormal);
+        }
+        if (progress != nullptr) {
+            InterlockedIncrement((volatile LONG*)&progress->trianglesDone);
+        }
     }
+}
 
-    LOG_INFO("Generating lightmaps for %lu meshes, %lu total triangles, %lu bounces\n",
-             geometry.meshes.size, totalTriangles, bounces);
+// Partial accumulation file written by a single shard:
+//   LightmapShardFileHeader
+//   LightmapShardFileMesh[numMeshes]
+//   Vec3 colors for each lit mesh, in mesh order
+const uint32 LIGHTMAP_SHARD_FILE_MAGIC = 0x44524853; // "SHRD"
 
-    DebugTimer lightmapTimer = StartDebugTimer();
+struct LightmapShardFileHeader
+{
+    uint32 magic;
+    uint32 shardIndex;
+    uint32 shardCount;
+    uint32 numMeshes;
+};
 
-    for (uint32 b = 0; b < bounces; b++) {
-        LOG_INFO("Bounce %lu\n", b);
-        bounce_ = b; // NOTE for logging purposes only
+struct LightmapShardFileMesh
+{
+    uint64 meshHash;
+    uint32 numColors;
+    uint32 lit;
+};
 
-        ALLOCATOR_SCOPE_RESET(*allocator);
+internal string GetLightmapShardFilePath(const_string lightmapDirPath, uint32 shardIndex, uint32 shardCount,
+                                         LinearAllocator* allocator)
+{
+    return AllocPrintf(allocator, "%.*s/shard_%lu_of_%lu.part", lightmapDirPath.size, lightmapDirPath.data,
+                       shardIndex, shardCount);
+}
 
-        Array<Lightmap> lightmaps = allocator->NewArray<Lightmap>(geometry.meshes.size);
-        if (lightmaps.data == nullptr) {
-            LOG_ERROR("Failed to allocate lightmaps array in bounce %lu\n", b);
-            return false;
+internal bool WriteLightmapShardFile(const_string filePath, LightmapShard shard, Array<bool> meshLit,
+                                     Array<uint64> meshHashes, Array<Array<Vec3>> meshVertexColors,
+                                     LinearAllocator* allocator)
+{
+    uint32 fileSize = sizeof(LightmapShardFileHeader) + meshLit.size * sizeof(LightmapShardFileMesh);
+    for (uint32 i = 0; i < meshLit.size; i++) {
+        if (meshLit[i]) {
+            fileSize += meshVertexColors[i].size * sizeof(Vec3);
         }
+    }
 
-        Array<Array<Vec3>> meshVertexColors = allocator->NewArray<Array<Vec3>>(geometry.meshes.size);
-        if (meshVertexColors.data == nullptr) {
-            LOG_ERROR("Failed to allocate vertex color arrays in bounce %lu\n", b);
-            return false;
+    Array<uint8> data = allocator->NewArray<uint8>(fileSize);
+    if (data.data == nullptr) {
+        LOG_ERROR("Failed to allocate %lu bytes for lightmap shard file\n", fileSize);
+        return false;
+    }
+
+    LightmapShardFileHeader* header = (LightmapShardFileHeader*)data.data;
+    header->magic = LIGHTMAP_SHARD_FILE_MAGIC;
+    header->shardIndex = shard.index;
+    header->shardCount = shard.count;
+    header->numMeshes = meshLit.size;
+
+    LightmapShardFileMesh* meshes = (LightmapShardFileMesh*)(data.data + sizeof(LightmapShardFileHeader));
+    uint32 offset = sizeof(LightmapShardFileHeader) + meshLit.size * sizeof(LightmapShardFileMesh);
+    for (uint32 i = 0; i < meshLit.size; i++) {
+        meshes[i].meshHash = meshHashes[i];
+        meshes[i].numColors = meshVertexColors[i].size;
+        meshes[i].lit = meshLit[i] ? 1 : 0;
+        if (meshLit[i]) {
+            const uint32 colorsSize = meshVertexColors[i].size * sizeof(Vec3);
+            MemCopy(data.data + offset, meshVertexColors[i].data, colorsSize);
+            offset += colorsSize;
         }
+    }
+    DEBUG_ASSERT(offset == fileSize);
 
-        for (uint32 i = 0; i < geometry.meshes.size; i++) {
-            const uint32 squareSize = geometry.meshes[i].lightmap.squareSize;
-            lightmaps[i].squareSize = squareSize,
+    return WriteFile(filePath, data, false);
+}
+
+// Encoded colors of an existing vertex file, if it was baked for the same mesh. Empty otherwise.
+internal Array<uint32> LoadBakedVertexColors(const_string verticesFilePath, uint64 meshHash, uint32 numColors,
+                                             LinearAllocator* allocator)
+{
+    const Array<uint32> none = { .size = 0, .data = nullptr };
+    const Array<uint8> file = LoadEntireFile(verticesFilePath, allocator);
+    if (file.data == nullptr || file.size != sizeof(LightmapVertexFileHeader) + numColors * sizeof(uint32)) {
+        return none;
+    }
+
+    const LightmapVertexFileHeader* header = (const LightmapVertexFileHeader*)file.data;
+    if (header->magic != LIGHTMAP_VERTEX_FILE_MAGIC || header->version != LIGHTMAP_VERTEX_FILE_VERSION
+        || header->encoding != LightmapVertexEncoding::RGB9E5 || header->numColors != numColors
+        || header->meshHash != meshHash) {
+        return none;
+    }
+
+    return { .size = numColors, .data = (uint32*)(header + 1) };
+}
+
+// Vertices marked LIGHTMAP_VERTEX_UNSELECTED keep the colors already baked into the file, or are black without one
+internal bool WriteLightVerticesFile(const_string lightmapDirPath, uint32 meshInd, uint64 meshHash,
+                                     Array<Vec3> vertexColors, LinearAllocator* allocator)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+
+    string verticesFilePath = AllocPrintf(allocator, "%.*s/%d.v", lightmapDirPath.size, lightmapDirPath.data, meshInd);
+
+    bool partial = false;
+    for (uint32 i = 0; i < vertexColors.size; i++) {
+        if (vertexColors[i].r < 0.0f) {
+            partial = true;
+            break;
+        }
+    }
+    Array<uint32> bakedColors = { .size = 0, .data = nullptr };
+    if (partial) {
+        bakedColors = LoadBakedVertexColors(verticesFilePath, meshHash, vertexColors.size, allocator);
+        if (bakedColors.data == nullptr) {
+            LOG_INFO("No baked light vertices for mesh %lu to merge into, unbaked triangles will be black\n", meshInd);
+        }
+    }
+
+    const uint32 fileSize = sizeof(LightmapVertexFileHeader) + vertexColors.size * sizeof(uint32);
+    Array<uint8> data = allocator->NewArray<uint8>(fileSize);
+    if (data.data == nullptr) {
+        LOG_ERROR("Failed to allocate %lu bytes for light vertices file, mesh %lu\n", fileSize, meshInd);
+        return false;
+    }
+
+    LightmapVertexFileHeader* header = (LightmapVertexFileHeader*)data.data;
+    header->magic = LIGHTMAP_VERTEX_FILE_MAGIC;
+    header->version = LIGHTMAP_VERTEX_FILE_VERSION;
+    header->encoding = LightmapVertexEncoding::RGB9E5;
+    header->numColors = vertexColors.size;
+    header->meshHash = meshHash;
+
+    uint32* colors = (uint32*)(header + 1);
+    for (uint32 i = 0; i < vertexColors.size; i++) {
+        if (vertexColors[i].r < 0.0f) {
+            colors[i] = bakedColors.data != nullptr ? bakedColors[i] : 0;
+        }
+        else {
+            colors[i] = EncodeRGB9E5(vertexColors[i]);
+        }
+    }
+
+    if (!WriteFile(verticesFilePath, data, false)) {
+        LOG_ERROR("Failed to write light vertices to %.*s for mesh %lu\n",
+                  verticesFilePath.size, verticesFilePath.data, meshInd);
+        return false;
+    }
+
+    return true;
+}
+
+// Fills vertexAo with the AO already baked into the mesh's .ao file, if it was baked for the same mesh, so that
+// triangles outside a partial bake keep it. Unoccluded otherwise.
+internal void LoadBakedVertexAo(const RaycastGeometry& geometry, uint32 meshInd, const_string lightmapDirPath,
+                                uint64 meshHash, Array<uint32> vertexAo, LinearAllocator* allocator)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+
+    const string aoFilePath = AllocPrintf(allocator, "%.*s/%d.ao", lightmapDirPath.size, lightmapDirPath.data, meshInd);
+    const Array<uint8> file = LoadEntireFile(aoFilePath, allocator);
+    if (file.data != nullptr && file.size == sizeof(LightmapAoFileHeader) + vertexAo.size * sizeof(uint32)) {
+        const LightmapAoFileHeader* header = (const LightmapAoFileHeader*)file.data;
+        if (header->magic == LIGHTMAP_AO_FILE_MAGIC && header->version == LIGHTMAP_AO_FILE_VERSION
+            && header->numValues == vertexAo.size && header->meshHash == meshHash) {
+            MemCopy(vertexAo.data, header + 1, vertexAo.size * sizeof(uint32));
+            return;
+        }
+    }
+
+    const RaycastMesh& mesh = geometry.meshes[geometry.instances[meshInd].meshInd];
+    for (uint32 i = 0; i < mesh.triangles.size; i++) {
+        for (int j = 0; j < 3; j++) {
+            vertexAo[i * 3 + j] = EncodeAoVertex(1.0f, mesh.triangles[i].normal);
+        }
+    }
+}
+
+internal bool WriteLightAoFile(const_string lightmapDirPath, uint32 meshInd, uint64 meshHash, Array<uint32> vertexAo,
+                              bool hasBentNormals, LinearAllocator* allocator)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+
+    const uint32 fileSize = sizeof(LightmapAoFileHeader) + vertexAo.size * sizeof(uint32);
+    Array<uint8> data = allocator->NewArray<uint8>(fileSize);
+    if (data.data == nullptr) {
+        LOG_ERROR("Failed to allocate %lu bytes for AO file, mesh %lu\n", fileSize, meshInd);
+        return false;
+    }
+
+    LightmapAoFileHeader* header = (LightmapAoFileHeader*)data.data;
+    header->magic = LIGHTMAP_AO_FILE_MAGIC;
+    header->version = LIGHTMAP_AO_FILE_VERSION;
+    header->numValues = vertexAo.size;
+    header->hasBentNormals = hasBentNormals ? 1 : 0;
+    header->meshHash = meshHash;
+    MemCopy(header + 1, vertexAo.data, vertexAo.size * sizeof(uint32));
+
+    string aoFilePath = AllocPrintf(allocator, "%.*s/%d.ao", lightmapDirPath.size, lightmapDirPath.data, meshInd);
+    if (!WriteFile(aoFilePath, data, false)) {
+        LOG_ERROR("Failed to write AO to %.*s for mesh %lu\n", aoFilePath.size, aoFilePath.data, meshInd);
+        return false;
+    }
+
+    return true;
+}
+
+internal bool BakeAmbientOcclusion(const RaycastGeometry& geometry, Array<bool> meshLit, Array<uint64> meshHashes,
+                                   const LightmapBakeRequest& request, LinearAllocator* allocator,
+                                   const_string lightmapDirPath, LightmapBakeProgress* progress)
+{
+    LOG_INFO("Baking ambient occlusion, max distance %.03f\n", request.aoMaxDistance);
+    DebugTimer aoTimer = StartDebugTimer();
+
+    for (uint32 i = 0; i < geometry.instances.size; i++) {
+        if (!meshLit[i]) continue;
+
+        ALLOCATOR_SCOPE_RESET(*allocator);
+
+        const uint32 numTriangles = geometry.meshes[geometry.instances[i].meshInd].triangles.size;
+        Array<uint32> vertexAo = allocator->NewArray<uint32>(numTriangles * 3);
+        if (vertexAo.data == nullptr) {
+            LOG_ERROR("Failed to allocate vertex AO, mesh %lu\n", i);
+            return false;
+        }
+        LoadBakedVertexAo(geometry, i, lightmapDirPath, meshHashes[i], vertexAo, allocator);
+        const Array<SampleGroup> hemisphereSampleGroups = GetMeshSampleGroups(i, allocator);
+        if (hemisphereSampleGroups.data == nullptr) {
+            LOG_ERROR("Failed to compute vertex AO for mesh %lu\n", i);
+            return false;
+        }
+        LightMeshVerticesAo(geometry, i, request, hemisphereSampleGroups, 0, numTriangles, vertexAo, progress);
+        if (!WriteLightAoFile(lightmapDirPath, i, meshHashes[i], vertexAo, request.aoBentNormals, allocator)) {
+            return false;
+        }
+    }
+
+    StopAndPrintDebugTimer(&aoTimer);
+    return true;
+}
+
+bool ParseLightmapMeshMask(const char* str, uint64* mask)
+{
+    if (strcmp(str, "all") == 0) {
+        *mask = LightmapBakeRequest::ALL_MESHES;
+        return true;
+    }
+
+    *mask = 0;
+    const char* c = str;
+    while (true) {
+        char* end;
+        const unsigned long meshInd = strtoul(c, &end, 10);
+        if (end == c || meshInd >= LightmapBakeRequest::MAX_MESHES) {
+            return false;
+        }
+        *mask |= (uint64)1 << meshInd;
+
+        if (*end == '\0') {
+            break;
+        }
+        if (*end != ',') {
+            return false;
+        }
+        c = end + 1;
+    }
+
+    return true;
+}
+
+bool GenerateLightmaps(const LoadObjResult& obj, uint32 bounces, const LightmapBakeRequest& request,
+                       AppWorkQueue* queue, LinearAllocator* allocator, const_string lightmapDirPath,
+                       LightmapBakeProgress* progress)
+{
+    const LightmapShard shard = request.shard;
+    if (shard.count == 0 || shard.index >= shard.count) {
+        LOG_ERROR("Invalid lightmap shard %lu/%lu\n", shard.index, shard.count);
+        return false;
+    }
+    // Later bounces read back the previous bounce's lighting, which a single shard only has part of
+    if (shard.count > 1 && bounces != 1) {
+        LOG_ERROR("Sharded lightmap generation only supports 1 bounce, got %lu\n", bounces);
+        return false;
+    }
+    // AO bakes are a fraction of the cost of GI, not worth a partial file format of their own
+    if (shard.count > 1 && request.mode == LightmapBakeMode::AO) {
+        LOG_ERROR("Sharded lightmap generation doesn't support AO mode\n");
+        return false;
+    }
+
+    if (obj.models.size > LightmapBakeRequest::MAX_MESHES) {
+        LOG_ERROR("Lightmap bake requests support at most %lu meshes, scene has %lu\n",
+                  LightmapBakeRequest::MAX_MESHES, obj.models.size);
+        return false;
+    }
+
+    RaycastGeometry geometry = CreateRaycastGeometry(obj, allocator);
+    if (geometry.meshes.data == nullptr) {
+        LOG_ERROR("Failed to construct raycast geometry from obj\n");
+        return false;
+    }
+
+    Array<uint32> meshTriangleOffsets = allocator->NewArray<uint32>(geometry.instances.size);
+    if (meshTriangleOffsets.data == nullptr) {
+        LOG_ERROR("Failed to allocate mesh triangle offsets\n");
+        return false;
+    }
+    uint32 totalTriangles = 0;
+    for (uint32 i = 0; i < geometry.instances.size; i++) {
+        meshTriangleOffsets[i] = totalTriangles;
+        totalTriangles += geometry.meshes[geometry.instances[i].meshInd].triangles.size;
+    }
+
+    Array<bool> meshLit = allocator->NewArray<bool>(geometry.instances.size);
+    if (meshLit.data == nullptr) {
+        LOG_ERROR("Failed to allocate mesh lit flags\n");
+        return false;
+    }
+    for (uint32 i = 0; i < geometry.instances.size; i++) {
+        const uint64 meshBit = (uint64)1 << i;
+        meshLit[i] = (request.litMeshes & meshBit) != 0;
+        geometry.instances[i].occluder = (request.occluderMeshes & meshBit) != 0;
+    }
+
+    Array<uint64> meshHashes = allocator->NewArray<uint64>(geometry.instances.size);
+    if (meshHashes.data == nullptr) {
+        LOG_ERROR("Failed to allocate mesh hashes\n");
+        return false;
+    }
+    for (uint32 i = 0; i < geometry.instances.size; i++) {
+        meshHashes[i] = HashObjModel(obj.models[i]);
+    }
+
+    if (progress != nullptr) {
+        uint32 litTriangles = 0;
+        for (uint32 i = 0; i < geometry.instances.size; i++) {
+            if (meshLit[i]) {
+                litTriangles += geometry.meshes[geometry.instances[i].meshInd].triangles.size;
+            }
+        }
+        progress->trianglesDone = 0;
+        progress->trianglesTotal = request.mode == LightmapBakeMode::AO ? litTriangles : litTriangles * bounces;
+    }
+
+    if (request.mode == LightmapBakeMode::AO) {
+        return BakeAmbientOcclusion(geometry, meshLit, meshHashes, request, allocator, lightmapDirPath, progress);
+    }
+
+    LOG_INFO("Generating lightmaps for %lu meshes, %lu total triangles, %lu bounces, shard %lu/%lu\n",
+             geometry.instances.size, totalTriangles, bounces, shard.index, shard.count);
+
+    DebugTimer lightmapTimer = StartDebugTimer();
+
+    for (uint32 b = 0; b < bounces; b++) {
+        LOG_INFO("Bounce %lu\n", b);
+        bounce_ = b; // NOTE for logging purposes only
+
+        ALLOCATOR_SCOPE_RESET(*allocator);
+
+        Array<Lightmap> lightmaps = allocator->NewArray<Lightmap>(geometry.instances.size);
+        if (lightmaps.data == nullptr) {
+            LOG_ERROR("Failed to allocate lightmaps array in bounce %lu\n", b);
+            return false;
+        }
+
+        Array<Array<Vec3>> meshVertexColors = allocator->NewArray<Array<Vec3>>(geometry.instances.size);
+        if (meshVertexColors.data == nullptr) {
+            LOG_ERROR("Failed to allocate vertex color arrays in bounce %lu\n", b);
+            return false;
+        }
+
+        for (uint32 i = 0; i < geometry.instances.size; i++) {
+            const uint32 squareSize = geometry.instances[i].lightmap.squareSize;
+            lightmaps[i].squareSize = squareSize,
             lightmaps[i].pixels = allocator->New<uint32>(squareSize * squareSize);
             if (lightmaps[i].pixels == nullptr) {
                 LOG_ERROR("Failed to allocate pixels for lightmap, bounce %lu, mesh %lu\n", b, i);
@@ -944,19 +1665,17 @@ bool GenerateLightmaps(const LoadObjResult& obj, uint32 bounces, AppWorkQueue* q
             }
             MemSet(lightmaps[i].pixels, 0, squareSize * squareSize * sizeof(uint32));
 
-            meshVertexColors[i] = allocator->NewArray<Vec3>(geometry.meshes[i].triangles.size * 3);
+            const uint32 numTriangles = geometry.meshes[geometry.instances[i].meshInd].triangles.size;
+            meshVertexColors[i] = allocator->NewArray<Vec3>(numTriangles * 3);
             if (meshVertexColors[i].data == nullptr) {
                 LOG_ERROR("Failed to allocate vertex colors, bounce %lu, mesh %lu\n", b, i);
                 return false;
             }
         }
 
-#if RESTRICT_LIGHTING
-        for (uint32 m = 0, i = MODELS_TO_LIGHT[m]; m < C_ARRAY_LENGTH(MODELS_TO_LIGHT); i = MODELS_TO_LIGHT[++m])
-#else
-        for (uint32 i = 0; i < geometry.meshes.size; i++)
-#endif
-        {
+        for (uint32 i = 0; i < geometry.instances.size; i++) {
+            if (!meshLit[i]) continue;
+
             LOG_INFO("Lighting mesh %lu\n", i);
 
             ALLOCATOR_SCOPE_RESET(*allocator);
@@ -964,7 +1683,7 @@ bool GenerateLightmaps(const LoadObjResult& obj, uint32 bounces, AppWorkQueue* q
             UNREFERENCED_PARAMETER(queue);
 #if 0
             // Calculate lightmap for mesh and save to file
-            if (!CalculateLightmapForMesh(geometry, i, queue, allocator, &lightmaps[i])) {
+            if (!CalculateLightmapForMesh(geometry, i, request, queue, allocator, &lightmaps[i])) {
                 LOG_ERROR("Failed to compute lightmap for mesh %lu, bounce %lu\n", i, b);
                 return false;
             }
@@ -979,28 +1698,39 @@ bool GenerateLightmaps(const LoadObjResult& obj, uint32 bounces, AppWorkQueue* q
             }
 #endif
 
-            // Calculate vertex light for mesh and save to file
-            if (!LightMeshVertices(geometry, i, allocator, meshVertexColors[i])) {
+            // Calculate vertex light for mesh
+            const Array<SampleGroup> hemisphereSampleGroups = GetMeshSampleGroups(i, allocator);
+            if (hemisphereSampleGroups.data == nullptr) {
                 LOG_ERROR("Failed to light vertices for mesh %lu, bounce %lu\n", i, b);
                 return false;
             }
-            const Array<uint8> vertexColorData = {
-                .size = meshVertexColors[i].size * sizeof(Vec3),
-                .data = (uint8*)meshVertexColors[i].data
-            };
-            string verticesFilePath = AllocPrintf(allocator, "%.*s/%d.v", lightmapDirPath.size, lightmapDirPath.data, i);
-            if (!WriteFile(verticesFilePath, vertexColorData, false)) {
-                LOG_ERROR("Failed to write light vertices to %.*s for mesh %lu, bounce %lu\n",
-                          verticesFilePath.size, verticesFilePath.data, i, b);
+            const uint32 numTriangles = meshVertexColors[i].size / 3;
+            LightMeshVertices(geometry, i, meshTriangleOffsets[i], request, hemisphereSampleGroups, 0, numTriangles,
+                              meshVertexColors[i], progress);
+
+            // A lone shard owns every triangle, so its result is already final
+            if (shard.count == 1) {
+                if (!WriteLightVerticesFile(lightmapDirPath, i, meshHashes[i], meshVertexColors[i], allocator)) {
+                    return false;
+                }
+            }
+        }
+
+        if (shard.count > 1) {
+            const string shardFilePath = GetLightmapShardFilePath(lightmapDirPath, shard.index, shard.count,
+                                                                  allocator);
+            if (!WriteLightmapShardFile(shardFilePath, shard, meshLit, meshHashes, meshVertexColors, allocator)) {
+                LOG_ERROR("Failed to write lightmap shard file %.*s\n", shardFilePath.size, shardFilePath.data);
                 return false;
             }
+            LOG_INFO("Wrote lightmap shard file %.*s\n", shardFilePath.size, shardFilePath.data);
         }
 
         if (b != bounces - 1) {
             // Copy calculated lightmaps to RaycastGeometry for the next bounce
-            for (uint32 i = 0; i < geometry.meshes.size; i++) {
+            for (uint32 i = 0; i < geometry.instances.size; i++) {
                 const uint32 squareSize = lightmaps[i].squareSize;
-                MemCopy(geometry.meshes[i].lightmap.pixels, lightmaps[i].pixels, squareSize * squareSize * sizeof(uint32));
+                MemCopy(geometry.instances[i].lightmap.pixels, lightmaps[i].pixels, squareSize * squareSize * sizeof(uint32));
             }
         }
     }
@@ -1009,3 +1739,695 @@ bool GenerateLightmaps(const LoadObjResult& obj, uint32 bounces, AppWorkQueue* q
 
     return true;
 }
+
+bool MergeLightmapShards(uint32 shardCount, LinearAllocator* allocator, const_string lightmapDirPath)
+{
+    if (shardCount == 0) {
+        LOG_ERROR("Can't merge 0 lightmap shards\n");
+        return false;
+    }
+
+    Array<Array<uint8>> shardFiles = allocator->NewArray<Array<uint8>>(shardCount);
+    if (shardFiles.data == nullptr) {
+        LOG_ERROR("Failed to allocate lightmap shard file array\n");
+        return false;
+    }
+
+    // Load and validate every shard file before writing anything, so a missing shard can't produce partial output
+    for (uint32 i = 0; i < shardCount; i++) {
+        const string filePath = GetLightmapShardFilePath(lightmapDirPath, i, shardCount, allocator);
+        shardFiles[i] = LoadEntireFile(filePath, allocator);
+        if (shardFiles[i].data == nullptr) {
+            LOG_ERROR("Failed to load lightmap shard file %.*s\n", filePath.size, filePath.data);
+            return false;
+        }
+        if (shardFiles[i].size < sizeof(LightmapShardFileHeader)) {
+            LOG_ERROR("Lightmap shard file %.*s too small\n", filePath.size, filePath.data);
+            return false;
+        }
+
+        const LightmapShardFileHeader* header = (const LightmapShardFileHeader*)shardFiles[i].data;
+        const LightmapShardFileHeader* header0 = (const LightmapShardFileHeader*)shardFiles[0].data;
+        if (header->magic != LIGHTMAP_SHARD_FILE_MAGIC || header->shardIndex != i || header->shardCount != shardCount) {
+            LOG_ERROR("Bad header in lightmap shard file %.*s\n", filePath.size, filePath.data);
+            return false;
+        }
+
+        const uint32 tableSize = sizeof(LightmapShardFileHeader) + header->numMeshes * sizeof(LightmapShardFileMesh);
+        if (shardFiles[i].size < tableSize) {
+            LOG_ERROR("Lightmap shard file %.*s truncated\n", filePath.size, filePath.data);
+            return false;
+        }
+
+        const LightmapShardFileMesh* meshes = (const LightmapShardFileMesh*)(header + 1);
+        const LightmapShardFileMesh* meshes0 = (const LightmapShardFileMesh*)(header0 + 1);
+        if (header->numMeshes != header0->numMeshes) {
+            LOG_ERROR("Lightmap shard file %.*s has %lu meshes, shard 0 has %lu\n",
+                      filePath.size, filePath.data, header->numMeshes, header0->numMeshes);
+            return false;
+        }
+        for (uint32 j = 0; j < header->numMeshes; j++) {
+            if (meshes[j].meshHash != meshes0[j].meshHash || meshes[j].numColors != meshes0[j].numColors
+                || meshes[j].lit != meshes0[j].lit) {
+                LOG_ERROR("Lightmap shard file %.*s doesn't match shard 0 at mesh %lu, different scene or settings?\n",
+                          filePath.size, filePath.data, j);
+                return false;
+            }
+        }
+
+        uint32 expectedSize = tableSize;
+        for (uint32 j = 0; j < header->numMeshes; j++) {
+            if (meshes[j].lit) {
+                expectedSize += meshes[j].numColors * sizeof(Vec3);
+            }
+        }
+        if (shardFiles[i].size != expectedSize) {
+            LOG_ERROR("Lightmap shard file %.*s has size %lu, expected %lu\n",
+                      filePath.size, filePath.data, shardFiles[i].size, expectedSize);
+            return false;
+        }
+    }
+
+    const LightmapShardFileHeader* header0 = (const LightmapShardFileHeader*)shardFiles[0].data;
+    const LightmapShardFileMesh* meshes = (const LightmapShardFileMesh*)(header0 + 1);
+    uint32 offset = sizeof(LightmapShardFileHeader) + header0->numMeshes * sizeof(LightmapShardFileMesh);
+    for (uint32 i = 0; i < header0->numMeshes; i++) {
+        if (!meshes[i].lit) continue;
+
+        ALLOCATOR_SCOPE_RESET(*allocator);
+
+        Array<Vec3> vertexColors = allocator->NewArray<Vec3>(meshes[i].numColors);
+        if (vertexColors.data == nullptr) {
+            LOG_ERROR("Failed to allocate merged vertex colors for mesh %lu\n", i);
+            return false;
+        }
+        MemSet(vertexColors.data, 0, vertexColors.size * sizeof(Vec3));
+
+        // Every triangle is owned by exactly one shard and left black by all the others
+        for (uint32 j = 0; j < shardCount; j++) {
+            const Vec3* shardColors = (const Vec3*)(shardFiles[j].data + offset);
+            for (uint32 k = 0; k < vertexColors.size; k++) {
+                vertexColors[k] += shardColors[k];
+            }
+        }
+
+        if (!WriteLightVerticesFile(lightmapDirPath, i, meshes[i].meshHash, vertexColors, allocator)) {
+            return false;
+        }
+        offset += meshes[i].numColors * sizeof(Vec3);
+    }
+
+    LOG_INFO("Merged %lu lightmap shards\n", shardCount);
+    return true;
+}
+
+internal ShProbe BakeLightProbe(const RaycastGeometry& geometry, Array<Vec3> sphereDirs, Vec3 pos)
+{
+    const float32 SH_Y0 = 0.282095f;
+    const float32 SH_Y1 = 0.488603f;
+
+    ShProbe probe = SH_PROBE_ZERO;
+    for (uint32 i = 0; i < sphereDirs.size; i += 8) {
+        StaticArray<Vec3, 8> dirs;
+        for (int j = 0; j < 8; j++) {
+            dirs[j] = sphereDirs[i + j];
+        }
+
+        StaticArray<Vec3, 8> radiance;
+        TraceRadiance_8(dirs, pos, 0.0f, geometry, &radiance);
+        for (int j = 0; j < 8; j++) {
+            probe.coeffs[0] += radiance[j] * SH_Y0;
+            probe.coeffs[1] += radiance[j] * (SH_Y1 * dirs[j].y);
+            probe.coeffs[2] += radiance[j] * (SH_Y1 * dirs[j].z);
+            probe.coeffs[3] += radiance[j] * (SH_Y1 * dirs[j].x);
+        }
+    }
+
+    // Monte Carlo estimate over the sphere, uniformly distributed directions
+    const float32 weight = 4.0f * PI_F / (float32)sphereDirs.size;
+    for (int c = 0; c < 4; c++) {
+        probe.coeffs[c] *= weight;
+    }
+    return probe;
+}
+
+struct WorkLightProbeSliceCommon
+{
+    const RaycastGeometry* geometry;
+    Array<Vec3> sphereDirs;
+    LightProbeGrid* grid;
+    LightmapBakeProgress* progress;
+};
+
+struct WorkLightProbeSlice
+{
+    const WorkLightProbeSliceCommon* common;
+    int z;
+};
+
+void ThreadLightProbeSlice(AppWorkQueue* queue, void* data)
+{
+    UNREFERENCED_PARAMETER(queue);
+
+    const WorkLightProbeSlice* workData = (const WorkLightProbeSlice*)data;
+    LightProbeGrid* grid = workData->common->grid;
+    const int z = workData->z;
+    for (int y = 0; y < grid->dims.y; y++) {
+        for (int x = 0; x < grid->dims.x; x++) {
+            const Vec3 pos = grid->origin + Vec3 { (float32)x, (float32)y, (float32)z } * grid->spacing;
+            const uint32 ind = (z * grid->dims.y + y) * grid->dims.x + x;
+            grid->probes[ind] = BakeLightProbe(*workData->common->geometry, workData->common->sphereDirs, pos);
+        }
+    }
+
+    if (workData->common->progress != nullptr) {
+        InterlockedIncrement((volatile LONG*)&workData->common->progress->probeSlicesDone);
+    }
+}
+
+internal string GetLightProbeFilePath(const_string lightmapDirPath, LinearAllocator* allocator)
+{
+    return AllocPrintf(allocator, "%.*s/probes.sh", lightmapDirPath.size, lightmapDirPath.data);
+}
+
+// Full sphere sample directions, and a grid fit to the scene bounds to bake them into slice by slice
+internal bool SetUpLightProbeBake(const RaycastGeometry* geometry, LinearAllocator* allocator,
+                                  LightmapBakeProgress* progress, WorkLightProbeSliceCommon* common)
+{
+    // Full sphere of directions: the hemisphere sample set plus its mirror image
+    Array<SampleGroup> hemisphereSampleGroups = allocator->NewArray<SampleGroup>(NUM_HEMISPHERE_SAMPLE_GROUPS);
+    if (hemisphereSampleGroups.data == nullptr) {
+        LOG_ERROR("Failed to allocate hemisphere sample groups\n");
+        return false;
+    }
+    if (!GenerateHemisphereSampleGroups(hemisphereSampleGroups, LIGHTMAP_SAMPLE_SEED, allocator)) {
+        LOG_ERROR("Failed to generate hemisphere sample groups\n");
+        return false;
+    }
+    Array<Vec3> sphereDirs = allocator->NewArray<Vec3>(NUM_HEMISPHERE_SAMPLES * 2);
+    if (sphereDirs.data == nullptr) {
+        LOG_ERROR("Failed to allocate probe sample directions\n");
+        return false;
+    }
+    for (uint32 i = 0; i < NUM_HEMISPHERE_SAMPLES; i++) {
+        const Vec3 dir = hemisphereSampleGroups[i / SAMPLES_PER_GROUP].group[i % SAMPLES_PER_GROUP];
+        sphereDirs[i] = dir;
+        sphereDirs[i + NUM_HEMISPHERE_SAMPLES] = Vec3 { -dir.x, dir.y, dir.z };
+    }
+
+    // Fit the grid to the scene bounds
+    Vec3 sceneMin = Vec3::one * 1e8;
+    Vec3 sceneMax = -Vec3::one * 1e8;
+    for (uint32 i = 0; i < geometry->instances.size; i++) {
+        for (int e = 0; e < 3; e++) {
+            sceneMin.e[e] = MinFloat32(sceneMin.e[e], geometry->instances[i].min.e[e]);
+            sceneMax.e[e] = MaxFloat32(sceneMax.e[e], geometry->instances[i].max.e[e]);
+        }
+    }
+
+    LightProbeGrid* grid = allocator->New<LightProbeGrid>();
+    if (grid == nullptr) {
+        LOG_ERROR("Failed to allocate light probe grid\n");
+        return false;
+    }
+    const Vec3 sceneSize = sceneMax - sceneMin;
+    const float32 maxSize = MaxFloat32(sceneSize.x, MaxFloat32(sceneSize.y, sceneSize.z));
+    grid->origin = sceneMin;
+    grid->spacing = MaxFloat32(LIGHT_PROBE_SPACING, maxSize / (float32)(LightProbeGrid::MAX_DIM - 1));
+    for (int e = 0; e < 3; e++) {
+        grid->dims.e[e] = MinInt((int)ceilf(sceneSize.e[e] / grid->spacing) + 1, LightProbeGrid::MAX_DIM);
+    }
+
+    LOG_INFO("Generating %d x %d x %d light probes, spacing %.03f\n",
+             grid->dims.x, grid->dims.y, grid->dims.z, grid->spacing);
+
+    *common = {
+        .geometry = geometry,
+        .sphereDirs = sphereDirs,
+        .grid = grid,
+        .progress = progress
+    };
+    if (progress != nullptr) {
+        progress->probeSlicesDone = 0;
+        progress->probeSlicesTotal = grid->dims.z;
+    }
+    return true;
+}
+
+internal bool WriteLightProbeFile(const LightProbeGrid& grid, const_string lightmapDirPath, LinearAllocator* allocator)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+
+    const uint32 numProbes = grid.dims.x * grid.dims.y * grid.dims.z;
+    const uint32 fileSize = sizeof(LightProbeFileHeader) + numProbes * sizeof(ShProbe);
+    Array<uint8> data = allocator->NewArray<uint8>(fileSize);
+    if (data.data == nullptr) {
+        LOG_ERROR("Failed to allocate %lu bytes for light probe file\n", fileSize);
+        return false;
+    }
+    LightProbeFileHeader* header = (LightProbeFileHeader*)data.data;
+    header->magic = LIGHT_PROBE_FILE_MAGIC;
+    header->version = LIGHT_PROBE_FILE_VERSION;
+    header->dims = grid.dims;
+    header->origin = grid.origin;
+    header->spacing = grid.spacing;
+    MemCopy(header + 1, grid.probes.data, numProbes * sizeof(ShProbe));
+
+    const string filePath = GetLightProbeFilePath(lightmapDirPath, allocator);
+    if (!WriteFile(filePath, data, false)) {
+        LOG_ERROR("Failed to write light probes to %.*s\n", filePath.size, filePath.data);
+        return false;
+    }
+
+    return true;
+}
+
+bool GenerateLightProbes(const LoadObjResult& obj, AppWorkQueue* queue, LinearAllocator* allocator,
+                         const_string lightmapDirPath, LightmapBakeProgress* progress)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+
+    RaycastGeometry geometry = CreateRaycastGeometry(obj, allocator);
+    if (geometry.meshes.data == nullptr) {
+        LOG_ERROR("Failed to construct raycast geometry from obj\n");
+        return false;
+    }
+
+    WorkLightProbeSliceCommon workCommon;
+    if (!SetUpLightProbeBake(&geometry, allocator, progress, &workCommon)) {
+        return false;
+    }
+    const LightProbeGrid& grid = *workCommon.grid;
+
+    DebugTimer probeTimer = StartDebugTimer();
+
+    Array<WorkLightProbeSlice> work = allocator->NewArray<WorkLightProbeSlice>(grid.dims.z);
+    if (work.data == nullptr) {
+        LOG_ERROR("Failed to allocate light probe work entries\n");
+        return false;
+    }
+    for (int z = 0; z < grid.dims.z; z++) {
+        work[z].common = &workCommon;
+        work[z].z = z;
+        if (queue == nullptr) {
+            ThreadLightProbeSlice(queue, &work[z]);
+        }
+        else if (!TryAddWork(queue, ThreadLightProbeSlice, &work[z])) {
+            CompleteAllWork(queue);
+            DEBUG_ASSERT(TryAddWork(queue, ThreadLightProbeSlice, &work[z]));
+        }
+    }
+    if (queue != nullptr) {
+        CompleteAllWork(queue);
+    }
+
+    StopAndPrintDebugTimer(&probeTimer);
+
+    return WriteLightProbeFile(grid, lightmapDirPath, allocator);
+}
+
+bool LoadLightProbes(const_string lightmapDirPath, LinearAllocator* allocator, LightProbeGrid* grid)
+{
+    ALLOCATOR_SCOPE_RESET(*allocator);
+
+    grid->dims = Vec3Int::zero;
+
+    const string filePath = GetLightProbeFilePath(lightmapDirPath, allocator);
+    const Array<uint8> data = LoadEntireFile(filePath, allocator);
+    if (data.data == nullptr) {
+        LOG_ERROR("Failed to load light probes from %.*s\n", filePath.size, filePath.data);
+        return false;
+    }
+
+    const LightProbeFileHeader* header = (const LightProbeFileHeader*)data.data;
+    if (data.size < sizeof(LightProbeFileHeader) || header->magic != LIGHT_PROBE_FILE_MAGIC
+        || header->version != LIGHT_PROBE_FILE_VERSION) {
+        LOG_ERROR("Unrecognized light probe file %.*s\n", filePath.size, filePath.data);
+        return false;
+    }
+    for (int e = 0; e < 3; e++) {
+        if (header->dims.e[e] <= 0 || header->dims.e[e] > (int)LightProbeGrid::MAX_DIM) {
+            LOG_ERROR("Invalid light probe grid dimensions in %.*s\n", filePath.size, filePath.data);
+            return false;
+        }
+    }
+    const uint32 numProbes = header->dims.x * header->dims.y * header->dims.z;
+    if (data.size != sizeof(LightProbeFileHeader) + numProbes * sizeof(ShProbe)) {
+        LOG_ERROR("Light probe file %.*s has the wrong size\n", filePath.size, filePath.data);
+        return false;
+    }
+
+    MemCopy(grid->probes.data, header + 1, numProbes * sizeof(ShProbe));
+    grid->origin = header->origin;
+    grid->spacing = header->spacing;
+    grid->dims = header->dims;
+    return true;
+}
+
+bool SampleLightProbes(const LightProbeGrid& grid, Vec3 pos, ShProbe* probe)
+{
+    if (grid.dims.x == 0) {
+        return false;
+    }
+
+    const Vec3 gridPos = (pos - grid.origin) / grid.spacing;
+    Vec3Int base;
+    Vec3 t;
+    for (int e = 0; e < 3; e++) {
+        const float32 maxCoord = (float32)(grid.dims.e[e] - 1);
+        if (gridPos.e[e] < 0.0f || gridPos.e[e] > maxCoord) {
+            return false;
+        }
+        base.e[e] = MinInt((int)gridPos.e[e], MaxInt(grid.dims.e[e] - 2, 0));
+        t.e[e] = grid.dims.e[e] == 1 ? 0.0f : gridPos.e[e] - (float32)base.e[e];
+    }
+
+    *probe = SH_PROBE_ZERO;
+    for (int corner = 0; corner < 8; corner++) {
+        Vec3Int ind = base;
+        float32 weight = 1.0f;
+        for (int e = 0; e < 3; e++) {
+            if (corner & (1 << e)) {
+                ind.e[e] = MinInt(ind.e[e] + 1, grid.dims.e[e] - 1);
+                weight *= t.e[e];
+            }
+            else {
+                weight *= 1.0f - t.e[e];
+            }
+        }
+
+        const ShProbe& cornerProbe = grid.probes[(ind.z * grid.dims.y + ind.y) * grid.dims.x + ind.x];
+        for (int c = 0; c < 4; c++) {
+            probe->coeffs[c] += cornerProbe.coeffs[c] * weight;
+        }
+    }
+
+    return true;
+}
+
+// Lit triangles per VERTICES entry, raised for big scenes so that a stage fits in LightmapBakeJob::MAX_ENTRIES
+const uint32 LIGHTMAP_BAKE_BATCH_TRIANGLES = 64;
+
+struct LightmapBakeBatch
+{
+    uint32 meshInd;
+    uint32 triangleStart;
+    uint32 triangleEnd;
+};
+
+// Lives at the start of the job's memory, for the whole bake
+struct LightmapBakeData
+{
+    LinearAllocator allocator; // the rest of the job's memory, only used by single-entry stages
+    LoadObjResult obj;
+    RaycastGeometry geometry;
+    Array<uint32> meshTriangleOffsets;
+    Array<uint64> meshHashes;
+    Array<Array<SampleGroup>> meshSampleGroups;
+    Array<Array<Vec3>> meshVertexColors; // GI mode
+    Array<Array<uint32>> meshVertexAo;   // AO mode
+    Array<LightmapBakeBatch> batches;
+    WorkLightProbeSliceCommon probeCommon;
+};
+
+internal bool LoadLightmapBake(LightmapBakeJob* job)
+{
+    const LightmapBakeRequest& request = job->request;
+    // Sharded bakes are run from the command line, and need the shard files merged afterwards
+    if (request.shard.count != 1) {
+        LOG_ERROR("Lightmap bake jobs don't support sharding, got %lu shards\n", request.shard.count);
+        return false;
+    }
+    // Each stage is a single pass over the scene, later bounces would need another VERTICES stage per bounce
+    static_assert(LIGHTMAP_NUM_BOUNCES == 1);
+
+    LinearAllocator allocator(job->memory);
+    LightmapBakeData* data = allocator.New<LightmapBakeData>();
+    if (data == nullptr) {
+        LOG_ERROR("Failed to allocate lightmap bake data\n");
+        return false;
+    }
+
+    if (!LoadObj(job->objFilePath, &data->obj, &allocator)) {
+        LOG_ERROR("Failed to load obj %.*s for lightmap bake\n", job->objFilePath.size, job->objFilePath.data);
+        return false;
+    }
+    const LoadObjResult& obj = data->obj;
+    if (obj.models.size > LightmapBakeRequest::MAX_MESHES) {
+        LOG_ERROR("Lightmap bake requests support at most %lu meshes, scene has %lu\n",
+                  LightmapBakeRequest::MAX_MESHES, obj.models.size);
+        return false;
+    }
+
+    data->geometry = CreateRaycastGeometry(obj, &allocator);
+    RaycastGeometry& geometry = data->geometry;
+    if (geometry.meshes.data == nullptr) {
+        LOG_ERROR("Failed to construct raycast geometry from obj\n");
+        return false;
+    }
+
+    const uint32 numMeshes = geometry.instances.size;
+    data->meshTriangleOffsets = allocator.NewArray<uint32>(numMeshes);
+    data->meshHashes = allocator.NewArray<uint64>(numMeshes);
+    data->meshSampleGroups = allocator.NewArray<Array<SampleGroup>>(numMeshes);
+    data->meshVertexColors = allocator.NewArray<Array<Vec3>>(numMeshes);
+    data->meshVertexAo = allocator.NewArray<Array<uint32>>(numMeshes);
+    if (data->meshTriangleOffsets.data == nullptr || data->meshHashes.data == nullptr
+        || data->meshSampleGroups.data == nullptr || data->meshVertexColors.data == nullptr
+        || data->meshVertexAo.data == nullptr) {
+        LOG_ERROR("Failed to allocate per-mesh lightmap bake data\n");
+        return false;
+    }
+
+    uint32 totalTriangles = 0;
+    uint32 litTriangles = 0;
+    uint32 numLitMeshes = 0;
+    for (uint32 i = 0; i < numMeshes; i++) {
+        const uint64 meshBit = (uint64)1 << i;
+        const bool lit = (request.litMeshes & meshBit) != 0;
+        geometry.instances[i].occluder = (request.occluderMeshes & meshBit) != 0;
+        data->meshHashes[i] = HashObjModel(obj.models[i]);
+
+        const uint32 numTriangles = geometry.meshes[geometry.instances[i].meshInd].triangles.size;
+        data->meshTriangleOffsets[i] = totalTriangles;
+        totalTriangles += numTriangles;
+
+        data->meshSampleGroups[i] = { .size = 0, .data = nullptr };
+        data->meshVertexColors[i] = { .size = 0, .data = nullptr };
+        data->meshVertexAo[i] = { .size = 0, .data = nullptr };
+        if (!lit) continue;
+
+        litTriangles += numTriangles;
+        numLitMeshes++;
+        data->meshSampleGroups[i] = GetMeshSampleGroups(i, &allocator);
+        if (data->meshSampleGroups[i].data == nullptr) {
+            LOG_ERROR("Failed to set up vertex lighting for mesh %lu\n", i);
+            return false;
+        }
+        if (request.mode == LightmapBakeMode::AO) {
+            data->meshVertexAo[i] = allocator.NewArray<uint32>(numTriangles * 3);
+        }
+        else {
+            data->meshVertexColors[i] = allocator.NewArray<Vec3>(numTriangles * 3);
+        }
+        if (data->meshVertexAo[i].data == nullptr && data->meshVertexColors[i].data == nullptr) {
+            LOG_ERROR("Failed to allocate vertex results, mesh %lu\n", i);
+            return false;
+        }
+        if (request.mode == LightmapBakeMode::AO) {
+            LoadBakedVertexAo(geometry, i, job->lightmapDirPath, data->meshHashes[i], data->meshVertexAo[i],
+                              &allocator);
+        }
+    }
+
+    // Each lit mesh's last batch may be partial, so leave room for one extra batch per mesh
+    uint32 batchTriangles = LIGHTMAP_BAKE_BATCH_TRIANGLES;
+    const uint32 maxFullBatches = LightmapBakeJob::MAX_ENTRIES - LightmapBakeRequest::MAX_MESHES;
+    if (litTriangles > batchTriangles * maxFullBatches) {
+        batchTriangles = (litTriangles + maxFullBatches - 1) / maxFullBatches;
+    }
+    uint32 numBatches = 0;
+    for (uint32 i = 0; i < numMeshes; i++) {
+        if (data->meshSampleGroups[i].data != nullptr) {
+            const uint32 numTriangles = geometry.meshes[geometry.instances[i].meshInd].triangles.size;
+            numBatches += (numTriangles + batchTriangles - 1) / batchTriangles;
+        }
+    }
+    DEBUG_ASSERT(numBatches <= LightmapBakeJob::MAX_ENTRIES);
+    data->batches = allocator.NewArray<LightmapBakeBatch>(numBatches);
+    if (data->batches.data == nullptr) {
+        LOG_ERROR("Failed to allocate lightmap bake batches\n");
+        return false;
+    }
+    uint32 batch = 0;
+    for (uint32 i = 0; i < numMeshes; i++) {
+        if (data->meshSampleGroups[i].data == nullptr) continue;
+
+        const uint32 numTriangles = geometry.meshes[geometry.instances[i].meshInd].triangles.size;
+        for (uint32 t = 0; t < numTriangles; t += batchTriangles) {
+            data->batches[batch++] = {
+                .meshInd = i,
+                .triangleStart = t,
+                .triangleEnd = t + batchTriangles < numTriangles ? t + batchTriangles : numTriangles
+            };
+        }
+    }
+
+    job->progress.trianglesDone = 0;
+    job->progress.trianglesTotal = litTriangles;
+    LOG_INFO("Baking %s for %lu meshes, %lu lit triangles in %lu batches\n",
+             request.mode == LightmapBakeMode::AO ? "AO" : "vertex light", numLitMeshes, litTriangles, numBatches);
+
+    // Whatever's left is scratch space for the single-entry stages
+    data->allocator = LinearAllocator(job->memory.size - allocator.used, job->memory.data + allocator.used);
+    job->bakeData = data;
+    return true;
+}
+
+internal bool WriteLightmapBakeVertices(LightmapBakeJob* job)
+{
+    LightmapBakeData* data = (LightmapBakeData*)job->bakeData;
+    RaycastGeometry& geometry = data->geometry;
+    for (uint32 i = 0; i < geometry.instances.size; i++) {
+        if (data->meshSampleGroups[i].data == nullptr) continue;
+
+        if (job->request.mode == LightmapBakeMode::AO) {
+            if (!WriteLightAoFile(job->lightmapDirPath, i, data->meshHashes[i], data->meshVertexAo[i],
+                                  job->request.aoBentNormals, &data->allocator)) {
+                return false;
+            }
+        }
+        else if (!WriteLightVerticesFile(job->lightmapDirPath, i, data->meshHashes[i], data->meshVertexColors[i],
+                                         &data->allocator)) {
+            return false;
+        }
+    }
+
+    // AO bakes don't touch the probes, same as GenerateLightmaps
+    if (job->request.mode == LightmapBakeMode::AO) {
+        return true;
+    }
+
+    // Probes light dynamic objects anywhere in the scene, so everything occludes them regardless of the request
+    for (uint32 i = 0; i < geometry.instances.size; i++) {
+        geometry.instances[i].occluder = true;
+    }
+    return SetUpLightProbeBake(&geometry, &data->allocator, &job->progress, &data->probeCommon);
+}
+
+void ThreadLightmapBakeEntry(AppWorkQueue* queue, void* data)
+{
+    const LightmapBakeEntry* entry = (const LightmapBakeEntry*)data;
+    LightmapBakeJob* job = entry->job;
+    LightmapBakeData* bakeData = (LightmapBakeData*)job->bakeData;
+
+    bool success = true;
+    switch (job->stage) {
+        case LightmapBakeStage::LOAD: {
+            success = LoadLightmapBake(job);
+        } break;
+        case LightmapBakeStage::VERTICES: {
+            const LightmapBakeBatch& batch = bakeData->batches[entry->index];
+            if (job->request.mode == LightmapBakeMode::AO) {
+                LightMeshVerticesAo(bakeData->geometry, batch.meshInd, job->request,
+                                    bakeData->meshSampleGroups[batch.meshInd], batch.triangleStart,
+                                    batch.triangleEnd, bakeData->meshVertexAo[batch.meshInd], &job->progress);
+            }
+            else {
+                LightMeshVertices(bakeData->geometry, batch.meshInd, bakeData->meshTriangleOffsets[batch.meshInd],
+                                  job->request, bakeData->meshSampleGroups[batch.meshInd], batch.triangleStart,
+                                  batch.triangleEnd, bakeData->meshVertexColors[batch.meshInd], &job->progress);
+            }
+        } break;
+        case LightmapBakeStage::WRITE_VERTICES: {
+            success = WriteLightmapBakeVertices(job);
+        } break;
+        case LightmapBakeStage::PROBES: {
+            WorkLightProbeSlice slice = { .common = &bakeData->probeCommon, .z = (int)entry->index };
+            ThreadLightProbeSlice(queue, &slice);
+        } break;
+        case LightmapBakeStage::WRITE_PROBES: {
+            success = WriteLightProbeFile(*bakeData->probeCommon.grid, job->lightmapDirPath, &bakeData->allocator);
+        } break;
+    }
+
+    if (!success) {
+        InterlockedExchange((volatile LONG*)&job->failed, 1);
+    }
+    // Full barrier, so the frame loop sees this entry's results once it sees it done
+    InterlockedIncrement((volatile LONG*)&job->entriesDone);
+}
+
+internal void SetLightmapBakeStage(LightmapBakeJob* job, LightmapBakeStage stage, uint32 numEntries)
+{
+    DEBUG_ASSERT(numEntries <= LightmapBakeJob::MAX_ENTRIES);
+    job->stage = stage;
+    job->numEntries = numEntries;
+    job->entriesQueued = 0;
+    job->entriesDone = 0;
+}
+
+void StartLightmapBake(AppWorkQueue* queue, LightmapBakeJob* job)
+{
+    DEBUG_ASSERT(job->state != LightmapBakeState::RUNNING);
+
+    for (uint32 i = 0; i < LightmapBakeJob::MAX_ENTRIES; i++) {
+        job->entries[i] = { .job = job, .index = i };
+    }
+    job->progress = {};
+    job->failed = 0;
+    job->bakeData = nullptr;
+    SetLightmapBakeStage(job, LightmapBakeStage::LOAD, 1);
+    job->state = LightmapBakeState::RUNNING;
+
+    UpdateLightmapBake(queue, job);
+}
+
+void UpdateLightmapBake(AppWorkQueue* queue, LightmapBakeJob* job)
+{
+    if (job->state != LightmapBakeState::RUNNING) {
+        return;
+    }
+
+    // Stages can finish within one frame if they're short, or if the queue was empty when they were queued
+    while (true) {
+        while (job->entriesQueued < job->numEntries) {
+            if (!TryAddWork(queue, ThreadLightmapBakeEntry, &job->entries[job->entriesQueued])) {
+                return;
+            }
+            job->entriesQueued++;
+        }
+        if (job->entriesDone != job->numEntries) {
+            return;
+        }
+
+        if (job->failed) {
+            job->state = LightmapBakeState::FAILED;
+            return;
+        }
+
+        const LightmapBakeData* data = (const LightmapBakeData*)job->bakeData;
+        switch (job->stage) {
+            case LightmapBakeStage::LOAD: {
+                SetLightmapBakeStage(job, LightmapBakeStage::VERTICES, data->batches.size);
+            } break;
+            case LightmapBakeStage::VERTICES: {
+                SetLightmapBakeStage(job, LightmapBakeStage::WRITE_VERTICES, 1);
+            } break;
+            case LightmapBakeStage::WRITE_VERTICES: {
+                if (job->request.mode == LightmapBakeMode::AO) {
+                    job->state = LightmapBakeState::DONE;
+                    return;
+                }
+                SetLightmapBakeStage(job, LightmapBakeStage::PROBES, data->probeCommon.grid->dims.z);
+            } break;
+            case LightmapBakeStage::PROBES: {
+                SetLightmapBakeStage(job, LightmapBakeStage::WRITE_PROBES, 1);
+            } break;
+            case LightmapBakeStage::WRITE_PROBES: {
+                job->state = LightmapBakeState::DONE;
+                return;
+            } break;
+        }
+    }
+}
@@ -4,28 +4,13 @@
 #include <km_common/km_memory.h>
 #include <km_common/app/km_app.h>
 
-// MODEL INDICES:
+// MODEL INDICES (reference scene):
 // 0, 1, 2 - some rocks
 // 3 - box, left
 // 4 - head
 // 5 - box, right
 // 6 - some other rock
-// 7 - walls
-
-#define RESTRICT_LIGHTING 1
-const int MODELS_TO_LIGHT[] = {
-    3
-};
-
-#define RESTRICT_OCCLUSION 0
-#define MODEL_TO_OCCLUDE 3
-
-#define RESTRICT_WALL 1
-const uint64 PLANE_LEFT  = 0;
-const uint64 PLANE_BACK  = 1;
-const uint64 PLANE_RIGHT = 2;
-const uint64 PLANE_FLOOR = 3;
-#define PLANE_TO_LIGHT PLANE_FLOOR
+// 7 - walls, 2 triangles each: left, back, right, floor
 
 const uint32 LIGHTMAP_NUM_BOUNCES = 1;
 const VkFilter LIGHTMAP_TEXTURE_FILTER = VK_FILTER_LINEAR;
@@ -36,5 +21,234 @@ const uint32 SAMPLES_PER_GROUP = 8; // AVX width, won't compile if != 8
 static_assert(NUM_HEMISPHERE_SAMPLES % SAMPLES_PER_GROUP == 0);
 const uint32 NUM_HEMISPHERE_SAMPLE_GROUPS = NUM_HEMISPHERE_SAMPLES / SAMPLES_PER_GROUP;
 
-bool GenerateLightmaps(const LoadObjResult& obj, uint32 bounces, AppWorkQueue* queue, LinearAllocator* allocator,
-                       const_string lightmapDirPath);
+// Vertex light files, data/lightmaps/N.v:
+//   LightmapVertexFileHeader
+//   uint32 colors[numColors], one per triangle corner, in the header's encoding
+const uint32 LIGHTMAP_VERTEX_FILE_MAGIC = 0x5654584c; // "LXTV"
+const uint32 LIGHTMAP_VERTEX_FILE_VERSION = 1;
+
+enum class LightmapVertexEncoding : uint32
+{
+    RGB9E5 = 0 // 9-bit mantissas with a shared 5-bit exponent, decoded in lightmapMesh.vert
+};
+
+struct LightmapVertexFileHeader
+{
+    uint32 magic;
+    uint32 version;
+    LightmapVertexEncoding encoding;
+    uint32 numColors;
+    uint64 meshHash; // HashObjModel of the mesh the file was baked for
+};
+
+// Hashes vertex positions, so lighting baked for an older version of a model can be detected on load
+uint64 HashObjModel(const ObjModel& model);
+uint32 EncodeRGB9E5(Vec3 color);
+
+// Read-only memory mapping of a whole file
+struct MappedFile
+{
+    void* fileHandle;
+    void* mappingHandle;
+    Array<uint8> data;
+};
+
+bool MapFileReadOnly(const_string filePath, LinearAllocator* allocator, MappedFile* mappedFile);
+void UnmapFile(MappedFile* mappedFile);
+
+// Fixed so that separate processes baking different shards of the same scene trace identical sample directions
+const unsigned int LIGHTMAP_SAMPLE_SEED = 0x4c4d4150;
+
+// Triangles are dealt round-robin across shards, by their index over all meshes in the scene.
+// A shard with count 1 bakes the whole scene and writes the final lightmap files directly.
+struct LightmapShard
+{
+    uint32 index;
+    uint32 count;
+};
+
+const LightmapShard LIGHTMAP_SHARD_ALL = { .index = 0, .count = 1 };
+
+enum class LightmapBakeMode : uint32
+{
+    GI, // light rects plus bounces, written as .v vertex light files
+    AO  // short-range ambient occlusion only, no lights or bounces, written as .ao files
+};
+
+// Ambient occlusion files, N.ao next to the vertex light files:
+//   LightmapAoFileHeader
+//   uint32 values[numValues], one per triangle corner: RGBA8, bent normal * 0.5 + 0.5 in RGB, visibility in A
+const uint32 LIGHTMAP_AO_FILE_MAGIC = 0x58564f41; // "AOVX"
+const uint32 LIGHTMAP_AO_FILE_VERSION = 1;
+
+struct LightmapAoFileHeader
+{
+    uint32 magic;
+    uint32 version;
+    uint32 numValues;
+    uint32 hasBentNormals; // if 0, RGB is unused
+    uint64 meshHash;
+};
+
+// Close enough for contact shadowing between props in the reference scene
+const float32 LIGHTMAP_AO_DEFAULT_MAX_DISTANCE = 0.5f;
+
+// Selects which part of the scene a bake computes. Mesh masks have one bit per obj model, so at most 64 models.
+// Lit meshes' triangles outside the selection are written as black.
+struct LightmapBakeRequest
+{
+    static const uint32 MAX_MESHES = 64;
+    static const uint64 ALL_MESHES = 0xffffffffffffffff;
+    static const uint32 ALL_TRIANGLES = 0xffffffff;
+
+    uint64 litMeshes;      // meshes that receive light
+    uint64 occluderMeshes; // meshes that block rays
+    // Per lit mesh, only triangles in [triangleStart, triangleEnd) are baked
+    uint32 triangleStart;
+    uint32 triangleEnd;
+    // If set, only triangles with their centroid inside [regionMin, regionMax] are baked
+    bool restrictRegion;
+    Vec3 regionMin;
+    Vec3 regionMax;
+    LightmapShard shard;
+    LightmapBakeMode mode;
+    float32 aoMaxDistance; // AO rays only count hits closer than this
+    bool aoBentNormals;    // also store the average unoccluded direction per vertex
+};
+
+// Box on the left of the reference scene
+const LightmapBakeRequest LIGHTMAP_BAKE_REQUEST_DEFAULT = {
+    .litMeshes = 1 << 3,
+    .occluderMeshes = LightmapBakeRequest::ALL_MESHES,
+    .triangleStart = 0,
+    .triangleEnd = LightmapBakeRequest::ALL_TRIANGLES,
+    .restrictRegion = false,
+    .regionMin = { 0.0f, 0.0f, 0.0f },
+    .regionMax = { 0.0f, 0.0f, 0.0f },
+    .shard = LIGHTMAP_SHARD_ALL,
+    .mode = LightmapBakeMode::GI,
+    .aoMaxDistance = LIGHTMAP_AO_DEFAULT_MAX_DISTANCE,
+    .aoBentNormals = false
+};
+
+// Parses "all" or a comma-separated list of mesh indices, e.g. "3,5"
+bool ParseLightmapMeshMask(const char* str, uint64* mask);
+
+// Written by the baking thread, only read elsewhere for display
+struct LightmapBakeProgress
+{
+    volatile uint32 trianglesDone;
+    volatile uint32 trianglesTotal;
+    volatile uint32 probeSlicesDone;
+    volatile uint32 probeSlicesTotal;
+};
+
+// In AO mode, bounces is ignored and sharding is not supported
+bool GenerateLightmaps(const LoadObjResult& obj, uint32 bounces, const LightmapBakeRequest& request,
+                       AppWorkQueue* queue, LinearAllocator* allocator, const_string lightmapDirPath,
+                       LightmapBakeProgress* progress = nullptr);
+
+// Combines the partial files written by shards 0 .. shardCount-1 into the final per-mesh vertex light files
+bool MergeLightmapShards(uint32 shardCount, LinearAllocator* allocator, const_string lightmapDirPath);
+
+// L1 spherical harmonics radiance, coefficients ordered Y00, Y1-1 (y), Y10 (z), Y11 (x)
+struct ShProbe
+{
+    Vec3 coeffs[4];
+};
+
+const ShProbe SH_PROBE_ZERO = {};
+
+// Probe files, data/lightmaps/probes.sh:
+//   LightProbeFileHeader
+//   ShProbe probes[dims.x * dims.y * dims.z], x fastest, then y, then z
+const uint32 LIGHT_PROBE_FILE_MAGIC = 0x424f5250; // "PROB"
+const uint32 LIGHT_PROBE_FILE_VERSION = 1;
+
+struct LightProbeFileHeader
+{
+    uint32 magic;
+    uint32 version;
+    Vec3Int dims;
+    Vec3 origin;
+    float32 spacing;
+};
+
+// Grid spacing is widened past this when the scene doesn't fit in MAX_DIM probes per axis
+const float32 LIGHT_PROBE_SPACING = 0.5f;
+
+struct LightProbeGrid
+{
+    static const uint32 MAX_DIM = 32;
+    static const uint32 MAX_PROBES = MAX_DIM * MAX_DIM * MAX_DIM;
+
+    Vec3Int dims; // all zero when no probes are loaded
+    Vec3 origin;
+    float32 spacing;
+    StaticArray<ShProbe, MAX_PROBES> probes;
+};
+
+// Bakes a probe grid over the scene bounds with the same tracer as vertex lighting, for lighting dynamic objects.
+// With a null queue, slices are baked on the calling thread.
+bool GenerateLightProbes(const LoadObjResult& obj, AppWorkQueue* queue, LinearAllocator* allocator,
+                         const_string lightmapDirPath, LightmapBakeProgress* progress = nullptr);
+
+bool LoadLightProbes(const_string lightmapDirPath, LinearAllocator* allocator, LightProbeGrid* grid);
+
+// Trilinearly interpolated probe at pos. False outside the grid, or if no probes are loaded.
+bool SampleLightProbes(const LightProbeGrid& grid, Vec3 pos, ShProbe* probe);
+
+enum class LightmapBakeState : uint32
+{
+    IDLE,
+    RUNNING,
+    DONE,
+    FAILED
+};
+
+// Stages of a bake, each one split into work queue entries that run in parallel
+enum class LightmapBakeStage : uint32
+{
+    LOAD,           // 1 entry: loads the obj and sets up the raycast geometry
+    VERTICES,       // 1 entry per batch of lit triangles
+    WRITE_VERTICES, // 1 entry: writes the vertex light or AO files, sets up the probe grid unless baking AO
+    PROBES,         // 1 entry per probe grid slice, not in AO mode
+    WRITE_PROBES    // 1 entry
+};
+
+struct LightmapBakeJob;
+
+struct LightmapBakeEntry
+{
+    LightmapBakeJob* job;
+    uint32 index;
+};
+
+// A full bake (vertex lighting, then probes), fed to the work queue a stage at a time by UpdateLightmapBake.
+// No entry waits on another, so the queue stays free for other work while the bake runs.
+// The job owns its memory, since the frame loop's scratch memory is reset every frame.
+struct LightmapBakeJob
+{
+    static const uint32 MAX_ENTRIES = 4096;
+
+    volatile LightmapBakeState state; // set by the frame loop only
+    LightmapBakeRequest request;
+    LightmapBakeProgress progress;
+    const_string objFilePath;
+    const_string lightmapDirPath;
+    LargeArray<uint8> memory;
+
+    LightmapBakeStage stage;
+    uint32 numEntries;     // in the current stage
+    uint32 entriesQueued;
+    volatile uint32 entriesDone;
+    volatile uint32 failed;
+    StaticArray<LightmapBakeEntry, MAX_ENTRIES> entries;
+    void* bakeData; // in memory, set up by the LOAD stage
+};
+
+// Sets the job RUNNING and queues its first stage. The request and paths must be set.
+void StartLightmapBake(AppWorkQueue* queue, LightmapBakeJob* job);
+// Call every frame while the job is RUNNING. Queues pending entries, and moves on to the next stage once every
+// entry of the current one is done. Sets the job DONE or FAILED once all its entries have finished.
+void UpdateLightmapBake(AppWorkQueue* queue, LightmapBakeJob* job);
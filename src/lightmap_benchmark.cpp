@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #define LOG_ERROR(format, ...) fprintf(stderr, format, ##__VA_ARGS__)
@@ -49,10 +50,89 @@ APP_UNLOAD_VULKAN_STATE_FUNCTION(AppUnloadVulkanState)
 
 #include "win32_main.cpp"
 
+const char* USAGE =
+    "Usage: lightmap_benchmark [options]\n"
+    "  --light <meshes>           meshes that receive light, \"all\" or e.g. \"3,5\"\n"
+    "  --occlude <meshes>         meshes that block light, \"all\" or e.g. \"3,5\"\n"
+    "  --triangles <start>-<end>  only bake triangles in [start, end) of each lit mesh\n"
+    "  --region <x,y,z,x,y,z>     only bake triangles with centroids inside this min/max box\n"
+    "  --shard <index>/<count>    bake one shard and write a partial file\n"
+    "  --merge <count>            combine the partial files of count shards\n"
+    "  --ao <max distance>        bake ambient occlusion only, counting hits closer than max distance\n"
+    "  --bent-normals <0|1>       also store bent normals in AO files\n"
+    "  --obj <path>               scene to bake, default data/models/reference-scene-small.obj\n"
+    "  --out <dir>                directory for baked files, default data/lightmaps\n";
+
 int main(int argc, char* argv[])
 {
-    UNREFERENCED_PARAMETER(argc);
-    UNREFERENCED_PARAMETER(argv);
+    LightmapBakeRequest request = LIGHTMAP_BAKE_REQUEST_DEFAULT;
+    uint32 mergeCount = 0;
+    const char* objFilePath = "data/models/reference-scene-small.obj";
+    const char* outDirPath = "data/lightmaps";
+    // Every option takes a single value
+    for (int i = 1; i < argc; i += 2) {
+        const char* option = argv[i];
+        if (i + 1 >= argc) {
+            LOG_ERROR("Missing value for \"%s\"\n", option);
+            LOG_ERROR(USAGE);
+            return 1;
+        }
+        const char* value = argv[i + 1];
+
+        bool valid = false;
+        if (strcmp(option, "--light") == 0) {
+            valid = ParseLightmapMeshMask(value, &request.litMeshes);
+        }
+        else if (strcmp(option, "--occlude") == 0) {
+            valid = ParseLightmapMeshMask(value, &request.occluderMeshes);
+        }
+        else if (strcmp(option, "--triangles") == 0) {
+            valid = sscanf(value, "%u-%u", &request.triangleStart, &request.triangleEnd) == 2
+                && request.triangleStart < request.triangleEnd;
+        }
+        else if (strcmp(option, "--region") == 0) {
+            Vec3& min = request.regionMin;
+            Vec3& max = request.regionMax;
+            valid = sscanf(value, "%f,%f,%f,%f,%f,%f", &min.x, &min.y, &min.z, &max.x, &max.y, &max.z) == 6;
+            request.restrictRegion = true;
+        }
+        else if (strcmp(option, "--shard") == 0) {
+            LightmapShard& shard = request.shard;
+            valid = sscanf(value, "%u/%u", &shard.index, &shard.count) == 2
+                && shard.count != 0 && shard.index < shard.count;
+        }
+        else if (strcmp(option, "--merge") == 0) {
+            valid = sscanf(value, "%u", &mergeCount) == 1 && mergeCount != 0;
+        }
+        else if (strcmp(option, "--ao") == 0) {
+            valid = sscanf(value, "%f", &request.aoMaxDistance) == 1 && request.aoMaxDistance > 0.0f;
+            request.mode = LightmapBakeMode::AO;
+        }
+        else if (strcmp(option, "--bent-normals") == 0) {
+            uint32 bentNormals;
+            valid = sscanf(value, "%u", &bentNormals) == 1 && bentNormals <= 1;
+            request.aoBentNormals = bentNormals != 0;
+        }
+        else if (strcmp(option, "--obj") == 0) {
+            objFilePath = value;
+            valid = true;
+        }
+        else if (strcmp(option, "--out") == 0) {
+            outDirPath = value;
+            valid = true;
+        }
+        else {
+            LOG_ERROR("Unrecognized option \"%s\"\n", option);
+            LOG_ERROR(USAGE);
+            return 1;
+        }
+
+        if (!valid) {
+            LOG_ERROR("Invalid value \"%s\" for %s\n", value, option);
+            LOG_ERROR(USAGE);
+            return 1;
+        }
+    }
 
     srand((unsigned int)time(NULL));
 
@@ -103,15 +183,27 @@ int main(int argc, char* argv[])
         LOG_INFO("Loaded work queue, %d threads\n", numThreads);
     }
 
+    const_string lightmapDirPath = ToString(outDirPath);
+
+    if (mergeCount != 0) {
+        LinearAllocator allocator(memory);
+        if (!MergeLightmapShards(mergeCount, &allocator, lightmapDirPath)) {
+            LOG_ERROR("Failed to merge lightmap shards\n");
+            LOG_FLUSH();
+            return 1;
+        }
+        return 0;
+    }
+
     {
         LinearAllocator allocator(memory);
 
         LoadObjResult obj;
-        if (!LoadObj(ToString("data/models/reference-scene-small.obj"), &obj, &allocator)) {
-            LOG_ERROR("Failed to load scene .obj when generating lightmaps\n");
+        if (!LoadObj(ToString(objFilePath), &obj, &allocator)) {
+            LOG_ERROR("Failed to load scene .obj %s when generating lightmaps\n", objFilePath);
             return 1;
         }
-        if (!GenerateLightmaps(obj, BOUNCES, &appWorkQueue, &allocator, "data/lightmaps/%llu.png")) {
+        if (!GenerateLightmaps(obj, BOUNCES, request, &appWorkQueue, &allocator, lightmapDirPath)) {
             LOG_ERROR("Failed to generate lightmaps\n");
         }
     }
@@ -19,23 +19,12 @@
 #define ENABLE_LIGHTMAPPED_MESH 1
 #define ENABLE_GRID 0
 
-#define DEFINE_BLOCK_ROTATION_MATRICES const Mat4 top = Translate(Vec3::unitZ); \
-const Mat4 bottom = UnitQuatToMat4(QuatFromAngleUnitAxis(PI_F, Normalize(Vec3 { 1.0f, 1.0f, 0.0f }))); \
-const Mat4 left   = Translate(Vec3 { 0.0f, 1.0f, 1.0f }) * \
-UnitQuatToMat4(QuatFromAngleUnitAxis(-PI_F / 2.0f, Vec3::unitX)); \
-const Mat4 right  = UnitQuatToMat4(QuatFromAngleUnitAxis(PI_F / 2.0f, Vec3::unitX)); \
-const Mat4 front  = Translate(Vec3 { 1.0f, 0.0f, 1.0f }) * \
-UnitQuatToMat4(QuatFromAngleUnitAxis(PI_F / 2.0f, Vec3::unitY)); \
-const Mat4 back   = UnitQuatToMat4(QuatFromAngleUnitAxis(-PI_F / 2.0f, Vec3::unitY));
-
 /*
 TODO
 
-> handle very large block grids (at least 2048x2048x64)
 > custom mesh blocks
 > ability to place any block (scroll wheel to switch?)
 > outline of block before placing
-> simple mob AI (keep going forward / chase player)
 > post-process pipeline for grain
 
 */
@@ -46,15 +35,29 @@ const int WINDOW_START_WIDTH  = 1600;
 const int WINDOW_START_HEIGHT = 900;
 const bool WINDOW_LOCK_CURSOR = true;
 const uint64 PERMANENT_MEMORY_SIZE = MEGABYTES(128);
-const uint64 TRANSIENT_MEMORY_SIZE = MEGABYTES(512);
+const uint64 TRANSIENT_MEMORY_SIZE = MEGABYTES(768);
+const uint64 LIGHTMAP_BAKE_MEMORY_SIZE = MEGABYTES(128); // carved out of transient memory, not reset per frame
+const uint64 LEVEL_JOB_MEMORY_SIZE = MEGABYTES(64); // same
+// Saves need a page and the chunk directory, the rest holds copies of chunks edited while they're being saved
+static_assert(LEVEL_JOB_MEMORY_SIZE >= LEVEL_SAVE_MAX_MEMORY + MEGABYTES(16));
 
 const float32 DEFAULT_BLOCK_SIZE = 1.0f;
-const uint32 DEFAULT_STREET_SIZE = 3;
-const uint32 DEFAULT_SIDEWALK_SIZE = 2;
-const uint32 DEFAULT_BUILDING_SIZE = 10;
-const uint32 DEFAULT_BUILDING_HEIGHT = 3;
-
-const float32 BLOCK_COLLISION_MARGIN = 0.2f;
+const uint32 DEFAULT_CITY_SEED = 1;
+const uint32 CITY_DISTRICT_SIZE = 256;
+const uint32 CITY_STREET_SIZE = 3;
+const uint32 CITY_SIDEWALK_SIZE = 2;
+const float32 CITY_PLAZA_CHANCE = 0.1f;
+// Residential, commercial, downtown. Buildings end below the top of the ground's chunk layer, so a city over the whole
+// grid takes half the chunk pool.
+const CityDistrict CITY_DISTRICTS[] = {
+    { .minLotSize = 8,  .maxLotSize = 14, .minBuildingHeight = 2,  .maxBuildingHeight = 6 },
+    { .minLotSize = 12, .maxLotSize = 20, .minBuildingHeight = 6,  .maxBuildingHeight = 16 },
+    { .minLotSize = 16, .maxLotSize = 24, .minBuildingHeight = 16, .maxBuildingHeight = 28 },
+};
+static_assert(BLOCK_ORIGIN.z - 1 + 28 < CHUNK_SIZE);
+
+const float32 PLAYER_RADIUS = 0.2f;
+const float32 PLAYER_HEAD_HEIGHT = 0.1f; // collision box top, above the camera
 
 const float32 DEFAULT_MOB_SPAWN_FREQ = 0.01f;
 
@@ -68,14 +71,23 @@ internal AppState* GetAppState(AppMemory* memory)
 
 internal TransientState* GetTransientState(AppMemory* memory)
 {
-    static_assert(sizeof(TransientState) < TRANSIENT_MEMORY_SIZE);
-    DEBUG_ASSERT(sizeof(TransientState) < memory->transient.size);
+    const uint64 jobsSize = LIGHTMAP_BAKE_MEMORY_SIZE + LEVEL_JOB_MEMORY_SIZE;
+    static_assert(sizeof(TransientState) + jobsSize < TRANSIENT_MEMORY_SIZE);
+    DEBUG_ASSERT(sizeof(TransientState) + jobsSize < memory->transient.size);
 
     TransientState* transientState = (TransientState*)memory->transient.data;
-    transientState->scratch = {
-        .size = memory->transient.size - sizeof(TransientState),
+    transientState->lightmapBakeJob.memory = {
+        .size = LIGHTMAP_BAKE_MEMORY_SIZE,
         .data = memory->transient.data + sizeof(TransientState),
     };
+    transientState->levelJob.memory = {
+        .size = LEVEL_JOB_MEMORY_SIZE,
+        .data = memory->transient.data + sizeof(TransientState) + LIGHTMAP_BAKE_MEMORY_SIZE,
+    };
+    transientState->scratch = {
+        .size = memory->transient.size - sizeof(TransientState) - jobsSize,
+        .data = memory->transient.data + sizeof(TransientState) + jobsSize,
+    };
     return transientState;
 }
 
@@ -100,6 +112,112 @@ Vec3 BlockIndexToWorldPos(Vec3Int blockIndex, float32 blockSize, Vec3Int blockOr
     };
 }
 
+#if ENABLE_LIGHTMAPPED_MESH
+// Fails if the triangle range is empty
+internal bool GetDebugBakeRequest(const AppState& appState, LightmapBakeRequest* request)
+{
+    *request = LIGHTMAP_BAKE_REQUEST_DEFAULT;
+
+    const PanelInputIntState& inputMesh = appState.inputBakeMesh;
+    if (inputMesh.valid && inputMesh.value >= 0 && inputMesh.value < (int)LightmapBakeRequest::MAX_MESHES) {
+        request->litMeshes = (uint64)1 << inputMesh.value;
+    }
+    else if (inputMesh.valid && inputMesh.value < 0) {
+        request->litMeshes = LightmapBakeRequest::ALL_MESHES;
+    }
+    if (appState.bakeOccludeLitOnly) {
+        request->occluderMeshes = request->litMeshes;
+    }
+
+    if (appState.inputBakeTriangleStart.valid && appState.inputBakeTriangleStart.value >= 0) {
+        request->triangleStart = appState.inputBakeTriangleStart.value;
+    }
+    if (appState.inputBakeTriangleEnd.valid && appState.inputBakeTriangleEnd.value >= 0) {
+        request->triangleEnd = appState.inputBakeTriangleEnd.value;
+    }
+
+    if (request->triangleStart >= request->triangleEnd) {
+        LOG_ERROR("Bake triangle range %lu-%lu is empty\n", request->triangleStart, request->triangleEnd);
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+internal CityGenParams GetCityGenParams(uint32 seed)
+{
+    return CityGenParams {
+        .seed = seed,
+        .districtSize = CITY_DISTRICT_SIZE,
+        .streetSize = CITY_STREET_SIZE,
+        .sidewalkSize = CITY_SIDEWALK_SIZE,
+        .plazaChance = CITY_PLAZA_CHANCE,
+        .districts = CITY_DISTRICTS,
+        .numDistricts = C_ARRAY_LENGTH(CITY_DISTRICTS)
+    };
+}
+
+// Any chunk's mesh has to fit in the staging ring on its own
+static_assert(MAX_CHUNK_QUADS * 6 * sizeof(VulkanMeshVertex) <= VulkanStagingRing::SIZE);
+
+internal bool LoadChunkMesh(const VulkanWindow& window, VkCommandBuffer commandBuffer, uint32 chunkSlot,
+                            Array<VulkanMeshVertex> vertices, VulkanAppState* app)
+{
+    DEBUG_ASSERT(app->chunkMeshInds[chunkSlot] == 0);
+    VulkanStaticMesh* chunkMesh = app->chunkMeshes.Append();
+    if (!LoadStaticMesh(window, commandBuffer, vertices, &app->stagingRing, chunkMesh)) {
+        app->chunkMeshes.RemoveLast();
+        return false;
+    }
+
+    app->chunkMeshSlots.Append((uint16)chunkSlot);
+    app->chunkMeshInds[chunkSlot] = (uint16)app->chunkMeshes.size;
+    return true;
+}
+
+// The last mesh moves into the unloaded one's place
+internal void UnloadChunkMesh(VkDevice device, uint32 chunkSlot, VulkanAppState* app)
+{
+    const uint16 meshInd = app->chunkMeshInds[chunkSlot];
+    if (meshInd == 0) {
+        return;
+    }
+
+    UnloadStaticMesh(device, &app->chunkMeshes[meshInd - 1]);
+    const uint32 last = app->chunkMeshes.size - 1;
+    app->chunkMeshes[meshInd - 1] = app->chunkMeshes[last];
+    app->chunkMeshSlots[meshInd - 1] = app->chunkMeshSlots[last];
+    app->chunkMeshInds[app->chunkMeshSlots[last]] = meshInd;
+    app->chunkMeshes.RemoveLast();
+    app->chunkMeshSlots.RemoveLast();
+    app->chunkMeshInds[chunkSlot] = 0;
+}
+
+// A running level job holds a work queue entry for its whole duration, so waiting for the queue to drain would wait
+// for it. Level work runs on the calling thread instead while one is in progress.
+// Lightmap bake entries are short, so waiting on them is fine.
+internal AppWorkQueue* GetLevelWorkQueue(AppWorkQueue* queue, const TransientState& transientState)
+{
+    if (transientState.levelJob.state == LevelJobState::RUNNING) {
+        return nullptr;
+    }
+
+    return queue;
+}
+
+// Block index that chunk data is streamed around
+internal Vec3Int GetStreamingBlockIndex(const AppState& appState)
+{
+    const float32 blockSize = appState.levelData.blockSize;
+    const Vec3 streamingPos = appState.noclip ? appState.noclipPos : appState.cameraPos;
+    return Vec3Int {
+        (int)FloorFloat32(streamingPos.x / blockSize) + BLOCK_ORIGIN.x,
+        (int)FloorFloat32(streamingPos.y / blockSize) + BLOCK_ORIGIN.y,
+        (int)FloorFloat32(streamingPos.z / blockSize) + BLOCK_ORIGIN.z,
+    };
+}
+
 APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
 {
     UNREFERENCED_PARAMETER(queue);
@@ -121,18 +239,29 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
 
         appState->cameraPos = startPos;
         appState->cameraAngles = Vec2 { 0.0f, 0.0f };
+        appState->fallSpeed = 0.0f;
 
         appState->levelData.blockSize = DEFAULT_BLOCK_SIZE; // NOTE this needs to happen before UpdateBlocksRenderInfo
+        appState->levelData.grid.pool = &appState->levelData.chunkPool;
         {
             LinearAllocator allocator(transientState->scratch);
 
+            appState->citySeed = DEFAULT_CITY_SEED;
             const Array<string> levels = GetSavedLevels(&allocator);
-            if (LoadLevel(levels[0], &appState->levelData, &allocator)) {
+            if (levels.size > 0 && LoadLevel(levels[0], &appState->levelData, &allocator)) {
                 LOG_INFO("Loaded level %.*s\n", levels[0].size, levels[0].data);
             }
             else {
-                LOG_ERROR("Failed to load level %.*s\n", levels[0].size, levels[0].data);
+                if (levels.size > 0) {
+                    LOG_ERROR("Failed to load level %.*s\n", levels[0].size, levels[0].data);
+                }
+                if (!GenerateCity(GetCityGenParams(appState->citySeed), &appState->levelData)) {
+                    LOG_ERROR("Failed to generate city\n");
+                }
             }
+
+            // Without probes, dynamic meshes fall back to the default directional lights
+            LoadLightProbes(ToString("data/lightmaps"), &allocator, &appState->lightProbes);
         }
 
         appState->levelData.collapsingMobIndex = appState->levelData.mobs.size;
@@ -147,6 +276,11 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
         appState->sliderBlockSize.value = appState->levelData.blockSize;
         appState->loadLevelDropdownState.selected = 0;
 
+        appState->inputBakeMesh.Initialize(3);
+        appState->inputBakeTriangleStart.Initialize(-1);
+        appState->inputBakeTriangleEnd.Initialize(-1);
+        appState->bakeOccludeLitOnly = false;
+
         memory->initialized = true;
     }
 
@@ -178,31 +312,53 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
     }
 
 #if ENABLE_LIGHTMAPPED_MESH
+    // Bake is fed to the work queue a stage at a time, results are swapped in on a later frame once it's done
+    LightmapBakeJob* bakeJob = &transientState->lightmapBakeJob;
     if (KeyPressed(input, KM_KEY_L)) {
+        if (bakeJob->state != LightmapBakeState::IDLE) {
+            LOG_INFO("Lightmap bake already in progress\n");
+        }
+        else if (GetDebugBakeRequest(*appState, &bakeJob->request)) {
+            bakeJob->objFilePath = ToString("data/models/reference-scene-small.obj");
+            bakeJob->lightmapDirPath = ToString("data/lightmaps");
+            StartLightmapBake(queue, bakeJob);
+        }
+    }
+    UpdateLightmapBake(queue, bakeJob);
+
+    if (bakeJob->state == LightmapBakeState::DONE) {
         LinearAllocator allocator(transientState->scratch);
 
-        LoadObjResult obj;
-        if (LoadObj(ToString("data/models/reference-scene-small.obj"), &obj, &allocator)) {
-            if (GenerateLightmaps(obj, LIGHTMAP_NUM_BOUNCES, queue, &allocator, ToString("data/lightmaps"))) {
-                AppUnloadVulkanSwapchainState(vulkanState, memory);
-                AppUnloadVulkanWindowState(vulkanState, memory);
-                if (!AppLoadVulkanWindowState(vulkanState, memory)) {
-                    LOG_ERROR("Failed to reload Vulkan state after lightmap generation\n");
-                }
-                if (!AppLoadVulkanSwapchainState(vulkanState, memory)) {
-                    LOG_ERROR("Failed to reload Vulkan state after lightmap generation\n");
-                }
-            }
-            else {
-                LOG_ERROR("Failed to generate lightmaps\n");
-            }
+        if (!LoadLightProbes(bakeJob->lightmapDirPath, &allocator, &appState->lightProbes)) {
+            LOG_ERROR("Failed to reload light probes after lightmap generation\n");
         }
-        else {
-            LOG_ERROR("Failed to load scene .obj when generating lightmaps\n");
+        if (!ReloadLightmapMeshLighting(vulkanState.window, appState->vulkanAppState.commandPool,
+                                        bakeJob->objFilePath, &allocator,
+                                        &appState->vulkanAppState.lightmapMeshPipeline)) {
+            LOG_ERROR("Failed to reload lightmaps after lightmap generation\n");
         }
+        bakeJob->state = LightmapBakeState::IDLE;
+    }
+    else if (bakeJob->state == LightmapBakeState::FAILED) {
+        LOG_ERROR("Lightmap bake failed\n");
+        bakeJob->state = LightmapBakeState::IDLE;
     }
 #endif
 
+    // Between frames' grid edits, a finished load replaces the level, and a finished save stops preserving chunks
+    LevelJob* levelJob = &transientState->levelJob;
+    FinishLevelJob(levelJob);
+    // The level being loaded is built in pool chunks the current one doesn't use, so it can't be edited until then
+    const bool levelLoading = levelJob->state == LevelJobState::RUNNING && levelJob->type == LevelJobType::LOAD;
+
+    // Block data around the camera, ahead of collision and edits. Loading doesn't wait on the rest of the queue.
+    if (!levelLoading) {
+        LinearAllocator allocator(transientState->scratch);
+        if (!UpdateBlockStreaming(GetStreamingBlockIndex(*appState), queue, &allocator, &appState->levelData)) {
+            LOG_ERROR("Failed to stream block chunk columns\n");
+        }
+    }
+
     const float32 cameraSensitivity = 2.0f;
     const Vec2 mouseDeltaFrac = {
         (float32)input.mouseDelta.x / (float32)screenSize.x,
@@ -258,42 +414,24 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
 
     if (velocity != Vec3::zero) {
         velocity = Normalize(velocity) * speed * deltaTime;
-        if (appState->noclip) {
-            appState->noclipPos += velocity;
-        }
-        else {
-            const Vec3 prevPos = appState->noclip ? appState->noclipPos : appState->cameraPos;
-            const Vec3Int prevBlockIndex = WorldPosToBlockIndex(prevPos, appState->levelData.blockSize,
-                                                                BLOCKS_SIZE, BLOCK_ORIGIN);
-
-            Rect range = {
-                .min = Vec2 { -1e8, -1e8 },
-                .max = Vec2 {  1e8,  1e8 },
-            };
-            if (prevBlockIndex.x >= 0 && prevBlockIndex.y >= 0) {
-                const Vec3 blockOrigin = BlockIndexToWorldPos(prevBlockIndex, appState->levelData.blockSize, BLOCK_ORIGIN);
-                if (!IsWalkable(appState->levelData, prevBlockIndex - Vec3Int::unitX)) {
-                    range.min.x = blockOrigin.x + BLOCK_COLLISION_MARGIN;
-                }
-                if (!IsWalkable(appState->levelData, prevBlockIndex + Vec3Int::unitX)) {
-                    range.max.x = blockOrigin.x + appState->levelData.blockSize - BLOCK_COLLISION_MARGIN;
-                }
-                if (!IsWalkable(appState->levelData, prevBlockIndex - Vec3Int::unitY)) {
-                    range.min.y = blockOrigin.y + BLOCK_COLLISION_MARGIN;
-                }
-                if (!IsWalkable(appState->levelData, prevBlockIndex + Vec3Int::unitY)) {
-                    range.max.y = blockOrigin.y + appState->levelData.blockSize - BLOCK_COLLISION_MARGIN;
-                }
-            }
-
-            Vec3 newPos = appState->cameraPos + velocity;
-            const Vec2 prevPos2 = { prevPos.x, prevPos.y };
-            if (IsWalkable(appState->levelData, prevBlockIndex)) {
-                newPos.x = ClampFloat32(newPos.x, range.min.x, range.max.x);
-                newPos.y = ClampFloat32(newPos.y, range.min.y, range.max.y);
-            }
-            appState->cameraPos = newPos;
+    }
+    if (appState->noclip) {
+        appState->noclipPos += velocity;
+    }
+    else {
+        // The player is a box from the feet to just above the camera, falling and walking through the block grid
+        appState->fallSpeed = MinFloat32(appState->fallSpeed + GRAVITY * deltaTime, MAX_FALL_SPEED);
+        const Vec3 delta = velocity - Vec3::unitZ * (appState->fallSpeed * deltaTime);
+        const Vec3 pos = appState->cameraPos;
+        const Box box = {
+            .min = Vec3 { pos.x - PLAYER_RADIUS, pos.y - PLAYER_RADIUS, pos.z - CAMERA_HEIGHT },
+            .max = Vec3 { pos.x + PLAYER_RADIUS, pos.y + PLAYER_RADIUS, pos.z + PLAYER_HEAD_HEIGHT },
+        };
+        const Vec3 moved = MoveBoxThroughBlocks(appState->levelData, box, delta);
+        if (moved.z > delta.z) {
+            appState->fallSpeed = 0.0f;
         }
+        appState->cameraPos += moved;
     }
 
     const Vec3 currentPos = appState->noclip ? appState->noclipPos : appState->cameraPos;
@@ -306,26 +444,17 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
     const Quat inverseCameraRot = Inverse(cameraRot);
     const Vec3 cameraForward = inverseCameraRot * Vec3::unitX;
 
-    uint32 hoverMobIndex = appState->levelData.mobs.size;
-    float32 hoverMobMinDist = 1e8;
-    for (uint32 i = 0; i < appState->levelData.mobs.size; i++) {
-        const Mob& mob = appState->levelData.mobs[i];
-        if (mob.collapsed) continue;
+    // Mobs that collapsed last frame are removed before any mob indices are taken for this one
+    CompactMobs(&appState->levelData);
+    // Hitboxes as they were moved last frame, along with mobs spawned or cleared since
+    UpdateMobSpatialHash(&appState->levelData);
 
+    uint32 hoverMobIndex = appState->levelData.mobs.size;
+    {
         const Vec3 rayOrigin = appState->noclip ? appState->noclipPos : appState->cameraPos;
-        const Vec3 inverseRayDir = Reciprocal(cameraForward);
-        // const float32 hitboxCollapsedScale = MinFloat32(1.0f, 1.2f - mob.collapseT);
-        const float32 hitboxCollapsedScale = 1.0f;
-        const Box hitboxCollapsed = {
-            .min = mob.hitbox.min * hitboxCollapsedScale,
-            .max = mob.hitbox.max * hitboxCollapsedScale
-        };
-        float32 t;
-        if (RayAxisAlignedBoxIntersection(rayOrigin, inverseRayDir, hitboxCollapsed, &t)) {
-            if (t < hoverMobMinDist) {
-                hoverMobIndex = i;
-                hoverMobMinDist = t;
-            }
+        MobRaycastHit hit;
+        if (RaycastMobs(appState->levelData, rayOrigin, cameraForward, INFINITY, &hit)) {
+            hoverMobIndex = hit.mobIndex;
         }
     }
 
@@ -341,21 +470,12 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
     const float32 totalCollapseTime = 2.0f;
     const float32 totalUncollapseTime = 0.6f;
 
-    for (uint32 i = 0; i < appState->levelData.mobs.size; i++) {
-        Mob& mob = appState->levelData.mobs[i];
-
-        if (i == appState->levelData.collapsingMobIndex) {
-            mob.collapseT += deltaTime / totalCollapseTime;
-            if (mob.collapseT >= 1.0f) {
-                mob.collapsed = true;
-                appState->levelData.collapsingMobIndex = appState->levelData.mobs.size;
-            }
-        }
-        else if (mob.collapseT < 1.0f) {
-            mob.collapseT -= deltaTime / totalUncollapseTime;
-        }
-
-        mob.collapseT = MaxFloat32(mob.collapseT, 0.0f);
+    UpdateMobCollapse(deltaTime / totalCollapseTime, deltaTime / totalUncollapseTime, &appState->levelData);
+    {
+        // Mobs chase the player's feet, which are on the same block level as theirs
+        const Vec3 playerPos = appState->noclip ? appState->noclipPos
+            : appState->cameraPos - Vec3::unitZ * CAMERA_HEIGHT;
+        UpdateMobSimulation(deltaTime, playerPos, GetLevelWorkQueue(queue, *transientState), &appState->levelData);
     }
 
     // Transforms world-view camera (+X forward, +Z up) to Vulkan camera (+Z forward, -Y up)
@@ -409,6 +529,10 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
                                                     blockIndex.x, blockIndex.y, blockIndex.z);
         panelDebugInfo.Text(blockIndexString);
 
+        const_string streamingString = AllocPrintf(&allocator, "%lu / %lu block quads streamed",
+                                                   appState->levelData.gridRenderInfo.numQuads, STREAMING_MAX_QUADS);
+        panelDebugInfo.Text(streamingString);
+
         panelDebugInfo.Text(string::empty);
 
         bool cursorLocked = IsCursorLocked();
@@ -417,54 +541,41 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
         }
         panelDebugInfo.Checkbox(&appState->noclip, ToString("noclip (N)"));
 
+#if ENABLE_LIGHTMAPPED_MESH
+        panelDebugInfo.Text(string::empty);
+        panelDebugInfo.Text(ToString("bake (L), -1 for all"));
+        panelDebugInfo.Text(ToString("mesh"));
+        panelDebugInfo.InputInt(&appState->inputBakeMesh, inputTextColor);
+        panelDebugInfo.Text(ToString("triangles start / end"));
+        panelDebugInfo.InputInt(&appState->inputBakeTriangleStart, inputTextColor);
+        panelDebugInfo.InputInt(&appState->inputBakeTriangleEnd, inputTextColor);
+        panelDebugInfo.Checkbox(&appState->bakeOccludeLitOnly, ToString("only lit mesh occludes"));
+
+        const LightmapBakeJob& bakeJob = transientState->lightmapBakeJob;
+        if (bakeJob.state == LightmapBakeState::RUNNING) {
+            const LightmapBakeProgress& progress = bakeJob.progress;
+            const_string progressString = AllocPrintf(&allocator, "baking: %lu/%lu tris, %lu/%lu probe slices",
+                                                      progress.trianglesDone, progress.trianglesTotal,
+                                                      progress.probeSlicesDone, progress.probeSlicesTotal);
+            panelDebugInfo.Text(progressString);
+        }
+#endif
+
         panelDebugInfo.Draw(panelBorderSize, Vec4::one, backgroundColor, screenSize,
                             &transientState->frameState.spriteRenderState, &transientState->frameState.textRenderState);
 
         // Block interact
-        const uint32 BLOCK_INTERACT_RANGE = 5;
+        const float32 BLOCK_INTERACT_DISTANCE = 32.0f;
         Vec3Int hitIndex = { -1, -1, -1 };
         float32 hitMinDist = 1e8;
+        BlockFace hitFace = BlockFace::TOP;
         {
             const Vec3 rayOrigin = appState->noclip ? appState->noclipPos : appState->cameraPos;
-            const Vec3 inverseRayDir = Reciprocal(cameraForward);
-
-            const Vec3Int startBlockIndex = WorldPosToBlockIndex(rayOrigin, appState->levelData.blockSize,
-                                                                 BLOCKS_SIZE, BLOCK_ORIGIN);
-            const int signX = cameraForward.x > 0.0f ? 1 : -1;
-            const int signY = cameraForward.y > 0.0f ? 1 : -1;
-            const int signZ = cameraForward.z > 0.0f ? 1 : -1;
-            for (uint32 z = 0; z < BLOCK_INTERACT_RANGE; z++) {
-                for (uint32 y = 0; y < BLOCK_INTERACT_RANGE; y++) {
-                    for (uint32 x = 0; x < BLOCK_INTERACT_RANGE; x++) {
-                        const Vec3Int blockInd = {
-                            .x = (int)x * signX + startBlockIndex.x,
-                            .y = (int)y * signY + startBlockIndex.y,
-                            .z = (int)z * signZ + startBlockIndex.z,
-                        };
-
-                        if (blockInd.x < 0 || blockInd.x >= BLOCKS_SIZE.x ||
-                            blockInd.y < 0 || blockInd.y >= BLOCKS_SIZE.y ||
-                            blockInd.z < 0 || blockInd.z >= BLOCKS_SIZE.z) {
-                            continue;
-                        }
-                        if (appState->levelData.grid[blockInd.z][blockInd.y][blockInd.x].id == BlockId::NONE) {
-                            continue;
-                        }
-
-                        const Vec3 blockPos = BlockIndexToWorldPos(blockInd, appState->levelData.blockSize, BLOCK_ORIGIN);
-                        const Box box = {
-                            .min = blockPos,
-                            .max = blockPos + Vec3 { appState->levelData.blockSize, appState->levelData.blockSize, appState->levelData.blockSize },
-                        };
-                        float32 t;
-                        if (RayAxisAlignedBoxIntersection(rayOrigin, inverseRayDir, box, &t)) {
-                            if (t > 0.0f && t < hitMinDist) {
-                                hitIndex = blockInd;
-                                hitMinDist = t;
-                            }
-                        }
-                    }
-                }
+            BlockRaycastHit hit;
+            if (RaycastBlocks(appState->levelData, rayOrigin, cameraForward, BLOCK_INTERACT_DISTANCE, &hit)) {
+                hitIndex = hit.blockIndex;
+                hitMinDist = hit.t;
+                hitFace = hit.face;
             }
         }
 
@@ -497,7 +608,13 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
         panelBlockEditor.Text(string::empty);
 
         if (panelBlockEditor.Button(ToString("Clear mobs (C)")) || KeyPressed(input, KM_KEY_C)) {
-            appState->levelData.mobs.Clear();
+            ClearMobs(&appState->levelData.mobs);
+        }
+        if ((panelBlockEditor.Button(ToString("Undo (Z)")) || KeyPressed(input, KM_KEY_Z)) && !levelLoading) {
+            UndoBlockUpdates(&appState->levelData, GetLevelWorkQueue(queue, *transientState), &allocator);
+        }
+        if ((panelBlockEditor.Button(ToString("Redo (Y)")) || KeyPressed(input, KM_KEY_Y)) && !levelLoading) {
+            RedoBlockUpdates(&appState->levelData, GetLevelWorkQueue(queue, *transientState), &allocator);
         }
 
         panelBlockEditor.Text(string::empty);
@@ -506,11 +623,8 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
         const Array<string> levels = GetSavedLevels(&allocator);
         if (panelBlockEditor.Dropdown(&appState->loadLevelDropdownState, levels)) {
             const_string level = levels[appState->loadLevelDropdownState.selected];
-            if (LoadLevel(level, &appState->levelData, &allocator)) {
-                LOG_INFO("Loaded level %.*s\n", level.size, level.data);
-            }
-            else {
-                LOG_ERROR("Failed to load level %.*s\n", level.size, level.data);
+            if (!StartLoadLevel(level, &appState->levelData, queue, levelJob)) {
+                LOG_ERROR("Failed to start loading level %.*s\n", level.size, level.data);
             }
         }
 
@@ -518,13 +632,19 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
 
         if (panelBlockEditor.Button(ToString("Save"))) {
             const_string level = levels[appState->loadLevelDropdownState.selected];
-            if (SaveLevel(level, appState->levelData, &allocator)) {
-                LOG_INFO("Saved level %.*s\n", level.size, level.data);
+            if (!StartSaveLevel(level, &appState->levelData, queue, levelJob)) {
+                LOG_ERROR("Failed to start saving level %.*s\n", level.size, level.data);
             }
-            else {
-                LOG_ERROR("Failed to save level %.*s\n", level.size, level.data);
+        }
+        if (panelBlockEditor.Button(ToString("Generate city")) && levelJob->state != LevelJobState::RUNNING) {
+            appState->citySeed++;
+            if (!GenerateCity(GetCityGenParams(appState->citySeed), &appState->levelData)) {
+                LOG_ERROR("Failed to generate city, seed %lu\n", appState->citySeed);
             }
         }
+        if (levelJob->state == LevelJobState::RUNNING) {
+            panelBlockEditor.Text(ToString(levelJob->type == LevelJobType::LOAD ? "loading..." : "saving..."));
+        }
 
         if (hitIndex.x != -1) {
             panelBlockEditor.Text(string::empty);
@@ -533,7 +653,7 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
 
             FixedArray<BlockUpdate, 2> updates;
             updates.Clear();
-            if (appState->blockEditor && !blockEditorChanged) {
+            if (appState->blockEditor && !blockEditorChanged && !levelLoading) {
                 if (MousePressed(input, KM_MOUSE_LEFT)) {
                     BlockUpdate* update = updates.Append();
                     update->index = hitIndex;
@@ -542,7 +662,7 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
                 if (MousePressed(input, KM_MOUSE_RIGHT)) {
                     if (hitIndex.z != BLOCKS_SIZE.z - 1) {
                         if (KeyDown(input, KM_KEY_SHIFT)) {
-                            const Vec3 hitboxRadius = { 0.5f, 0.5f, 1.3f };
+                            // Bottom of the hitbox on top of the block
                             const Vec3 blockPos = BlockIndexToWorldPos(hitIndex, appState->levelData.blockSize,
                                                                        BLOCK_ORIGIN);
                             const Vec3 mobOffset = Vec3 {
@@ -550,28 +670,29 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
                                 appState->levelData.blockSize / 2.0f,
                                 2.2f
                             };
-
-                            Mob* newMob = appState->levelData.mobs.Append();
-                            newMob->pos = blockPos + mobOffset;
-                            newMob->yaw = ModFloat32(appState->cameraAngles.x + PI_F, 2.0f * PI_F);
-                            newMob->hitbox = {
-                                .min = newMob->pos - hitboxRadius,
-                                .max = newMob->pos + hitboxRadius,
-                            };
-                            newMob->collapseT = 0.0f;
-                            newMob->collapsed = false;
+                            const float32 yaw = ModFloat32(appState->cameraAngles.x + PI_F, 2.0f * PI_F);
+                            if (!AddMob(blockPos + mobOffset, yaw, &appState->levelData.mobs)) {
+                                LOG_ERROR("Failed to add mob, limit is %lu\n", MAX_MOBS);
+                            }
                         }
                         else {
-                            BlockUpdate* update = updates.Append();
-                            update->index = hitIndex + Vec3Int::unitZ;
-                            update->block = { .id = BlockId::SIDEWALK };
+                            // Against the face that was clicked
+                            const Vec3Int placeIndex = hitIndex + BLOCK_FACE_AXES[(uint32)hitFace].normal;
+                            if (IsInBlockGrid(placeIndex)) {
+                                BlockUpdate* update = updates.Append();
+                                update->index = placeIndex;
+                                update->block = {
+                                    .id = KeyDown(input, KM_KEY_E) ? BlockId::LAMP : BlockId::SIDEWALK
+                                };
+                            }
                         }
                     }
                 }
             }
 
             if (updates.size > 0) {
-                SubmitBlockUpdates(updates.ToArray(), &appState->levelData);
+                SubmitBlockUpdates(updates.ToArray(), &appState->levelData, GetLevelWorkQueue(queue, *transientState),
+                                   &allocator);
             }
         }
 
@@ -613,24 +734,33 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
     }
 
 #if ENABLE_GRID
-    // Draw mobs
+    // Stream block chunk render data around the camera
     {
-        for (uint32 i = 0; i < appState->levelData.mobs.size; i++) {
-            const Mob& mob = appState->levelData.mobs[i];
-            if (mob.collapsed) continue;
-
-            const Mat4 model = Translate(mob.pos) * Rotate(Vec3 { 0.0f, 0.0f, mob.yaw }) * Scale(0.45f);
-            PushMesh(MeshId::MOB, model, Vec3::one * 0.6f, Vec3::zero, mob.collapseT,
-                     &transientState->frameState.meshRenderState);
+        // Meshing doesn't wait on the rest of the queue, so it can run next to a level job
+        LinearAllocator allocator(transientState->scratch);
+        if (!UpdateGridStreaming(appState->levelData.grid, GetStreamingBlockIndex(*appState), queue, &allocator,
+                                 &appState->levelData.gridRenderInfo)) {
+            LOG_ERROR("Failed to stream block chunks\n");
         }
     }
 
-    // Draw blocks
+    // Draw mobs
     {
-        for (uint32 i = 0; i < appState->levelData.gridRenderInfo.size; i++) {
-            const BlockRenderInfo& renderInfo = appState->levelData.gridRenderInfo[i];
-            PushMesh(renderInfo.meshId, renderInfo.model, renderInfo.color, Vec3::zero, 0.0f,
-                     &transientState->frameState.meshRenderState);
+        const MobList& mobs = appState->levelData.mobs;
+        for (uint32 w = 0; w < MOB_MASK_WORDS; w++) {
+            uint64 alive = mobs.aliveMask[w];
+            while (alive != 0) {
+                const uint32 i = w * 64 + (uint32)_tzcnt_u64(alive);
+                alive &= alive - 1;
+
+                const Vec3 pos = GetMobRenderPos(appState->levelData, i);
+                const float32 yaw = GetMobRenderYaw(appState->levelData, i);
+                const Mat4 model = Translate(pos) * Rotate(Vec3 { 0.0f, 0.0f, yaw }) * Scale(0.45f);
+                ShProbe probe;
+                const bool hasProbe = SampleLightProbes(appState->lightProbes, pos, &probe);
+                PushMesh(MeshId::MOB, model, Vec3::one * 0.6f, Vec3::zero, mobs.collapseT[i],
+                         hasProbe ? &probe : nullptr, &transientState->frameState.meshRenderState);
+            }
         }
     }
 
@@ -685,6 +815,42 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
         LOG_ERROR("vkBeginCommandBuffer failed\n");
     }
 
+#if ENABLE_GRID
+    // Upload block chunks whose quads changed, copying from the staging ring ahead of the render pass. The fence wait
+    // above means the previous frame is done with the old meshes and the ring. Chunks that don't fit wait a frame.
+    {
+        GridRenderInfo* gridRenderInfo = &appState->levelData.gridRenderInfo;
+        VulkanStagingRing* stagingRing = &appState->vulkanAppState.stagingRing;
+        stagingRing->used = 0;
+        bool stagingFull = false;
+        for (uint32 i = 0; i < GridRenderInfo::DIRTY_WORDS && !stagingFull; i++) {
+            uint64* upload = &gridRenderInfo->uploadChunks[i];
+            while (*upload != 0) {
+                const uint32 chunkSlot = i * 64 + (uint32)_tzcnt_u64(*upload);
+
+                LinearAllocator allocator(transientState->scratch);
+                const Array<VulkanMeshVertex> vertices = GetChunkMeshVertices(*gridRenderInfo, chunkSlot,
+                                                                              appState->levelData.blockSize,
+                                                                              BLOCK_ORIGIN, &allocator);
+                if (vertices.size * sizeof(VulkanMeshVertex) > VulkanStagingRing::SIZE - stagingRing->used) {
+                    stagingFull = true;
+                    break;
+                }
+
+                UnloadChunkMesh(vulkanState.window.device, chunkSlot, &appState->vulkanAppState);
+                if (vertices.size > 0 && !LoadChunkMesh(vulkanState.window, buffer, chunkSlot, vertices,
+                                                        &appState->vulkanAppState)) {
+                    LOG_ERROR("Failed to load mesh for block chunk %lu\n", chunkSlot);
+                }
+                *upload &= *upload - 1;
+            }
+        }
+        if (stagingRing->used > 0) {
+            SubmitStaticMeshUploadBarrier(buffer);
+        }
+    }
+#endif
+
     const VkClearValue clearValues[] = {
         { 0.0f, 0.0f, 0.0f, 1.0f },
         { 1.0f, 0 }
@@ -716,6 +882,10 @@ APP_UPDATE_AND_RENDER_FUNCTION(AppUpdateAndRender)
         LinearAllocator allocator(transientState->scratch);
         UploadAndSubmitMeshDrawCommands(vulkanState.window.device, buffer, appState->vulkanAppState.meshPipeline,
                                         transientState->frameState.meshRenderState, view, proj, &allocator);
+#if ENABLE_GRID
+        SubmitStaticMeshDrawCommands(buffer, appState->vulkanAppState.meshPipeline,
+                                     appState->vulkanAppState.chunkMeshes.ToArray());
+#endif
     }
 
     // Sprites
@@ -883,6 +1053,15 @@ APP_LOAD_VULKAN_WINDOW_STATE_FUNCTION(AppLoadVulkanWindowState)
         return false;
     }
 
+    if (!LoadStagingRing(window, &app->stagingRing)) {
+        LOG_ERROR("Failed to load staging ring\n");
+        return false;
+    }
+
+    // Chunk meshes were freed with the previous window state, if any
+    MemSet(appState->levelData.gridRenderInfo.uploadChunks.data, 0xff,
+           sizeof(appState->levelData.gridRenderInfo.uploadChunks));
+
 #if ENABLE_LIGHTMAPPED_MESH
     const bool lightmapMeshPipeline = LoadLightmapMeshPipelineWindow(window, app->commandPool, &allocator,
                                                                      &app->lightmapMeshPipeline);
@@ -985,6 +1164,13 @@ APP_UNLOAD_VULKAN_WINDOW_STATE_FUNCTION(AppUnloadVulkanWindowState)
 #if ENABLE_LIGHTMAPPED_MESH
     UnloadLightmapMeshPipelineWindow(device, &app->lightmapMeshPipeline);
 #endif
+    for (uint32 i = 0; i < app->chunkMeshes.size; i++) {
+        UnloadStaticMesh(device, &app->chunkMeshes[i]);
+    }
+    app->chunkMeshes.Clear();
+    app->chunkMeshSlots.Clear();
+    MemSet(app->chunkMeshInds.data, 0, sizeof(app->chunkMeshInds));
+    UnloadStagingRing(device, &app->stagingRing);
     UnloadMeshPipelineWindow(device, &app->meshPipeline);
 
     UnloadTextPipelineWindow(device, &app->textPipeline);
@@ -10,6 +10,7 @@
 
 #include "imgui.h"
 #include "level.h"
+#include "lightmap.h"
 #include "mesh.h"
 
 enum class SpriteId
@@ -40,12 +41,16 @@ struct VulkanAppState
 
     VulkanMeshPipeline meshPipeline;
     VulkanLightmapMeshPipeline lightmapMeshPipeline;
+
+    // Loaded block chunk meshes from gridRenderInfo, packed so drawing only visits these
+    FixedArray<VulkanStaticMesh, BlockGrid::NUM_CHUNK_SLOTS> chunkMeshes;
+    FixedArray<uint16, BlockGrid::NUM_CHUNK_SLOTS> chunkMeshSlots; // chunk index of each mesh
+    StaticArray<uint16, BlockGrid::NUM_CHUNK_SLOTS> chunkMeshInds; // per chunk index, 1 + mesh index, or 0
+    VulkanStagingRing stagingRing; // for chunk mesh uploads
 };
 
 struct AppState
 {
-    static const uint32 MAX_MOBS = 1024;
-
     VulkanAppState vulkanAppState;
     VulkanFontFace fontFaces[FontId::COUNT];
 
@@ -53,8 +58,10 @@ struct AppState
 
     Vec3 cameraPos;
     Vec2 cameraAngles;
+    float32 fallSpeed;
 
     LevelData levelData;
+    LightProbeGrid lightProbes;
 
     // Debug
     bool debugView;
@@ -65,6 +72,13 @@ struct AppState
     bool blockEditor;
     PanelSliderState sliderBlockSize;
     PanelDropdownState loadLevelDropdownState;
+    uint32 citySeed; // of the last generated city
+
+    // Lightmap bake selection for the L key, -1 means all
+    PanelInputIntState inputBakeMesh;
+    PanelInputIntState inputBakeTriangleStart;
+    PanelInputIntState inputBakeTriangleEnd;
+    bool bakeOccludeLitOnly;
 };
 
 struct FrameState
@@ -78,5 +92,7 @@ struct FrameState
 struct TransientState
 {
     FrameState frameState;
+    LightmapBakeJob lightmapBakeJob; // persists across frames while the bake runs on the work queue
+    LevelJob levelJob; // same, for level saves and loads
     LargeArray<uint8> scratch;
 };
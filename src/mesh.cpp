@@ -1,11 +1,6 @@
 #include "mesh.h"
 
-struct VulkanMeshVertex
-{
-    Vec3 pos;
-    Vec3 normal;
-    Vec3 color;
-};
+#include <intrin.h>
 
 using VulkanMeshTriangle = StaticArray<VulkanMeshVertex, 3>;
 
@@ -26,7 +21,6 @@ struct VulkanLightmapMeshVertex
 {
     Vec3 pos;
     Vec3 normal;
-    Vec3 color;
     Vec2 uv;
     float32 lightmapWeight;
 };
@@ -127,8 +121,6 @@ internal VulkanLightmapMeshGeometry ObjToVulkanLightmapMeshGeometry(const LoadOb
         return geometry;
     }
 
-    const Vec3 vertexColor = Vec3::zero;
-
     uint32 endInd = 0;
     for (uint32 i = 0; i < obj.models.size; i++) {
         for (uint32 j = 0; j < obj.models[i].triangles.size; j++) {
@@ -139,7 +131,6 @@ internal VulkanLightmapMeshGeometry ObjToVulkanLightmapMeshGeometry(const LoadOb
             for (int k = 0; k < 3; k++) {
                 geometry.triangles[tInd][k].pos = t.v[k].pos;
                 geometry.triangles[tInd][k].normal = normal;
-                geometry.triangles[tInd][k].color = vertexColor;
                 geometry.triangles[tInd][k].uv = t.v[k].uv;
             }
         }
@@ -153,7 +144,6 @@ internal VulkanLightmapMeshGeometry ObjToVulkanLightmapMeshGeometry(const LoadOb
             for (int k = 0; k < 3; k++) {
                 geometry.triangles[tInd][k].pos = q.v[k].pos;
                 geometry.triangles[tInd][k].normal = normal;
-                geometry.triangles[tInd][k].color = vertexColor;
                 geometry.triangles[tInd][k].uv = q.v[k].uv;
             }
 
@@ -161,7 +151,6 @@ internal VulkanLightmapMeshGeometry ObjToVulkanLightmapMeshGeometry(const LoadOb
                 const uint32 quadInd = (k + 2) % 4;
                 geometry.triangles[tInd + 1][k].pos = q.v[quadInd].pos;
                 geometry.triangles[tInd + 1][k].normal = normal;
-                geometry.triangles[tInd + 1][k].color = vertexColor;
                 geometry.triangles[tInd + 1][k].uv = q.v[quadInd].uv;
             }
         }
@@ -174,7 +163,96 @@ internal VulkanLightmapMeshGeometry ObjToVulkanLightmapMeshGeometry(const LoadOb
     return geometry;
 }
 
-void PushMesh(MeshId meshId, Mat4 model, Vec3 color, Vec3 collapseMid, float32 collapseT,
+// Copies packed vertex colors for one mesh out of its lightmap vertex file into dst, which must be exactly the
+// mesh's vertex count. Returns false if the file is missing or was baked for a different version of the mesh.
+internal bool LoadLightmapVertexColors(const_string filePath, uint64 meshHash, LinearAllocator* allocator,
+                                       Array<uint32> dst)
+{
+    MappedFile file;
+    if (!MapFileReadOnly(filePath, allocator, &file)) {
+        LOG_ERROR("Failed to map lightmap vertex file %.*s\n", filePath.size, filePath.data);
+        return false;
+    }
+    defer(UnmapFile(&file));
+
+    const LightmapVertexFileHeader* header = (const LightmapVertexFileHeader*)file.data.data;
+    if (file.data.size < sizeof(LightmapVertexFileHeader) || header->magic != LIGHTMAP_VERTEX_FILE_MAGIC) {
+        // Headerless float Vec3 files from before the format was versioned, no way to tell if they're stale
+        if (file.data.size == dst.size * sizeof(Vec3)) {
+            LOG_INFO("Converting legacy lightmap vertex file %.*s, rebake to update it\n", filePath.size, filePath.data);
+            const Vec3* legacyColors = (const Vec3*)file.data.data;
+            for (uint32 i = 0; i < dst.size; i++) {
+                dst[i] = EncodeRGB9E5(legacyColors[i]);
+            }
+            return true;
+        }
+
+        LOG_ERROR("Unrecognized lightmap vertex file %.*s\n", filePath.size, filePath.data);
+        return false;
+    }
+
+    if (header->version != LIGHTMAP_VERTEX_FILE_VERSION || header->encoding != LightmapVertexEncoding::RGB9E5) {
+        LOG_ERROR("Unsupported version %lu / encoding %lu in lightmap vertex file %.*s\n",
+                  header->version, (uint32)header->encoding, filePath.size, filePath.data);
+        return false;
+    }
+    if (header->meshHash != meshHash || header->numColors != dst.size) {
+        LOG_ERROR("Lightmap vertex file %.*s was baked for a different mesh (%lu colors, expected %lu)\n",
+                  filePath.size, filePath.data, header->numColors, dst.size);
+        return false;
+    }
+    if (file.data.size != sizeof(LightmapVertexFileHeader) + header->numColors * sizeof(uint32)) {
+        LOG_ERROR("Lightmap vertex file %.*s is truncated\n", filePath.size, filePath.data);
+        return false;
+    }
+
+    MemCopy(dst.data, header + 1, dst.size * sizeof(uint32));
+    return true;
+}
+
+// Darkens one mesh's vertex colors by its baked AO file and swaps in bent normals if the file has them.
+// Returns false, leaving the vertices untouched, if the file is missing or was baked for a different mesh.
+internal bool ApplyMeshVertexAo(const_string filePath, uint64 meshHash, LinearAllocator* allocator,
+                                Array<VulkanMeshTriangle> triangles)
+{
+    MappedFile file;
+    if (!MapFileReadOnly(filePath, allocator, &file)) {
+        return false;
+    }
+    defer(UnmapFile(&file));
+
+    const LightmapAoFileHeader* header = (const LightmapAoFileHeader*)file.data.data;
+    if (file.data.size < sizeof(LightmapAoFileHeader) || header->magic != LIGHTMAP_AO_FILE_MAGIC
+        || header->version != LIGHTMAP_AO_FILE_VERSION) {
+        LOG_ERROR("Unrecognized AO file %.*s\n", filePath.size, filePath.data);
+        return false;
+    }
+    if (header->meshHash != meshHash || header->numValues != triangles.size * 3
+        || file.data.size != sizeof(LightmapAoFileHeader) + header->numValues * sizeof(uint32)) {
+        LOG_ERROR("AO file %.*s was baked for a different mesh\n", filePath.size, filePath.data);
+        return false;
+    }
+
+    const uint32* values = (const uint32*)(header + 1);
+    for (uint32 i = 0; i < triangles.size; i++) {
+        for (int j = 0; j < 3; j++) {
+            const uint32 value = values[i * 3 + j];
+            triangles[i][j].color *= (float32)(value >> 24) / 255.0f;
+            if (header->hasBentNormals) {
+                const Vec3 bentNormal = {
+                    (float32)(value & 0xff) / 255.0f * 2.0f - 1.0f,
+                    (float32)((value >> 8) & 0xff) / 255.0f * 2.0f - 1.0f,
+                    (float32)((value >> 16) & 0xff) / 255.0f * 2.0f - 1.0f
+                };
+                triangles[i][j].normal = Normalize(bentNormal);
+            }
+        }
+    }
+
+    return true;
+}
+
+void PushMesh(MeshId meshId, Mat4 model, Vec3 color, Vec3 collapseMid, float32 collapseT, const ShProbe* probe,
               VulkanMeshRenderState* renderState)
 {
     const uint32 meshIndex = (uint32)meshId;
@@ -185,6 +263,14 @@ void PushMesh(MeshId meshId, Mat4 model, Vec3 color, Vec3 collapseMid, float32 c
     instanceData->color = color;
     instanceData->collapseMid = collapseMid;
     instanceData->collapseT = collapseT;
+    instanceData->hasProbe = probe != nullptr ? 1.0f : 0.0f;
+    const Vec3* c = probe != nullptr ? probe->coeffs : SH_PROBE_ZERO.coeffs;
+    const __m128i shR = _mm_cvtps_ph(_mm_setr_ps(c[0].r, c[1].r, c[2].r, c[3].r), _MM_FROUND_TO_NEAREST_INT);
+    const __m128i shG = _mm_cvtps_ph(_mm_setr_ps(c[0].g, c[1].g, c[2].g, c[3].g), _MM_FROUND_TO_NEAREST_INT);
+    const __m128i shB = _mm_cvtps_ph(_mm_setr_ps(c[0].b, c[1].b, c[2].b, c[3].b), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storel_epi64((__m128i*)instanceData->shR, shR);
+    _mm_storel_epi64((__m128i*)instanceData->shG, shG);
+    _mm_storel_epi64((__m128i*)instanceData->shB, shB);
 }
 
 void ResetMeshRenderState(VulkanMeshRenderState* renderState)
@@ -258,6 +344,26 @@ void UploadAndSubmitMeshDrawCommands(VkDevice device, VkCommandBuffer commandBuf
     }
 }
 
+void SubmitStaticMeshDrawCommands(VkCommandBuffer commandBuffer, const VulkanMeshPipeline& meshPipeline,
+                                  const Array<VulkanStaticMesh> staticMeshes)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline.pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline.pipelineLayout, 0, 1,
+                            &meshPipeline.descriptorSet, 0, nullptr);
+
+    for (uint32 i = 0; i < staticMeshes.size; i++) {
+        if (staticMeshes[i].numVertices == 0) continue;
+
+        const VkBuffer vertexBuffers[] = {
+            staticMeshes[i].vertexBuffer.buffer,
+            meshPipeline.staticInstanceBuffer.buffer
+        };
+        const VkDeviceSize offsets[] = { 0, 0 };
+        vkCmdBindVertexBuffers(commandBuffer, 0, C_ARRAY_LENGTH(vertexBuffers), vertexBuffers, offsets);
+        vkCmdDraw(commandBuffer, staticMeshes[i].numVertices, 1, 0, 0);
+    }
+}
+
 void UploadAndSubmitLightmapMeshDrawCommands(VkDevice device, VkCommandBuffer commandBuffer,
                                              const VulkanLightmapMeshPipeline& lightmapMeshPipeline,
                                              Mat4 model, Mat4 view, Mat4 proj)
@@ -275,8 +381,8 @@ void UploadAndSubmitLightmapMeshDrawCommands(VkDevice device, VkCommandBuffer co
 
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, lightmapMeshPipeline.pipeline);
 
-    const VkBuffer vertexBuffers[] = { lightmapMeshPipeline.vertexBuffer.buffer };
-    const VkDeviceSize offsets[] = { 0 };
+    const VkBuffer vertexBuffers[] = { lightmapMeshPipeline.vertexBuffer.buffer, lightmapMeshPipeline.colorBuffer.buffer };
+    const VkDeviceSize offsets[] = { 0, 0 };
     vkCmdBindVertexBuffers(commandBuffer, 0, C_ARRAY_LENGTH(vertexBuffers), vertexBuffers, offsets);
 
     uint32 startTriangleInd = 0;
@@ -335,7 +441,7 @@ bool LoadMeshPipelineSwapchain(const VulkanWindow& window, const VulkanSwapchain
     VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageCreateInfo, fragShaderStageCreateInfo };
 
     VkVertexInputBindingDescription bindingDescriptions[2] = {};
-    VkVertexInputAttributeDescription attributeDescriptions[10] = {};
+    VkVertexInputAttributeDescription attributeDescriptions[14] = {};
 
     // Per-vertex attribute bindings
     bindingDescriptions[0].binding = 0;
@@ -394,6 +500,26 @@ bool LoadMeshPipelineSwapchain(const VulkanWindow& window, const VulkanSwapchain
     attributeDescriptions[9].format = VK_FORMAT_R32_SFLOAT;
     attributeDescriptions[9].offset = offsetof(VulkanMeshInstanceData, collapseT);
 
+    attributeDescriptions[10].binding = 1;
+    attributeDescriptions[10].location = 10;
+    attributeDescriptions[10].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    attributeDescriptions[10].offset = offsetof(VulkanMeshInstanceData, shR);
+
+    attributeDescriptions[11].binding = 1;
+    attributeDescriptions[11].location = 11;
+    attributeDescriptions[11].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    attributeDescriptions[11].offset = offsetof(VulkanMeshInstanceData, shG);
+
+    attributeDescriptions[12].binding = 1;
+    attributeDescriptions[12].location = 12;
+    attributeDescriptions[12].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    attributeDescriptions[12].offset = offsetof(VulkanMeshInstanceData, shB);
+
+    attributeDescriptions[13].binding = 1;
+    attributeDescriptions[13].location = 13;
+    attributeDescriptions[13].format = VK_FORMAT_R32_SFLOAT;
+    attributeDescriptions[13].offset = offsetof(VulkanMeshInstanceData, hasProbe);
+
     VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
     vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     vertexInputCreateInfo.vertexBindingDescriptionCount = C_ARRAY_LENGTH(bindingDescriptions);
@@ -551,10 +677,11 @@ bool LoadMeshPipelineWindow(const VulkanWindow& window, VkCommandPool commandPoo
         struct ObjMesh {
             MeshId id;
             const_string path;
+            const_string aoDirPath; // optional AO bake, e.g. lightmap_benchmark --ao 0.5 --obj <path> --out <dir>
         };
 
         const ObjMesh objMeshes[] = {
-            { MeshId::MOB, ToString("data/models/enemy1.obj") },
+            { MeshId::MOB, ToString("data/models/enemy1.obj"), ToString("data/lightmaps/enemy1") },
         };
 
         for (uint32 i = 0; i < C_ARRAY_LENGTH(objMeshes); i++) {
@@ -570,6 +697,21 @@ bool LoadMeshPipelineWindow(const VulkanWindow& window, VkCommandPool commandPoo
                 return false;
             }
 
+            // Contact shadowing without a full GI bake, meshes without an AO file stay unshadowed
+            uint32 startInd = 0;
+            for (uint32 j = 0; j < obj.models.size; j++) {
+                const Array<VulkanMeshTriangle> modelTriangles = {
+                    .size = geometry.meshEndInds[j] - startInd,
+                    .data = geometry.triangles.data + startInd
+                };
+                const_string aoFilePath = AllocPrintf(allocator, "%.*s/%lu.ao",
+                                                      objMeshes[i].aoDirPath.size, objMeshes[i].aoDirPath.data, j);
+                if (!ApplyMeshVertexAo(aoFilePath, HashObjModel(obj.models[j]), allocator, modelTriangles)) {
+                    LOG_INFO("No AO for %.*s model %lu\n", objMeshes[i].path.size, objMeshes[i].path.data, j);
+                }
+                startInd = geometry.meshEndInds[j];
+            }
+
             const Array<VulkanMeshVertex> objVertices = {
                 .size = geometry.triangles.size * 3,
                 .data = &geometry.triangles[0][0]
@@ -625,6 +767,28 @@ bool LoadMeshPipelineWindow(const VulkanWindow& window, VkCommandPool commandPoo
         }
     }
 
+    // Create static mesh instance buffer
+    {
+        const VkDeviceSize bufferSize = sizeof(VulkanMeshInstanceData);
+
+        if (!CreateVulkanBuffer(bufferSize,
+                                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                window.device, window.physicalDevice, &meshPipeline->staticInstanceBuffer)) {
+            LOG_ERROR("CreateBuffer failed for static instance buffer\n");
+            return false;
+        }
+
+        VulkanMeshInstanceData instance = {};
+        instance.model = Mat4::one;
+        instance.color = Vec3::one;
+
+        void* data;
+        vkMapMemory(window.device, meshPipeline->staticInstanceBuffer.memory, 0, bufferSize, 0, &data);
+        MemCopy(data, &instance, sizeof(instance));
+        vkUnmapMemory(window.device, meshPipeline->staticInstanceBuffer.memory);
+    }
+
     // Create uniform buffer
     {
         VkDeviceSize uniformBufferSize = sizeof(MeshUniformBufferObject);
@@ -716,10 +880,85 @@ void UnloadMeshPipelineWindow(VkDevice device, VulkanMeshPipeline* meshPipeline)
     vkDestroyDescriptorSetLayout(device, meshPipeline->descriptorSetLayout, nullptr);
 
     DestroyVulkanBuffer(device, &meshPipeline->uniformBuffer);
+    DestroyVulkanBuffer(device, &meshPipeline->staticInstanceBuffer);
     DestroyVulkanBuffer(device, &meshPipeline->instanceBuffer);
     DestroyVulkanBuffer(device, &meshPipeline->vertexBuffer);
 }
 
+bool LoadStagingRing(const VulkanWindow& window, VulkanStagingRing* stagingRing)
+{
+    if (!CreateVulkanBuffer(VulkanStagingRing::SIZE,
+                            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                            window.device, window.physicalDevice, &stagingRing->buffer)) {
+        LOG_ERROR("CreateBuffer failed for staging ring\n");
+        return false;
+    }
+
+    void* data;
+    if (vkMapMemory(window.device, stagingRing->buffer.memory, 0, VulkanStagingRing::SIZE, 0, &data) != VK_SUCCESS) {
+        LOG_ERROR("vkMapMemory failed for staging ring\n");
+        DestroyVulkanBuffer(window.device, &stagingRing->buffer);
+        return false;
+    }
+
+    stagingRing->data = (uint8*)data;
+    stagingRing->used = 0;
+    return true;
+}
+
+void UnloadStagingRing(VkDevice device, VulkanStagingRing* stagingRing)
+{
+    vkUnmapMemory(device, stagingRing->buffer.memory);
+    DestroyVulkanBuffer(device, &stagingRing->buffer);
+}
+
+bool LoadStaticMesh(const VulkanWindow& window, VkCommandBuffer commandBuffer, Array<VulkanMeshVertex> vertices,
+                    VulkanStagingRing* stagingRing, VulkanStaticMesh* staticMesh)
+{
+    DEBUG_ASSERT(vertices.size > 0);
+    const VkDeviceSize vertexBufferSize = vertices.size * sizeof(VulkanMeshVertex);
+    DEBUG_ASSERT(vertexBufferSize <= VulkanStagingRing::SIZE - stagingRing->used);
+
+    if (!CreateVulkanBuffer(vertexBufferSize,
+                            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            window.device, window.physicalDevice, &staticMesh->vertexBuffer)) {
+        LOG_ERROR("CreateBuffer failed for vertex buffer\n");
+        return false;
+    }
+
+    MemCopy(stagingRing->data + stagingRing->used, vertices.data, vertexBufferSize);
+
+    VkBufferCopy copyRegion = {};
+    copyRegion.srcOffset = stagingRing->used;
+    copyRegion.dstOffset = 0;
+    copyRegion.size = vertexBufferSize;
+    vkCmdCopyBuffer(commandBuffer, stagingRing->buffer.buffer, staticMesh->vertexBuffer.buffer, 1, &copyRegion);
+    stagingRing->used += vertexBufferSize;
+
+    staticMesh->numVertices = vertices.size;
+    return true;
+}
+
+void UnloadStaticMesh(VkDevice device, VulkanStaticMesh* staticMesh)
+{
+    if (staticMesh->numVertices > 0) {
+        DestroyVulkanBuffer(device, &staticMesh->vertexBuffer);
+        staticMesh->numVertices = 0;
+    }
+}
+
+void SubmitStaticMeshUploadBarrier(VkCommandBuffer commandBuffer)
+{
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+}
+
 bool LoadLightmapMeshPipelineSwapchain(const VulkanWindow& window, const VulkanSwapchain& swapchain, LinearAllocator* allocator, VulkanLightmapMeshPipeline* lightmapMeshPipeline)
 {
     const Array<uint8> vertShaderCode = LoadEntireFile(ToString("data/shaders/lightmapMesh.vert.spv"), allocator);
@@ -762,10 +1001,14 @@ bool LoadLightmapMeshPipelineSwapchain(const VulkanWindow& window, const VulkanS
 
     VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageCreateInfo, fragShaderStageCreateInfo };
 
-    VkVertexInputBindingDescription bindingDescription = {};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(VulkanLightmapMeshVertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    VkVertexInputBindingDescription bindingDescriptions[2] = {};
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = sizeof(VulkanLightmapMeshVertex);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    bindingDescriptions[1].binding = 1;
+    bindingDescriptions[1].stride = sizeof(uint32);
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
     VkVertexInputAttributeDescription attributeDescriptions[5] = {};
     attributeDescriptions[0].binding = 0;
@@ -778,10 +1021,10 @@ bool LoadLightmapMeshPipelineSwapchain(const VulkanWindow& window, const VulkanS
     attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
     attributeDescriptions[1].offset = offsetof(VulkanLightmapMeshVertex, normal);
 
-    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].binding = 1;
     attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(VulkanLightmapMeshVertex, color);
+    attributeDescriptions[2].format = VK_FORMAT_R32_UINT;
+    attributeDescriptions[2].offset = 0;
 
     attributeDescriptions[3].binding = 0;
     attributeDescriptions[3].location = 3;
@@ -795,8 +1038,8 @@ bool LoadLightmapMeshPipelineSwapchain(const VulkanWindow& window, const VulkanS
 
     VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
     vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
-    vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputCreateInfo.vertexBindingDescriptionCount = C_ARRAY_LENGTH(bindingDescriptions);
+    vertexInputCreateInfo.pVertexBindingDescriptions = bindingDescriptions;
     vertexInputCreateInfo.vertexAttributeDescriptionCount = C_ARRAY_LENGTH(attributeDescriptions);
     vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions;
 
@@ -923,18 +1166,144 @@ void UnloadLightmapMeshPipelineSwapchain(VkDevice device, VulkanLightmapMeshPipe
     vkDestroyPipelineLayout(device, lightmapMeshPipeline->pipelineLayout, nullptr);
 }
 
+// Copies memory-mapped lightmap vertex files straight into the staging buffer. Meshes with missing or stale files
+// are left unlit rather than failing, since lightmaps can be rebaked at runtime.
+internal bool CreateLightmapMeshColorBuffer(const VulkanWindow& window, VkCommandPool commandPool,
+                                            const LoadObjResult& obj, const Array<uint32>& meshEndInds,
+                                            LinearAllocator* allocator, VulkanBuffer* colorBuffer)
+{
+    const uint32 numColors = (meshEndInds.size > 0 ? meshEndInds[meshEndInds.size - 1] : 0) * 3;
+    const VkDeviceSize colorBufferSize = numColors * sizeof(uint32);
+
+    VulkanBuffer stagingBuffer;
+    if (!CreateVulkanBuffer(colorBufferSize,
+                            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                            window.device, window.physicalDevice, &stagingBuffer)) {
+        LOG_ERROR("CreateBuffer failed for color staging buffer\n");
+        return false;
+    }
+    defer(DestroyVulkanBuffer(window.device, &stagingBuffer));
+
+    void* data;
+    vkMapMemory(window.device, stagingBuffer.memory, 0, colorBufferSize, 0, &data);
+    const Array<uint32> colors = { .size = numColors, .data = (uint32*)data };
+
+    uint32 startInd = 0;
+    for (uint32 i = 0; i < meshEndInds.size; i++) {
+        const Array<uint32> meshColors = {
+            .size = (meshEndInds[i] - startInd) * 3,
+            .data = colors.data + startInd * 3
+        };
+        const_string filePath = AllocPrintf(allocator, "data/lightmaps/%llu.v", i);
+        if (!LoadLightmapVertexColors(filePath, HashObjModel(obj.models[i]), allocator, meshColors)) {
+            LOG_ERROR("Missing or stale vertex colors for mesh %lu, rendering unlit\n", i);
+            MemSet(meshColors.data, 0, meshColors.size * sizeof(uint32));
+        }
+
+        startInd = meshEndInds[i];
+    }
+
+    vkUnmapMemory(window.device, stagingBuffer.memory);
+
+    if (!CreateVulkanBuffer(colorBufferSize,
+                            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            window.device, window.physicalDevice, colorBuffer)) {
+        LOG_ERROR("CreateBuffer failed for color buffer\n");
+        return false;
+    }
+
+    CopyBuffer(window.device, commandPool, window.graphicsQueue, stagingBuffer.buffer, colorBuffer->buffer,
+               colorBufferSize);
+    return true;
+}
+
+internal void DestroyLightmapImages(VkDevice device,
+                                    FixedArray<VulkanImage, VulkanLightmapMeshPipeline::MAX_LIGHTMAPS>* lightmaps)
+{
+    for (uint32 i = 0; i < lightmaps->size; i++) {
+        vkDestroyImageView(device, (*lightmaps)[i].view, nullptr);
+        vkDestroyImage(device, (*lightmaps)[i].image, nullptr);
+        vkFreeMemory(device, (*lightmaps)[i].memory, nullptr);
+    }
+    lightmaps->Clear();
+}
+
+// Appends one image per mesh to lightmaps. On failure, images loaded so far are left in the array.
+internal bool LoadLightmapImages(const VulkanWindow& window, VkCommandPool commandPool, uint32 numMeshes,
+                                 LinearAllocator* allocator,
+                                 FixedArray<VulkanImage, VulkanLightmapMeshPipeline::MAX_LIGHTMAPS>* lightmaps)
+{
+    for (uint32 i = 0; i < numMeshes; i++) {
+        const char* filePath = ToCString(AllocPrintf(allocator, "data/lightmaps/%llu.png", i), allocator);
+        int width, height, channels;
+        unsigned char* imageData = stbi_load(filePath, &width, &height, &channels, 0);
+        if (imageData == NULL) {
+            LOG_ERROR("Failed to load lightmap: %s\n", filePath);
+            return false;
+        }
+        defer(stbi_image_free(imageData));
+
+        VulkanImage* lightmapImage = lightmaps->Append();
+        if (!LoadVulkanImage(window.device, window.physicalDevice, window.graphicsQueue, commandPool,
+                             width, height, channels, (const uint8*)imageData, lightmapImage)) {
+            LOG_ERROR("Failed to Vulkan image for lightmap %s\n", filePath);
+            lightmaps->RemoveLast();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+internal void WriteLightmapMeshDescriptorSets(VkDevice device, const VulkanLightmapMeshPipeline& lightmapMeshPipeline)
+{
+    for (uint32 i = 0; i < lightmapMeshPipeline.descriptorSets.size; i++) {
+        VkWriteDescriptorSet descriptorWrites[2] = {};
+
+        VkDescriptorBufferInfo bufferInfo = {};
+        bufferInfo.buffer = lightmapMeshPipeline.uniformBuffer.buffer;
+        bufferInfo.offset = 0;
+        bufferInfo.range = sizeof(LightmapMeshUniformBufferObject);
+
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = lightmapMeshPipeline.descriptorSets[i];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+        VkDescriptorImageInfo imageInfo = {};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = lightmapMeshPipeline.lightmaps[i].view;
+        imageInfo.sampler = lightmapMeshPipeline.lightmapSampler;
+
+        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[1].dstSet = lightmapMeshPipeline.descriptorSets[i];
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].dstArrayElement = 0;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[1].descriptorCount = 1;
+        descriptorWrites[1].pImageInfo = &imageInfo;
+
+        vkUpdateDescriptorSets(device, C_ARRAY_LENGTH(descriptorWrites), descriptorWrites, 0, nullptr);
+    }
+}
+
 bool LoadLightmapMeshPipelineWindow(const VulkanWindow& window, VkCommandPool commandPool, LinearAllocator* allocator,
                                     VulkanLightmapMeshPipeline* lightmapMeshPipeline)
 {
+    LoadObjResult obj;
+    if (!LoadObj(ToString("data/models/reference-scene-small.obj"), &obj, allocator)) {
+        LOG_ERROR("Failed to load reference scene .obj\n");
+        return false;
+    }
+
     // Load vulkan vertex geometry
     VulkanLightmapMeshGeometry geometry;
     {
-        LoadObjResult obj;
-        if (!LoadObj(ToString("data/models/reference-scene-small.obj"), &obj, allocator)) {
-            LOG_ERROR("Failed to load reference scene .obj\n");
-            return false;
-        }
-
         geometry = ObjToVulkanLightmapMeshGeometry(obj, allocator);
         if (!geometry.valid) {
             LOG_ERROR("Failed to load Vulkan geometry from obj\n");
@@ -951,44 +1320,6 @@ bool LoadLightmapMeshPipelineWindow(const VulkanWindow& window, VkCommandPool co
             }
         }
 
-        // Load vertex colors from lightmap data
-        uint32 startInd = 0;
-        for (uint32 i = 0; i < geometry.meshEndInds.size; i++) {
-            const_string filePath = AllocPrintf(allocator, "data/lightmaps/%llu.v", i);
-            Array<uint8> vertexColors = LoadEntireFile(filePath, allocator);
-            if (vertexColors.data == nullptr) {
-                LOG_ERROR("Failed to load vertex colors for mesh %lu\n", i);
-                return false;
-            }
-
-            const bool sizeEvenVec3 = vertexColors.size % sizeof(Vec3) == 0;
-            const bool sizeEvenTriangles = (vertexColors.size / sizeof(Vec3)) % 3 == 0;
-            if (!sizeEvenVec3 || !sizeEvenTriangles) {
-                LOG_ERROR("Incorrect format for vertex colors at %.*s, mesh %lu\n", filePath.size, filePath.data, i);
-                return false;
-            }
-
-            const uint32 expectedColors = (geometry.meshEndInds[i] - startInd) * 3;
-            const uint32 numColors = vertexColors.size / sizeof(Vec3);
-            if (expectedColors != numColors) {
-                LOG_ERROR("Mismatched number of vertex colors, expected %lu, got %lu\n", expectedColors, numColors);
-                return false;
-            }
-
-            const Array<Vec3> colors = {
-                .size = vertexColors.size / sizeof(Vec3),
-                .data = (Vec3*)vertexColors.data
-            };
-            for (uint32 j = startInd; j < geometry.meshEndInds[i]; j++) {
-                const uint32 colorInd = (j - startInd) * 3;
-                geometry.triangles[j][0].color = colors[colorInd];
-                geometry.triangles[j][1].color = colors[colorInd + 1];
-                geometry.triangles[j][2].color = colors[colorInd + 2];
-            }
-
-            startInd = geometry.meshEndInds[i];
-        }
-
         // Save mesh triangle end inds to VulkanApp structure for draw commands to use
         for (uint32 i = 0; i < geometry.meshEndInds.size; i++) {
             lightmapMeshPipeline->meshTriangleEndInds.Append(geometry.meshEndInds[i]);
@@ -1029,24 +1360,21 @@ bool LoadLightmapMeshPipelineWindow(const VulkanWindow& window, VkCommandPool co
         DestroyVulkanBuffer(window.device, &stagingBuffer);
     }
 
-    // Create lightmaps
+    // Create vertex color buffer
     {
-        for (uint32 i = 0; i < geometry.meshEndInds.size; i++) {
-            const char* filePath = ToCString(AllocPrintf(allocator, "data/lightmaps/%llu.png", i), allocator);
-            int width, height, channels;
-            unsigned char* imageData = stbi_load(filePath, &width, &height, &channels, 0);
-            if (imageData == NULL) {
-                LOG_ERROR("Failed to load lightmap: %s\n", filePath);
-                return false;
-            }
-            defer(stbi_image_free(imageData));
+        if (!CreateLightmapMeshColorBuffer(window, commandPool, obj, geometry.meshEndInds, allocator,
+                                           &lightmapMeshPipeline->colorBuffer)) {
+            LOG_ERROR("Failed to create lightmap vertex color buffer\n");
+            return false;
+        }
+    }
 
-            VulkanImage* lightmapImage = lightmapMeshPipeline->lightmaps.Append();
-            if (!LoadVulkanImage(window.device, window.physicalDevice, window.graphicsQueue, commandPool,
-                                 width, height, channels, (const uint8*)imageData, lightmapImage)) {
-                LOG_ERROR("Failed to Vulkan image for lightmap %s\n", filePath);
-                return false;
-            }
+    // Create lightmaps
+    {
+        if (!LoadLightmapImages(window, commandPool, geometry.meshEndInds.size, allocator,
+                                &lightmapMeshPipeline->lightmaps)) {
+            LOG_ERROR("Failed to load lightmap images\n");
+            return false;
         }
     }
 
@@ -1158,42 +1486,59 @@ bool LoadLightmapMeshPipelineWindow(const VulkanWindow& window, VkCommandPool co
         }
         lightmapMeshPipeline->descriptorSets.size = geometry.meshEndInds.size;
 
-        for (uint32 i = 0; i < geometry.meshEndInds.size; i++) {
-            VkWriteDescriptorSet descriptorWrites[2] = {};
-
-            VkDescriptorBufferInfo bufferInfo = {};
-            bufferInfo.buffer = lightmapMeshPipeline->uniformBuffer.buffer;
-            bufferInfo.offset = 0;
-            bufferInfo.range = sizeof(LightmapMeshUniformBufferObject);
-
-            descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[0].dstSet = lightmapMeshPipeline->descriptorSets[i];
-            descriptorWrites[0].dstBinding = 0;
-            descriptorWrites[0].dstArrayElement = 0;
-            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            descriptorWrites[0].descriptorCount = 1;
-            descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-            VkDescriptorImageInfo imageInfo = {};
-            imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            imageInfo.imageView = lightmapMeshPipeline->lightmaps[i].view;
-            imageInfo.sampler = lightmapMeshPipeline->lightmapSampler;
-
-            descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[1].dstSet = lightmapMeshPipeline->descriptorSets[i];
-            descriptorWrites[1].dstBinding = 1;
-            descriptorWrites[1].dstArrayElement = 0;
-            descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            descriptorWrites[1].descriptorCount = 1;
-            descriptorWrites[1].pImageInfo = &imageInfo;
-
-            vkUpdateDescriptorSets(window.device, C_ARRAY_LENGTH(descriptorWrites), descriptorWrites, 0, nullptr);
-        }
+        WriteLightmapMeshDescriptorSets(window.device, *lightmapMeshPipeline);
     }
 
     return true;
 }
 
+bool ReloadLightmapMeshLighting(const VulkanWindow& window, VkCommandPool commandPool, const_string objFilePath,
+                                LinearAllocator* allocator, VulkanLightmapMeshPipeline* lightmapMeshPipeline)
+{
+    LoadObjResult obj;
+    if (!LoadObj(objFilePath, &obj, allocator)) {
+        LOG_ERROR("Failed to load %.*s\n", objFilePath.size, objFilePath.data);
+        return false;
+    }
+    // Vertex positions stay in the already loaded vertex buffer, so the scene can't have changed shape
+    if (obj.models.size != lightmapMeshPipeline->meshTriangleEndInds.size) {
+        LOG_ERROR("Reference scene has %lu meshes, %lu loaded, restart to reload geometry\n",
+                  obj.models.size, lightmapMeshPipeline->meshTriangleEndInds.size);
+        return false;
+    }
+
+    // Everything new is created before anything old is destroyed, so a failure keeps the previous lighting
+    const Array<uint32> meshEndInds = {
+        .size = lightmapMeshPipeline->meshTriangleEndInds.size,
+        .data = lightmapMeshPipeline->meshTriangleEndInds.data
+    };
+    VulkanBuffer colorBuffer;
+    if (!CreateLightmapMeshColorBuffer(window, commandPool, obj, meshEndInds, allocator, &colorBuffer)) {
+        LOG_ERROR("Failed to create lightmap vertex color buffer\n");
+        return false;
+    }
+
+    FixedArray<VulkanImage, VulkanLightmapMeshPipeline::MAX_LIGHTMAPS> lightmaps;
+    lightmaps.Clear();
+    if (!LoadLightmapImages(window, commandPool, meshEndInds.size, allocator, &lightmaps)) {
+        LOG_ERROR("Failed to load lightmap images\n");
+        DestroyLightmapImages(window.device, &lightmaps);
+        DestroyVulkanBuffer(window.device, &colorBuffer);
+        return false;
+    }
+
+    // Frames in flight may still be reading the old buffer and images
+    vkDeviceWaitIdle(window.device);
+
+    DestroyVulkanBuffer(window.device, &lightmapMeshPipeline->colorBuffer);
+    DestroyLightmapImages(window.device, &lightmapMeshPipeline->lightmaps);
+    lightmapMeshPipeline->colorBuffer = colorBuffer;
+    lightmapMeshPipeline->lightmaps = lightmaps;
+
+    WriteLightmapMeshDescriptorSets(window.device, *lightmapMeshPipeline);
+    return true;
+}
+
 void UnloadLightmapMeshPipelineWindow(VkDevice device, VulkanLightmapMeshPipeline* lightmapMeshPipeline)
 {
     lightmapMeshPipeline->descriptorSets.Clear();
@@ -1204,13 +1549,9 @@ void UnloadLightmapMeshPipelineWindow(VkDevice device, VulkanLightmapMeshPipelin
 
     vkDestroySampler(device, lightmapMeshPipeline->lightmapSampler, nullptr);
 
-    for (uint32 i = 0; i < lightmapMeshPipeline->lightmaps.size; i++) {
-        vkDestroyImageView(device, lightmapMeshPipeline->lightmaps[i].view, nullptr);
-        vkDestroyImage(device, lightmapMeshPipeline->lightmaps[i].image, nullptr);
-        vkFreeMemory(device, lightmapMeshPipeline->lightmaps[i].memory, nullptr);
-    }
-    lightmapMeshPipeline->lightmaps.Clear();
+    DestroyLightmapImages(device, &lightmapMeshPipeline->lightmaps);
 
+    DestroyVulkanBuffer(device, &lightmapMeshPipeline->colorBuffer);
     DestroyVulkanBuffer(device, &lightmapMeshPipeline->vertexBuffer);
 
     lightmapMeshPipeline->meshTriangleEndInds.Clear();
@@ -5,6 +5,8 @@
 #include <km_common/vulkan/km_vulkan_core.h>
 #include <km_common/vulkan/km_vulkan_util.h>
 
+#include "lightmap.h"
+
 enum class MeshId
 {
     TILE,
@@ -13,11 +15,19 @@ enum class MeshId
     COUNT
 };
 
+struct VulkanMeshVertex
+{
+    Vec3 pos;
+    Vec3 normal;
+    Vec3 color;
+};
+
 struct VulkanLightmapMeshPipeline
 {
     static const uint32 MAX_MESHES = 64;
     FixedArray<uint32, MAX_MESHES> meshTriangleEndInds;
     VulkanBuffer vertexBuffer;
+    VulkanBuffer colorBuffer; // baked vertex light, packed RGB9E5, separate so it can be filled from .v files as-is
 
     static const uint32 MAX_LIGHTMAPS = 64;
     FixedArray<VulkanImage, MAX_LIGHTMAPS> lightmaps;
@@ -41,6 +51,7 @@ struct VulkanMeshPipeline
     StaticArray<uint32, MAX_MESHES> numVertices;
     VulkanBuffer vertexBuffer;
     VulkanBuffer instanceBuffer;
+    VulkanBuffer staticInstanceBuffer; // a single identity instance, for drawing VulkanStaticMeshes
     VulkanBuffer uniformBuffer;
 
     VkDescriptorSetLayout descriptorSetLayout;
@@ -57,6 +68,12 @@ struct VulkanMeshInstanceData
     Vec3 color;
     Vec3 collapseMid;
     float32 collapseT;
+    // L1 SH light per color channel as half floats, ShProbe coefficients transposed.
+    // Half precision keeps MAX_INSTANCES worth of these in budget.
+    uint16 shR[4];
+    uint16 shG[4];
+    uint16 shB[4];
+    float32 hasProbe; // 1 if lit by the SH above, even if it's dark. 0 for the default directional lights.
 };
 
 struct VulkanMeshRenderState
@@ -65,7 +82,8 @@ struct VulkanMeshRenderState
     StaticArray<MeshInstanceData, VulkanMeshPipeline::MAX_MESHES> meshInstanceData;
 };
 
-void PushMesh(MeshId meshId, Mat4 model, Vec3 color, Vec3 collapseMid, float32 collapseT,
+// Lit by the default directional lights if probe is null
+void PushMesh(MeshId meshId, Mat4 model, Vec3 color, Vec3 collapseMid, float32 collapseT, const ShProbe* probe,
               VulkanMeshRenderState* renderState);
 
 void ResetMeshRenderState(VulkanMeshRenderState* renderState);
@@ -74,6 +92,38 @@ void UploadAndSubmitMeshDrawCommands(VkDevice device, VkCommandBuffer commandBuf
                                      const VulkanMeshPipeline& meshPipeline, const VulkanMeshRenderState& renderState,
                                      Mat4 view, Mat4 proj, LinearAllocator* allocator);
 
+// Geometry with its own vertex buffer, already in world space, drawn with the mesh pipeline (e.g. a block chunk)
+struct VulkanStaticMesh
+{
+    VulkanBuffer vertexBuffer;
+    uint32 numVertices; // 0 if nothing is loaded
+};
+
+// Persistently mapped staging memory shared by static mesh uploads. Copies out of it are recorded into the frame's
+// command buffer, so it starts over from the front each frame, once the frame's fence has been waited on.
+struct VulkanStagingRing
+{
+    static const uint64 SIZE = MEGABYTES(32);
+
+    VulkanBuffer buffer;
+    uint8* data;
+    uint64 used; // this frame
+};
+
+bool LoadStagingRing(const VulkanWindow& window, VulkanStagingRing* stagingRing);
+void UnloadStagingRing(VkDevice device, VulkanStagingRing* stagingRing);
+
+// Stages the vertices in the ring, which must have room for them, and records their copy into commandBuffer outside of
+// a render pass. SubmitStaticMeshUploadBarrier has to follow before the mesh is drawn.
+bool LoadStaticMesh(const VulkanWindow& window, VkCommandBuffer commandBuffer, Array<VulkanMeshVertex> vertices,
+                    VulkanStagingRing* stagingRing, VulkanStaticMesh* staticMesh);
+void UnloadStaticMesh(VkDevice device, VulkanStaticMesh* staticMesh);
+void SubmitStaticMeshUploadBarrier(VkCommandBuffer commandBuffer);
+
+// Uses the view and projection from this frame's UploadAndSubmitMeshDrawCommands, so it must come after it
+void SubmitStaticMeshDrawCommands(VkCommandBuffer commandBuffer, const VulkanMeshPipeline& meshPipeline,
+                                  const Array<VulkanStaticMesh> staticMeshes);
+
 void UploadAndSubmitLightmapMeshDrawCommands(VkDevice device, VkCommandBuffer commandBuffer,
                                              const VulkanLightmapMeshPipeline& lightmapMeshPipeline,
                                              Mat4 model, Mat4 view, Mat4 proj);
@@ -91,4 +141,8 @@ void UnloadLightmapMeshPipelineSwapchain(VkDevice device, VulkanLightmapMeshPipe
 
 bool LoadLightmapMeshPipelineWindow(const VulkanWindow& window, VkCommandPool commandPool, LinearAllocator* allocator,
                                     VulkanLightmapMeshPipeline* lightmapMeshPipeline);
-void UnloadLightmapMeshPipelineWindow(VkDevice device, VulkanLightmapMeshPipeline* lightmapMeshPipeline);
\ No newline at end of file
+void UnloadLightmapMeshPipelineWindow(VkDevice device, VulkanLightmapMeshPipeline* lightmapMeshPipeline);
+
+// Reloads baked vertex colors and lightmap images from disk and swaps them in, leaving geometry and pipelines alone
+bool ReloadLightmapMeshLighting(const VulkanWindow& window, VkCommandPool commandPool, const_string objFilePath,
+                                LinearAllocator* allocator, VulkanLightmapMeshPipeline* lightmapMeshPipeline);
\ No newline at end of file
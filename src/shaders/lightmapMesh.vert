@@ -2,7 +2,7 @@
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
-layout(location = 2) in vec3 inColor;
+layout(location = 2) in uint inColorRgb9e5;
 layout(location = 3) in vec2 inUv;
 layout(location = 4) in float inLightmapWeight;
 
@@ -19,9 +19,17 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 proj;
 } ubo;
 
+// Same bit layout as VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, see EncodeRGB9E5
+vec3 DecodeRgb9e5(uint packed)
+{
+    const uvec3 mantissa = uvec3(packed, packed >> 9, packed >> 18) & 0x1ffu;
+    const int exponent = int(packed >> 27) - 15 - 9;
+    return vec3(mantissa) * exp2(float(exponent));
+}
+
 void main() {
     outNormal = inNormal;
-    outColor = inColor;
+    outColor = DecodeRgb9e5(inColorRgb9e5);
     outUv = inUv;
     outLightmapWeight = inLightmapWeight;
 
@@ -2,11 +2,29 @@
 
 layout(location = 0) in vec3 inNormal;
 layout(location = 1) in vec3 inColor;
+layout(location = 2) flat in vec4 inShR;
+layout(location = 3) flat in vec4 inShG;
+layout(location = 4) flat in vec4 inShB;
+layout(location = 5) flat in float inHasProbe;
 
 layout(location = 0) out vec4 outColor;
 
+// Diffuse light from L1 SH radiance, coefficients ordered Y00, Y1-1 (y), Y10 (z), Y11 (x)
+vec3 ShDiffuse(vec3 normal)
+{
+	// Y00, and Y1m convolved with the clamped cosine lobe (2/3) and divided by pi for outgoing radiance
+	vec4 basis = vec4(0.282095, 0.325735 * normal.y, 0.325735 * normal.z, 0.325735 * normal.x);
+	return max(vec3(dot(inShR, basis), dot(inShG, basis), dot(inShB, basis)), vec3(0.0));
+}
+
 void main()
 {
+	if (inHasProbe > 0.5) {
+		vec3 probeLight = clamp(ShDiffuse(inNormal), vec3(0.0), vec3(1.0));
+		outColor = vec4(pow(inColor * probeLight, vec3(2.2)), 1.0);
+		return;
+	}
+
 	vec3 lightAmbientColor = vec3(0.05, 0.05, 0.05);
 
 	float lightDirIntensity = 0.8f;
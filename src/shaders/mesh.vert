@@ -10,9 +10,17 @@ layout(location = 3) in mat4 model; // mat4 takes locations 3, 4, 5, 6
 layout(location = 7) in vec3 color;
 layout(location = 8) in vec3 collapseMid;
 layout(location = 9) in float collapseT;
+layout(location = 10) in vec4 shR;
+layout(location = 11) in vec4 shG;
+layout(location = 12) in vec4 shB;
+layout(location = 13) in float hasProbe;
 
 layout(location = 0) out vec3 outNormal;
 layout(location = 1) out vec3 outColor;
+layout(location = 2) flat out vec4 outShR;
+layout(location = 3) flat out vec4 outShG;
+layout(location = 4) flat out vec4 outShB;
+layout(location = 5) flat out float outHasProbe;
 
 layout(binding = 0) uniform UniformBufferObject {
     mat4 view;
@@ -48,6 +56,10 @@ void main()
 	vec4 worldNormal = model * vec4(inNormal, 0.0);
     outNormal = normalize(worldNormal.xyz);
     outColor = inColor * color;
+    outShR = shR;
+    outShG = shG;
+    outShB = shB;
+    outHasProbe = hasProbe;
 
 	float randOffset = 0.0;
 	if (collapseT > 0.0) {